@@ -0,0 +1,143 @@
+#include "cec_mock.hpp"
+#include "cec_discovery.hpp"
+#include "spdlog/spdlog.h"
+#include <atomic>
+#include <poll.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Events delivered to the handler, in order.
+vector<CECEvent> delivered;
+
+void collect(void *context, const CECEvent &event) {
+    delivered.push_back(event);
+}
+
+/**
+ * Wait for the backend's fd and service it, as the event loop does.
+ *
+ * @return  bool    false if the fd did not become readable.
+ */
+bool serviceOnce(CECBackend &backend) {
+    struct pollfd fd { backend.fd(), POLLIN | POLLPRI, 0 };
+    if (poll(&fd, 1, 1000) != 1) {
+        return false;
+    }
+    backend.service();
+    return true;
+}
+
+/**
+ * Check that the mock acknowledges present devices only, reports injected
+ * messages and delivers everything through fd() and service().
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testMock() {
+    MockCECBackend backend(1 << CEC_ADDRESS_PLAYBACK_1);
+    delivered.clear();
+    if (!backend.open(CEC_ADDRESS_TV, 0x18C086, "JVC NX7", collect, nullptr) || backend.fd() < 0) {
+        spdlog::error("Mock: open failed");
+        return 1;
+    }
+
+    const uint8_t request[] { CEC_OPCODE_GIVE_DEVICE_POWER_STATUS };
+    backend.transmit(CEC_ADDRESS_PLAYBACK_1, request, 1, false);
+    backend.transmit(CEC_ADDRESS_AUDIO_SYSTEM, request, 1, false);
+    backend.inject({ 2, CEC_ADDRESS_PLAYBACK_1, CEC_ADDRESS_TV, { CEC_OPCODE_REPORT_POWER_STATUS, CEC_POWER_ON } });
+
+    if (!serviceOnce(backend) || delivered.size() != 3) {
+        spdlog::error("Mock: {} events delivered", delivered.size());
+        return 1;
+    }
+    if (delivered[0].kind != CEC_EVENT_TRANSMITTED || !delivered[0].acknowledged
+            || delivered[1].kind != CEC_EVENT_TRANSMITTED || delivered[1].acknowledged) {
+        spdlog::error("Mock: transmit results are wrong");
+        return 1;
+    }
+    if (delivered[2].kind != CEC_EVENT_RECEIVED || delivered[2].message.initiator != CEC_ADDRESS_PLAYBACK_1
+            || delivered[2].message.payload[0] != CEC_OPCODE_REPORT_POWER_STATUS) {
+        spdlog::error("Mock: injected message is wrong");
+        return 1;
+    }
+    if (backend.transmitted().size() != 2 || backend.transmitted()[1].follower != CEC_ADDRESS_AUDIO_SYSTEM) {
+        spdlog::error("Mock: transmits not recorded");
+        return 1;
+    }
+
+    // Nothing left, so service() must not block.
+    backend.service();
+    backend.close();
+
+    spdlog::info("Mock: OK");
+    return 0;
+}
+
+/**
+ * Run a discovery pass through the mock, with a thread servicing it like the event loop.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testDiscoveryThroughBackend() {
+    static MockCECBackend backend(1 << CEC_ADDRESS_PLAYBACK_1 | 1 << CEC_ADDRESS_AUDIO_SYSTEM);
+    static CECDeviceTable devices;
+    static CECDiscovery discovery(devices, CEC_ADDRESS_TV, [](void *context, int follower, const uint8_t *payload, size_t length) {
+        return backend.transmit(follower, payload, length, false);
+    }, nullptr);
+
+    backend.open(CEC_ADDRESS_TV, 0x18C086, "JVC NX7", [](void *context, const CECEvent &event) {
+        if (event.kind == CEC_EVENT_TRANSMITTED) {
+            discovery.onTransmitResult(event.message.follower, event.message.payload, event.message.length, event.acknowledged);
+        }
+    }, nullptr);
+
+    atomic<bool> running { true };
+    thread worker([&running]() {
+        while (running) {
+            serviceOnce(backend);
+        }
+    });
+
+    // Nobody answers the requests, so keep the pass short.
+    CECDiscoveryResult result = discovery.run(200);
+    running = false;
+    worker.join();
+    backend.close();
+
+    if (result.present != 2 || devices.presentMask() != (1 << CEC_ADDRESS_PLAYBACK_1 | 1 << CEC_ADDRESS_AUDIO_SYSTEM)) {
+        spdlog::error("Discovery through backend: {} present", result.present);
+        return 1;
+    }
+
+    spdlog::info("Discovery through backend: OK ({} frames in {}ms)", result.transmitted, result.elapsedMs);
+    return 0;
+}
+
+/**
+ * The kernel backend fails cleanly without an adapter.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testLinuxWithoutAdapter() {
+    CECBackend *backend = createLinuxCECBackend("/dev/null/cec0");
+    bool opened = backend->open(CEC_ADDRESS_TV, 0x18C086, "JVC NX7", collect, nullptr);
+    int fd = backend->fd();
+    delete backend;
+
+    if (opened || fd != -1) {
+        spdlog::error("Linux: opened a device that does not exist");
+        return 1;
+    }
+
+    spdlog::info("Linux: OK");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[BACKEND] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    return testMock() | testDiscoveryThroughBackend() | testLinuxWithoutAdapter();
+}
@@ -0,0 +1,74 @@
+#include "cec_devices.hpp"
+#include "spdlog/spdlog.h"
+
+using namespace std;
+
+/**
+ * Check that the table starts empty, records each field and ignores bad addresses.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testDevices() {
+    CECDeviceTable devices;
+
+    for (int address = 0; address < CEC_LOGICAL_ADDRESS_COUNT; address++) {
+        if (devices.hasPhysicalAddress(address) || devices.at(address).lastSeenMs != 0) {
+            spdlog::error("Devices: {} should start unknown", address);
+            return 1;
+        }
+    }
+
+    const uint8_t vendor[] { 0x00, 0x0D, 0x4B };
+    const uint8_t name[] { 'R', 'o', 'k', 'u', ' ', 'U', 'l', 't', 'r', 'a', ' ', '4', '8', '0', '0', 'X' };
+    devices.setPhysicalAddress(4, 0x10, 0x00);
+    devices.setVendorId(4, vendor);
+    devices.setOSDName(4, name, sizeof(name));
+    devices.setCECVersion(4, 0x05);
+    devices.setPowerStatus(4, 0x00);
+    devices.seen(4);
+
+    const CECDevice &roku = devices.at(4);
+    if (!devices.hasPhysicalAddress(4) || roku.physicalAddress != 0x1000) {
+        spdlog::error("Devices: physical address is {:04X}", roku.physicalAddress);
+        return 1;
+    }
+    if (roku.vendorId != 0x000D4B) {
+        spdlog::error("Devices: vendor ID is {:06X}", roku.vendorId);
+        return 1;
+    }
+    if (strcmp(roku.osdName, "Roku Ultra 4800") != 0) {
+        spdlog::error("Devices: OSD name is '{}'", roku.osdName);
+        return 1;
+    }
+    if (roku.cecVersion != 0x05 || roku.powerStatus != 0x00 || roku.lastSeenMs == 0) {
+        spdlog::error("Devices: version, power status or last seen not recorded");
+        return 1;
+    }
+    if (devices.hasPhysicalAddress(5)) {
+        spdlog::error("Devices: setting 4 changed 5");
+        return 1;
+    }
+
+    devices.setPhysicalAddress(16, 0x20, 0x00);
+    devices.seen(-1);
+    if (devices.hasPhysicalAddress(16) || devices.at(-1).lastSeenMs != 0) {
+        spdlog::error("Devices: out of range addresses should be ignored");
+        return 1;
+    }
+
+    devices.clear();
+    if (devices.hasPhysicalAddress(4)) {
+        spdlog::error("Devices: clear() kept a physical address");
+        return 1;
+    }
+
+    spdlog::info("Devices: OK");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[DEVICES] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    return testDevices();
+}
@@ -0,0 +1,327 @@
+#include "cec_discovery.hpp"
+#include "spdlog/spdlog.h"
+#include <map>
+#include <thread>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+const int TV { 0 };
+const int DISCOVERY_TIMEOUT_MS { 10000 };
+
+/**
+ * A device on the simulated bus, and how it answers discovery.
+ */
+struct VirtualDevice {
+    uint16_t physicalAddress;
+    uint32_t vendorId;
+    const char *osdName;
+    uint8_t powerStatus;
+    // Time the device takes to start its answer.
+    int responseMs;
+    // Requests it answers with a FeatureAbort, or ignores.
+    uint8_t aborts;
+    uint8_t ignores;
+};
+
+/**
+ * In-process CEC bus: one frame at a time, each taking its real bus time.
+ *
+ * Frames from the TV are acknowledged if a device sits at the follower's
+ * address, and the device queues its answer. Answers are delivered to the
+ * device table and the discovery pass, as the event loop would.
+ */
+class SimulatedBus {
+public:
+    SimulatedBus(map<int, VirtualDevice> devices, CECDeviceTable &table)
+        : devices_(devices), table_(table), discovery_(table, TV, transmit, this) {
+        thread_ = thread(&SimulatedBus::run, this);
+    }
+
+    ~SimulatedBus() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            running_ = false;
+        }
+        changed_.notify_all();
+        thread_.join();
+    }
+
+    CECDiscovery &discovery() {
+        return discovery_;
+    }
+
+    // Time the bus spent carrying frames.
+    int64_t busyUs() {
+        return busyUs_;
+    }
+
+private:
+    struct Frame {
+        int initiator;
+        int follower;
+        uint8_t payload[16];
+        size_t length;
+    };
+
+    static int transmit(void *context, int follower, const uint8_t *payload, size_t length) {
+        SimulatedBus *bus = (SimulatedBus *)context;
+        Frame frame { TV, follower, {}, length };
+        memcpy(frame.payload, payload, length);
+        bus->queue(Clock::now(), frame);
+        return 0;
+    }
+
+    void queue(Clock::time_point readyAt, const Frame &frame) {
+        {
+            lock_guard<mutex> lock(mutex_);
+            frames_.insert({ readyAt, frame });
+        }
+        changed_.notify_all();
+    }
+
+    void run() {
+        unique_lock<mutex> lock(mutex_);
+        while (running_) {
+            if (frames_.empty() || frames_.begin()->first > Clock::now()) {
+                if (frames_.empty()) {
+                    changed_.wait(lock);
+                } else {
+                    changed_.wait_until(lock, frames_.begin()->first);
+                }
+                continue;
+            }
+
+            Frame frame = frames_.begin()->second;
+            frames_.erase(frames_.begin());
+            lock.unlock();
+            int frameUs = cecFrameTimeUs(frame.length) + CEC_SIGNAL_FREE_BITS * CEC_BIT_PERIOD_US;
+            this_thread::sleep_for(chrono::microseconds(frameUs));
+            busyUs_ += frameUs;
+            deliver(frame);
+            lock.lock();
+        }
+    }
+
+    void deliver(const Frame &frame) {
+        if (frame.initiator != TV) {
+            record(frame);
+            discovery_.onMessage(frame.initiator, frame.payload, frame.length);
+            return;
+        }
+
+        auto device = devices_.find(frame.follower);
+        discovery_.onTransmitResult(frame.follower, frame.payload, frame.length, device != devices_.end());
+        if (device == devices_.end() || frame.length == 0) {
+            return;
+        }
+
+        Frame reply = answer(frame.follower, device->second, frame.payload[0]);
+        if (reply.length) {
+            queue(Clock::now() + chrono::milliseconds(device->second.responseMs), reply);
+        }
+    }
+
+    Frame answer(int address, const VirtualDevice &device, uint8_t opcode) {
+        Frame reply { address, TV, {}, 0 };
+        if (device.ignores == opcode) {
+            return reply;
+        }
+        if (device.aborts == opcode) {
+            reply.payload[0] = 0x00;
+            reply.payload[1] = opcode;
+            reply.payload[2] = 0x00;
+            reply.length = 3;
+            return reply;
+        }
+
+        switch (opcode) {
+            case 0x83:
+                reply.follower = 15;
+                reply.payload[0] = 0x84;
+                reply.payload[1] = device.physicalAddress >> 8;
+                reply.payload[2] = device.physicalAddress & 0xFF;
+                reply.payload[3] = address;
+                reply.length = 4;
+                break;
+            case 0x8C:
+                reply.follower = 15;
+                reply.payload[0] = 0x87;
+                reply.payload[1] = device.vendorId >> 16;
+                reply.payload[2] = device.vendorId >> 8;
+                reply.payload[3] = device.vendorId;
+                reply.length = 4;
+                break;
+            case 0x46:
+                reply.payload[0] = 0x47;
+                reply.length = 1 + strlen(device.osdName);
+                memcpy(&reply.payload[1], device.osdName, reply.length - 1);
+                break;
+            case 0x8F:
+                reply.payload[0] = 0x90;
+                reply.payload[1] = device.powerStatus;
+                reply.length = 2;
+                break;
+        }
+        return reply;
+    }
+
+    // What main.cpp's handlers record for each answer.
+    void record(const Frame &frame) {
+        table_.seen(frame.initiator);
+        switch (frame.payload[0]) {
+            case 0x84:
+                table_.setPhysicalAddress(frame.initiator, frame.payload[1], frame.payload[2]);
+                break;
+            case 0x87:
+                table_.setVendorId(frame.initiator, &frame.payload[1]);
+                break;
+            case 0x47:
+                table_.setOSDName(frame.initiator, &frame.payload[1], frame.length - 1);
+                break;
+            case 0x90:
+                table_.setPowerStatus(frame.initiator, frame.payload[1]);
+                break;
+        }
+    }
+
+    const map<int, VirtualDevice> devices_;
+    CECDeviceTable &table_;
+    CECDiscovery discovery_;
+
+    mutex mutex_;
+    condition_variable changed_;
+    multimap<Clock::time_point, Frame> frames_;
+    bool running_ { true };
+    atomic<int64_t> busyUs_ { 0 };
+    thread thread_;
+};
+
+/**
+ * Discover a Roku, an audio system that will not give its name and a
+ * recorder that never reports its power status.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testDiscovery() {
+    CECDeviceTable table;
+    SimulatedBus bus({
+        { 4, { 0x1000, 0x000D4B, "Roku Ultra", 0x00, 40, 0, 0 } },
+        { 5, { 0x2000, 0x0000F0, "", 0x00, 120, 0x46, 0 } },
+        { 1, { 0x3000, 0x00903E, "Recorder", 0x01, 200, 0, 0x8F } },
+    }, table);
+
+    CECDiscoveryResult result = bus.discovery().run(DISCOVERY_TIMEOUT_MS);
+
+    spdlog::info(
+        "Discovery: {} devices in {}ms, {} frames, {} replies, {} unanswered, bus busy {}ms",
+        result.present,
+        result.elapsedMs,
+        result.transmitted,
+        result.replies,
+        result.unanswered,
+        bus.busyUs() / 1000
+    );
+
+    if (result.present != 3 || table.presentMask() != (1 << 1 | 1 << 4 | 1 << 5)) {
+        spdlog::error("Discovery: present mask {:016b}", table.presentMask());
+        return 1;
+    }
+    // 14 polls and four requests for each of the three devices.
+    if (result.transmitted != 14 + 3 * 4 || result.replies != 11 || result.unanswered != 1) {
+        spdlog::error("Discovery: wrong counts");
+        return 1;
+    }
+
+    const CECDevice &roku = table.at(4);
+    if (roku.physicalAddress != 0x1000 || roku.vendorId != 0x000D4B
+            || strcmp(roku.osdName, "Roku Ultra") != 0 || roku.powerStatus != 0x00) {
+        spdlog::error("Discovery: Roku is {:04X} {:06X} '{}' {}", roku.physicalAddress, roku.vendorId, roku.osdName, roku.powerStatus);
+        return 1;
+    }
+    if (table.at(5).physicalAddress != 0x2000 || table.at(5).osdName[0] != '\0') {
+        spdlog::error("Discovery: audio system not recorded");
+        return 1;
+    }
+    if (table.at(1).powerStatus != CEC_UNKNOWN || table.at(1).vendorId != 0x00903E) {
+        spdlog::error("Discovery: recorder not recorded");
+        return 1;
+    }
+
+    // Frames never overlap, so the pass can not be shorter than the bus time.
+    if (result.elapsedMs * 1000 < bus.busyUs()) {
+        spdlog::error("Discovery: finished before the bus carried every frame");
+        return 1;
+    }
+
+    spdlog::info("Discovery: OK");
+    return 0;
+}
+
+/**
+ * A bus with nobody on it finishes after the polls.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testEmptyBus() {
+    CECDeviceTable table;
+    SimulatedBus bus({}, table);
+
+    CECDiscoveryResult result = bus.discovery().run(DISCOVERY_TIMEOUT_MS);
+    if (result.present != 0 || result.transmitted != 14 || result.unanswered != 0 || table.presentMask() != 0) {
+        spdlog::error("Empty bus: {} present, {} frames", result.present, result.transmitted);
+        return 1;
+    }
+
+    spdlog::info("Empty bus: OK ({}ms)", result.elapsedMs);
+    return 0;
+}
+
+/**
+ * Transmits into the void: no result ever comes back.
+ *
+ * @return  int     0, as if the frame was queued.
+ */
+int transmitNowhere(void *context, int follower, const uint8_t *payload, size_t length) {
+    return 0;
+}
+
+/**
+ * A cancelled pass returns without waiting for results that will never
+ * come, and a pass started after cancel() returns at once.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testCancel() {
+    CECDeviceTable table;
+    CECDiscovery discovery(table, TV, transmitNowhere, nullptr);
+
+    const Clock::time_point start = Clock::now();
+    thread canceller([&discovery]() {
+        this_thread::sleep_for(chrono::milliseconds(50));
+        discovery.cancel();
+    });
+    CECDiscoveryResult result = discovery.run(DISCOVERY_TIMEOUT_MS);
+    canceller.join();
+    const int64_t elapsedMs = chrono::duration_cast<chrono::milliseconds>(Clock::now() - start).count();
+    if (elapsedMs > 500 || result.transmitted != 1) {
+        spdlog::error("Cancel: returned after {}ms, {} frames", elapsedMs, result.transmitted);
+        return 1;
+    }
+
+    result = discovery.run(DISCOVERY_TIMEOUT_MS);
+    if (result.transmitted != 0 || result.elapsedMs > 50) {
+        spdlog::error("Cancel: later pass sent {} frames", result.transmitted);
+        return 1;
+    }
+
+    spdlog::info("Cancel: OK ({}ms)", elapsedMs);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[DISCOVERY] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    return testDiscovery() | testEmptyBus() | testCancel();
+}
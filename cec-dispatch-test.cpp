@@ -0,0 +1,222 @@
+#include "cec_routes.hpp"
+#include "spdlog/spdlog.h"
+#include <chrono>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+const int BENCH_MESSAGES { 10000000 };
+
+const int TV { CEC_ADDRESS_TV };
+const int PLAYBACK1 { CEC_ADDRESS_PLAYBACK_1 };
+const int AUDIO { CEC_ADDRESS_AUDIO_SYSTEM };
+const int BROADCAST { CEC_ADDRESS_BROADCAST };
+
+// Number of calls per handler, indexed by opcode.
+uint64_t handled[256] {};
+
+void count(CECMessage &message) {
+    handled[message.payload[0]]++;
+}
+
+// The routes main.cpp registers, with every handler counting its calls.
+constexpr CECRouteTable<CECMessage> ROUTES = buildCECRoutes({
+    count, count, count, count, count, count,
+    count, count, count, count, count, count,
+});
+
+/**
+ * The routes as a chain of predicates, the way handleCECCallback dispatched
+ * messages before the route table.
+ *
+ * @return  bool    Whether a handler ran.
+ */
+bool dispatchLinear(CECMessage &message) {
+    const uint32_t length = message.length;
+    const uint8_t opcode = length > 0 ? message.payload[0] : 0;
+    const bool toTV = message.follower == TV;
+    const bool fromTV = message.initiator == TV;
+
+    if (length == 1 && (opcode == CEC_OPCODE_IMAGE_VIEW_ON || opcode == CEC_OPCODE_TEXT_VIEW_ON)) {
+        count(message);
+        return true;
+    }
+    if ((toTV || message.follower == BROADCAST) && !fromTV && length == 1 && opcode == CEC_OPCODE_STANDBY) {
+        count(message);
+        return true;
+    }
+    if (toTV && length == 1 && opcode == CEC_OPCODE_GIVE_DEVICE_VENDOR_ID) {
+        count(message);
+        return true;
+    }
+    if (toTV && length == 1 && opcode == CEC_OPCODE_GIVE_DEVICE_POWER_STATUS) {
+        count(message);
+        return true;
+    }
+    if (length >= 3 && opcode == CEC_OPCODE_REPORT_PHYSICAL_ADDRESS) {
+        count(message);
+        return true;
+    }
+    if (length == 1 && opcode == CEC_OPCODE_GIVE_OSD_NAME) {
+        count(message);
+        return true;
+    }
+    if (toTV && !fromTV && length >= 2 && opcode == CEC_OPCODE_USER_CONTROL_PRESSED) {
+        count(message);
+        return true;
+    }
+    if (toTV && !fromTV && length == 1 && opcode == CEC_OPCODE_USER_CONTROL_RELEASED) {
+        count(message);
+        return true;
+    }
+    if (length == 4 && opcode == CEC_OPCODE_DEVICE_VENDOR_ID) {
+        count(message);
+        return true;
+    }
+    if (length >= 2 && length <= 1 + CEC_OSD_NAME_SIZE && opcode == CEC_OPCODE_SET_OSD_NAME) {
+        count(message);
+        return true;
+    }
+    if (length == 2 && opcode == CEC_OPCODE_CEC_VERSION) {
+        count(message);
+        return true;
+    }
+    if (length == 2 && opcode == CEC_OPCODE_REPORT_POWER_STATUS) {
+        count(message);
+        return true;
+    }
+    return false;
+}
+
+CECMessage make(int initiator, int follower, vector<uint8_t> bytes) {
+    CECMessage message { (uint32_t)bytes.size(), initiator, follower, {} };
+    copy(bytes.begin(), bytes.end(), message.payload);
+    return message;
+}
+
+/**
+ * Check which messages the routes accept, and that the predicate chain
+ * agrees.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testRoutes() {
+    const vector<pair<CECMessage, bool>> cases {
+        { make(PLAYBACK1, TV, { CEC_OPCODE_IMAGE_VIEW_ON }), true },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_TEXT_VIEW_ON }), true },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_STANDBY }), true },
+        { make(PLAYBACK1, BROADCAST, { CEC_OPCODE_STANDBY }), true },
+        { make(TV, BROADCAST, { CEC_OPCODE_STANDBY }), false },
+        { make(PLAYBACK1, AUDIO, { CEC_OPCODE_STANDBY }), false },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_GIVE_DEVICE_VENDOR_ID }), true },
+        { make(PLAYBACK1, AUDIO, { CEC_OPCODE_GIVE_DEVICE_VENDOR_ID }), false },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_GIVE_DEVICE_POWER_STATUS }), true },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_GIVE_DEVICE_POWER_STATUS, 0x00 }), false },
+        { make(PLAYBACK1, BROADCAST, { CEC_OPCODE_REPORT_PHYSICAL_ADDRESS, 0x10, 0x00, 0x04 }), true },
+        { make(PLAYBACK1, BROADCAST, { CEC_OPCODE_REPORT_PHYSICAL_ADDRESS, 0x10 }), false },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_GIVE_OSD_NAME }), true },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_USER_CONTROL_PRESSED, CEC_USER_CONTROL_VOLUME_UP }), true },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_USER_CONTROL_PRESSED }), false },
+        { make(PLAYBACK1, AUDIO, { CEC_OPCODE_USER_CONTROL_PRESSED, CEC_USER_CONTROL_VOLUME_UP }), false },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_USER_CONTROL_RELEASED }), true },
+        { make(TV, TV, { CEC_OPCODE_USER_CONTROL_RELEASED }), false },
+        { make(PLAYBACK1, BROADCAST, { CEC_OPCODE_DEVICE_VENDOR_ID, 0x00, 0x0D, 0x4B }), true },
+        { make(PLAYBACK1, BROADCAST, { CEC_OPCODE_DEVICE_VENDOR_ID, 0x00, 0x0D }), false },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_SET_OSD_NAME, 'R', 'o', 'k', 'u' }), true },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_SET_OSD_NAME }), false },
+        { make(AUDIO, TV, { CEC_OPCODE_CEC_VERSION, 0x05 }), true },
+        { make(AUDIO, TV, { CEC_OPCODE_REPORT_POWER_STATUS, 0x00 }), true },
+        { make(AUDIO, TV, { CEC_OPCODE_REPORT_POWER_STATUS }), false },
+        { make(PLAYBACK1, BROADCAST, { CEC_OPCODE_ACTIVE_SOURCE, 0x10, 0x00 }), false },
+        { make(PLAYBACK1, TV, {}), false },
+    };
+
+    for (size_t i = 0; i < cases.size(); i++) {
+        CECMessage message = cases[i].first;
+        if (dispatchCECMessage(ROUTES, message) != cases[i].second) {
+            spdlog::error("Routes: case {} should {}be handled", i, cases[i].second ? "" : "not ");
+            return 1;
+        }
+        if (dispatchLinear(message) != cases[i].second) {
+            spdlog::error("Routes: the predicate chain disagrees on case {}", i);
+            return 1;
+        }
+    }
+
+    spdlog::info("Routes: OK");
+    return 0;
+}
+
+/**
+ * Replay a Roku-like traffic mix through both dispatchers and compare cost.
+ *
+ * Mostly power polls, then vendor ID and OSD name requests, physical address
+ * reports, other devices' broadcasts nobody handles, replies to discovery,
+ * remote keys and the odd power command.
+ *
+ * The table is kept for readability, not speed: expect about the same cost
+ * per message as the chain.
+ *
+ * @return  int     0 on success, 1 if the dispatchers disagree.
+ */
+int benchmark() {
+    const vector<pair<CECMessage, int>> mix {
+        { make(PLAYBACK1, TV, { CEC_OPCODE_GIVE_DEVICE_POWER_STATUS }), 45 },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_GIVE_DEVICE_VENDOR_ID }), 8 },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_GIVE_OSD_NAME }), 5 },
+        { make(PLAYBACK1, BROADCAST, { CEC_OPCODE_REPORT_PHYSICAL_ADDRESS, 0x10, 0x00, 0x04 }), 8 },
+        { make(PLAYBACK1, BROADCAST, { CEC_OPCODE_DEVICE_VENDOR_ID, 0x00, 0x0D, 0x4B }), 8 },
+        { make(PLAYBACK1, BROADCAST, { CEC_OPCODE_ACTIVE_SOURCE, 0x10, 0x00 }), 8 },
+        { make(AUDIO, TV, { CEC_OPCODE_REPORT_POWER_STATUS, 0x00 }), 6 },
+        { make(AUDIO, TV, { CEC_OPCODE_CEC_VERSION, 0x05 }), 1 },
+        { make(AUDIO, TV, { CEC_OPCODE_SET_OSD_NAME, 'A', 'V', 'R' }), 1 },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_USER_CONTROL_PRESSED, CEC_USER_CONTROL_VOLUME_UP }), 3 },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_USER_CONTROL_RELEASED }), 2 },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_IMAGE_VIEW_ON }), 2 },
+        { make(PLAYBACK1, TV, { CEC_OPCODE_TEXT_VIEW_ON }), 1 },
+        { make(PLAYBACK1, BROADCAST, { CEC_OPCODE_STANDBY }), 2 },
+    };
+
+    vector<CECMessage> traffic;
+    for (auto &entry : mix) {
+        for (int i = 0; i < entry.second; i++) {
+            traffic.push_back(entry.first);
+        }
+    }
+    shuffle(traffic.begin(), traffic.end(), mt19937(42));
+
+    uint64_t linearHandled { 0 };
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_MESSAGES; i++) {
+        linearHandled += dispatchLinear(traffic[i % traffic.size()]);
+    }
+    auto linear = chrono::steady_clock::now() - start;
+
+    uint64_t tableHandled { 0 };
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_MESSAGES; i++) {
+        tableHandled += dispatchCECMessage(ROUTES, traffic[i % traffic.size()]);
+    }
+    auto table = chrono::steady_clock::now() - start;
+
+    if (linearHandled != tableHandled) {
+        spdlog::error("Benchmark: linear handled {} messages, table handled {}", linearHandled, tableHandled);
+        return 1;
+    }
+
+    spdlog::info(
+        "Benchmark: predicate chain {:.2f} ns/msg, route table {:.2f} ns/msg ({:.0f}% handled)",
+        chrono::duration<double, nano>(linear).count() / BENCH_MESSAGES,
+        chrono::duration<double, nano>(table).count() / BENCH_MESSAGES,
+        100.0 * tableHandled / BENCH_MESSAGES
+    );
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[DISPATCH] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    return testRoutes() | benchmark();
+}
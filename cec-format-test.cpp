@@ -0,0 +1,162 @@
+#include "cec_format.hpp"
+#include "spdlog/sinks/null_sink.h"
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdlib.h>
+#include <string>
+
+using namespace std;
+
+const int BENCH_MESSAGES { 1000000 };
+
+// Heap allocations so far, counted by the operator new below.
+atomic<uint64_t> allocations { 0 };
+
+// Not inlined, so GCC does not pair the free() with a call to operator new.
+__attribute__((noinline)) void *operator new(size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    void *pointer = malloc(size ? size : 1);
+    if (!pointer) {
+        throw bad_alloc();
+    }
+    return pointer;
+}
+
+__attribute__((noinline)) void operator delete(void *pointer) noexcept {
+    free(pointer);
+}
+
+__attribute__((noinline)) void operator delete(void *pointer, size_t size) noexcept {
+    free(pointer);
+}
+
+/**
+ * The payload formatting main.cpp used before cec_format.hpp.
+ */
+string getOpcodeString(uint8_t* payload, size_t length) {
+    string content = "";
+
+    if (!length) {
+        return content;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        content += fmt::format("{:X} ", payload[i]);
+    }
+
+    content.pop_back();  // Remove trailing space
+    return content;
+}
+
+void logLegacy(const CECMessage &message) {
+    string content = getOpcodeString((uint8_t *)message.payload, message.length);
+    spdlog::debug(
+        "Received message: initiator={initiator:X} follower={follower:X} length={length:d} content={content}",
+        fmt::arg("initiator", message.initiator),
+        fmt::arg("follower", message.follower),
+        fmt::arg("length", message.length),
+        fmt::arg("content", content)
+    );
+}
+
+void logFormatter(const CECMessage &message) {
+    spdlog::debug("Received message: {}", message);
+}
+
+/**
+ * Check the formatted text.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testFormat() {
+    const CECMessage activeSource { 3, CEC_ADDRESS_PLAYBACK_1, CEC_ADDRESS_BROADCAST, { CEC_OPCODE_ACTIVE_SOURCE, 0x11, 0x00 } };
+    const CECMessage poll { 0, CEC_ADDRESS_TV, CEC_ADDRESS_AUDIO_SYSTEM, {} };
+    const CECMessage vendor { 2, CEC_ADDRESS_AUDIO_SYSTEM, CEC_ADDRESS_TV, { 0xFE, 0x0A } };
+    const CECMessage overlong { 99, CEC_ADDRESS_PLAYBACK_1, CEC_ADDRESS_TV, { CEC_OPCODE_STANDBY } };
+
+    const struct {
+        string formatted;
+        string expected;
+    } cases[] {
+        { fmt::format("{}", activeSource), "4F:82:11:00 ActiveSource" },
+        { fmt::format("{}", poll), "05" },
+        { fmt::format("{}", vendor), "50:FE:0A" },
+        { fmt::format("{}", overlong), "40:36:00:00:00:00:00:00:00:00:00:00:00:00:00:00 Standby" },
+        { fmt::format("{}", CECPhysicalAddress { 0x1100 }), "1.1.0.0" },
+        { fmt::format("{}", CECPhysicalAddress { 0xFFFF }), "F.F.F.F" },
+        { cecPowerStatusName(CEC_POWER_ON_PENDING), "standby->on" },
+        { cecPowerStatusName(CEC_POWER_STANDBY_PENDING), "on->standby" },
+    };
+    for (const auto &check : cases) {
+        if (check.formatted != check.expected) {
+            spdlog::error("Format: got '{}', expected '{}'", check.formatted, check.expected);
+            return 1;
+        }
+    }
+
+    spdlog::info("Format: OK");
+    return 0;
+}
+
+/**
+ * Time one way of tracing received messages.
+ *
+ * @return  pair    Nanoseconds and allocations per message.
+ */
+pair<double, double> measure(void (*trace)(const CECMessage &), const CECMessage &message) {
+    uint64_t allocated = allocations.load();
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_MESSAGES; i++) {
+        trace(message);
+    }
+    auto elapsed = chrono::steady_clock::now() - start;
+    return {
+        chrono::duration<double, nano>(elapsed).count() / BENCH_MESSAGES,
+        (double)(allocations.load() - allocated) / BENCH_MESSAGES,
+    };
+}
+
+/**
+ * Compare the old and new trace of a received message, with debug logging
+ * off (the daemon's usual level) and on, into a sink that drops everything.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int benchmark() {
+    // Long enough that the old content string does not fit in std::string itself.
+    const CECMessage message { 11, CEC_ADDRESS_PLAYBACK_1, CEC_ADDRESS_TV, { CEC_OPCODE_SET_OSD_NAME, 'R', 'o', 'k', 'u', ' ', 'U', 'l', 't', 'r', 'a' } };
+
+    auto console = spdlog::default_logger();
+    spdlog::set_default_logger(spdlog::null_logger_mt("null"));
+
+    int failed = 0;
+    for (spdlog::level::level_enum level : { spdlog::level::info, spdlog::level::debug }) {
+        spdlog::set_level(level);
+        pair<double, double> legacy = measure(logLegacy, message);
+        pair<double, double> formatter = measure(logFormatter, message);
+
+        console->info(
+            "Benchmark at {}: getOpcodeString {:.1f} ns/msg ({:.1f} allocs), formatter {:.1f} ns/msg ({:.1f} allocs)",
+            spdlog::level::to_string_view(level),
+            legacy.first,
+            legacy.second,
+            formatter.first,
+            formatter.second
+        );
+        if (formatter.second != 0) {
+            console->error("Benchmark: the formatter allocated");
+            failed = 1;
+        }
+    }
+
+    spdlog::set_default_logger(console);
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[FORMAT] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    return testFormat() | benchmark();
+}
@@ -0,0 +1,241 @@
+#include "cec_scheduler.hpp"
+#include "cec_mock.hpp"
+#include "spdlog/spdlog.h"
+#include <chrono>
+#include <poll.h>
+#include <string.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+CECTransmitScheduler *scheduler;
+
+// Final outcomes reported by the scheduler, in order.
+vector<pair<CECMessage, bool>> results;
+
+void collectResult(void *context, const CECMessage &message, bool acknowledged) {
+    results.push_back({ message, acknowledged });
+}
+
+void forwardEvent(void *context, const CECEvent &event) {
+    if (event.kind == CEC_EVENT_TRANSMITTED) {
+        scheduler->onTransmitted(event);
+    }
+}
+
+/**
+ * Service the backend until it has nothing more to deliver, as the event loop does.
+ */
+void drain(CECBackend &backend) {
+    struct pollfd fd { backend.fd(), POLLIN, 0 };
+    while (poll(&fd, 1, 0) == 1) {
+        backend.service();
+    }
+}
+
+/**
+ * Open a mock bus and a scheduler transmitting on it.
+ */
+void openBus(MockCECBackend &backend) {
+    results.clear();
+    backend.open(CEC_ADDRESS_TV, 0x18C086, "JVC NX7", forwardEvent, nullptr);
+    scheduler = new CECTransmitScheduler(CEC_ADDRESS_TV, collectResult, nullptr);
+    scheduler->setBackend(&backend);
+}
+
+void closeBus(MockCECBackend &backend) {
+    backend.close();
+    delete scheduler;
+    scheduler = nullptr;
+}
+
+/**
+ * A backend that accepts transmits and never reports their result.
+ */
+class SilentCECBackend : public CECBackend {
+public:
+    const char *name() const override {
+        return "silent";
+    }
+
+    bool open(int address, uint32_t vendorId, const char *osdName, CECEventHandler handler, void *context) override {
+        return true;
+    }
+
+    void close() override {}
+
+    int transmit(int follower, const uint8_t *payload, size_t length, bool isReply) override {
+        transmits++;
+        return 0;
+    }
+
+    int fd() const override {
+        return -1;
+    }
+
+    void service() override {}
+
+    int transmits { 0 };
+};
+
+/**
+ * Check that a reply queued behind broadcasts is sent before them.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testPriority() {
+    MockCECBackend backend(1 << CEC_ADDRESS_PLAYBACK_1);
+    openBus(backend);
+
+    const uint8_t standby[] { CEC_OPCODE_STANDBY };
+    const uint8_t streamPath[] { CEC_OPCODE_SET_STREAM_PATH, 0x11, 0x00 };
+    const uint8_t reply[] { CEC_OPCODE_REPORT_POWER_STATUS, CEC_POWER_ON };
+    scheduler->submit(CEC_ADDRESS_BROADCAST, standby, sizeof(standby), CEC_LANE_BROADCAST);
+    scheduler->submit(CEC_ADDRESS_BROADCAST, streamPath, sizeof(streamPath), CEC_LANE_BROADCAST);
+    scheduler->submit(CEC_ADDRESS_PLAYBACK_1, reply, sizeof(reply), CEC_LANE_REPLY);
+    drain(backend);
+
+    vector<CECMessage> sent = backend.transmitted();
+    closeBus(backend);
+
+    // The standby was already on the bus when the others were queued.
+    if (sent.size() != 3
+            || sent[0].payload[0] != CEC_OPCODE_STANDBY
+            || sent[1].payload[0] != CEC_OPCODE_REPORT_POWER_STATUS
+            || sent[2].payload[0] != CEC_OPCODE_SET_STREAM_PATH) {
+        spdlog::error("Priority: wrong order of {} frames", sent.size());
+        return 1;
+    }
+    if (results.size() != 3 || !results[1].second) {
+        spdlog::error("Priority: {} results", results.size());
+        return 1;
+    }
+
+    spdlog::info("Priority: OK");
+    return 0;
+}
+
+/**
+ * Check that a broadcast queued or just sent is not sent again, and that
+ * only a queued one is pending.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testDuplicateBroadcasts() {
+    MockCECBackend backend;
+    openBus(backend);
+
+    const uint8_t standby[] { CEC_OPCODE_STANDBY };
+    const uint8_t vendorId[] { CEC_OPCODE_DEVICE_VENDOR_ID, 0x18, 0xC0, 0x86 };
+    const CECMessage standbyMessage { sizeof(standby), CEC_ADDRESS_TV, CEC_ADDRESS_BROADCAST, { CEC_OPCODE_STANDBY } };
+    scheduler->submit(CEC_ADDRESS_BROADCAST, standby, sizeof(standby), CEC_LANE_BROADCAST);
+    scheduler->submit(CEC_ADDRESS_BROADCAST, standby, sizeof(standby), CEC_LANE_BROADCAST);
+    const bool pendingInFlight = scheduler->isPending(standbyMessage);
+    drain(backend);
+    scheduler->submit(CEC_ADDRESS_BROADCAST, standby, sizeof(standby), CEC_LANE_BROADCAST);
+    const bool pendingWhenSent = scheduler->isPending(standbyMessage);
+    scheduler->submit(CEC_ADDRESS_BROADCAST, vendorId, sizeof(vendorId), CEC_LANE_BROADCAST);
+    drain(backend);
+
+    size_t sent = backend.transmitted().size();
+    CECTransmitStats stats = scheduler->stats();
+    closeBus(backend);
+
+    if (sent != 2 || stats.suppressed != 2 || stats.submitted != 2) {
+        spdlog::error("Duplicates: {} sent, {} suppressed", sent, stats.suppressed);
+        return 1;
+    }
+    if (!pendingInFlight || pendingWhenSent) {
+        spdlog::error("Duplicates: pending in flight {}, once sent {}", pendingInFlight, pendingWhenSent);
+        return 1;
+    }
+
+    spdlog::info("Duplicate broadcasts: OK");
+    return 0;
+}
+
+/**
+ * Check that unacknowledged directed messages are retried a bounded number
+ * of times, polls are not, and every attempt is charged its bus time.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testRetries() {
+    MockCECBackend backend;
+    openBus(backend);
+
+    const uint8_t giveName[] { CEC_OPCODE_GIVE_OSD_NAME };
+    scheduler->submit(CEC_ADDRESS_AUDIO_SYSTEM, giveName, sizeof(giveName), CEC_LANE_REQUEST);
+    drain(backend);
+    scheduler->submit(CEC_ADDRESS_AUDIO_SYSTEM, nullptr, 0, CEC_LANE_BACKGROUND);
+    drain(backend);
+
+    size_t sent = backend.transmitted().size();
+    CECTransmitStats stats = scheduler->stats();
+    closeBus(backend);
+
+    if (sent != 1 + CEC_TRANSMIT_RETRIES + 1 || stats.retried != CEC_TRANSMIT_RETRIES || stats.failed != 2) {
+        spdlog::error("Retries: {} sent, {} retried, {} failed", sent, stats.retried, stats.failed);
+        return 1;
+    }
+    if (results.size() != 2 || results[0].second || results[1].second || results[1].first.length != 0) {
+        spdlog::error("Retries: {} results", results.size());
+        return 1;
+    }
+    const int64_t busyUs = (1 + CEC_TRANSMIT_RETRIES) * cecFrameTimeUs(1) + cecFrameTimeUs(0);
+    if (stats.transmitted != sent || stats.busyUs != busyUs || stats.utilization <= 0) {
+        spdlog::error("Retries: {}us on the bus, expected {}us", stats.busyUs, busyUs);
+        return 1;
+    }
+
+    spdlog::info("Retries and bus time: OK");
+    return 0;
+}
+
+/**
+ * Check that a message whose result never comes is given up on and the next
+ * one sent, and that a full lane refuses more.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testLostResult() {
+    SilentCECBackend backend;
+    results.clear();
+    CECTransmitScheduler silent(CEC_ADDRESS_TV, collectResult, nullptr);
+    silent.setBackend(&backend);
+
+    const uint8_t givePower[] { CEC_OPCODE_GIVE_DEVICE_POWER_STATUS };
+    int refused = 0;
+    for (size_t i = 0; i < 1 + CEC_LANE_CAPACITY + 1; i++) {
+        refused -= silent.submit(CEC_ADDRESS_PLAYBACK_1, givePower, sizeof(givePower), CEC_LANE_BACKGROUND);
+    }
+    if (backend.transmits != 1 || refused != 1 || silent.stats().dropped != 1) {
+        spdlog::error("Lost result: {} sent, {} refused", backend.transmits, refused);
+        return 1;
+    }
+
+    int timeoutMs = silent.timeoutMs();
+    silent.expire();
+    if (timeoutMs <= 0 || timeoutMs > CEC_TRANSMIT_RESULT_MS + 1 || !results.empty()) {
+        spdlog::error("Lost result: expired early, timeout {}ms", timeoutMs);
+        return 1;
+    }
+    this_thread::sleep_for(chrono::milliseconds(timeoutMs));
+    silent.expire();
+    if (results.size() != 1 || results[0].second || backend.transmits != 2) {
+        spdlog::error("Lost result: {} results, {} sent", results.size(), backend.transmits);
+        return 1;
+    }
+
+    spdlog::info("Lost result: OK");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[SCHEDULER] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    return testPriority() | testDuplicateBroadcasts() | testRetries() | testLostResult();
+}
@@ -0,0 +1,341 @@
+#include "cec_sim.hpp"
+#include "cec_discovery.hpp"
+#include "spdlog/spdlog.h"
+#include <atomic>
+#include <mutex>
+#include <poll.h>
+#include <sstream>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+SimCECBackend *bus;
+
+// Events delivered to the handler, in order.
+mutex deliveredMutex;
+vector<CECEvent> delivered;
+
+// Whether the handler answers power status requests, as the daemon does.
+bool answerPowerStatus = false;
+
+void collect(void *context, const CECEvent &event) {
+    {
+        lock_guard<mutex> lock(deliveredMutex);
+        delivered.push_back(event);
+    }
+    if (answerPowerStatus && event.kind == CEC_EVENT_RECEIVED && event.message.payload[0] == CEC_OPCODE_GIVE_DEVICE_POWER_STATUS) {
+        const uint8_t reply[] { CEC_OPCODE_REPORT_POWER_STATUS, CEC_POWER_ON };
+        bus->transmit(event.message.initiator, reply, sizeof(reply), true);
+    }
+}
+
+/**
+ * Services the bus on its own thread, as the event loop does.
+ */
+class Worker {
+public:
+    Worker(SimCECBackend &backend) : backend_(backend), thread_([this]() {
+        while (running_) {
+            struct pollfd fd { backend_.fd(), POLLIN | POLLPRI, 0 };
+            if (poll(&fd, 1, 50) == 1) {
+                backend_.service();
+            }
+        }
+        // Whatever the last frame produced.
+        backend_.service();
+    }) {}
+
+    ~Worker() {
+        running_ = false;
+        thread_.join();
+    }
+
+private:
+    SimCECBackend &backend_;
+    atomic<bool> running_ { true };
+    thread thread_;
+};
+
+/**
+ * Open a bus with the theater devices and the given scenario.
+ */
+void openBus(const CECScenario &scenario = {}) {
+    delivered.clear();
+    bus = new SimCECBackend(theaterCECDevices(), scenario);
+    bus->open(CEC_ADDRESS_TV, 0x18C086, "JVC NX7", collect, nullptr);
+}
+
+/**
+ * Events received so far from one initiator, in order.
+ */
+vector<CECMessage> receivedFrom(int initiator) {
+    lock_guard<mutex> lock(deliveredMutex);
+    vector<CECMessage> messages;
+    for (const CECEvent &event : delivered) {
+        if (event.kind == CEC_EVENT_RECEIVED && event.message.initiator == initiator) {
+            messages.push_back(event.message);
+        }
+    }
+    return messages;
+}
+
+/**
+ * Check that directed frames are acknowledged only by present devices and
+ * hold the bus for their full duration.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testAcknowledgement() {
+    openBus();
+    int failed = 0;
+    {
+        Worker worker(*bus);
+        bus->transmit(CEC_ADDRESS_PLAYBACK_1, nullptr, 0, false);
+        bus->transmit(7, nullptr, 0, false);
+        bus->waitIdle(1000);
+    }
+
+    lock_guard<mutex> lock(deliveredMutex);
+    if (delivered.size() != 2 || delivered[0].kind != CEC_EVENT_TRANSMITTED || !delivered[0].acknowledged
+            || delivered[1].kind != CEC_EVENT_TRANSMITTED || delivered[1].acknowledged) {
+        spdlog::error("Acknowledgement: wrong transmit results ({} events)", delivered.size());
+        failed = 1;
+    } else if (bus->nacks() != 1 || bus->frames() != 2) {
+        spdlog::error("Acknowledgement: {} frames, {} NACKed", bus->frames(), bus->nacks());
+        failed = 1;
+    } else if (bus->busyUs(CEC_ADDRESS_TV) != 2 * cecFrameTimeUs(0)) {
+        spdlog::error("Acknowledgement: bus busy for {}us", bus->busyUs(CEC_ADDRESS_TV));
+        failed = 1;
+    } else if (bus->elapsedUs() < 2 * cecFrameTimeUs(0) + CEC_SIGNAL_FREE_BITS * CEC_BIT_PERIOD_US) {
+        spdlog::error("Acknowledgement: two polls took only {}us", bus->elapsedUs());
+        failed = 1;
+    }
+
+    delete bus;
+    if (!failed) {
+        spdlog::info("Acknowledgement: OK");
+    }
+    return failed;
+}
+
+/**
+ * Check that the lowest header wins when several initiators start at once.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testArbitration() {
+    CECScenario scenario;
+    scenario.steps.push_back({ 50, { 1, CEC_ADDRESS_AUDIO_SYSTEM, CEC_ADDRESS_TV, { CEC_OPCODE_GIVE_DEVICE_POWER_STATUS } } });
+    scenario.steps.push_back({ 50, { 1, CEC_ADDRESS_PLAYBACK_1, CEC_ADDRESS_BROADCAST, { CEC_OPCODE_STANDBY } } });
+    scenario.steps.push_back({ 50, { 1, CEC_ADDRESS_PLAYBACK_1, CEC_ADDRESS_TV, { CEC_OPCODE_IMAGE_VIEW_ON } } });
+    scenario.endMs = 50;
+    openBus(scenario);
+
+    int failed = 0;
+    {
+        Worker worker(*bus);
+        bus->waitIdle(1000);
+    }
+
+    lock_guard<mutex> lock(deliveredMutex);
+    // 4F:36 beats 50:8F. The Audio System then only waits the signal free
+    // time of a new initiator, so it goes before the Roku's second frame.
+    if (delivered.size() != 3 || delivered[0].message.payload[0] != CEC_OPCODE_STANDBY
+            || delivered[1].message.initiator != CEC_ADDRESS_AUDIO_SYSTEM
+            || delivered[2].message.payload[0] != CEC_OPCODE_IMAGE_VIEW_ON) {
+        spdlog::error("Arbitration: wrong order ({} events)", delivered.size());
+        failed = 1;
+    } else if (bus->arbitrationLosses() != 1) {
+        spdlog::error("Arbitration: {} losses", bus->arbitrationLosses());
+        failed = 1;
+    }
+
+    delete bus;
+    if (!failed) {
+        spdlog::info("Arbitration: OK");
+    }
+    return failed;
+}
+
+/**
+ * Check that virtual devices answer requests on their own.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testVirtualDevices() {
+    openBus();
+    {
+        Worker worker(*bus);
+        const uint8_t physicalAddress[] { CEC_OPCODE_GIVE_PHYSICAL_ADDRESS };
+        const uint8_t osdName[] { CEC_OPCODE_GIVE_OSD_NAME };
+        const uint8_t vendorId[] { CEC_OPCODE_GIVE_DEVICE_VENDOR_ID };
+        bus->transmit(CEC_ADDRESS_PLAYBACK_1, physicalAddress, 1, false);
+        bus->transmit(CEC_ADDRESS_AUDIO_SYSTEM, osdName, 1, false);
+        bus->transmit(CEC_ADDRESS_AUDIO_SYSTEM, vendorId, 1, false);
+        bus->waitIdle(1000);
+    }
+
+    vector<CECMessage> roku = receivedFrom(CEC_ADDRESS_PLAYBACK_1);
+    vector<CECMessage> nad = receivedFrom(CEC_ADDRESS_AUDIO_SYSTEM);
+    delete bus;
+
+    if (roku.size() != 1 || roku[0].follower != CEC_ADDRESS_BROADCAST || roku[0].length != 4
+            || roku[0].payload[0] != CEC_OPCODE_REPORT_PHYSICAL_ADDRESS || roku[0].payload[1] != 0x11
+            || roku[0].payload[3] != CEC_ADDRESS_PLAYBACK_1) {
+        spdlog::error("Virtual devices: wrong physical address report ({} frames)", roku.size());
+        return 1;
+    }
+    if (nad.size() != 2 || nad[0].payload[0] != CEC_OPCODE_SET_OSD_NAME
+            || string((const char *)&nad[0].payload[1], nad[0].length - 1) != "NAD T778") {
+        spdlog::error("Virtual devices: wrong OSD name ({} frames)", nad.size());
+        return 1;
+    }
+    if (nad[1].payload[0] != CEC_OPCODE_FEATURE_ABORT || nad[1].payload[1] != CEC_OPCODE_GIVE_DEVICE_VENDOR_ID) {
+        spdlog::error("Virtual devices: vendor ID request not aborted");
+        return 1;
+    }
+
+    spdlog::info("Virtual devices: OK");
+    return 0;
+}
+
+/**
+ * Check the scenario formats.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testParseScenario() {
+    stringstream script(
+        "# Roku wakes the theater\n"
+        "2000 4F:82:11:00\n"
+        "100 every 100 until 300 40:8F   # polls\n"
+        "\n"
+        "end 5000\n"
+    );
+    CECScenario scenario;
+    if (parseCECScenario(script, scenario) != 0 || scenario.steps.size() != 4 || scenario.endMs != 5000
+            || scenario.steps[0].atMs != 100 || scenario.steps[2].atMs != 300 || scenario.steps[3].atMs != 2000
+            || scenario.steps[3].message.follower != CEC_ADDRESS_BROADCAST || scenario.steps[3].message.length != 3) {
+        spdlog::error("Parse: script parsed wrong ({} steps)", scenario.steps.size());
+        return 1;
+    }
+
+    stringstream recorded(
+        "NOTICE:  [     412]\tconnection opened\n"
+        "TRAFFIC: [    3542]\t>> 40:04\n"
+        "TRAFFIC: [    3610]\t<< 04:90:00\n"
+        "TRAFFIC: [    3700]\t>> 04:90:00\n"
+        "TRAFFIC: [    4042]\t>> 4f:36\n"
+    );
+    if (parseCECScenario(recorded, scenario) != 0 || scenario.steps.size() != 2 || scenario.steps[1].atMs != 500
+            || scenario.steps[1].message.payload[0] != CEC_OPCODE_STANDBY || scenario.endMs != 2500) {
+        spdlog::error("Parse: recording parsed wrong ({} steps)", scenario.steps.size());
+        return 1;
+    }
+
+    stringstream bad("100 40:04\n200 40:XY\n");
+    if (parseCECScenario(bad, scenario) != 2) {
+        spdlog::error("Parse: bad frame not reported");
+        return 1;
+    }
+    stringstream badRepeat("0 every 0 until 10 40:04\n");
+    if (parseCECScenario(badRepeat, scenario) != 1) {
+        spdlog::error("Parse: zero period not reported");
+        return 1;
+    }
+
+    spdlog::info("Parse: OK");
+    return 0;
+}
+
+/**
+ * Play synthetic traffic against a handler that answers power polls, and
+ * measure the handler latency.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testScenario() {
+    static atomic<bool> finished { false };
+    stringstream script("100 every 200 until 900 40:8F\n50 50:8F\nend 1200\n");
+    CECScenario scenario;
+    parseCECScenario(script, scenario);
+    openBus(scenario);
+    bus->onScenarioFinished([]() {
+        finished = true;
+    });
+
+    answerPowerStatus = true;
+    {
+        Worker worker(*bus);
+        for (int waited = 0; !finished && waited < 2000; waited += 10) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+    }
+    answerPowerStatus = false;
+
+    int failed = 0;
+    const LatencyHistogram &latency = bus->handlerLatency();
+    if (!finished) {
+        spdlog::error("Scenario: never finished");
+        failed = 1;
+    } else if (latency.count() != 6 || latency.max() > 100000) {
+        spdlog::error("Scenario: {} answers, slowest {}us", latency.count(), latency.max());
+        failed = 1;
+    } else if (bus->busyUs(CEC_ADDRESS_PLAYBACK_1) != 5 * cecFrameTimeUs(1) || bus->busyUs(CEC_ADDRESS_TV) != 6 * cecFrameTimeUs(2)) {
+        spdlog::error("Scenario: wrong bus occupancy ({}us, {}us)", bus->busyUs(CEC_ADDRESS_PLAYBACK_1), bus->busyUs(CEC_ADDRESS_TV));
+        failed = 1;
+    }
+
+    if (!failed) {
+        spdlog::info("Scenario: OK (handler p99 {}us)", latency.percentile(99));
+    }
+    delete bus;
+    return failed;
+}
+
+/**
+ * Run discovery against the theater.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testDiscovery() {
+    static CECDeviceTable devices;
+    static CECDiscovery discovery(devices, CEC_ADDRESS_TV, [](void *context, int follower, const uint8_t *payload, size_t length) {
+        return bus->transmit(follower, payload, length, false);
+    }, nullptr);
+
+    bus = new SimCECBackend(theaterCECDevices());
+    bus->open(CEC_ADDRESS_TV, 0x18C086, "JVC NX7", [](void *context, const CECEvent &event) {
+        if (event.kind == CEC_EVENT_TRANSMITTED) {
+            discovery.onTransmitResult(event.message.follower, event.message.payload, event.message.length, event.acknowledged);
+        } else {
+            discovery.onMessage(event.message.initiator, event.message.payload, event.message.length);
+        }
+    }, nullptr);
+
+    CECDiscoveryResult result;
+    {
+        Worker worker(*bus);
+        result = discovery.run(5000);
+    }
+    delete bus;
+
+    // The vendor ID request to the receiver is answered with a FeatureAbort.
+    if (result.present != 2 || result.replies != 8 || result.unanswered != 0
+            || devices.presentMask() != (1 << CEC_ADDRESS_PLAYBACK_1 | 1 << CEC_ADDRESS_AUDIO_SYSTEM)) {
+        spdlog::error("Discovery: {} present, {} replies, {} unanswered", result.present, result.replies, result.unanswered);
+        return 1;
+    }
+
+    spdlog::info("Discovery: OK ({} frames in {}ms)", result.transmitted, result.elapsedMs);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[SIM] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    return testAcknowledgement() | testArbitration() | testVirtualDevices() | testParseScenario() | testScenario() | testDiscovery();
+}
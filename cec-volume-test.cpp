@@ -0,0 +1,244 @@
+#include "cec_volume.hpp"
+#include "spdlog/spdlog.h"
+#include <chrono>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Frames handed to the transmit function, oldest first.
+vector<CECMessage> sent;
+
+int record(void *context, int follower, const uint8_t *payload, size_t length) {
+    CECMessage message {};
+    message.length = length;
+    message.initiator = CEC_ADDRESS_TV;
+    message.follower = follower;
+    memcpy(message.payload, payload, length);
+    sent.push_back(message);
+    return 0;
+}
+
+// Whether record() fails every UserControlReleased, as a busy bus would.
+bool failReleases { false };
+
+int recordFailingReleases(void *context, int follower, const uint8_t *payload, size_t length) {
+    record(context, follower, payload, length);
+    return failReleases && payload[0] == CEC_OPCODE_USER_CONTROL_RELEASED ? -1 : 0;
+}
+
+/**
+ * Acknowledge the last frame sent, as the bus would.
+ */
+bool acknowledge(CECVolumeForwarder &volume) {
+    const CECMessage &last = sent.back();
+    return volume.onTransmitResult(last.follower, last.payload, last.length, true);
+}
+
+bool isPressed(const CECMessage &message, uint8_t key) {
+    return message.follower == CEC_ADDRESS_AUDIO_SYSTEM && message.length == 2
+        && message.payload[0] == CEC_OPCODE_USER_CONTROL_PRESSED && message.payload[1] == key;
+}
+
+bool isReleased(const CECMessage &message) {
+    return message.follower == CEC_ADDRESS_AUDIO_SYSTEM && message.length == 1
+        && message.payload[0] == CEC_OPCODE_USER_CONTROL_RELEASED;
+}
+
+/**
+ * Check that a burst of repeats does not queue frames, and that the release
+ * follows the frame in flight straight away.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testBurst() {
+    sent.clear();
+    CECVolumeForwarder volume(CEC_ADDRESS_AUDIO_SYSTEM, record, nullptr);
+
+    for (int i = 0; i < 20; i++) {
+        volume.onPressed(CEC_ADDRESS_PLAYBACK_1, CEC_USER_CONTROL_VOLUME_UP);
+    }
+    volume.onReleased(CEC_ADDRESS_PLAYBACK_1);
+    if (sent.size() != 1 || !isPressed(sent[0], CEC_USER_CONTROL_VOLUME_UP)) {
+        spdlog::error("Burst: {} frames queued", sent.size());
+        return 1;
+    }
+
+    acknowledge(volume);
+    if (sent.size() != 2 || !isReleased(sent[1])) {
+        spdlog::error("Burst: release not sent after the press");
+        return 1;
+    }
+    acknowledge(volume);
+
+    CECVolumeStats stats = volume.stats();
+    if (sent.size() != 2 || stats.presses != 1 || stats.coalesced != 19 || stats.releases != 1
+            || volume.latency().count() != 2 || volume.timeoutMs() != -1) {
+        spdlog::error("Burst: {} frames, {} coalesced", sent.size(), stats.coalesced);
+        return 1;
+    }
+
+    spdlog::info("Burst: OK");
+    return 0;
+}
+
+/**
+ * Check that a held key is repeated on schedule, and released when the
+ * remote stops repeating.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testHold() {
+    sent.clear();
+    CECVolumeForwarder volume(CEC_ADDRESS_AUDIO_SYSTEM, record, nullptr);
+
+    auto start = chrono::steady_clock::now();
+    volume.onPressed(CEC_ADDRESS_PLAYBACK_1, CEC_USER_CONTROL_VOLUME_DOWN);
+    acknowledge(volume);
+
+    // The remote repeats every 200ms for a second, then goes quiet.
+    auto lastRepeat = start;
+    while (chrono::steady_clock::now() - start < chrono::milliseconds(1000)) {
+        this_thread::sleep_for(chrono::milliseconds(10));
+        if (chrono::steady_clock::now() - lastRepeat >= chrono::milliseconds(200)) {
+            volume.onPressed(CEC_ADDRESS_PLAYBACK_1, CEC_USER_CONTROL_VOLUME_DOWN);
+            lastRepeat = chrono::steady_clock::now();
+        }
+        volume.expire();
+        acknowledge(volume);
+    }
+    while (volume.timeoutMs() >= 0) {
+        this_thread::sleep_for(chrono::milliseconds(volume.timeoutMs()));
+        volume.expire();
+        acknowledge(volume);
+    }
+    auto elapsed = chrono::steady_clock::now() - start;
+
+    CECVolumeStats stats = volume.stats();
+    if (!isReleased(sent.back()) || stats.timedOut != 1 || stats.repeats < 4 || stats.repeats > 7) {
+        spdlog::error("Hold: {} repeats, {} timed out", stats.repeats, stats.timedOut);
+        return 1;
+    }
+    for (size_t i = 0; i + 1 < sent.size(); i++) {
+        if (!isPressed(sent[i], CEC_USER_CONTROL_VOLUME_DOWN)) {
+            spdlog::error("Hold: frame {} is not a press", i);
+            return 1;
+        }
+    }
+    if (elapsed > chrono::milliseconds(1000 + CEC_KEY_RELEASE_MS + 100)) {
+        spdlog::error("Hold: released after {}ms", chrono::duration_cast<chrono::milliseconds>(elapsed).count());
+        return 1;
+    }
+
+    spdlog::info("Hold: OK ({} repeats)", stats.repeats);
+    return 0;
+}
+
+/**
+ * Check that other keys are left alone, mute is not repeated, and a key
+ * pressed on another device's remote takes over.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testKeys() {
+    sent.clear();
+    CECVolumeForwarder volume(CEC_ADDRESS_AUDIO_SYSTEM, record, nullptr);
+
+    const uint8_t select { 0x00 };
+    if (volume.onPressed(CEC_ADDRESS_PLAYBACK_1, select) || !sent.empty()) {
+        spdlog::error("Keys: forwarded Select");
+        return 1;
+    }
+
+    volume.onPressed(CEC_ADDRESS_PLAYBACK_1, CEC_USER_CONTROL_MUTE);
+    acknowledge(volume);
+    volume.expire();
+    int timeoutMs = volume.timeoutMs();
+    if (sent.size() != 1 || timeoutMs < CEC_KEY_RELEASE_MS - 50) {
+        spdlog::error("Keys: mute repeats after {}ms", timeoutMs);
+        return 1;
+    }
+
+    // The audio system's own keys are not sent back to it.
+    volume.onPressed(CEC_ADDRESS_AUDIO_SYSTEM, CEC_USER_CONTROL_VOLUME_UP);
+    volume.onPressed(CEC_ADDRESS_RECORDER_1, CEC_USER_CONTROL_VOLUME_UP);
+    acknowledge(volume);
+    // Only the device holding the key releases it.
+    volume.onReleased(CEC_ADDRESS_PLAYBACK_1);
+    volume.onReleased(CEC_ADDRESS_RECORDER_1);
+    acknowledge(volume);
+
+    if (sent.size() != 3 || !isPressed(sent[1], CEC_USER_CONTROL_VOLUME_UP) || !isReleased(sent[2])) {
+        spdlog::error("Keys: {} frames", sent.size());
+        return 1;
+    }
+
+    spdlog::info("Keys: OK");
+    return 0;
+}
+
+/**
+ * Check that a release that fails to send is sent again, and that the
+ * retries stop once the audio system would have released the key itself.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testFailedRelease() {
+    sent.clear();
+    CECVolumeForwarder volume(CEC_ADDRESS_AUDIO_SYSTEM, recordFailingReleases, nullptr);
+
+    volume.onPressed(CEC_ADDRESS_PLAYBACK_1, CEC_USER_CONTROL_VOLUME_DOWN);
+    acknowledge(volume);
+    failReleases = true;
+    volume.onReleased(CEC_ADDRESS_PLAYBACK_1);
+    int timeoutMs = volume.timeoutMs();
+    if (sent.size() != 2 || !isReleased(sent[1]) || timeoutMs < 0 || timeoutMs > CEC_VOLUME_RETRY_MS + 1) {
+        spdlog::error("Failed release: {} frames, retry in {}ms", sent.size(), timeoutMs);
+        return 1;
+    }
+
+    failReleases = false;
+    this_thread::sleep_for(chrono::milliseconds(timeoutMs));
+    volume.expire();
+    if (sent.size() != 3 || !isReleased(sent[2])) {
+        spdlog::error("Failed release: not sent again, {} frames", sent.size());
+        return 1;
+    }
+    acknowledge(volume);
+    if (volume.timeoutMs() != -1 || volume.stats().failed != 1) {
+        spdlog::error("Failed release: still owed after it was acknowledged");
+        return 1;
+    }
+
+    // A release that never gets through is given up on.
+    volume.onPressed(CEC_ADDRESS_PLAYBACK_1, CEC_USER_CONTROL_VOLUME_DOWN);
+    acknowledge(volume);
+    failReleases = true;
+    volume.onReleased(CEC_ADDRESS_PLAYBACK_1);
+    auto start = chrono::steady_clock::now();
+    while ((timeoutMs = volume.timeoutMs()) >= 0) {
+        if (chrono::steady_clock::now() - start > chrono::milliseconds(CEC_KEY_RELEASE_MS * 2)) {
+            spdlog::error("Failed release: still retrying");
+            return 1;
+        }
+        this_thread::sleep_for(chrono::milliseconds(timeoutMs));
+        volume.expire();
+    }
+    failReleases = false;
+    size_t attempts = sent.size() - 4;
+    if (attempts < 2 || attempts > CEC_KEY_RELEASE_MS / CEC_VOLUME_RETRY_MS + 1) {
+        spdlog::error("Failed release: sent {} times", attempts);
+        return 1;
+    }
+
+    spdlog::info("Failed release: OK");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[VOLUME] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    return testBurst() | testHold() | testKeys() | testFailedRelease();
+}
@@ -0,0 +1,238 @@
+#ifndef CEC_H
+#define CEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CEC protocol constants, from the HDMI specification. Named so they do not
+// clash with the Broadcom (vc_cec.h) or kernel (linux/cec.h) definitions.
+
+/**
+ * Logical addresses used here.
+ */
+enum CECLogicalAddress {
+    CEC_ADDRESS_TV = 0,
+    CEC_ADDRESS_RECORDER_1 = 1,
+    CEC_ADDRESS_TUNER_1 = 3,
+    CEC_ADDRESS_PLAYBACK_1 = 4,
+    CEC_ADDRESS_AUDIO_SYSTEM = 5,
+    CEC_ADDRESS_BROADCAST = 15,
+};
+
+/**
+ * Opcodes used here, and common ones that show up in traces.
+ */
+enum CECOpcode {
+    CEC_OPCODE_FEATURE_ABORT = 0x00,
+    CEC_OPCODE_IMAGE_VIEW_ON = 0x04,
+    CEC_OPCODE_TEXT_VIEW_ON = 0x0D,
+    CEC_OPCODE_SET_MENU_LANGUAGE = 0x32,
+    CEC_OPCODE_STANDBY = 0x36,
+    CEC_OPCODE_USER_CONTROL_PRESSED = 0x44,
+    CEC_OPCODE_USER_CONTROL_RELEASED = 0x45,
+    CEC_OPCODE_GIVE_OSD_NAME = 0x46,
+    CEC_OPCODE_SET_OSD_NAME = 0x47,
+    CEC_OPCODE_SYSTEM_AUDIO_MODE_REQUEST = 0x70,
+    CEC_OPCODE_GIVE_AUDIO_STATUS = 0x71,
+    CEC_OPCODE_SET_SYSTEM_AUDIO_MODE = 0x72,
+    CEC_OPCODE_REPORT_AUDIO_STATUS = 0x7A,
+    CEC_OPCODE_ROUTING_CHANGE = 0x80,
+    CEC_OPCODE_ACTIVE_SOURCE = 0x82,
+    CEC_OPCODE_GIVE_PHYSICAL_ADDRESS = 0x83,
+    CEC_OPCODE_REPORT_PHYSICAL_ADDRESS = 0x84,
+    CEC_OPCODE_REQUEST_ACTIVE_SOURCE = 0x85,
+    CEC_OPCODE_SET_STREAM_PATH = 0x86,
+    CEC_OPCODE_DEVICE_VENDOR_ID = 0x87,
+    CEC_OPCODE_VENDOR_COMMAND = 0x89,
+    CEC_OPCODE_GIVE_DEVICE_VENDOR_ID = 0x8C,
+    CEC_OPCODE_MENU_REQUEST = 0x8D,
+    CEC_OPCODE_GIVE_DEVICE_POWER_STATUS = 0x8F,
+    CEC_OPCODE_REPORT_POWER_STATUS = 0x90,
+    CEC_OPCODE_GET_MENU_LANGUAGE = 0x91,
+    CEC_OPCODE_INACTIVE_SOURCE = 0x9D,
+    CEC_OPCODE_CEC_VERSION = 0x9E,
+    CEC_OPCODE_GET_CEC_VERSION = 0x9F,
+    CEC_OPCODE_VENDOR_COMMAND_WITH_ID = 0xA0,
+};
+
+/**
+ * Operand of ReportPowerStatus.
+ */
+enum CECPowerStatus {
+    CEC_POWER_ON = 0,
+    CEC_POWER_STANDBY = 1,
+    CEC_POWER_ON_PENDING = 2,
+    CEC_POWER_STANDBY_PENDING = 3,
+};
+
+/**
+ * Operand of UserControlPressed: the keys forwarded to the audio system.
+ */
+enum CECUserControl {
+    CEC_USER_CONTROL_VOLUME_UP = 0x41,
+    CEC_USER_CONTROL_VOLUME_DOWN = 0x42,
+    CEC_USER_CONTROL_MUTE = 0x43,
+};
+
+// Signalling. Times are in microseconds.
+const int CEC_START_BIT_US { 4500 };
+const int CEC_BIT_PERIOD_US { 2400 };
+// Every block (header or data byte) is 8 data bits, EOM and ACK.
+const int CEC_BLOCK_BITS { 10 };
+// Bit periods the bus must be idle before an initiator sends its next frame,
+// and before an initiator sends after someone else's frame.
+const int CEC_SIGNAL_FREE_BITS { 7 };
+const int CEC_SIGNAL_FREE_NEW_INITIATOR_BITS { 5 };
+// How long a follower has to answer a request.
+const int CEC_MAX_RESPONSE_MS { 1000 };
+// While a key is held, UserControlPressed is repeated at this interval at
+// most, and a follower that hears nothing for CEC_KEY_RELEASE_MS assumes
+// the key was released.
+const int CEC_KEY_REPEAT_MS { 450 };
+const int CEC_KEY_RELEASE_MS { 550 };
+
+/**
+ * Time a frame occupies the bus.
+ *
+ * @param   size_t  length  Bytes after the header, opcode included. 0 for a poll.
+ *
+ * @return  int             Microseconds.
+ */
+constexpr int cecFrameTimeUs(size_t length) {
+    return CEC_START_BIT_US + (int)(1 + length) * CEC_BLOCK_BITS * CEC_BIT_PERIOD_US;
+}
+
+// Longest message after the header block: opcode and 14 operands.
+const size_t CEC_MAX_PAYLOAD_SIZE { 15 };
+
+/**
+ * One CEC message, without its header block.
+ */
+struct CECMessage {
+    // Length of the payload, opcode included. 0 for a poll.
+    uint32_t length;
+    int initiator;
+    int follower;
+    uint8_t payload[16];
+};
+
+enum CECEventKind {
+    // A message from another device.
+    CEC_EVENT_RECEIVED,
+    // The outcome of a message we transmitted.
+    CEC_EVENT_TRANSMITTED,
+};
+
+/**
+ * Something a backend reports: a received message or a transmit result.
+ */
+struct CECEvent {
+    CECEventKind kind;
+    // For CEC_EVENT_TRANSMITTED, whether the follower acknowledged.
+    bool acknowledged;
+    CECMessage message;
+};
+
+/**
+ * Receives events from a backend.
+ *
+ * Backends without an fd() call this from their own thread, so it must not
+ * block. Backends with an fd() call it from service().
+ *
+ * @param   void *    context  The context given to CECBackend::open().
+ * @param   CECEvent  event    The event.
+ */
+typedef void (*CECEventHandler)(void *context, const CECEvent &event);
+
+/**
+ * Queue a frame for transmission. Must not block for the transmission itself.
+ *
+ * The outcome is reported back to whoever queued it, e.g. through
+ * CECDiscovery::onTransmitResult().
+ *
+ * @param   void *     context   The context given along with the function.
+ * @param   int        follower  Logical address of the destination.
+ * @param   uint8_t *  payload   Opcode and operands. nullptr for a poll.
+ * @param   size_t     length    Length of the payload. 0 for a poll.
+ *
+ * @return  int                  0 if the frame was queued.
+ */
+typedef int (*CECTransmitFunction)(void *context, int follower, const uint8_t *payload, size_t length);
+
+/**
+ * A CEC adapter.
+ */
+class CECBackend {
+public:
+    virtual ~CECBackend() {}
+
+    /**
+     * Short name for logs, e.g. "vc".
+     *
+     * @return  const char *
+     */
+    virtual const char *name() const = 0;
+
+    /**
+     * Open the adapter and claim a logical address.
+     *
+     * @param   int              address   Logical address to claim. Its device type is used too.
+     * @param   uint32_t         vendorId  Our vendor ID.
+     * @param   char *           osdName   Our OSD name.
+     * @param   CECEventHandler  handler   Receives events until close().
+     * @param   void *           context   Passed to `handler`.
+     *
+     * @return  bool                       Whether the adapter is ready.
+     */
+    virtual bool open(int address, uint32_t vendorId, const char *osdName, CECEventHandler handler, void *context) = 0;
+
+    /**
+     * Release the logical address and close the adapter.
+     */
+    virtual void close() = 0;
+
+    /**
+     * Queue a message. The result is reported as a CEC_EVENT_TRANSMITTED event.
+     *
+     * @param   int        follower  Logical address of the destination.
+     * @param   uint8_t *  payload   Opcode and operands. nullptr for a poll.
+     * @param   size_t     length    Length of the payload. 0 for a poll.
+     * @param   bool       isReply   Whether this answers a request.
+     *
+     * @return  int                  0 if the message was queued.
+     */
+    virtual int transmit(int follower, const uint8_t *payload, size_t length, bool isReply) = 0;
+
+    /**
+     * File descriptor to poll for POLLIN and POLLPRI, or -1 if the backend
+     * delivers events from its own thread.
+     *
+     * @return  int
+     */
+    virtual int fd() const {
+        return -1;
+    }
+
+    /**
+     * Deliver the events that are ready on fd(). Never blocks.
+     */
+    virtual void service() {}
+};
+
+/**
+ * The Broadcom VideoCore backend (vc_cec). Only in builds with HAVE_VC_CEC.
+ *
+ * @return  CECBackend *
+ */
+CECBackend *createVcCECBackend();
+
+/**
+ * The Linux kernel CEC framework backend.
+ *
+ * @param   char *  device  The adapter, e.g. "/dev/cec0".
+ *
+ * @return  CECBackend *
+ */
+CECBackend *createLinuxCECBackend(const char *device);
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef CEC_DEVICES_H
+#define CEC_DEVICES_H
+
+#include <chrono>
+#include <stdint.h>
+#include <string.h>
+
+const int CEC_LOGICAL_ADDRESS_COUNT { 16 };
+
+// Physical address of a device that has not reported one yet.
+const uint16_t CEC_UNKNOWN_PHYSICAL_ADDRESS { 0xFFFF };
+// Vendor ID of a device that has not reported one yet (vendor IDs are 24 bit).
+const uint32_t CEC_UNKNOWN_VENDOR_ID { 0xFFFFFFFF };
+// CEC version and power status of a device that has not reported them yet.
+const uint8_t CEC_UNKNOWN { 0xFF };
+// OSD names are at most 14 characters.
+const int CEC_OSD_NAME_SIZE { 15 };
+
+/**
+ * Everything we have heard about the device at one logical address.
+ */
+struct alignas(32) CECDevice {
+    // Milliseconds on the steady clock when the device last sent a message, 0 if never.
+    int64_t lastSeenMs;
+    uint32_t vendorId;
+    uint16_t physicalAddress;
+    uint8_t cecVersion;
+    uint8_t powerStatus;
+    char osdName[CEC_OSD_NAME_SIZE + 1];
+};
+
+static_assert(sizeof(CECDevice) == 32, "Two CECDevice slots should share a cache line");
+
+/**
+ * Fixed table of CEC devices, indexed by logical address.
+ *
+ * Needs no allocation and every lookup is a single array index. Addresses
+ * outside 0-15 are ignored by the setters and read as an unknown device.
+ */
+class CECDeviceTable {
+public:
+    CECDeviceTable() {
+        clear();
+    }
+
+    /**
+     * Forget every device.
+     */
+    void clear() {
+        present_ = 0;
+        for (CECDevice &device : devices_) {
+            device.lastSeenMs = 0;
+            device.vendorId = CEC_UNKNOWN_VENDOR_ID;
+            device.physicalAddress = CEC_UNKNOWN_PHYSICAL_ADDRESS;
+            device.cecVersion = CEC_UNKNOWN;
+            device.powerStatus = CEC_UNKNOWN;
+            device.osdName[0] = '\0';
+        }
+    }
+
+    /**
+     * The device at a logical address.
+     *
+     * @param   int  address  Logical address, 0-15.
+     *
+     * @return  CECDevice
+     */
+    const CECDevice &at(int address) const {
+        return valid(address) ? devices_[address] : unknown_;
+    }
+
+    /**
+     * Whether a device has reported its physical address.
+     *
+     * @param   int  address  Logical address, 0-15.
+     *
+     * @return  bool
+     */
+    bool hasPhysicalAddress(int address) const {
+        return at(address).physicalAddress != CEC_UNKNOWN_PHYSICAL_ADDRESS;
+    }
+
+    /**
+     * Whether a device acknowledged the last poll of its address.
+     *
+     * @param   int  address  Logical address, 0-15.
+     *
+     * @return  bool
+     */
+    bool isPresent(int address) const {
+        return valid(address) && (present_ & 1u << address);
+    }
+
+    /**
+     * Bitmask of present devices, bit N for logical address N.
+     *
+     * @return  uint16_t
+     */
+    uint16_t presentMask() const {
+        return present_;
+    }
+
+    /**
+     * Record whether a device answered a poll.
+     *
+     * @param   int   address  Logical address, 0-15.
+     * @param   bool  present  Whether it acknowledged.
+     */
+    void setPresent(int address, bool present) {
+        if (valid(address)) {
+            present_ = present ? present_ | 1u << address : present_ & ~(1u << address);
+        }
+    }
+
+    /**
+     * Record that a device sent a message.
+     *
+     * @param   int  address  Logical address, 0-15.
+     */
+    void seen(int address) {
+        if (valid(address)) {
+            devices_[address].lastSeenMs = nowMs();
+        }
+    }
+
+    /**
+     * Set a device's physical address from the two bytes of a ReportPhysicalAddress.
+     *
+     * @param   int      address  Logical address, 0-15.
+     * @param   uint8_t  high     First byte of the physical address.
+     * @param   uint8_t  low      Second byte of the physical address.
+     */
+    void setPhysicalAddress(int address, uint8_t high, uint8_t low) {
+        if (valid(address)) {
+            devices_[address].physicalAddress = (uint16_t)(high << 8 | low);
+        }
+    }
+
+    /**
+     * Set a device's vendor ID from the three bytes of a DeviceVendorID.
+     *
+     * @param   int        address  Logical address, 0-15.
+     * @param   uint8_t *  bytes    The vendor ID, most significant byte first.
+     */
+    void setVendorId(int address, const uint8_t *bytes) {
+        if (valid(address)) {
+            devices_[address].vendorId = (uint32_t)bytes[0] << 16 | bytes[1] << 8 | bytes[2];
+        }
+    }
+
+    /**
+     * Set a device's OSD name. Names longer than 14 characters are truncated.
+     *
+     * @param   int        address  Logical address, 0-15.
+     * @param   uint8_t *  name     The name, not terminated.
+     * @param   size_t     length   Length of the name.
+     */
+    void setOSDName(int address, const uint8_t *name, size_t length) {
+        if (valid(address)) {
+            length = length < (size_t)CEC_OSD_NAME_SIZE ? length : CEC_OSD_NAME_SIZE;
+            memcpy(devices_[address].osdName, name, length);
+            devices_[address].osdName[length] = '\0';
+        }
+    }
+
+    /**
+     * Set a device's CEC version.
+     *
+     * @param   int      address  Logical address, 0-15.
+     * @param   uint8_t  version  The version operand of a CECVersion message.
+     */
+    void setCECVersion(int address, uint8_t version) {
+        if (valid(address)) {
+            devices_[address].cecVersion = version;
+        }
+    }
+
+    /**
+     * Set a device's power status.
+     *
+     * @param   int      address  Logical address, 0-15.
+     * @param   uint8_t  status   The status operand of a ReportPowerStatus message.
+     */
+    void setPowerStatus(int address, uint8_t status) {
+        if (valid(address)) {
+            devices_[address].powerStatus = status;
+        }
+    }
+
+    /**
+     * Milliseconds on the steady clock, the unit of lastSeenMs.
+     *
+     * @return  int64_t
+     */
+    static int64_t nowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count();
+    }
+
+private:
+    static bool valid(int address) {
+        return address >= 0 && address < CEC_LOGICAL_ADDRESS_COUNT;
+    }
+
+    CECDevice devices_[CEC_LOGICAL_ADDRESS_COUNT];
+    uint16_t present_;
+    CECDevice unknown_ { 0, CEC_UNKNOWN_VENDOR_ID, CEC_UNKNOWN_PHYSICAL_ADDRESS, CEC_UNKNOWN, CEC_UNKNOWN, "" };
+};
+
+#endif
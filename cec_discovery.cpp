@@ -0,0 +1,222 @@
+#include "cec.hpp"
+#include "cec_discovery.hpp"
+
+using namespace std;
+
+/**
+ * A question asked of every present device, and the message that answers it.
+ */
+struct DiscoveryRequest {
+    uint8_t opcode;
+    uint8_t reply;
+};
+
+const DiscoveryRequest REQUESTS[] {
+    { CEC_OPCODE_GIVE_PHYSICAL_ADDRESS, CEC_OPCODE_REPORT_PHYSICAL_ADDRESS },
+    { CEC_OPCODE_GIVE_DEVICE_VENDOR_ID, CEC_OPCODE_DEVICE_VENDOR_ID },
+    { CEC_OPCODE_GIVE_OSD_NAME, CEC_OPCODE_SET_OSD_NAME },
+    { CEC_OPCODE_GIVE_DEVICE_POWER_STATUS, CEC_OPCODE_REPORT_POWER_STATUS },
+};
+
+const int REQUEST_COUNT { sizeof(REQUESTS) / sizeof(REQUESTS[0]) };
+
+// How long to wait for the result of a transmit. The frame may have to wait
+// for other initiators' frames, and be retransmitted.
+const int TRANSMIT_RESULT_MS { CEC_MAX_RESPONSE_MS };
+
+CECDiscovery::CECDiscovery(CECDeviceTable &devices, int self, CECTransmitFunction transmit, void *context)
+    : devices_(devices), self_(self), transmit_(transmit), context_(context) {
+}
+
+/**
+ * Whether a transmit result is about a queued frame.
+ *
+ * @return  bool
+ */
+bool CECDiscovery::matches(const Frame &frame, int follower, const uint8_t *payload, size_t length) const {
+    if (frame.follower != follower) {
+        return false;
+    }
+    if (frame.request < 0) {
+        return length == 0;
+    }
+    return length == 1 && payload[0] == REQUESTS[frame.request].opcode;
+}
+
+/**
+ * Act on the result of the frame on the bus. Called with mutex_ held.
+ *
+ * @param   bool  acknowledged  Whether the follower acknowledged it.
+ * @param   bool  onBus         Whether the result came from the bus, rather
+ *                              than from run() giving up on it.
+ */
+void CECDiscovery::finishTransmit(bool acknowledged, bool onBus) {
+    waitingForResult_ = false;
+    nextTransmit_ = Clock::now() + chrono::microseconds(CEC_SIGNAL_FREE_BITS * CEC_BIT_PERIOD_US);
+
+    const Frame frame = inflight_;
+    if (frame.request >= 0) {
+        if (acknowledged) {
+            pending_.push_back({ frame.follower, frame.request, Clock::now() + chrono::milliseconds(CEC_MAX_RESPONSE_MS) });
+        } else {
+            result_.unanswered++;
+        }
+        return;
+    }
+
+    if (!acknowledged) {
+        // A lost result says nothing about the device, and run() must not
+        // write the table.
+        if (onBus) {
+            devices_.setPresent(frame.follower, false);
+        }
+        return;
+    }
+    devices_.setPresent(frame.follower, true);
+
+    // Ask the device everything before polling further, so its answers
+    // arrive while the remaining addresses are polled.
+    result_.present++;
+    for (int request = REQUEST_COUNT - 1; request >= 0; request--) {
+        queue_.push_front({ frame.follower, request });
+    }
+}
+
+/**
+ * Count requests whose answer is overdue. Called with mutex_ held.
+ *
+ * @param   time_point  now  The current time.
+ *
+ * @return  time_point       The earliest deadline left, or time_point::max().
+ */
+CECDiscovery::Clock::time_point CECDiscovery::expirePending(Clock::time_point now) {
+    Clock::time_point earliest = Clock::time_point::max();
+    for (size_t i = 0; i < pending_.size();) {
+        if (pending_[i].deadline <= now) {
+            result_.unanswered++;
+            pending_[i] = pending_.back();
+            pending_.pop_back();
+        } else {
+            earliest = min(earliest, pending_[i].deadline);
+            i++;
+        }
+    }
+    return earliest;
+}
+
+CECDiscoveryResult CECDiscovery::run(int timeoutMs) {
+    unique_lock<mutex> lock(mutex_);
+
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point end = start + chrono::milliseconds(timeoutMs);
+
+    active_ = true;
+    result_ = {};
+    queue_.clear();
+    pending_.clear();
+    waitingForResult_ = false;
+    nextTransmit_ = start;
+    for (int address = 0; address < CEC_LOGICAL_ADDRESS_COUNT - 1; address++) {
+        if (address != self_) {
+            queue_.push_back({ address, -1 });
+        }
+    }
+
+    while (true) {
+        Clock::time_point now = Clock::now();
+
+        if (cancelled_) {
+            result_.unanswered += (int)pending_.size();
+            break;
+        }
+
+        if (waitingForResult_ && now >= resultDeadline_) {
+            // The result got lost. Treat the frame as unacknowledged.
+            finishTransmit(false, false);
+        }
+
+        if (!waitingForResult_ && !queue_.empty() && now >= nextTransmit_) {
+            const Frame frame = queue_.front();
+            queue_.pop_front();
+            inflight_ = frame;
+            waitingForResult_ = true;
+
+            const uint8_t *payload = frame.request < 0 ? nullptr : &REQUESTS[frame.request].opcode;
+            const size_t length = frame.request < 0 ? 0 : 1;
+            resultDeadline_ = now + chrono::milliseconds(TRANSMIT_RESULT_MS);
+            result_.transmitted++;
+
+            // The result can arrive before transmit_() returns.
+            lock.unlock();
+            int sent = transmit_(context_, frame.follower, payload, length);
+            lock.lock();
+
+            if (sent != 0 && waitingForResult_ && matches(inflight_, frame.follower, payload, length)) {
+                finishTransmit(false, false);
+            }
+            continue;
+        }
+
+        Clock::time_point wakeAt = expirePending(now);
+        if (!waitingForResult_ && queue_.empty() && pending_.empty()) {
+            break;
+        }
+        if (now >= end) {
+            result_.unanswered += (int)pending_.size();
+            break;
+        }
+
+        if (waitingForResult_) {
+            wakeAt = min(wakeAt, resultDeadline_);
+        } else if (!queue_.empty()) {
+            wakeAt = min(wakeAt, nextTransmit_);
+        }
+        changed_.wait_until(lock, min(wakeAt, end));
+    }
+
+    active_ = false;
+    result_.elapsedMs = chrono::duration_cast<chrono::milliseconds>(Clock::now() - start).count();
+    return result_;
+}
+
+void CECDiscovery::cancel() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        cancelled_ = true;
+    }
+    changed_.notify_all();
+}
+
+void CECDiscovery::onTransmitResult(int follower, const uint8_t *payload, size_t length, bool acknowledged) {
+    lock_guard<mutex> lock(mutex_);
+    if (!active_ || !waitingForResult_ || !matches(inflight_, follower, payload, length)) {
+        return;
+    }
+
+    finishTransmit(acknowledged, true);
+    changed_.notify_all();
+}
+
+void CECDiscovery::onMessage(int initiator, const uint8_t *payload, size_t length) {
+    if (length == 0) {
+        return;
+    }
+
+    lock_guard<mutex> lock(mutex_);
+    if (!active_) {
+        return;
+    }
+
+    for (size_t i = 0; i < pending_.size(); i++) {
+        const DiscoveryRequest &request = REQUESTS[pending_[i].request];
+        bool answers = payload[0] == request.reply
+            || (payload[0] == CEC_OPCODE_FEATURE_ABORT && length > 1 && payload[1] == request.opcode);
+        if (pending_[i].address == initiator && answers) {
+            result_.replies++;
+            pending_[i] = pending_.back();
+            pending_.pop_back();
+            changed_.notify_all();
+            return;
+        }
+    }
+}
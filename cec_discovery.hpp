@@ -0,0 +1,127 @@
+#ifndef CEC_DISCOVERY_H
+#define CEC_DISCOVERY_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "cec.hpp"
+#include "cec_devices.hpp"
+
+/**
+ * Outcome of a discovery pass.
+ */
+struct CECDiscoveryResult {
+    // Devices that acknowledged their poll.
+    int present;
+    // Frames sent, polls included.
+    int transmitted;
+    // Requests answered, with the information or a FeatureAbort.
+    int replies;
+    // Requests not acknowledged or not answered within CEC_MAX_RESPONSE_MS.
+    int unanswered;
+    int64_t elapsedMs;
+};
+
+/**
+ * Finds every device on the bus and fills a CECDeviceTable with what it reports.
+ *
+ * Each logical address is polled. Every device that acknowledges is asked
+ * for its physical address, vendor ID, OSD name and power status. Only one
+ * frame is on the bus at a time, and the next follows its result after the
+ * signal free time, but requests do not wait for earlier answers: replies
+ * are collected while later frames go out.
+ *
+ * Replies and transmit results are fed in from the thread that receives CEC
+ * messages, while run() waits on another thread. The device table is only
+ * written from onTransmitResult(), so it has a single writer.
+ */
+class CECDiscovery {
+public:
+    /**
+     * @param   CECDeviceTable       devices   Table to record present devices in.
+     * @param   int                  self      Our own logical address, which is not polled.
+     * @param   CECTransmitFunction  transmit  Sends a frame.
+     * @param   void *               context   Passed to `transmit`.
+     */
+    CECDiscovery(CECDeviceTable &devices, int self, CECTransmitFunction transmit, void *context);
+
+    /**
+     * Run a discovery pass, blocking until it completes or times out.
+     *
+     * @param   int  timeoutMs  Upper bound on the whole pass.
+     *
+     * @return  CECDiscoveryResult
+     */
+    CECDiscoveryResult run(int timeoutMs);
+
+    /**
+     * End the pass in progress now, without waiting for results or answers
+     * that are still due, e.g. because nothing delivers them any more. A
+     * pass started later returns at once.
+     */
+    void cancel();
+
+    /**
+     * Report the outcome of a frame we sent. Ignored outside of a pass.
+     *
+     * @param   int        follower      Destination of the frame.
+     * @param   uint8_t *  payload       Opcode and operands of the frame.
+     * @param   size_t     length        Length of the payload. 0 for a poll.
+     * @param   bool       acknowledged  Whether the follower acknowledged it.
+     */
+    void onTransmitResult(int follower, const uint8_t *payload, size_t length, bool acknowledged);
+
+    /**
+     * Report a received message. Ignored outside of a pass.
+     *
+     * @param   int        initiator  Who sent it.
+     * @param   uint8_t *  payload    Opcode and operands.
+     * @param   size_t     length     Length of the payload.
+     */
+    void onMessage(int initiator, const uint8_t *payload, size_t length);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // A frame waiting for its turn on the bus.
+    struct Frame {
+        int follower;
+        // -1 for a poll, otherwise an index into the discovery requests.
+        int request;
+    };
+
+    // A request that was acknowledged and waits for an answer.
+    struct Pending {
+        int address;
+        int request;
+        Clock::time_point deadline;
+    };
+
+    bool matches(const Frame &frame, int follower, const uint8_t *payload, size_t length) const;
+    void finishTransmit(bool acknowledged, bool onBus);
+    Clock::time_point expirePending(Clock::time_point now);
+
+    CECDeviceTable &devices_;
+    const int self_;
+    const CECTransmitFunction transmit_;
+    void *const context_;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    bool active_ { false };
+    bool cancelled_ { false };
+    std::deque<Frame> queue_;
+    // The frame on the bus, if waitingForResult_.
+    Frame inflight_ {};
+    bool waitingForResult_ { false };
+    Clock::time_point resultDeadline_;
+    Clock::time_point nextTransmit_;
+    std::vector<Pending> pending_;
+    CECDiscoveryResult result_ {};
+};
+
+#endif
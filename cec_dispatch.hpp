@@ -0,0 +1,79 @@
+#ifndef CEC_DISPATCH_H
+#define CEC_DISPATCH_H
+
+#include <array>
+#include <stdint.h>
+
+// Bitmask of logical addresses, bit N for logical address N.
+typedef uint16_t CECAddressMask;
+
+const CECAddressMask CEC_ANY_ADDRESS { 0xFFFF };
+
+/**
+ * Bitmask with a single logical address set.
+ *
+ * @param   int  address  Logical address, 0-15.
+ *
+ * @return  CECAddressMask
+ */
+constexpr CECAddressMask cecAddressBit(int address) {
+    return (CECAddressMask)(1u << address);
+}
+
+/**
+ * How to handle one opcode, and which messages with it to accept.
+ *
+ * @tparam  Message  The CEC message type. Needs `length`, `initiator`,
+ *                   `follower` and `payload` members.
+ */
+template <typename Message>
+struct CECRoute {
+    // Bounds on the message length, opcode included.
+    uint8_t minLength;
+    uint8_t maxLength;
+    // Accepted followers (destinations) and initiators.
+    CECAddressMask followers;
+    CECAddressMask initiators;
+    // nullptr for opcodes that are not handled.
+    void (*handle)(Message &message);
+};
+
+/**
+ * Routes for every opcode, indexed by opcode.
+ */
+template <typename Message>
+using CECRouteTable = std::array<CECRoute<Message>, 256>;
+
+/**
+ * Run the handler registered for a message's opcode.
+ *
+ * The table is not there for speed: on a bus of a few dozen messages a
+ * second it costs about the same as the chain of predicates it replaced.
+ * It keeps each opcode's length and address checks on one line next to its
+ * handler, where they are easy to review and hard to forget.
+ *
+ * @param   CECRouteTable  routes   The route table.
+ * @param   Message        message  The message to handle.
+ *
+ * @return  bool                    false if the message was not accepted by any handler.
+ */
+template <typename Message>
+inline bool dispatchCECMessage(const CECRouteTable<Message> &routes, Message &message) {
+    if (message.length == 0) {
+        return false;
+    }
+
+    const CECRoute<Message> &route = routes[message.payload[0]];
+    if (!route.handle
+            || message.length < route.minLength
+            || message.length > route.maxLength
+            || !(route.followers & cecAddressBit(message.follower))
+            || !(route.initiators & cecAddressBit(message.initiator))) {
+        return false;
+    }
+
+    route.handle(message);
+    return true;
+}
+
+#endif
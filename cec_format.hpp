@@ -0,0 +1,149 @@
+#ifndef CEC_FORMAT_H
+#define CEC_FORMAT_H
+
+#include <stdint.h>
+#include "spdlog/spdlog.h"
+#include "cec.hpp"
+
+// fmt formatters for CEC traces.
+//
+// Pass messages and addresses to spdlog as they are, e.g.
+// `spdlog::debug("Received {}", message)`. spdlog only formats them when the
+// level is enabled, and then straight into its own buffer, so a disabled
+// trace costs a level check and nothing is allocated either way.
+
+/**
+ * Name of an opcode as the HDMI specification spells it.
+ *
+ * @param   uint8_t  opcode
+ *
+ * @return  const char *     nullptr for opcodes not in CECOpcode.
+ */
+inline const char *cecOpcodeName(uint8_t opcode) {
+    switch (opcode) {
+        case CEC_OPCODE_FEATURE_ABORT: return "FeatureAbort";
+        case CEC_OPCODE_IMAGE_VIEW_ON: return "ImageViewOn";
+        case CEC_OPCODE_TEXT_VIEW_ON: return "TextViewOn";
+        case CEC_OPCODE_SET_MENU_LANGUAGE: return "SetMenuLanguage";
+        case CEC_OPCODE_STANDBY: return "Standby";
+        case CEC_OPCODE_USER_CONTROL_PRESSED: return "UserControlPressed";
+        case CEC_OPCODE_USER_CONTROL_RELEASED: return "UserControlReleased";
+        case CEC_OPCODE_GIVE_OSD_NAME: return "GiveOSDName";
+        case CEC_OPCODE_SET_OSD_NAME: return "SetOSDName";
+        case CEC_OPCODE_SYSTEM_AUDIO_MODE_REQUEST: return "SystemAudioModeRequest";
+        case CEC_OPCODE_GIVE_AUDIO_STATUS: return "GiveAudioStatus";
+        case CEC_OPCODE_SET_SYSTEM_AUDIO_MODE: return "SetSystemAudioMode";
+        case CEC_OPCODE_REPORT_AUDIO_STATUS: return "ReportAudioStatus";
+        case CEC_OPCODE_ROUTING_CHANGE: return "RoutingChange";
+        case CEC_OPCODE_ACTIVE_SOURCE: return "ActiveSource";
+        case CEC_OPCODE_GIVE_PHYSICAL_ADDRESS: return "GivePhysicalAddress";
+        case CEC_OPCODE_REPORT_PHYSICAL_ADDRESS: return "ReportPhysicalAddress";
+        case CEC_OPCODE_REQUEST_ACTIVE_SOURCE: return "RequestActiveSource";
+        case CEC_OPCODE_SET_STREAM_PATH: return "SetStreamPath";
+        case CEC_OPCODE_DEVICE_VENDOR_ID: return "DeviceVendorID";
+        case CEC_OPCODE_VENDOR_COMMAND: return "VendorCommand";
+        case CEC_OPCODE_GIVE_DEVICE_VENDOR_ID: return "GiveDeviceVendorID";
+        case CEC_OPCODE_MENU_REQUEST: return "MenuRequest";
+        case CEC_OPCODE_GIVE_DEVICE_POWER_STATUS: return "GiveDevicePowerStatus";
+        case CEC_OPCODE_REPORT_POWER_STATUS: return "ReportPowerStatus";
+        case CEC_OPCODE_GET_MENU_LANGUAGE: return "GetMenuLanguage";
+        case CEC_OPCODE_INACTIVE_SOURCE: return "InactiveSource";
+        case CEC_OPCODE_CEC_VERSION: return "CECVersion";
+        case CEC_OPCODE_GET_CEC_VERSION: return "GetCECVersion";
+        case CEC_OPCODE_VENDOR_COMMAND_WITH_ID: return "VendorCommandWithID";
+        default: return nullptr;
+    }
+}
+
+/**
+ * Name of a ReportPowerStatus operand.
+ *
+ * @param   uint8_t  status  CECPowerStatus.
+ *
+ * @return  const char *
+ */
+inline const char *cecPowerStatusName(uint8_t status) {
+    switch (status) {
+        case CEC_POWER_ON: return "on";
+        case CEC_POWER_STANDBY: return "standby";
+        case CEC_POWER_ON_PENDING: return "standby->on";
+        case CEC_POWER_STANDBY_PENDING: return "on->standby";
+        default: return "unknown";
+    }
+}
+
+/**
+ * A physical address, formatted as "1.1.0.0".
+ */
+struct CECPhysicalAddress {
+    uint16_t address;
+};
+
+/**
+ * Formats a message as cec-client does, header block first, followed by the
+ * opcode name: "4F:82:11:00 ActiveSource". A poll is just its header, "40".
+ */
+template <>
+struct fmt::formatter<CECMessage> {
+    constexpr auto parse(format_parse_context &ctx) -> decltype(ctx.begin()) {
+        if (ctx.begin() != ctx.end() && *ctx.begin() != '}') {
+            throw format_error("CECMessage takes no format spec");
+        }
+        return ctx.begin();
+    }
+
+    template <typename FormatContext>
+    auto format(const CECMessage &message, FormatContext &ctx) -> decltype(ctx.out()) {
+        static const char digits[] = "0123456789ABCDEF";
+
+        // Header and up to 15 bytes, each with its separator.
+        char hex[3 * (1 + CEC_MAX_PAYLOAD_SIZE)];
+        char *end = hex;
+        *end++ = digits[message.initiator & 0x0F];
+        *end++ = digits[message.follower & 0x0F];
+
+        const uint32_t length = message.length < CEC_MAX_PAYLOAD_SIZE ? message.length : CEC_MAX_PAYLOAD_SIZE;
+        for (uint32_t i = 0; i < length; i++) {
+            *end++ = ':';
+            *end++ = digits[message.payload[i] >> 4];
+            *end++ = digits[message.payload[i] & 0x0F];
+        }
+
+        auto out = std::copy(hex, end, ctx.out());
+        const char *name = length ? cecOpcodeName(message.payload[0]) : nullptr;
+        if (name) {
+            *out++ = ' ';
+            for (; *name; name++) {
+                *out++ = *name;
+            }
+        }
+        return out;
+    }
+};
+
+template <>
+struct fmt::formatter<CECPhysicalAddress> {
+    constexpr auto parse(format_parse_context &ctx) -> decltype(ctx.begin()) {
+        if (ctx.begin() != ctx.end() && *ctx.begin() != '}') {
+            throw format_error("CECPhysicalAddress takes no format spec");
+        }
+        return ctx.begin();
+    }
+
+    template <typename FormatContext>
+    auto format(const CECPhysicalAddress &physical, FormatContext &ctx) -> decltype(ctx.out()) {
+        static const char digits[] = "0123456789ABCDEF";
+        const char text[] {
+            digits[physical.address >> 12],
+            '.',
+            digits[(physical.address >> 8) & 0x0F],
+            '.',
+            digits[(physical.address >> 4) & 0x0F],
+            '.',
+            digits[physical.address & 0x0F],
+        };
+        return std::copy(text, text + sizeof(text), ctx.out());
+    }
+};
+
+#endif
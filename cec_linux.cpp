@@ -0,0 +1,197 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/cec.h>
+#include <string.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include "spdlog/spdlog.h"
+#include "cec.hpp"
+
+// Most messages service() hands on per call, so one wakeup can not flood the
+// handler's queue. poll() reports the rest right away.
+const int SERVICE_BATCH { 16 };
+
+/**
+ * CEC through the Linux kernel CEC framework (/dev/cecN).
+ *
+ * The adapter is opened non-blocking. Received messages and the results of
+ * transmits are both read with CEC_RECEIVE when fd() polls readable, and
+ * adapter events with CEC_DQEVENT when it polls priority. No thread of its own.
+ */
+class LinuxCECBackend : public CECBackend {
+public:
+    LinuxCECBackend(const char *device) : device_(device) {}
+
+    ~LinuxCECBackend() {
+        close();
+    }
+
+    const char *name() const override {
+        return "linux";
+    }
+
+    bool open(int address, uint32_t vendorId, const char *osdName, CECEventHandler handler, void *context) override;
+    void close() override;
+    int transmit(int follower, const uint8_t *payload, size_t length, bool isReply) override;
+
+    int fd() const override {
+        return fd_;
+    }
+
+    void service() override;
+
+private:
+    void dequeueEvents();
+
+    const std::string device_;
+    int fd_ { -1 };
+    int address_ { CEC_ADDRESS_TV };
+    CECEventHandler handler_ { nullptr };
+    void *context_ { nullptr };
+};
+
+bool LinuxCECBackend::open(int address, uint32_t vendorId, const char *osdName, CECEventHandler handler, void *context) {
+    handler_ = handler;
+    context_ = context;
+    address_ = address;
+
+    fd_ = ::open(device_.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd_ < 0) {
+        spdlog::critical("Could not open {}: {}", device_, strerror(errno));
+        return false;
+    }
+
+    struct cec_caps caps {};
+    if (ioctl(fd_, CEC_ADAP_G_CAPS, &caps) < 0) {
+        spdlog::critical("{} is not a CEC adapter: {}", device_, strerror(errno));
+        close();
+        return false;
+    }
+    spdlog::info("CEC adapter {} ({}, {})", device_, caps.name, caps.driver);
+
+    // Initiator, and see every message instead of letting the kernel answer them.
+    uint32_t mode = CEC_MODE_INITIATOR | CEC_MODE_EXCL_FOLLOWER_PASSTHRU;
+    if (ioctl(fd_, CEC_S_MODE, &mode) < 0) {
+        spdlog::critical("Failed to become the exclusive follower: {}", strerror(errno));
+        close();
+        return false;
+    }
+
+    // The TV is the root of the HDMI tree. Adapters that do not read the
+    // physical address from EDID need to be told.
+    if (caps.capabilities & CEC_CAP_PHYS_ADDR) {
+        uint16_t physicalAddress { 0x0000 };
+        if (ioctl(fd_, CEC_ADAP_S_PHYS_ADDR, &physicalAddress) < 0) {
+            spdlog::critical("Failed to set physical address: {}", strerror(errno));
+            close();
+            return false;
+        }
+    }
+
+    if (!(caps.capabilities & CEC_CAP_LOG_ADDRS)) {
+        spdlog::critical("{} does not let us claim a logical address", device_);
+        close();
+        return false;
+    }
+
+    // Drop whatever an earlier process claimed first.
+    struct cec_log_addrs addresses {};
+    ioctl(fd_, CEC_ADAP_S_LOG_ADDRS, &addresses);
+
+    addresses.cec_version = CEC_OP_CEC_VERSION_1_4;
+    addresses.num_log_addrs = 1;
+    addresses.vendor_id = vendorId;
+    strncpy(addresses.osd_name, osdName, sizeof(addresses.osd_name) - 1);
+    addresses.primary_device_type[0] = CEC_OP_PRIM_DEVTYPE_TV;
+    addresses.log_addr_type[0] = CEC_LOG_ADDR_TYPE_TV;
+    addresses.all_device_types[0] = CEC_OP_ALL_DEVTYPE_TV;
+    // Claiming happens in the background, since the fd is non-blocking.
+    if (ioctl(fd_, CEC_ADAP_S_LOG_ADDRS, &addresses) < 0) {
+        spdlog::critical("Failed to set logical address: {}", strerror(errno));
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void LinuxCECBackend::close() {
+    if (fd_ < 0) {
+        return;
+    }
+
+    struct cec_log_addrs addresses {};
+    ioctl(fd_, CEC_ADAP_S_LOG_ADDRS, &addresses);
+    ::close(fd_);
+    fd_ = -1;
+}
+
+int LinuxCECBackend::transmit(int follower, const uint8_t *payload, size_t length, bool isReply) {
+    if (length > CEC_MAX_PAYLOAD_SIZE) {
+        return -1;
+    }
+
+    struct cec_msg msg {};
+    msg.len = 1 + length;
+    msg.msg[0] = (uint8_t)(address_ << 4 | (follower & 0x0F));
+    if (length) {
+        memcpy(&msg.msg[1], payload, length);
+    }
+
+    // Returns once queued. The result comes back through CEC_RECEIVE.
+    if (ioctl(fd_, CEC_TRANSMIT, &msg) < 0) {
+        spdlog::warn("Failed to queue CEC message to {}: {}", follower, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Log adapter events: configuration changes and dropped messages.
+ */
+void LinuxCECBackend::dequeueEvents() {
+    struct cec_event event {};
+    while (ioctl(fd_, CEC_DQEVENT, &event) == 0) {
+        if (event.event == CEC_EVENT_STATE_CHANGE) {
+            spdlog::info(
+                "CEC adapter state: physical address {:04X}, logical addresses {:04X}",
+                event.state_change.phys_addr,
+                event.state_change.log_addr_mask
+            );
+        } else if (event.event == CEC_EVENT_LOST_MSGS) {
+            spdlog::warn("CEC adapter dropped {} messages", event.lost_msgs.lost_msgs);
+        }
+    }
+}
+
+void LinuxCECBackend::service() {
+    dequeueEvents();
+
+    for (int i = 0; i < SERVICE_BATCH; i++) {
+        struct cec_msg msg {};
+        if (ioctl(fd_, CEC_RECEIVE, &msg) < 0) {
+            if (errno != EAGAIN) {
+                spdlog::warn("Failed to receive CEC message: {}", strerror(errno));
+            }
+            return;
+        }
+        if (msg.len == 0) {
+            continue;
+        }
+
+        CECEvent event {};
+        // Results of our own transmits carry the sequence number they were given.
+        event.kind = msg.sequence && msg.tx_status ? CEC_EVENT_TRANSMITTED : CEC_EVENT_RECEIVED;
+        event.acknowledged = msg.tx_status & CEC_TX_STATUS_OK;
+        event.message.length = msg.len - 1;
+        event.message.initiator = msg.msg[0] >> 4;
+        event.message.follower = msg.msg[0] & 0x0F;
+        memcpy(event.message.payload, &msg.msg[1], event.message.length);
+        handler_(context_, event);
+    }
+}
+
+CECBackend *createLinuxCECBackend(const char *device) {
+    return new LinuxCECBackend(device);
+}
@@ -0,0 +1,99 @@
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "cec_mock.hpp"
+
+using namespace std;
+
+bool MockCECBackend::open(int address, uint32_t vendorId, const char *osdName, CECEventHandler handler, void *context) {
+    lock_guard<mutex> lock(mutex_);
+    fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    address_ = address;
+    handler_ = handler;
+    context_ = context;
+    events_.clear();
+    transmitted_.clear();
+    return fd_ >= 0;
+}
+
+void MockCECBackend::close() {
+    lock_guard<mutex> lock(mutex_);
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+/**
+ * Queue an event for service() and wake up the poller.
+ *
+ * @param   CECEvent  event  The event.
+ */
+void MockCECBackend::queue(const CECEvent &event) {
+    lock_guard<mutex> lock(mutex_);
+    if (fd_ < 0) {
+        return;
+    }
+    events_.push_back(event);
+    uint64_t one { 1 };
+    write(fd_, &one, sizeof(one));
+}
+
+int MockCECBackend::transmit(int follower, const uint8_t *payload, size_t length, bool isReply) {
+    if (length > CEC_MAX_PAYLOAD_SIZE) {
+        return -1;
+    }
+
+    CECEvent event {};
+    event.kind = CEC_EVENT_TRANSMITTED;
+    event.message.length = length;
+    event.message.initiator = address_;
+    event.message.follower = follower;
+    if (length) {
+        memcpy(event.message.payload, payload, length);
+    }
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        // Broadcasts are acknowledged unless a follower rejects them.
+        event.acknowledged = follower == CEC_ADDRESS_BROADCAST || (present_ & 1u << follower);
+        transmitted_.push_back(event.message);
+    }
+    queue(event);
+    return 0;
+}
+
+void MockCECBackend::inject(const CECMessage &message) {
+    CECEvent event {};
+    event.kind = CEC_EVENT_RECEIVED;
+    event.message = message;
+    queue(event);
+}
+
+void MockCECBackend::setPresent(uint16_t present) {
+    lock_guard<mutex> lock(mutex_);
+    present_ = present;
+}
+
+vector<CECMessage> MockCECBackend::transmitted() {
+    lock_guard<mutex> lock(mutex_);
+    return transmitted_;
+}
+
+void MockCECBackend::service() {
+    deque<CECEvent> events;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (fd_ < 0) {
+            return;
+        }
+        uint64_t count;
+        read(fd_, &count, sizeof(count));
+        events.swap(events_);
+    }
+
+    // The handler may transmit, so it runs without the lock.
+    for (const CECEvent &event : events) {
+        handler_(context_, event);
+    }
+}
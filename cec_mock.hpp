@@ -0,0 +1,75 @@
+#ifndef CEC_MOCK_H
+#define CEC_MOCK_H
+
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "cec.hpp"
+
+/**
+ * In-process CEC backend for tests, and for running without an adapter.
+ *
+ * Behaves like the kernel backend: events are delivered by service() when
+ * fd() polls readable. Transmits are recorded, and acknowledged if the
+ * follower is marked present. Messages from other devices are injected.
+ */
+class MockCECBackend : public CECBackend {
+public:
+    /**
+     * @param   uint16_t  present  Logical addresses that acknowledge, bit N for address N.
+     */
+    MockCECBackend(uint16_t present = 0) : present_(present) {}
+
+    ~MockCECBackend() {
+        close();
+    }
+
+    const char *name() const override {
+        return "mock";
+    }
+
+    bool open(int address, uint32_t vendorId, const char *osdName, CECEventHandler handler, void *context) override;
+    void close() override;
+    int transmit(int follower, const uint8_t *payload, size_t length, bool isReply) override;
+
+    int fd() const override {
+        return fd_;
+    }
+
+    void service() override;
+
+    /**
+     * Deliver a message as if another device had sent it.
+     *
+     * @param   CECMessage  message  The message.
+     */
+    void inject(const CECMessage &message);
+
+    /**
+     * Change which logical addresses acknowledge.
+     *
+     * @param   uint16_t  present  Bit N for address N.
+     */
+    void setPresent(uint16_t present);
+
+    /**
+     * Every message transmitted since open(), oldest first.
+     *
+     * @return  vector<CECMessage>
+     */
+    std::vector<CECMessage> transmitted();
+
+private:
+    void queue(const CECEvent &event);
+
+    std::mutex mutex_;
+    uint16_t present_;
+    int fd_ { -1 };
+    int address_ { CEC_ADDRESS_TV };
+    CECEventHandler handler_ { nullptr };
+    void *context_ { nullptr };
+    std::deque<CECEvent> events_;
+    std::vector<CECMessage> transmitted_;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef CEC_ROUTES_H
+#define CEC_ROUTES_H
+
+#include "cec.hpp"
+#include "cec_devices.hpp"
+#include "cec_dispatch.hpp"
+
+/**
+ * The handler of each opcode the daemon handles.
+ */
+struct CECHandlers {
+    // Image View On and Text View On.
+    void (*imageViewOn)(CECMessage &message);
+    void (*standby)(CECMessage &message);
+    void (*giveDeviceVendorID)(CECMessage &message);
+    void (*giveDevicePowerStatus)(CECMessage &message);
+    void (*reportPhysicalAddress)(CECMessage &message);
+    void (*giveOSDName)(CECMessage &message);
+    void (*userControlPressed)(CECMessage &message);
+    void (*userControlReleased)(CECMessage &message);
+    void (*deviceVendorID)(CECMessage &message);
+    void (*setOSDName)(CECMessage &message);
+    void (*cecVersion)(CECMessage &message);
+    void (*reportPowerStatus)(CECMessage &message);
+};
+
+/**
+ * Build the table of CEC handlers, indexed by opcode.
+ *
+ * Each route also holds the length, follower and initiator constraints a
+ * message must meet to be handled. Opcodes without a route are ignored.
+ *
+ * @param   CECHandlers  handlers  The handler of each route.
+ *
+ * @return  CECRouteTable
+ */
+constexpr CECRouteTable<CECMessage> buildCECRoutes(const CECHandlers &handlers) {
+    const CECAddressMask tv = cecAddressBit(CEC_ADDRESS_TV);
+    const CECAddressMask tvOrBroadcast = tv | cecAddressBit(CEC_ADDRESS_BROADCAST);
+    const CECAddressMask notTV = CEC_ANY_ADDRESS & ~tv;
+
+    CECRouteTable<CECMessage> routes {};
+    routes[CEC_OPCODE_IMAGE_VIEW_ON] = { 1, 1, CEC_ANY_ADDRESS, CEC_ANY_ADDRESS, handlers.imageViewOn };
+    routes[CEC_OPCODE_TEXT_VIEW_ON] = { 1, 1, CEC_ANY_ADDRESS, CEC_ANY_ADDRESS, handlers.imageViewOn };
+    routes[CEC_OPCODE_STANDBY] = { 1, 1, tvOrBroadcast, notTV, handlers.standby };
+    routes[CEC_OPCODE_GIVE_DEVICE_VENDOR_ID] = { 1, 1, tv, CEC_ANY_ADDRESS, handlers.giveDeviceVendorID };
+    routes[CEC_OPCODE_GIVE_DEVICE_POWER_STATUS] = { 1, 1, tv, CEC_ANY_ADDRESS, handlers.giveDevicePowerStatus };
+    // Opcode, two bytes of physical address and (optionally) the device type.
+    routes[CEC_OPCODE_REPORT_PHYSICAL_ADDRESS] = { 3, 16, CEC_ANY_ADDRESS, CEC_ANY_ADDRESS, handlers.reportPhysicalAddress };
+    routes[CEC_OPCODE_GIVE_OSD_NAME] = { 1, 1, CEC_ANY_ADDRESS, CEC_ANY_ADDRESS, handlers.giveOSDName };
+    // Opcode, UI command and (for a few commands) its operands.
+    routes[CEC_OPCODE_USER_CONTROL_PRESSED] = { 2, 16, tv, notTV, handlers.userControlPressed };
+    routes[CEC_OPCODE_USER_CONTROL_RELEASED] = { 1, 1, tv, notTV, handlers.userControlReleased };
+    // Opcode and three bytes of vendor ID.
+    routes[CEC_OPCODE_DEVICE_VENDOR_ID] = { 4, 4, CEC_ANY_ADDRESS, CEC_ANY_ADDRESS, handlers.deviceVendorID };
+    routes[CEC_OPCODE_SET_OSD_NAME] = { 2, 1 + CEC_OSD_NAME_SIZE, CEC_ANY_ADDRESS, CEC_ANY_ADDRESS, handlers.setOSDName };
+    routes[CEC_OPCODE_CEC_VERSION] = { 2, 2, CEC_ANY_ADDRESS, CEC_ANY_ADDRESS, handlers.cecVersion };
+    routes[CEC_OPCODE_REPORT_POWER_STATUS] = { 2, 2, CEC_ANY_ADDRESS, CEC_ANY_ADDRESS, handlers.reportPowerStatus };
+    return routes;
+}
+
+#endif
@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <string.h>
+#include "spdlog/spdlog.h"
+#include "cec_format.hpp"
+#include "cec_scheduler.hpp"
+
+using namespace std;
+
+/**
+ * Whether two messages have the same destination and content.
+ */
+bool sameMessage(const CECMessage &a, const CECMessage &b) {
+    return a.follower == b.follower && a.length == b.length && memcmp(a.payload, b.payload, a.length) == 0;
+}
+
+CECTransmitScheduler::CECTransmitScheduler(int self, CECTransmitResultHandler onResult, void *context)
+    : self_(self), onResult_(onResult), context_(context), start_(Clock::now()) {}
+
+void CECTransmitScheduler::setBackend(CECBackend *backend) {
+    Results results;
+    {
+        lock_guard<mutex> lock(mutex_);
+        backend_ = backend;
+        pump(results);
+    }
+    report(results);
+}
+
+bool CECTransmitScheduler::isDuplicateBroadcast(const CECMessage &message, Clock::time_point now) {
+    while (!recentBroadcasts_.empty() && now - recentBroadcasts_.front().first > chrono::milliseconds(CEC_DUPLICATE_BROADCAST_MS)) {
+        recentBroadcasts_.pop_front();
+    }
+    for (const auto &recent : recentBroadcasts_) {
+        if (sameMessage(recent.second, message)) {
+            return true;
+        }
+    }
+    return hasPending(message);
+}
+
+/**
+ * Whether an identical message is queued or in flight. Called with mutex_ held.
+ */
+bool CECTransmitScheduler::hasPending(const CECMessage &message) {
+    if (transmitting_ && sameMessage(inflight_.message, message)) {
+        return true;
+    }
+    for (const deque<Frame> &lane : lanes_) {
+        for (const Frame &frame : lane) {
+            if (sameMessage(frame.message, message)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool CECTransmitScheduler::isPending(const CECMessage &message) {
+    lock_guard<mutex> lock(mutex_);
+    return hasPending(message);
+}
+
+int CECTransmitScheduler::submit(int follower, const uint8_t *payload, size_t length, CECLane lane) {
+    if (length > CEC_MAX_PAYLOAD_SIZE) {
+        return -1;
+    }
+
+    Frame frame {};
+    frame.message.length = length;
+    frame.message.initiator = self_;
+    frame.message.follower = follower;
+    if (length) {
+        memcpy(frame.message.payload, payload, length);
+    }
+    frame.lane = lane;
+
+    Results results;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (follower == CEC_ADDRESS_BROADCAST && isDuplicateBroadcast(frame.message, Clock::now())) {
+            spdlog::debug("Suppressed duplicate broadcast {}", frame.message);
+            stats_.suppressed++;
+            return 0;
+        }
+        if (lanes_[lane].size() >= CEC_LANE_CAPACITY) {
+            stats_.dropped++;
+            return -1;
+        }
+
+        stats_.submitted++;
+        lanes_[lane].push_back(frame);
+        pump(results);
+    }
+    report(results);
+    return 0;
+}
+
+/**
+ * Hand the next message to the backend if nothing is in flight. Called with mutex_ held.
+ */
+void CECTransmitScheduler::pump(Results &results) {
+    while (backend_ && !transmitting_) {
+        deque<Frame> *lane = find_if(begin(lanes_), end(lanes_), [](const deque<Frame> &lane) {
+            return !lane.empty();
+        });
+        if (lane == end(lanes_)) {
+            return;
+        }
+
+        inflight_ = lane->front();
+        lane->pop_front();
+        inflight_.attempts++;
+
+        const CECMessage &message = inflight_.message;
+        // The result is only processed on the thread that takes this lock,
+        // so it cannot be missed even if it arrives before transmit() returns.
+        if (backend_->transmit(message.follower, message.payload, message.length, inflight_.lane == CEC_LANE_REPLY) != 0) {
+            finish(inflight_, false, results);
+            continue;
+        }
+        transmitting_ = true;
+        resultDeadline_ = Clock::now() + chrono::milliseconds(CEC_TRANSMIT_RESULT_MS);
+    }
+}
+
+/**
+ * Record the final outcome of a message. Called with mutex_ held.
+ */
+void CECTransmitScheduler::finish(const Frame &frame, bool acknowledged, Results &results) {
+    if (acknowledged) {
+        stats_.acknowledged++;
+    } else {
+        stats_.failed++;
+    }
+    results.push_back({ frame.message, acknowledged });
+}
+
+void CECTransmitScheduler::report(const Results &results) {
+    for (const auto &result : results) {
+        if (!result.second) {
+            spdlog::debug("CEC message was not acknowledged: {}", result.first);
+        }
+        if (onResult_) {
+            onResult_(context_, result.first, result.second);
+        }
+    }
+}
+
+/**
+ * Charge bus time to the utilization window. Called with mutex_ held.
+ */
+void CECTransmitScheduler::chargeBus(int64_t us, Clock::time_point now) {
+    stats_.busyUs += us;
+    recentBusy_.push_back({ now, us });
+    recentBusyUs_ += us;
+    while (now - recentBusy_.front().first > chrono::milliseconds(CEC_UTILIZATION_WINDOW_MS)) {
+        recentBusyUs_ -= recentBusy_.front().second;
+        recentBusy_.pop_front();
+    }
+}
+
+bool CECTransmitScheduler::onTransmitted(const CECEvent &event) {
+    Results results;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (!transmitting_ || !sameMessage(inflight_.message, event.message)) {
+            return false;
+        }
+
+        const Clock::time_point now = Clock::now();
+        transmitting_ = false;
+        stats_.transmitted++;
+        chargeBus(cecFrameTimeUs(inflight_.message.length), now);
+
+        const CECMessage &message = inflight_.message;
+        const bool retryable = message.follower != CEC_ADDRESS_BROADCAST && message.length > 0;
+        if (event.acknowledged) {
+            if (message.follower == CEC_ADDRESS_BROADCAST) {
+                recentBroadcasts_.push_back({ now, message });
+            }
+            finish(inflight_, true, results);
+        } else if (retryable && inflight_.attempts <= CEC_TRANSMIT_RETRIES) {
+            // Again, ahead of everything else in its lane.
+            stats_.retried++;
+            lanes_[inflight_.lane].push_front(inflight_);
+        } else {
+            finish(inflight_, false, results);
+        }
+        pump(results);
+    }
+    report(results);
+    return true;
+}
+
+int CECTransmitScheduler::timeoutMs() {
+    lock_guard<mutex> lock(mutex_);
+    if (!transmitting_) {
+        return -1;
+    }
+    auto left = chrono::duration_cast<chrono::milliseconds>(resultDeadline_ - Clock::now()).count();
+    return max<int64_t>(0, left + 1);
+}
+
+void CECTransmitScheduler::expire() {
+    Results results;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (!transmitting_ || Clock::now() < resultDeadline_) {
+            return;
+        }
+        spdlog::warn("No transmit result for {}", inflight_.message);
+        transmitting_ = false;
+        finish(inflight_, false, results);
+        pump(results);
+    }
+    report(results);
+}
+
+CECTransmitStats CECTransmitScheduler::stats() {
+    lock_guard<mutex> lock(mutex_);
+    CECTransmitStats stats = stats_;
+
+    const Clock::time_point now = Clock::now();
+    while (!recentBusy_.empty() && now - recentBusy_.front().first > chrono::milliseconds(CEC_UTILIZATION_WINDOW_MS)) {
+        recentBusyUs_ -= recentBusy_.front().second;
+        recentBusy_.pop_front();
+    }
+    const int64_t windowUs = min<int64_t>(
+        CEC_UTILIZATION_WINDOW_MS * 1000,
+        max<int64_t>(1, chrono::duration_cast<chrono::microseconds>(now - start_).count())
+    );
+    stats.utilization = (double)recentBusyUs_ / windowUs;
+    return stats;
+}
+
+void CECTransmitScheduler::logStats() {
+    CECTransmitStats stats = this->stats();
+    spdlog::info(
+        "CEC transmit: submitted={} sent={} acked={} retried={} failed={} suppressed={} dropped={} bus={}ms utilization={:.1f}%",
+        stats.submitted,
+        stats.transmitted,
+        stats.acknowledged,
+        stats.retried,
+        stats.failed,
+        stats.suppressed,
+        stats.dropped,
+        stats.busyUs / 1000,
+        stats.utilization * 100
+    );
+}
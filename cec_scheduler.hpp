@@ -0,0 +1,186 @@
+#ifndef CEC_SCHEDULER_H
+#define CEC_SCHEDULER_H
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+#include "cec.hpp"
+
+/**
+ * Transmit lanes, highest priority first.
+ */
+enum CECLane {
+    // Answers to requests, e.g. the Roku's power status polls.
+    CEC_LANE_REPLY,
+    // Directed messages we start.
+    CEC_LANE_REQUEST,
+    CEC_LANE_BROADCAST,
+    // Discovery and anything else that can wait.
+    CEC_LANE_BACKGROUND,
+    CEC_LANE_COUNT,
+};
+
+// Frames each lane holds before new ones are dropped.
+const size_t CEC_LANE_CAPACITY { 16 };
+// Retransmissions of a directed message that was not acknowledged. Polls
+// and broadcasts are never retried.
+const int CEC_TRANSMIT_RETRIES { 2 };
+// A broadcast identical to one acknowledged this recently is not sent again.
+const int CEC_DUPLICATE_BROADCAST_MS { 2000 };
+// How long to wait for the result of a transmit before giving up on it.
+const int CEC_TRANSMIT_RESULT_MS { CEC_MAX_RESPONSE_MS };
+// Window over which bus utilization is reported.
+const int CEC_UTILIZATION_WINDOW_MS { 10000 };
+
+/**
+ * Receives the final outcome of a scheduled message, after any retries.
+ *
+ * Called without the scheduler's lock held, so it may submit again.
+ *
+ * @param   void *      context       The context given to CECTransmitScheduler.
+ * @param   CECMessage  message       The message.
+ * @param   bool        acknowledged  Whether the follower acknowledged it.
+ */
+typedef void (*CECTransmitResultHandler)(void *context, const CECMessage &message, bool acknowledged);
+
+struct CECTransmitStats {
+    // Messages accepted by submit().
+    uint64_t submitted;
+    // Transmit attempts that got a result, retries included.
+    uint64_t transmitted;
+    uint64_t acknowledged;
+    uint64_t retried;
+    // Messages that were never acknowledged, or that the backend refused.
+    uint64_t failed;
+    // Broadcasts not sent because an identical one was queued or just sent.
+    uint64_t suppressed;
+    // Messages refused because their lane was full.
+    uint64_t dropped;
+    // Bus time of every transmit attempt since start, in microseconds.
+    int64_t busyUs;
+    // Share of the last CEC_UTILIZATION_WINDOW_MS the bus carried our frames, 0-1.
+    double utilization;
+};
+
+/**
+ * Queues outgoing CEC messages and hands them to the backend one at a time.
+ *
+ * The next message goes out once the backend reports the result of the
+ * previous one, so a burst of broadcasts cannot starve a reply: lanes are
+ * served in priority order every time the bus frees up. Directed messages
+ * that are not acknowledged are retried a bounded number of times, and
+ * every attempt is charged its time on the bus (see cecFrameTimeUs()).
+ *
+ * submit() may be called from any thread. Transmit results are fed in
+ * through onTransmitted() from the thread that receives CEC events, which
+ * also calls expire() when timeoutMs() passes without one.
+ */
+class CECTransmitScheduler {
+public:
+    /**
+     * @param   int                       self      Our logical address, the initiator of every message.
+     * @param   CECTransmitResultHandler  onResult  Receives final outcomes. May be nullptr.
+     * @param   void *                    context   Passed to `onResult`.
+     */
+    CECTransmitScheduler(int self, CECTransmitResultHandler onResult, void *context);
+
+    /**
+     * Set the backend to transmit with. Nothing is sent until it is set.
+     *
+     * @param   CECBackend *  backend
+     */
+    void setBackend(CECBackend *backend);
+
+    /**
+     * Queue a message.
+     *
+     * @param   int        follower  Logical address of the destination.
+     * @param   uint8_t *  payload   Opcode and operands. nullptr for a poll.
+     * @param   size_t     length    Length of the payload. 0 for a poll.
+     * @param   CECLane    lane      Its priority. Replies are sent with the backend's reply flag.
+     *
+     * @return  int                  0 if queued or a duplicate of a broadcast already
+     *                               handled, -1 if the lane is full or the message too long.
+     */
+    int submit(int follower, const uint8_t *payload, size_t length, CECLane lane);
+
+    /**
+     * Whether a message with this destination and content is queued or in
+     * flight, so its result is still to come.
+     *
+     * @param   CECMessage  message  The message. Its initiator is ignored.
+     *
+     * @return  bool
+     */
+    bool isPending(const CECMessage &message);
+
+    /**
+     * Report a CEC_EVENT_TRANSMITTED event.
+     *
+     * @param   CECEvent  event  The event.
+     *
+     * @return  bool             false if it was not for the message in flight.
+     */
+    bool onTransmitted(const CECEvent &event);
+
+    /**
+     * Time until the message in flight times out.
+     *
+     * @return  int     Milliseconds, or -1 if nothing is in flight.
+     */
+    int timeoutMs();
+
+    /**
+     * Give up on the message in flight if its result is overdue.
+     */
+    void expire();
+
+    CECTransmitStats stats();
+
+    /**
+     * Log the counters and utilization.
+     */
+    void logStats();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Frame {
+        CECMessage message;
+        CECLane lane;
+        int attempts;
+    };
+
+    typedef std::vector<std::pair<CECMessage, bool>> Results;
+
+    void pump(Results &results);
+    void finish(const Frame &frame, bool acknowledged, Results &results);
+    void report(const Results &results);
+    void chargeBus(int64_t us, Clock::time_point now);
+    bool isDuplicateBroadcast(const CECMessage &message, Clock::time_point now);
+    bool hasPending(const CECMessage &message);
+
+    const int self_;
+    const CECTransmitResultHandler onResult_;
+    void *const context_;
+
+    std::mutex mutex_;
+    CECBackend *backend_ { nullptr };
+    std::deque<Frame> lanes_[CEC_LANE_COUNT];
+    Frame inflight_ {};
+    bool transmitting_ { false };
+    Clock::time_point resultDeadline_;
+    // Broadcasts acknowledged within CEC_DUPLICATE_BROADCAST_MS.
+    std::deque<std::pair<Clock::time_point, CECMessage>> recentBroadcasts_;
+    // Bus time charged within CEC_UTILIZATION_WINDOW_MS.
+    std::deque<std::pair<Clock::time_point, int64_t>> recentBusy_;
+    int64_t recentBusyUs_ { 0 };
+    const Clock::time_point start_;
+    CECTransmitStats stats_ {};
+};
+
+#endif
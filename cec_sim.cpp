@@ -0,0 +1,544 @@
+#include <algorithm>
+#include <signal.h>
+#include <sstream>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "spdlog/spdlog.h"
+#include "cec_sim.hpp"
+
+using namespace std;
+
+// How long the daemon has to answer a frame for it to count towards handler latency.
+const int HANDLER_LATENCY_WINDOW_MS { 1000 };
+
+// Time left after the last scripted frame when a scenario has no `end`.
+const int SCENARIO_SETTLE_MS { 2000 };
+
+vector<VirtualCECDevice> theaterCECDevices() {
+    return {
+        { CEC_ADDRESS_PLAYBACK_1, 0x1100, 0x000D4B, "Roku Ultra", CEC_POWER_ON, 30, 0, 0 },
+        // The receiver does not give its vendor ID.
+        { CEC_ADDRESS_AUDIO_SYSTEM, 0x1000, 0, "NAD T778", CEC_POWER_STANDBY, 80, CEC_OPCODE_GIVE_DEVICE_VENDOR_ID, 0 },
+    };
+}
+
+/**
+ * Parse a frame written as hex bytes separated by colons, e.g. "4F:82:11:00".
+ *
+ * @return  bool    false if it is not a frame.
+ */
+bool parseFrame(const string &text, CECMessage &message) {
+    uint8_t bytes[1 + CEC_MAX_PAYLOAD_SIZE];
+    size_t count = 0;
+    stringstream stream(text);
+    string byte;
+    while (getline(stream, byte, ':')) {
+        if (count == sizeof(bytes) || byte.empty() || byte.size() > 2
+                || byte.find_first_not_of("0123456789abcdefABCDEF") != string::npos) {
+            return false;
+        }
+        bytes[count++] = (uint8_t)stoul(byte, nullptr, 16);
+    }
+    if (count == 0) {
+        return false;
+    }
+
+    message = {};
+    message.initiator = bytes[0] >> 4;
+    message.follower = bytes[0] & 0x0F;
+    message.length = count - 1;
+    memcpy(message.payload, &bytes[1], count - 1);
+    return true;
+}
+
+int parseCECScenario(istream &input, CECScenario &scenario) {
+    scenario = {};
+    int64_t endMs = -1;
+    int64_t firstRecordedMs = -1;
+    string line;
+
+    for (int number = 1; getline(input, line); number++) {
+        line = line.substr(0, line.find('#'));
+
+        // cec-client traffic: "TRAFFIC: [   3542]\t>> 40:04"
+        if (line.find("TRAFFIC:") != string::npos) {
+            size_t received = line.find(">>");
+            if (received == string::npos) {
+                // Our own frames (<<) are sent by the daemon.
+                continue;
+            }
+            size_t open = line.find('['), close = line.find(']');
+            string frame;
+            stringstream(line.substr(received + 2)) >> frame;
+            CECMessage message;
+            if (open == string::npos || close == string::npos || close < open || !parseFrame(frame, message)) {
+                return number;
+            }
+            int64_t ms;
+            try {
+                ms = stoll(line.substr(open + 1, close - open - 1));
+            } catch (const exception &e) {
+                return number;
+            }
+            if (firstRecordedMs < 0) {
+                firstRecordedMs = ms;
+            }
+            if (message.initiator != CEC_ADDRESS_TV) {
+                scenario.steps.push_back({ ms - firstRecordedMs, message });
+            }
+            continue;
+        }
+        if (line.find('[') != string::npos && line.find(':') < line.find('[')) {
+            // Any other cec-client log line.
+            continue;
+        }
+
+        stringstream words(line);
+        vector<string> tokens;
+        string token;
+        while (words >> token) {
+            tokens.push_back(token);
+        }
+        if (tokens.empty()) {
+            continue;
+        }
+
+        try {
+            if (tokens[0] == "end" && tokens.size() == 2) {
+                endMs = stoll(tokens[1]);
+                continue;
+            }
+
+            CECMessage message;
+            if (tokens.size() == 2 && parseFrame(tokens[1], message)) {
+                if (message.initiator != CEC_ADDRESS_TV) {
+                    scenario.steps.push_back({ stoll(tokens[0]), message });
+                }
+                continue;
+            }
+            if (tokens.size() == 6 && tokens[1] == "every" && tokens[3] == "until" && parseFrame(tokens[5], message)) {
+                int64_t every = stoll(tokens[2]);
+                if (every <= 0) {
+                    return number;
+                }
+                for (int64_t at = stoll(tokens[0]); at <= stoll(tokens[4]); at += every) {
+                    scenario.steps.push_back({ at, message });
+                }
+                continue;
+            }
+        } catch (const exception &e) {
+            // Not a number.
+        }
+        return number;
+    }
+
+    stable_sort(scenario.steps.begin(), scenario.steps.end(), [](const CECScenarioStep &a, const CECScenarioStep &b) {
+        return a.atMs < b.atMs;
+    });
+    int64_t lastMs = scenario.steps.empty() ? 0 : scenario.steps.back().atMs;
+    scenario.endMs = endMs >= 0 ? endMs : lastMs + SCENARIO_SETTLE_MS;
+    return 0;
+}
+
+SimCECBackend::SimCECBackend(vector<VirtualCECDevice> devices, CECScenario scenario)
+    : devices_(devices), scenario_(scenario) {
+    fill(begin(deviceAt_), end(deviceAt_), -1);
+    for (size_t i = 0; i < devices_.size(); i++) {
+        deviceAt_[devices_[i].address & 0x0F] = i;
+    }
+}
+
+SimCECBackend::~SimCECBackend() {
+    close();
+}
+
+bool SimCECBackend::open(int address, uint32_t vendorId, const char *osdName, CECEventHandler handler, void *context) {
+    lock_guard<mutex> lock(mutex_);
+    if (running_) {
+        return false;
+    }
+
+    fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd_ < 0) {
+        return false;
+    }
+    address_ = address;
+    handler_ = handler;
+    context_ = context;
+    start_ = Clock::now();
+    busFreeAt_ = start_;
+    running_ = true;
+
+    // Keep signals for the main thread, like the daemon's own threads.
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    bus_ = thread(&SimCECBackend::run, this);
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    return true;
+}
+
+void SimCECBackend::close() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    changed_.notify_all();
+    bus_.join();
+
+    logReport();
+    ::close(fd_);
+    fd_ = -1;
+}
+
+/**
+ * Put a frame in its initiator's queue. Called with mutex_ held.
+ */
+void SimCECBackend::enqueue(const CECMessage &message, Clock::time_point readyAt) {
+    queues_[message.initiator & 0x0F].push_back({ message, readyAt });
+    changed_.notify_all();
+}
+
+int SimCECBackend::transmit(int follower, const uint8_t *payload, size_t length, bool isReply) {
+    if (length > CEC_MAX_PAYLOAD_SIZE) {
+        return -1;
+    }
+
+    CECMessage message {};
+    message.length = length;
+    message.initiator = address_;
+    message.follower = follower;
+    if (length) {
+        memcpy(message.payload, payload, length);
+    }
+
+    lock_guard<mutex> lock(mutex_);
+    if (!running_) {
+        return -1;
+    }
+
+    Clock::time_point now = Clock::now();
+    while (!awaiting_.empty() && now - awaiting_.front().second > chrono::milliseconds(HANDLER_LATENCY_WINDOW_MS)) {
+        awaiting_.pop_front();
+    }
+    for (auto it = awaiting_.begin(); (isReply || follower == CEC_ADDRESS_BROADCAST) && it != awaiting_.end(); it++) {
+        if (it->first == follower || follower == CEC_ADDRESS_BROADCAST) {
+            handlerLatency_.record(chrono::duration_cast<chrono::microseconds>(now - it->second).count());
+            awaiting_.erase(it);
+            break;
+        }
+    }
+
+    enqueue(message, now);
+    return 0;
+}
+
+void SimCECBackend::inject(const CECMessage &message) {
+    lock_guard<mutex> lock(mutex_);
+    enqueue(message, Clock::now());
+}
+
+void SimCECBackend::onScenarioFinished(void (*finished)()) {
+    lock_guard<mutex> lock(mutex_);
+    finished_ = finished;
+}
+
+/**
+ * Queue an event for service() and wake up the poller. Called with mutex_ held.
+ */
+void SimCECBackend::queueEvent(CECEventKind kind, bool acknowledged, const CECMessage &message) {
+    events_.push_back({ kind, acknowledged, message });
+    uint64_t one { 1 };
+    write(fd_, &one, sizeof(one));
+}
+
+void SimCECBackend::service() {
+    deque<CECEvent> events;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (fd_ < 0) {
+            return;
+        }
+        uint64_t count;
+        read(fd_, &count, sizeof(count));
+        events.swap(events_);
+    }
+
+    // The handler may transmit, so it runs without the lock.
+    for (const CECEvent &event : events) {
+        handler_(context_, event);
+    }
+}
+
+/**
+ * A virtual device's reaction to a frame it received. Called with mutex_ held.
+ *
+ * @param   VirtualCECDevice  device   The device.
+ * @param   CECMessage        message  The frame.
+ * @param   time_point        at       When the frame ended.
+ */
+void SimCECBackend::react(VirtualCECDevice &device, const CECMessage &message, Clock::time_point at) {
+    if (message.length == 0 || message.initiator == device.address) {
+        return;
+    }
+
+    const uint8_t opcode = message.payload[0];
+    if (opcode == CEC_OPCODE_STANDBY) {
+        device.powerStatus = CEC_POWER_STANDBY;
+        return;
+    }
+    if (message.follower == CEC_ADDRESS_BROADCAST || opcode == device.ignores) {
+        return;
+    }
+
+    CECMessage reply {};
+    reply.initiator = device.address;
+    reply.follower = message.initiator;
+
+    if (opcode == device.aborts) {
+        reply.payload[0] = CEC_OPCODE_FEATURE_ABORT;
+        reply.payload[1] = opcode;
+        // Refused.
+        reply.payload[2] = 0x04;
+        reply.length = 3;
+    } else {
+        switch (opcode) {
+            case CEC_OPCODE_GIVE_PHYSICAL_ADDRESS:
+                reply.follower = CEC_ADDRESS_BROADCAST;
+                reply.payload[0] = CEC_OPCODE_REPORT_PHYSICAL_ADDRESS;
+                reply.payload[1] = device.physicalAddress >> 8;
+                reply.payload[2] = device.physicalAddress & 0xFF;
+                reply.payload[3] = device.address;
+                reply.length = 4;
+                break;
+            case CEC_OPCODE_GIVE_DEVICE_VENDOR_ID:
+                reply.follower = CEC_ADDRESS_BROADCAST;
+                reply.payload[0] = CEC_OPCODE_DEVICE_VENDOR_ID;
+                reply.payload[1] = (device.vendorId >> 16) & 0xFF;
+                reply.payload[2] = (device.vendorId >> 8) & 0xFF;
+                reply.payload[3] = device.vendorId & 0xFF;
+                reply.length = 4;
+                break;
+            case CEC_OPCODE_GIVE_OSD_NAME:
+                reply.payload[0] = CEC_OPCODE_SET_OSD_NAME;
+                reply.length = 1 + min(device.osdName.size(), CEC_MAX_PAYLOAD_SIZE - 1);
+                memcpy(&reply.payload[1], device.osdName.data(), reply.length - 1);
+                break;
+            case CEC_OPCODE_GIVE_DEVICE_POWER_STATUS:
+                reply.payload[0] = CEC_OPCODE_REPORT_POWER_STATUS;
+                reply.payload[1] = device.powerStatus;
+                reply.length = 2;
+                break;
+            case CEC_OPCODE_GET_CEC_VERSION:
+                reply.payload[0] = CEC_OPCODE_CEC_VERSION;
+                // Version 1.4
+                reply.payload[1] = 0x05;
+                reply.length = 2;
+                break;
+            default:
+                return;
+        }
+    }
+
+    enqueue(reply, at + chrono::milliseconds(device.responseMs));
+}
+
+/**
+ * Hand a frame that just ended to everyone it concerns. Called with mutex_ held.
+ *
+ * @param   CECMessage  message  The frame.
+ * @param   time_point  at       When the frame ended.
+ */
+void SimCECBackend::deliver(const CECMessage &message, Clock::time_point at) {
+    const bool broadcast = message.follower == CEC_ADDRESS_BROADCAST;
+    const bool fromDaemon = message.initiator == address_;
+    const bool toDaemon = !fromDaemon && (broadcast || message.follower == address_);
+    const int device = deviceAt_[message.follower & 0x0F];
+
+    const bool acknowledged = broadcast || (message.follower == address_ && !fromDaemon) || device >= 0;
+    if (!acknowledged) {
+        nacks_++;
+    }
+
+    if (fromDaemon) {
+        queueEvent(CEC_EVENT_TRANSMITTED, acknowledged, message);
+    }
+    if (toDaemon && message.length) {
+        queueEvent(CEC_EVENT_RECEIVED, true, message);
+        awaiting_.push_back({ message.initiator, at });
+    }
+
+    if (broadcast) {
+        for (VirtualCECDevice &other : devices_) {
+            react(other, message, at);
+        }
+    } else if (device >= 0) {
+        react(devices_[device], message, at);
+    }
+}
+
+/**
+ * Whether nothing is left to send. Called with mutex_ held.
+ *
+ * @return  bool
+ */
+bool SimCECBackend::idle() const {
+    if (onBus_ || nextStep_ < scenario_.steps.size()) {
+        return false;
+    }
+    for (const deque<Frame> &queue : queues_) {
+        if (!queue.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * The bus: plays the scenario, arbitrates and times frames, and delivers them.
+ */
+void SimCECBackend::run() {
+    unique_lock<mutex> lock(mutex_);
+
+    while (running_) {
+        Clock::time_point now = Clock::now();
+
+        while (nextStep_ < scenario_.steps.size() && start_ + chrono::milliseconds(scenario_.steps[nextStep_].atMs) <= now) {
+            const CECScenarioStep &step = scenario_.steps[nextStep_++];
+            enqueue(step.message, start_ + chrono::milliseconds(step.atMs));
+        }
+
+        const Clock::time_point endAt = start_ + chrono::milliseconds(scenario_.endMs);
+        if (!finishedCalled_ && finished_ && !scenario_.steps.empty() && now >= endAt && idle()) {
+            finishedCalled_ = true;
+            void (*finished)() = finished_;
+            lock.unlock();
+            finished();
+            lock.lock();
+            continue;
+        }
+
+        // Every initiator whose frame is ready and whose signal free time has
+        // passed starts at once. The lowest header wins arbitration.
+        int winner = -1;
+        int contenders = 0;
+        Clock::time_point wakeAt = Clock::time_point::max();
+        for (int initiator = 0; initiator < 16; initiator++) {
+            if (queues_[initiator].empty()) {
+                continue;
+            }
+            int freeBits = initiator == lastInitiator_ ? CEC_SIGNAL_FREE_BITS : CEC_SIGNAL_FREE_NEW_INITIATOR_BITS;
+            Clock::time_point startAt = max(queues_[initiator].front().readyAt, busFreeAt_ + chrono::microseconds(freeBits * CEC_BIT_PERIOD_US));
+            if (startAt > now) {
+                wakeAt = min(wakeAt, startAt);
+                continue;
+            }
+            contenders++;
+            const CECMessage &candidate = queues_[initiator].front().message;
+            if (winner < 0 || (candidate.initiator << 4 | candidate.follower) < (winner << 4 | queues_[winner].front().message.follower)) {
+                winner = initiator;
+            }
+        }
+
+        if (winner >= 0) {
+            arbitrationLosses_ += contenders - 1;
+            const CECMessage message = queues_[winner].front().message;
+            queues_[winner].pop_front();
+
+            const int frameUs = cecFrameTimeUs(message.length);
+            const Clock::time_point endOfFrame = now + chrono::microseconds(frameUs);
+            busFreeAt_ = endOfFrame;
+            onBus_ = true;
+            lock.unlock();
+            this_thread::sleep_until(endOfFrame);
+            lock.lock();
+
+            onBus_ = false;
+            lastInitiator_ = winner;
+            busyUs_[winner] += frameUs;
+            frames_++;
+            deliver(message, endOfFrame);
+            changed_.notify_all();
+            continue;
+        }
+
+        if (nextStep_ < scenario_.steps.size()) {
+            wakeAt = min(wakeAt, start_ + chrono::milliseconds(scenario_.steps[nextStep_].atMs));
+        } else if (!finishedCalled_ && finished_ && !scenario_.steps.empty()) {
+            wakeAt = min(wakeAt, max(endAt, now + chrono::milliseconds(1)));
+        }
+
+        if (wakeAt == Clock::time_point::max()) {
+            changed_.wait(lock);
+        } else {
+            changed_.wait_until(lock, wakeAt);
+        }
+    }
+}
+
+bool SimCECBackend::waitIdle(int timeoutMs) {
+    unique_lock<mutex> lock(mutex_);
+    return changed_.wait_for(lock, chrono::milliseconds(timeoutMs), [this]() {
+        return idle();
+    });
+}
+
+void SimCECBackend::logReport() {
+    lock_guard<mutex> lock(mutex_);
+
+    const int64_t elapsedUs = max<int64_t>(1, chrono::duration_cast<chrono::microseconds>(Clock::now() - start_).count());
+    int64_t totalBusyUs = 0;
+    for (int64_t busy : busyUs_) {
+        totalBusyUs += busy;
+    }
+
+    spdlog::info(
+        "CEC bus: {} frames, {} NACKed, {} lost arbitration, {:.1f}% occupied over {:.1f}s",
+        frames_,
+        nacks_,
+        arbitrationLosses_,
+        100.0 * totalBusyUs / elapsedUs,
+        elapsedUs / 1e6
+    );
+    for (int initiator = 0; initiator < 16; initiator++) {
+        if (busyUs_[initiator]) {
+            spdlog::info("  initiator {:X}: {}ms ({:.1f}%)", initiator, busyUs_[initiator] / 1000, 100.0 * busyUs_[initiator] / elapsedUs);
+        }
+    }
+    spdlog::info(
+        "CEC handler latency: {} answers, p50={}us p99={}us max={}us",
+        handlerLatency_.count(),
+        handlerLatency_.percentile(50),
+        handlerLatency_.percentile(99),
+        handlerLatency_.max()
+    );
+}
+
+uint64_t SimCECBackend::frames() {
+    lock_guard<mutex> lock(mutex_);
+    return frames_;
+}
+
+uint64_t SimCECBackend::nacks() {
+    lock_guard<mutex> lock(mutex_);
+    return nacks_;
+}
+
+uint64_t SimCECBackend::arbitrationLosses() {
+    lock_guard<mutex> lock(mutex_);
+    return arbitrationLosses_;
+}
+
+int64_t SimCECBackend::busyUs(int address) {
+    lock_guard<mutex> lock(mutex_);
+    return busyUs_[address & 0x0F];
+}
+
+int64_t SimCECBackend::elapsedUs() {
+    lock_guard<mutex> lock(mutex_);
+    return chrono::duration_cast<chrono::microseconds>(Clock::now() - start_).count();
+}
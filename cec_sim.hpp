@@ -0,0 +1,222 @@
+#ifndef CEC_SIM_H
+#define CEC_SIM_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cec.hpp"
+#include "histogram.hpp"
+
+/**
+ * A device on the simulated bus.
+ *
+ * Answers the Give* requests addressed to it on its own, after responseMs,
+ * and goes to standby on a Standby addressed to it or broadcast.
+ */
+struct VirtualCECDevice {
+    int address;
+    uint16_t physicalAddress;
+    uint32_t vendorId;
+    std::string osdName;
+    uint8_t powerStatus;
+    // Time the device takes to start an answer.
+    int responseMs;
+    // A request it answers with FeatureAbort, and one it ignores. 0 for none.
+    uint8_t aborts;
+    uint8_t ignores;
+};
+
+/**
+ * The theater this project runs in: a Roku at Playback 1 behind a NAD
+ * receiver at Audio System.
+ *
+ * @return  vector<VirtualCECDevice>
+ */
+std::vector<VirtualCECDevice> theaterCECDevices();
+
+/**
+ * A message a virtual device sends at a set time after the bus opens.
+ */
+struct CECScenarioStep {
+    int64_t atMs;
+    CECMessage message;
+};
+
+/**
+ * Scripted traffic, sorted by time.
+ */
+struct CECScenario {
+    std::vector<CECScenarioStep> steps;
+    // When the scenario is over, including time for the last answers.
+    int64_t endMs { 0 };
+};
+
+/**
+ * Read a scenario. One frame per line, bytes in hex as cec-client shows them:
+ *
+ *     # comment
+ *     2000 4F:82:11:00                    Roku is the active source at 2 s
+ *     3000 every 1000 until 9000 40:8F    Roku polls the TV's power status
+ *     end 12000                           Stop at 12 s
+ *
+ * cec-client traffic logs can be replayed as they are: lines like
+ * `TRAFFIC: [   3542]  >> 40:04` are sent at their time, relative to the
+ * first such line, and other cec-client log lines are ignored. Frames from
+ * the TV (initiator 0) are skipped, since the daemon plays the TV. Without an
+ * `end` line the scenario ends 2 s after the last frame.
+ *
+ * @param   istream      input     The scenario.
+ * @param   CECScenario  scenario  Receives the steps.
+ *
+ * @return  int                    0 on success, otherwise the number of the first bad line.
+ */
+int parseCECScenario(std::istream &input, CECScenario &scenario);
+
+/**
+ * A simulated CEC bus, with the daemon as one of its devices.
+ *
+ * One frame is on the bus at a time and holds it for its real duration,
+ * about 2.4 ms per bit. An initiator waits for the signal free time before
+ * its next frame: 5 bit periods after another initiator's frame, 7 after its
+ * own. When several initiators are waiting, the lowest header wins
+ * arbitration, as the dominant 0 bits would on a real bus. Directed frames
+ * are acknowledged only if a device sits at the follower's address.
+ * Broadcasts reach everyone and are always acknowledged.
+ *
+ * Like the kernel backend, events are delivered by service() when fd()
+ * polls readable. The bus runs on its own thread.
+ *
+ * Handler latency is the time from the end of a frame delivered to the
+ * daemon to its next reply to the initiator, or broadcast, within 1 s.
+ */
+class SimCECBackend : public CECBackend {
+public:
+    /**
+     * @param   vector<VirtualCECDevice>  devices   The other devices on the bus.
+     * @param   CECScenario               scenario  Traffic to play, timed from open().
+     */
+    SimCECBackend(std::vector<VirtualCECDevice> devices, CECScenario scenario = {});
+
+    ~SimCECBackend();
+
+    const char *name() const override {
+        return "sim";
+    }
+
+    bool open(int address, uint32_t vendorId, const char *osdName, CECEventHandler handler, void *context) override;
+    void close() override;
+    int transmit(int follower, const uint8_t *payload, size_t length, bool isReply) override;
+
+    int fd() const override {
+        return fd_;
+    }
+
+    void service() override;
+
+    /**
+     * Queue a frame from a virtual device, as if it had sent it now.
+     *
+     * @param   CECMessage  message  The frame. Its initiator is the sender.
+     */
+    void inject(const CECMessage &message);
+
+    /**
+     * Call a function once the scenario has ended. Runs on the bus thread.
+     *
+     * @param   void (*)()  finished  The function.
+     */
+    void onScenarioFinished(void (*finished)());
+
+    /**
+     * Wait until the scenario has been played and every queued frame sent.
+     *
+     * @param   int  timeoutMs  Upper bound on the wait.
+     *
+     * @return  bool            false on timeout.
+     */
+    bool waitIdle(int timeoutMs);
+
+    /**
+     * Log frame counts, bus occupancy per initiator and handler latency.
+     */
+    void logReport();
+
+    uint64_t frames();
+    uint64_t nacks();
+    uint64_t arbitrationLosses();
+
+    /**
+     * Time the bus carried frames from one initiator, in microseconds.
+     *
+     * @param   int  address  Logical address of the initiator.
+     *
+     * @return  int64_t
+     */
+    int64_t busyUs(int address);
+
+    /**
+     * Time since open(), in microseconds.
+     *
+     * @return  int64_t
+     */
+    int64_t elapsedUs();
+
+    const LatencyHistogram &handlerLatency() const {
+        return handlerLatency_;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Frame {
+        CECMessage message;
+        Clock::time_point readyAt;
+    };
+
+    void run();
+    void enqueue(const CECMessage &message, Clock::time_point readyAt);
+    void deliver(const CECMessage &message, Clock::time_point at);
+    void react(VirtualCECDevice &device, const CECMessage &message, Clock::time_point at);
+    void queueEvent(CECEventKind kind, bool acknowledged, const CECMessage &message);
+    bool idle() const;
+
+    std::vector<VirtualCECDevice> devices_;
+    // Index into devices_ by logical address, or -1.
+    int deviceAt_[16];
+    const CECScenario scenario_;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::thread bus_;
+    bool running_ { false };
+    std::deque<Frame> queues_[16];
+    size_t nextStep_ { 0 };
+    Clock::time_point start_;
+    Clock::time_point busFreeAt_;
+    // Whether a frame is being sent, and so out of its queue.
+    bool onBus_ { false };
+    int lastInitiator_ { -1 };
+    void (*finished_)() { nullptr };
+    bool finishedCalled_ { false };
+
+    int fd_ { -1 };
+    int address_ { CEC_ADDRESS_TV };
+    CECEventHandler handler_ { nullptr };
+    void *context_ { nullptr };
+    std::deque<CECEvent> events_;
+
+    uint64_t frames_ { 0 };
+    uint64_t nacks_ { 0 };
+    uint64_t arbitrationLosses_ { 0 };
+    int64_t busyUs_[16] {};
+    // Frames delivered to the daemon that it has not answered yet.
+    std::deque<std::pair<int, Clock::time_point>> awaiting_;
+    LatencyHistogram handlerLatency_;
+};
+
+#endif
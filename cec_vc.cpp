@@ -0,0 +1,164 @@
+#include <bcm_host.h>
+#include <string.h>
+#include "spdlog/spdlog.h"
+#include "cec.hpp"
+#include "flight_recorder.hpp"
+
+/**
+ * CEC through the Broadcom VideoCore firmware (vc_cec and VCHI).
+ *
+ * The firmware delivers notifications on its own callback thread, so fd()
+ * stays -1 and events go straight to the handler from that thread.
+ */
+class VcCECBackend : public CECBackend {
+public:
+    const char *name() const override {
+        return "vc";
+    }
+
+    bool open(int address, uint32_t vendorId, const char *osdName, CECEventHandler handler, void *context) override;
+    void close() override;
+    int transmit(int follower, const uint8_t *payload, size_t length, bool isReply) override;
+
+    /**
+     * Callback function for host side notification.
+     * This is the SAME as the callback function type defined in vc_cec.h
+     * Host applications register a single callback for all CEC related notifications.
+     * See vc_cec.h for meanings of all parameters
+     *
+     * This runs on the VCHI callback thread, so it only translates the
+     * notification and hands it on. It never logs, allocates or blocks.
+     *
+     * @param callback_data is the backend, as passed to <DFN>vc_cec_register_callback</DFN>
+     *
+     * @param reason bits 15-0 is VC_CEC_NOTIFY_T in vc_cec.h;
+     *               bits 23-16 is the valid length of message in param1 to param4 (LSB of param1 is the byte0, MSB of param4 is byte15), little endian
+     *               bits 31-24 is the return code (if any)
+     *
+     * @param param1 is the first parameter
+     *
+     * @param param2 is the second parameter
+     *
+     * @param param3 is the third parameter
+     *
+     * @param param4 is the fourth parameter
+     *
+     * @return void
+     */
+    static void handleCECCallback(void *callback_data, uint32_t reason, uint32_t param1, uint32_t param2, uint32_t param3, uint32_t param4);
+
+    /**
+     * Callback function for host side notification.
+     * Host applications register a single callback for all TV related notifications.
+     * See <DFN>VC_HDMI_NOTIFY_T</DFN> and <DFN>VC_SDTV_NOTIFY_T</DFN> in vc_hdmi.h and vc_sdtv.h
+     * respectively for list of reasons and respective param1 and param2
+     *
+     * @param callback_data is the context passed in during the call to vc_tv_register_callback
+     *
+     * @param reason is the notification reason
+     *
+     * @param param1 is the first optional parameter
+     *
+     * @param param2 is the second optional parameter
+     *
+     * @return void
+     */
+    static void handleTVCallback(void *callback_data, uint32_t reason, uint32_t p0, uint32_t p1);
+
+private:
+    CECEventHandler handler_ { nullptr };
+    void *context_ { nullptr };
+};
+
+void VcCECBackend::handleCECCallback(void *callback_data, uint32_t reason, uint32_t param1, uint32_t param2, uint32_t param3, uint32_t param4) {
+    VcCECBackend *backend = (VcCECBackend *)callback_data;
+    flightRecorder.recordCECNotification(reason, param1, param2, param3, param4);
+
+    VC_CEC_MESSAGE_T message;
+    if (vc_cec_param2message(reason, param1, param2, param3, param4, &message) != 0) {
+        // Not a message, e.g. a logical address or topology notification.
+        return;
+    }
+
+    CECEvent event;
+    event.kind = CEC_CB_REASON(reason) == VC_CEC_TX ? CEC_EVENT_TRANSMITTED : CEC_EVENT_RECEIVED;
+    event.acknowledged = CEC_CB_RC(reason) == VC_CEC_SUCCESS;
+    event.message.length = message.length;
+    event.message.initiator = message.initiator;
+    event.message.follower = message.follower;
+    memcpy(event.message.payload, message.payload, sizeof(event.message.payload));
+    backend->handler_(backend->context_, event);
+}
+
+void VcCECBackend::handleTVCallback(void *callback_data, uint32_t reason, uint32_t p0, uint32_t p1) {
+    spdlog::debug(
+        "Got a TV callback: reason={reason:X} param0={p0:X} param1={p1:X}",
+        fmt::arg("reason", reason),
+        fmt::arg("p0", p0),
+        fmt::arg("p1", p1)
+    );
+}
+
+bool VcCECBackend::open(int address, uint32_t vendorId, const char *osdName, CECEventHandler handler, void *context) {
+    handler_ = handler;
+    context_ = context;
+
+    bcm_host_init();
+    vcos_init();
+
+    VCHI_INSTANCE_T vchi_instance;
+    if (vchi_initialise(&vchi_instance) != 0) {
+        spdlog::critical("Could not initialize VHCI");
+        return false;
+    }
+
+    if (vchi_connect(nullptr, 0, vchi_instance) != 0) {
+        spdlog::critical("Failed to connect to VHCI");
+        return false;
+    }
+
+    vc_vchi_cec_init(vchi_instance, nullptr, 0);
+
+    if (vc_cec_set_passive(VC_TRUE) != 0) {
+        spdlog::critical("Failed to enter passive mode");
+        return false;
+    }
+
+    vc_cec_register_callback(handleCECCallback, this);
+    vc_tv_register_callback(handleTVCallback, nullptr);
+
+    if (vc_cec_register_all() != 0) {
+        spdlog::critical("Failed to register all opcodes");
+        return false;
+    }
+
+    // TODO: these probably aren't needed.
+    // vc_cec_register_command(CEC_Opcode_GivePhysicalAddress);
+    // vc_cec_register_command(CEC_Opcode_MenuRequest);
+    // vc_cec_register_command(CEC_Opcode_GetMenuLanguage);
+    // vc_cec_register_command(CEC_Opcode_GetCECVersion);
+    vc_cec_register_command(CEC_Opcode_GiveDeviceVendorID);
+    vc_cec_register_command(CEC_Opcode_GiveOSDName);
+    vc_cec_register_command(CEC_Opcode_GiveDevicePowerStatus);
+
+    if (vc_cec_set_logical_address((CEC_AllDevices_T)address, CEC_DeviceType_TV, vendorId) != 0) {
+        spdlog::critical("Failed to set logical address");
+        return false;
+    }
+
+    vc_cec_set_osd_name(osdName);
+    return true;
+}
+
+void VcCECBackend::close() {
+    // Notifications may still be in flight on the callback thread. The
+    // firmware drops the registration when the process exits.
+}
+
+int VcCECBackend::transmit(int follower, const uint8_t *payload, size_t length, bool isReply) {
+    return vc_cec_send_message(follower, payload, length, isReply ? VC_TRUE : VC_FALSE);
+}
+
+CECBackend *createVcCECBackend() {
+    return new VcCECBackend();
+}
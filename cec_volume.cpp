@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <string.h>
+#include "spdlog/spdlog.h"
+#include "cec_volume.hpp"
+
+using namespace std;
+
+/**
+ * Whether a UI command is one the audio system handles.
+ */
+bool isVolumeKey(uint8_t key) {
+    return key == CEC_USER_CONTROL_VOLUME_UP || key == CEC_USER_CONTROL_VOLUME_DOWN || key == CEC_USER_CONTROL_MUTE;
+}
+
+CECVolumeForwarder::CECVolumeForwarder(int target, CECTransmitFunction transmit, void *context)
+    : target_(target), transmit_(transmit), context_(context) {}
+
+bool CECVolumeForwarder::onPressed(int initiator, uint8_t key) {
+    if (!isVolumeKey(key)) {
+        return false;
+    }
+    if (initiator == target_) {
+        // The audio system's own remote.
+        return true;
+    }
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        Clock::time_point now = Clock::now();
+        releaseDeadline_ = now + chrono::milliseconds(CEC_KEY_RELEASE_MS);
+        if (key == heldKey_ && initiator == holder_) {
+            stats_.coalesced++;
+            return true;
+        }
+        stats_.presses++;
+        heldKey_ = key;
+        holder_ = initiator;
+        keyTime_ = now;
+        keyPending_ = true;
+    }
+    pump();
+    return true;
+}
+
+void CECVolumeForwarder::onReleased(int initiator) {
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (heldKey_ < 0 || initiator != holder_) {
+            return;
+        }
+        stats_.releases++;
+        heldKey_ = -1;
+        holder_ = -1;
+        keyTime_ = Clock::now();
+        keyPending_ = true;
+    }
+    pump();
+}
+
+/**
+ * Choose the frame that brings the audio system up to date with the remote.
+ * Called with mutex_ held.
+ *
+ * @return  bool    false if there is nothing to send yet.
+ */
+bool CECVolumeForwarder::nextFrame(Clock::time_point now, uint8_t *payload, size_t &length) {
+    if (outstanding_) {
+        return false;
+    }
+
+    if (heldKey_ >= 0 && now >= releaseDeadline_) {
+        // The remote's release was lost, or its repeats stopped.
+        stats_.timedOut++;
+        heldKey_ = -1;
+        holder_ = -1;
+    }
+
+    if (heldKey_ < 0) {
+        if (sentKey_ < 0) {
+            keyPending_ = false;
+            return false;
+        }
+        if (now < releaseRetryAt_) {
+            return false;
+        }
+        // sentKey_ is cleared once the release is acknowledged.
+        payload[0] = CEC_OPCODE_USER_CONTROL_RELEASED;
+        length = 1;
+    } else if (heldKey_ != sentKey_) {
+        payload[0] = CEC_OPCODE_USER_CONTROL_PRESSED;
+        payload[1] = heldKey_;
+        length = 2;
+        sentKey_ = heldKey_;
+        nextRepeat_ = now + chrono::milliseconds(CEC_VOLUME_REPEAT_MS);
+    } else if (heldKey_ != CEC_USER_CONTROL_MUTE && now >= nextRepeat_) {
+        payload[0] = CEC_OPCODE_USER_CONTROL_PRESSED;
+        payload[1] = heldKey_;
+        length = 2;
+        nextRepeat_ = now + chrono::milliseconds(CEC_VOLUME_REPEAT_MS);
+        stats_.repeats++;
+    } else {
+        // The key went down and up again before the release went out.
+        keyPending_ = false;
+        return false;
+    }
+
+    outstanding_ = true;
+    memcpy(outstandingPayload_, payload, length);
+    outstandingLength_ = length;
+    outstandingMeasured_ = keyPending_;
+    measuredSince_ = keyTime_;
+    keyPending_ = false;
+    return true;
+}
+
+/**
+ * Send the next frame if nothing is outstanding. Called without mutex_ held,
+ * as the transmit function may report its result straight away.
+ */
+void CECVolumeForwarder::pump() {
+    uint8_t payload[2];
+    size_t length;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (!nextFrame(Clock::now(), payload, length)) {
+            return;
+        }
+    }
+
+    if (transmit_(context_, target_, payload, length) != 0) {
+        lock_guard<mutex> lock(mutex_);
+        finishFrame(Clock::now(), false);
+    }
+}
+
+/**
+ * Settle the outstanding frame. Called with mutex_ held.
+ *
+ * A failed press or repeat is made up for by the next repeat. A failed
+ * release is sent again after CEC_VOLUME_RETRY_MS, until the audio system
+ * would have timed the key out by itself.
+ *
+ * @param   bool  acknowledged  Whether the audio system acknowledged it.
+ */
+void CECVolumeForwarder::finishFrame(Clock::time_point now, bool acknowledged) {
+    outstanding_ = false;
+    if (acknowledged && outstandingMeasured_) {
+        latency_.record(chrono::duration_cast<chrono::microseconds>(now - measuredSince_).count());
+    }
+    if (!acknowledged) {
+        stats_.failed++;
+    }
+    if (outstandingPayload_[0] != CEC_OPCODE_USER_CONTROL_RELEASED) {
+        return;
+    }
+
+    if (!acknowledged && heldKey_ < 0) {
+        if (releaseFailedAt_ == Clock::time_point()) {
+            releaseFailedAt_ = now;
+        }
+        if (now - releaseFailedAt_ < chrono::milliseconds(CEC_KEY_RELEASE_MS)) {
+            spdlog::debug("Volume key release failed. Sending it again.");
+            releaseRetryAt_ = now + chrono::milliseconds(CEC_VOLUME_RETRY_MS);
+            return;
+        }
+    }
+    // Released, given up on, or the key is down again and the audio system
+    // never heard it go up.
+    if (acknowledged || heldKey_ < 0) {
+        sentKey_ = -1;
+    }
+    releaseFailedAt_ = Clock::time_point();
+    releaseRetryAt_ = Clock::time_point();
+}
+
+bool CECVolumeForwarder::onTransmitResult(int follower, const uint8_t *payload, size_t length, bool acknowledged) {
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (!outstanding_ || follower != target_ || length != outstandingLength_ || memcmp(payload, outstandingPayload_, length) != 0) {
+            return false;
+        }
+        finishFrame(Clock::now(), acknowledged);
+    }
+    pump();
+    return true;
+}
+
+int CECVolumeForwarder::timeoutMs() {
+    lock_guard<mutex> lock(mutex_);
+    if (heldKey_ < 0) {
+        if (outstanding_ || sentKey_ < 0) {
+            return -1;
+        }
+        // A failed release waits to be sent again.
+        auto left = chrono::duration_cast<chrono::milliseconds>(releaseRetryAt_ - Clock::now()).count();
+        return max<int64_t>(0, left + 1);
+    }
+
+    Clock::time_point deadline = releaseDeadline_;
+    if (!outstanding_ && heldKey_ == sentKey_ && heldKey_ != CEC_USER_CONTROL_MUTE) {
+        deadline = min(deadline, nextRepeat_);
+    }
+    auto left = chrono::duration_cast<chrono::milliseconds>(deadline - Clock::now()).count();
+    return max<int64_t>(0, left + 1);
+}
+
+void CECVolumeForwarder::expire() {
+    pump();
+}
+
+CECVolumeStats CECVolumeForwarder::stats() {
+    lock_guard<mutex> lock(mutex_);
+    return stats_;
+}
+
+void CECVolumeForwarder::logStats() {
+    CECVolumeStats stats = this->stats();
+    spdlog::info(
+        "Volume keys: presses={} releases={} coalesced={} repeats={} timed_out={} failed={} latency p50={}us p99={}us max={}us",
+        stats.presses,
+        stats.releases,
+        stats.coalesced,
+        stats.repeats,
+        stats.timedOut,
+        stats.failed,
+        latency_.percentile(50),
+        latency_.percentile(99),
+        latency_.max()
+    );
+}
@@ -0,0 +1,150 @@
+#ifndef CEC_VOLUME_H
+#define CEC_VOLUME_H
+
+#include <chrono>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include "cec.hpp"
+#include "histogram.hpp"
+
+// Interval of the UserControlPressed repeats sent while a volume key is held.
+const int CEC_VOLUME_REPEAT_MS { 250 };
+// Wait before sending a failed UserControlReleased again. Retries stop once
+// the audio system would have released the key by itself (CEC_KEY_RELEASE_MS).
+const int CEC_VOLUME_RETRY_MS { 50 };
+
+struct CECVolumeStats {
+    // Volume keys pressed, and released, on the remote.
+    uint64_t presses;
+    uint64_t releases;
+    // Repeats from the remote folded into the key already held.
+    uint64_t coalesced;
+    // UserControlPressed repeats sent while a key was held.
+    uint64_t repeats;
+    // Keys released because the remote stopped repeating without a release.
+    uint64_t timedOut;
+    // Frames the audio system did not acknowledge, or that could not be queued.
+    uint64_t failed;
+};
+
+/**
+ * Forwards volume up, volume down and mute from the remote's source to the
+ * audio system.
+ *
+ * At most one forwarded frame is queued or on the bus at a time, and the
+ * next one is chosen when it completes: a burst of repeats from the remote
+ * collapses into the key being held, repeats to the audio system follow
+ * their own schedule (CEC_VOLUME_REPEAT_MS), and a release goes out as soon
+ * as the frame in flight completes, never behind a backlog of presses.
+ *
+ * Key-to-frame latency is measured from the key's arrival to the
+ * acknowledgement of the frame that forwards it.
+ *
+ * Keys and transmit results may be fed in from different threads. The
+ * owner calls expire() when timeoutMs() passes.
+ */
+class CECVolumeForwarder {
+public:
+    /**
+     * @param   int                  target    Logical address of the audio system.
+     * @param   CECTransmitFunction  transmit  Sends a frame.
+     * @param   void *               context   Passed to `transmit`.
+     */
+    CECVolumeForwarder(int target, CECTransmitFunction transmit, void *context);
+
+    /**
+     * Handle UserControlPressed.
+     *
+     * @param   int      initiator  Logical address of the device whose remote it is.
+     * @param   uint8_t  key        The UI command.
+     *
+     * @return  bool                false if it is not a volume key.
+     */
+    bool onPressed(int initiator, uint8_t key);
+
+    /**
+     * Handle UserControlReleased.
+     *
+     * @param   int  initiator  Logical address of the device whose remote it is.
+     */
+    void onReleased(int initiator);
+
+    /**
+     * Report the outcome of a transmitted frame.
+     *
+     * @param   int        follower      Logical address of the destination.
+     * @param   uint8_t *  payload       Opcode and operands.
+     * @param   size_t     length        Length of the payload.
+     * @param   bool       acknowledged  Whether the follower acknowledged it.
+     *
+     * @return  bool                     false if it was not a forwarded frame.
+     */
+    bool onTransmitResult(int follower, const uint8_t *payload, size_t length, bool acknowledged);
+
+    /**
+     * Time until the next repeat or release is due, or a failed release is
+     * sent again.
+     *
+     * @return  int     Milliseconds, or -1 if there is nothing to send.
+     */
+    int timeoutMs();
+
+    /**
+     * Send the repeat or release that is due, if any.
+     */
+    void expire();
+
+    CECVolumeStats stats();
+
+    /**
+     * Key-to-frame latency, in microseconds.
+     */
+    const LatencyHistogram &latency() const {
+        return latency_;
+    }
+
+    /**
+     * Log the counters and latency.
+     */
+    void logStats();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    void pump();
+    bool nextFrame(Clock::time_point now, uint8_t *payload, size_t &length);
+    void finishFrame(Clock::time_point now, bool acknowledged);
+
+    const int target_;
+    const CECTransmitFunction transmit_;
+    void *const context_;
+
+    std::mutex mutex_;
+    // The key held on the remote and whose remote it is, or -1.
+    int heldKey_ { -1 };
+    int holder_ { -1 };
+    // The key the audio system was last told is pressed, or -1. Kept until
+    // a release is acknowledged.
+    int sentKey_ { -1 };
+    // When the release that keeps failing first failed, and when to send it
+    // again. Default while no release has failed.
+    Clock::time_point releaseFailedAt_;
+    Clock::time_point releaseRetryAt_;
+    // Whether a forwarded frame is queued or on the bus.
+    bool outstanding_ { false };
+    uint8_t outstandingPayload_[2] {};
+    size_t outstandingLength_ { 0 };
+    // Whether the outstanding frame carries a key change whose latency is measured.
+    bool outstandingMeasured_ { false };
+    // Arrival of the latest key change not yet on the bus.
+    Clock::time_point keyTime_;
+    bool keyPending_ { false };
+    Clock::time_point releaseDeadline_;
+    Clock::time_point nextRepeat_;
+    Clock::time_point measuredSince_;
+    CECVolumeStats stats_ {};
+    LatencyHistogram latency_;
+};
+
+#endif
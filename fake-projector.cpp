@@ -0,0 +1,399 @@
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+#include "spdlog/spdlog.h"
+#include "jvc.hpp"
+
+using namespace std;
+
+#define PORT 20554
+#define OPEN "PJ_OK"
+#define REQUEST "PJREQ"
+#define ACK "PJACK"
+
+/**
+ * Behavior of the fake projector, set from the command line.
+ */
+struct Options {
+    int port { PORT };
+    // Delay between receiving a command and replying to it. Commands that
+    // arrive together are answered together, like over a slow network.
+    int latencyMs { 0 };
+    // Connections beyond this many are closed right after accept. 0: no limit.
+    int maxConnections { 0 };
+    // Chance that a command gets the connection closed instead of a reply.
+    double dropRate { 0 };
+    // Chance that a reply has a byte flipped.
+    double garbleRate { 0 };
+    // Time spent in WARMING and COOLING.
+    int warmupMs { 3000 };
+    int cooldownMs { 3000 };
+    // Close sessions that stay idle this long. 0: never.
+    int idleCloseMs { 0 };
+};
+
+Options options;
+atomic<int> activeConnections { 0 };
+atomic<bool> want_run { true };
+
+// Power state machine. Guarded by stateMutex.
+mutex stateMutex;
+JvcPower power { JVC_POWER_STANDBY };
+chrono::steady_clock::time_point transitionEnd;
+JvcInput input { JVC_INPUT_HDMI1 };
+
+mutex rngMutex;
+mt19937 rng { random_device{}() };
+
+/**
+ * Whether something with the given probability happens this time.
+ *
+ * @return  bool
+ */
+bool chance(double probability) {
+    if (probability <= 0) {
+        return false;
+    }
+    lock_guard<mutex> lock(rngMutex);
+    return uniform_real_distribution<double>(0, 1)(rng) < probability;
+}
+
+/**
+ * Current power state, completing WARMING or COOLING once it has lasted long enough.
+ *
+ * @return  JvcPower
+ */
+JvcPower currentPower() {
+    lock_guard<mutex> lock(stateMutex);
+    if ((power == JVC_POWER_WARMING || power == JVC_POWER_COOLING) && chrono::steady_clock::now() >= transitionEnd) {
+        power = power == JVC_POWER_WARMING ? JVC_POWER_ON : JVC_POWER_STANDBY;
+        spdlog::info("Power state is now {}", power == JVC_POWER_ON ? "POWER_ON" : "STANDBY");
+    }
+    return power;
+}
+
+/**
+ * Apply a power operation the way the projector does: ON only from STANDBY,
+ * OFF only from POWER_ON. Anything else is acknowledged and ignored.
+ *
+ * @return  void
+ */
+void setPower(bool on) {
+    JvcPower now = currentPower();
+    lock_guard<mutex> lock(stateMutex);
+    if (on && now == JVC_POWER_STANDBY) {
+        power = JVC_POWER_WARMING;
+        transitionEnd = chrono::steady_clock::now() + chrono::milliseconds(options.warmupMs);
+        spdlog::info("Power ON: WARMING for {}ms", options.warmupMs);
+    } else if (!on && now == JVC_POWER_ON) {
+        power = JVC_POWER_COOLING;
+        transitionEnd = chrono::steady_clock::now() + chrono::milliseconds(options.cooldownMs);
+        spdlog::info("Power OFF: COOLING for {}ms", options.cooldownMs);
+    } else {
+        spdlog::debug("Power {} ignored in state {}", on ? "ON" : "OFF", (int)now);
+    }
+}
+
+/**
+ * Apply an input operation the way the projector does: only while POWER_ON.
+ *
+ * @return  void
+ */
+void setInput(char code) {
+    JvcPower now = currentPower();
+    lock_guard<mutex> lock(stateMutex);
+    if (now == JVC_POWER_ON && (code == '0' + JVC_INPUT_HDMI1 || code == '0' + JVC_INPUT_HDMI2)) {
+        input = (JvcInput)(code - '0');
+        spdlog::info("Input is now {}", (int)input);
+    } else {
+        spdlog::debug("Input {} ignored in state {}", code, (int)now);
+    }
+}
+
+/**
+ * The data of a reference command response, as sent by the projector.
+ *
+ * @param   unsigned char  command  The command bytes after the unit ID.
+ * @param   size_t         length   Number of command bytes.
+ *
+ * @return  string                  Empty if the command is unknown.
+ */
+string referenceData(const unsigned char* command, size_t length) {
+    string cmd(reinterpret_cast<const char*>(command), length);
+    if (cmd == "PW") {
+        return string(1, '0' + currentPower());
+    }
+    if (cmd == "IP") {
+        lock_guard<mutex> lock(stateMutex);
+        return string(1, '0' + input);
+    }
+    if (cmd == "PMPM") {
+        return "0C";
+    }
+    if (cmd == "IFLT") {
+        return "04B0";
+    }
+    if (cmd == "IFSV") {
+        return "0320";
+    }
+    if (cmd == "MD") {
+        return "ILAFPJ -- B5B1";
+    }
+    if (cmd == "SC") {
+        return currentPower() == JVC_POWER_ON ? "1" : "0";
+    }
+    return "";
+}
+
+/**
+ * Send a reply, applying the configured latency and garbling.
+ *
+ * @param   int         sock        The connection.
+ * @param   string      bytes       The reply.
+ * @param   time_point  receivedAt  When the command arrived.
+ *
+ * @return  bool    false if the connection failed.
+ */
+bool reply(int sock, string bytes, chrono::steady_clock::time_point receivedAt) {
+    this_thread::sleep_until(receivedAt + chrono::milliseconds(options.latencyMs));
+    if (chance(options.garbleRate)) {
+        size_t index;
+        {
+            lock_guard<mutex> lock(rngMutex);
+            index = rng() % bytes.size();
+        }
+        bytes[index] ^= 0x5A;
+        spdlog::debug("Garbled reply byte {}", index);
+    }
+    return send(sock, bytes.data(), bytes.size(), MSG_NOSIGNAL) == (ssize_t)bytes.size();
+}
+
+/**
+ * Handle one command frame.
+ *
+ * @return  bool    false if the connection should be closed.
+ */
+bool handleCommand(int sock, const JvcFrame &frame, chrono::steady_clock::time_point receivedAt) {
+    if (chance(options.dropRate)) {
+        spdlog::debug("Dropping connection");
+        return false;
+    }
+
+    if (frame.length < 5 || frame.data[1] != 0x89 || frame.data[2] != 0x01) {
+        spdlog::warn("Ignoring malformed command");
+        return true;
+    }
+
+    const string header(reinterpret_cast<const char*>(frame.data + 1), 4);
+    const string ack = string(1, 0x06) + header + string(1, JVC_TERMINATOR);
+
+    if (frame.data[0] == 0x21) {
+        if (frame.length == 6 && frame.data[3] == 'P' && frame.data[4] == 'W') {
+            setPower(frame.data[5] == '1');
+        } else if (frame.length == 6 && frame.data[3] == 'I' && frame.data[4] == 'P') {
+            setInput(frame.data[5]);
+        }
+        return reply(sock, ack, receivedAt);
+    }
+
+    if (frame.data[0] == 0x3F) {
+        string data = referenceData(frame.data + 3, frame.length - 3);
+        if (data.empty()) {
+            spdlog::warn("Unknown reference command");
+            return true;
+        }
+        return reply(sock, ack + string(1, 0x40) + header + data + string(1, JVC_TERMINATOR), receivedAt);
+    }
+
+    spdlog::warn("Ignoring command with header {:X}", frame.data[0]);
+    return true;
+}
+
+/**
+ * Read exactly `length` bytes from a socket.
+ *
+ * @return  bool    false if the socket failed or closed first.
+ */
+bool readExactly(int sock, char* buffer, size_t length) {
+    size_t total { 0 };
+    while (total < length) {
+        ssize_t readLen = read(sock, buffer + total, length - total);
+        if (readLen <= 0) {
+            return false;
+        }
+        total += readLen;
+    }
+    return true;
+}
+
+/**
+ * Serve one connection until the client closes it.
+ *
+ * @return  void
+ */
+void serve(int sock) {
+    int flag { 1 };
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    if (options.idleCloseMs > 0) {
+        struct timeval timeout = { .tv_sec = options.idleCloseMs / 1000, .tv_usec = (options.idleCloseMs % 1000) * 1000 };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    char handshake[8] { 0 };
+    JvcFramer framer;
+    JvcFrame frame;
+
+    do {
+        if (send(sock, OPEN, strlen(OPEN), MSG_NOSIGNAL) < 0) {
+            break;
+        }
+        if (!readExactly(sock, handshake, strlen(REQUEST)) || strcmp(handshake, REQUEST) != 0) {
+            spdlog::warn("Bad handshake: {}", handshake);
+            break;
+        }
+        if (send(sock, ACK, strlen(ACK), MSG_NOSIGNAL) < 0) {
+            break;
+        }
+
+        bool open { true };
+        while (open) {
+            ssize_t readLen = read(sock, framer.writePtr(), framer.writeSpace());
+            if (readLen <= 0) {
+                break;
+            }
+            framer.commit(readLen);
+            auto receivedAt = chrono::steady_clock::now();
+            while (open && framer.next(frame)) {
+                open = handleCommand(sock, frame, receivedAt);
+            }
+        }
+    } while (0);
+
+    // Free the slot first: once the client sees the close, it may reconnect.
+    int active = --activeConnections;
+    close(sock);
+    spdlog::debug("Connection closed ({} active)", active);
+}
+
+/**
+ * Catch SIGINT and stop accepting connections.
+ *
+ * @param   int   s  Not used
+ *
+ * @return  void
+ */
+void handleSIGINT(int s) {
+    want_run = false;
+}
+
+/**
+ * Print usage.
+ *
+ * @return  void
+ */
+void usage(const char* name) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --port N              Port to listen on (default %d)\n"
+        "  --latency MS          Delay between a command and its reply (default 0)\n"
+        "  --max-connections N   Close connections beyond N at once (default: no limit)\n"
+        "  --drop-rate P         Chance [0-1] to drop the connection on a command\n"
+        "  --garble-rate P       Chance [0-1] to corrupt a reply\n"
+        "  --warmup MS           Time spent WARMING (default 3000)\n"
+        "  --cooldown MS         Time spent COOLING (default 3000)\n"
+        "  --idle-close MS       Close idle sessions after MS (default: never)\n"
+        "  --verbose             Log every connection\n",
+        name, PORT);
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[FAKE] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::info);
+
+    const struct option longOptions[] {
+        { "port", required_argument, nullptr, 'p' },
+        { "latency", required_argument, nullptr, 'l' },
+        { "max-connections", required_argument, nullptr, 'm' },
+        { "drop-rate", required_argument, nullptr, 'd' },
+        { "garble-rate", required_argument, nullptr, 'g' },
+        { "warmup", required_argument, nullptr, 'w' },
+        { "cooldown", required_argument, nullptr, 'c' },
+        { "idle-close", required_argument, nullptr, 'i' },
+        { "verbose", no_argument, nullptr, 'v' },
+        { nullptr, 0, nullptr, 0 },
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case 'p': options.port = atoi(optarg); break;
+            case 'l': options.latencyMs = atoi(optarg); break;
+            case 'm': options.maxConnections = atoi(optarg); break;
+            case 'd': options.dropRate = atof(optarg); break;
+            case 'g': options.garbleRate = atof(optarg); break;
+            case 'w': options.warmupMs = atoi(optarg); break;
+            case 'c': options.cooldownMs = atoi(optarg); break;
+            case 'i': options.idleCloseMs = atoi(optarg); break;
+            case 'v': spdlog::set_level(spdlog::level::debug); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse { 1 };
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(server, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(server, 8) != 0) {
+        spdlog::critical("Could not listen on port {}: {}", options.port, strerror(errno));
+        return 1;
+    }
+
+    // No SA_RESTART, so accept() returns on SIGINT.
+    struct sigaction sigIntHandler;
+    sigIntHandler.sa_handler = handleSIGINT;
+    sigemptyset(&sigIntHandler.sa_mask);
+    sigIntHandler.sa_flags = 0;
+    sigaction(SIGINT, &sigIntHandler, NULL);
+    sigaction(SIGTERM, &sigIntHandler, NULL);
+
+    spdlog::info("Fake projector listening on 127.0.0.1:{}. Press CTRL-c to exit.", options.port);
+
+    while (want_run) {
+        int sock = accept(server, nullptr, nullptr);
+        if (sock < 0) {
+            continue;
+        }
+
+        if (options.maxConnections > 0 && activeConnections >= options.maxConnections) {
+            spdlog::warn("Refusing connection: {} already active", activeConnections.load());
+            close(sock);
+            continue;
+        }
+
+        const int active = ++activeConnections;
+        spdlog::debug("Connection accepted ({} active)", active);
+        thread(serve, sock).detach();
+    }
+
+    close(server);
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include "fifo.hpp"
+#include "spdlog/spdlog.h"
+#include <string.h>
+#include <string>
+
+using namespace std;
+
+/**
+ * Feed a string to the parser in one read, as the FIFO reader does.
+ *
+ * @return  void
+ */
+void feed(FifoCommandParser &parser, const string &bytes) {
+    parser.feed(bytes.data(), bytes.size());
+}
+
+/**
+ * Check that writes that arrive together are all seen, and that a command
+ * split across reads waits for its newline.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testFraming() {
+    FifoCommandParser parser;
+
+    // "1" then "0" before the reader woke up: the second one used to be lost.
+    feed(parser, "1\n0\n");
+    FifoIntent intent = parser.finish();
+    if (intent.commands != 2 || intent.power != 0) {
+        spdlog::error("Framing: {} commands, power {}", intent.commands, intent.power);
+        return 1;
+    }
+
+    feed(parser, "vol");
+    intent = parser.finish();
+    if (intent.commands != 0) {
+        spdlog::error("Framing: partial command applied");
+        return 1;
+    }
+    feed(parser, "ume up 3\r\n  ON \n\n");
+    intent = parser.finish();
+    if (intent.commands != 2 || intent.volumeSteps != 3 || intent.power != 1) {
+        spdlog::error("Framing: {} commands, {} steps, power {}", intent.commands, intent.volumeSteps, intent.power);
+        return 1;
+    }
+
+    spdlog::info("Framing: OK");
+    return 0;
+}
+
+/**
+ * Check that "0" and "1" written without a newline still work.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testLegacy() {
+    FifoCommandParser parser;
+
+    feed(parser, "1");
+    FifoIntent intent = parser.finish();
+    if (intent.commands != 1 || intent.power != 1) {
+        spdlog::error("Legacy: {} commands, power {}", intent.commands, intent.power);
+        return 1;
+    }
+
+    feed(parser, "1");
+    feed(parser, "0");
+    intent = parser.finish();
+    if (intent.commands != 2 || intent.power != 0) {
+        spdlog::error("Legacy: {} commands, power {}", intent.commands, intent.power);
+        return 1;
+    }
+
+    spdlog::info("Legacy: OK");
+    return 0;
+}
+
+/**
+ * Check that a batch comes down to its final intent, and that the commands
+ * folded into it are counted.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testReduction() {
+    FifoCommandParser parser;
+
+    feed(parser, "input hdmi2\nvolume up 3\nvolume -\nmute\nvolume mute\nquery\n?\n");
+    FifoIntent intent = parser.finish();
+    if (intent.commands != 7 || intent.power != 1 || intent.input != 2 || intent.volumeSteps != 2
+            || intent.mute || !intent.query) {
+        spdlog::error(
+            "Reduction: {} commands, power {}, input {}, {} steps, mute {}, query {}",
+            intent.commands,
+            intent.power,
+            intent.input,
+            intent.volumeSteps,
+            intent.mute,
+            intent.query
+        );
+        return 1;
+    }
+    // Input with its power on, the volume and the query are applied.
+    FifoStats stats = parser.stats();
+    if (stats.received != 7 || stats.coalesced != 4 || stats.rejected != 0) {
+        spdlog::error("Reduction: received={} coalesced={}", stats.received, stats.coalesced);
+        return 1;
+    }
+
+    // A standby drops the input asked for before it.
+    feed(parser, "input 1\nstandby\n");
+    intent = parser.finish();
+    if (intent.power != 0 || intent.input != 0) {
+        spdlog::error("Reduction: power {}, input {} after standby", intent.power, intent.input);
+        return 1;
+    }
+
+    // Steps add up to at most FIFO_MAX_VOLUME_STEPS.
+    for (int i = 0; i < 3; i++) {
+        feed(parser, "volume down 20\n");
+    }
+    intent = parser.finish();
+    if (intent.volumeSteps != -FIFO_MAX_VOLUME_STEPS) {
+        spdlog::error("Reduction: {} steps", intent.volumeSteps);
+        return 1;
+    }
+
+    spdlog::info("Reduction: OK");
+    return 0;
+}
+
+/**
+ * Check that unknown, malformed and overlong commands are counted and do
+ * not disturb the commands around them.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testRejected() {
+    FifoCommandParser parser;
+
+    feed(parser, "bogus\nvolume up 99\ninput hdmi3\n1 2\n");
+    feed(parser, string(FIFO_MAX_COMMAND_SIZE * 2, 'x'));
+    feed(parser, "\n1\n");
+    FifoIntent intent = parser.finish();
+    FifoStats stats = parser.stats();
+    if (intent.commands != 1 || intent.power != 1) {
+        spdlog::error("Rejected: {} commands, power {}", intent.commands, intent.power);
+        return 1;
+    }
+    if (stats.received != 6 || stats.rejected != 5 || stats.coalesced != 0) {
+        spdlog::error("Rejected: received={} rejected={}", stats.received, stats.rejected);
+        return 1;
+    }
+
+    spdlog::info("Rejected: OK");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[FIFO COMMAND] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    return testFraming() | testLegacy() | testReduction() | testRejected();
+}
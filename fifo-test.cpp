@@ -1,11 +1,13 @@
 #include "fifo.hpp"
+#include "reactor.hpp"
 #include "spdlog/spdlog.h"
 #include <iostream>
 #include <unistd.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <sys/epoll.h>
 
-bool want_run = true;
+Reactor reactor;
 
 
 int onCallback() {
@@ -19,14 +21,14 @@ int offCallback() {
 }
 
 /**
- * Catch SIGINT and set running state of program to false.
+ * Stop the event loop on SIGINT.
  *
  * @param   int   s  Not used
  *
  * @return  void
  */
 void handleSIGINT(int s) {
-    want_run = false;
+    reactor.stop();
 }
 
 int main(int argc, char *argv[]) {
@@ -44,17 +46,17 @@ int main(int argc, char *argv[]) {
         };
 
         // Handle SIGINT cleanly
-        struct sigaction sigIntHandler;
-        sigIntHandler.sa_handler = handleSIGINT;
-        sigemptyset(&sigIntHandler.sa_mask);
-        sigIntHandler.sa_flags = 0;
-        sigaction(SIGINT, &sigIntHandler, NULL);
+        if (!reactor.open()
+                || !reactor.watchSignals("signals", { SIGINT }, handleSIGINT)
+                || !reactor.watch("fifo", fifoFd(), EPOLLIN, [](uint32_t) { readFIFO(); })) {
+            ret = 1;
+            break;
+        }
 
         spdlog::info("Running! Press CTRL-c to exit.");
 
-        while (want_run) {
-            pause();
-        }
+        reactor.run();
+        reactor.logStats();
     } while (0);
 
     int cleanup_ret = cleanupFIFO();
@@ -3,71 +3,225 @@
 #include <stdlib.h>
 #include "spdlog/spdlog.h"
 #include <string.h>
-#include <signal.h>
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <sstream>
 #include "fifo.hpp"
 
 using namespace std;
 
 const char * PIPE_PATH { "/tmp/p-cec-fix" };
-int fifo_fd;
-const int FIFO_COMMAND_SIZE { 2 };
-
-const char OFF_COMMAND[] { "0" };
-const char ON_COMMAND[] { "1" };
+int fifo_fd { -1 };
+// Bytes per read() while draining the FIFO.
+const int FIFO_READ_SIZE { 512 };
 
 f_callback off_callback;
 f_callback on_callback;
+f_input_callback input_callback;
+f_volume_callback volume_callback;
+f_callback query_callback;
 
+FifoCommandParser fifoParser;
 
-void registerOffCallback(f_callback callback) {
-    spdlog::debug("Registering OFF callback");
-    off_callback = callback;
+
+void FifoCommandParser::feed(const char *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        const char c = data[i];
+        if (c == '\n') {
+            if (overlong_) {
+                stats_.received++;
+                stats_.rejected++;
+                spdlog::warn("Command longer than {} bytes received on FIFO", FIFO_MAX_COMMAND_SIZE);
+                overlong_ = false;
+            } else {
+                parseLine(line_);
+            }
+            line_.clear();
+        } else if (!overlong_) {
+            if ((int)line_.size() == FIFO_MAX_COMMAND_SIZE) {
+                overlong_ = true;
+                line_.clear();
+            } else {
+                line_ += c;
+            }
+        }
+    }
 }
 
-void registerOnCallback(f_callback callback) {
-    spdlog::debug("Registering ON callback");
-    on_callback = callback;
+FifoIntent FifoCommandParser::finish() {
+    // Older clients write "1" or "0" without a newline.
+    if (!overlong_ && !line_.empty() && line_.find_first_not_of("01") == string::npos) {
+        for (char c : line_) {
+            parseLine(string(1, c));
+        }
+        line_.clear();
+    }
+
+    FifoIntent intent = batch_;
+    intent.volumeSteps = max(-FIFO_MAX_VOLUME_STEPS, min(intent.volumeSteps, FIFO_MAX_VOLUME_STEPS));
+    // An input applies the power on with it.
+    const int applied = (intent.input > 0 || intent.power >= 0)
+        + (intent.volumeSteps != 0)
+        + intent.mute
+        + intent.query;
+    stats_.coalesced += intent.commands - applied;
+    batch_ = { 0, -1, 0, 0, false, false };
+    return intent;
+}
+
+FifoStats FifoCommandParser::stats() const {
+    return stats_;
 }
 
 /**
- * Catch SIGIO and read incoming command from pipe.
- *
- * @param   int   s  Not used
+ * Count and log a line that is not a command.
  *
  * @return  void
  */
-void handleSIGIO(int s) {
-    char buffer[FIFO_COMMAND_SIZE] { 0 };
-
-    spdlog::debug("handleSIGIO called");
+void FifoCommandParser::reject(const string &line) {
+    stats_.rejected++;
+    spdlog::warn("Unknown command received on FIFO: '{}'", line);
+}
 
-    if(read(fifo_fd, buffer, FIFO_COMMAND_SIZE) < 1) {
-        spdlog::debug("FIFO buffer is empty");
+/**
+ * Fold one line into the batch.
+ *
+ * @param   string  line  Without its newline.
+ *
+ * @return  void
+ */
+void FifoCommandParser::parseLine(string line) {
+    const size_t start = line.find_first_not_of(" \t\r");
+    line = start == string::npos ? "" : line.substr(start, line.find_last_not_of(" \t\r") - start + 1);
+    for (char &c : line) {
+        c = tolower((unsigned char)c);
+    }
+    istringstream words(line);
+    string command, argument, count, extra;
+    words >> command >> argument >> count >> extra;
+    if (command.empty()) {
         return;
-    };
+    }
+    stats_.received++;
+    spdlog::debug("FIFO command: '{}'", line);
 
-    spdlog::debug("FIFO read buffer: '{}'", buffer);
+    if (!extra.empty()) {
+        reject(line);
+        return;
+    }
 
-    if (strncmp(buffer, OFF_COMMAND, 1) == 0) {
-        spdlog::debug("Remote OFF command received on FIFO");
-        if (off_callback) {
-            f_callback cb = * off_callback;
-            cb();
+    if ((command == "1" || command == "on") && argument.empty()) {
+        batch_.power = 1;
+    } else if ((command == "0" || command == "off" || command == "standby") && argument.empty()) {
+        batch_.power = 0;
+        batch_.input = 0;
+    } else if ((command == "query" || command == "?") && argument.empty()) {
+        batch_.query = true;
+    } else if (command == "input" && count.empty() && (argument == "hdmi1" || argument == "1")) {
+        batch_.power = 1;
+        batch_.input = 1;
+    } else if (command == "input" && count.empty() && (argument == "hdmi2" || argument == "2")) {
+        batch_.power = 1;
+        batch_.input = 2;
+    } else if ((command == "mute" && argument.empty()) || (command == "volume" && argument == "mute" && count.empty())) {
+        batch_.mute = !batch_.mute;
+    } else if (command == "volume" && (argument == "up" || argument == "+" || argument == "down" || argument == "-")) {
+        int steps = 1;
+        if (!count.empty()) {
+            char *end;
+            steps = strtol(count.c_str(), &end, 10);
+            if (*end != '\0' || steps < 1 || steps > FIFO_MAX_VOLUME_STEPS) {
+                reject(line);
+                return;
+            }
         }
+        batch_.volumeSteps += argument == "up" || argument == "+" ? steps : -steps;
+    } else {
+        reject(line);
         return;
     }
+    batch_.commands++;
+}
 
-    if (strncmp(buffer, ON_COMMAND, 1) == 0) {
-        spdlog::debug("Remote ON command received on FIFO");
-        if (on_callback) {
-            f_callback cb = * on_callback;
-            cb();
-        }
+
+void registerOffCallback(f_callback callback) {
+    spdlog::debug("Registering OFF callback");
+    off_callback = callback;
+}
+
+void registerOnCallback(f_callback callback) {
+    spdlog::debug("Registering ON callback");
+    on_callback = callback;
+}
+
+void registerInputCallback(f_input_callback callback) {
+    spdlog::debug("Registering input callback");
+    input_callback = callback;
+}
+
+void registerVolumeCallback(f_volume_callback callback) {
+    spdlog::debug("Registering volume callback");
+    volume_callback = callback;
+}
+
+void registerQueryCallback(f_callback callback) {
+    spdlog::debug("Registering query callback");
+    query_callback = callback;
+}
+
+int fifoFd() {
+    return fifo_fd;
+}
+
+FifoStats getFIFOStats() {
+    return fifoParser.stats();
+}
+
+void readFIFO() {
+    char buffer[FIFO_READ_SIZE];
+    ssize_t count;
+
+    // Drain the FIFO: one wakeup may stand for many writes.
+    while ((count = read(fifo_fd, buffer, sizeof(buffer))) > 0) {
+        fifoParser.feed(buffer, count);
+    }
+    if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        spdlog::error("Could not read {}: {}", PIPE_PATH, strerror(errno));
+    }
+
+    FifoIntent intent = fifoParser.finish();
+    if (intent.commands == 0) {
         return;
     }
+    spdlog::debug(
+        "FIFO batch of {} commands: power={} input={} volume={} mute={} query={}",
+        intent.commands,
+        intent.power,
+        intent.input,
+        intent.volumeSteps,
+        intent.mute,
+        intent.query
+    );
 
-    spdlog::warn("Unknown command received on FIFO: {}", buffer);
+    if (intent.input > 0 && input_callback) {
+        spdlog::debug("Remote input {} command received on FIFO", intent.input);
+        input_callback(intent.input);
+    }
+    if (intent.power == 0 && off_callback) {
+        spdlog::debug("Remote OFF command received on FIFO");
+        off_callback();
+    }
+    if (intent.power == 1 && on_callback) {
+        spdlog::debug("Remote ON command received on FIFO");
+        on_callback();
+    }
+    if ((intent.volumeSteps != 0 || intent.mute) && volume_callback) {
+        volume_callback(intent.volumeSteps, intent.mute);
+    }
+    if (intent.query && query_callback) {
+        query_callback();
+    }
 }
 
 /**
@@ -82,16 +236,6 @@ int initFIFO(f_callback off_callback, f_callback on_callback) {
     registerOffCallback(off_callback);
     registerOnCallback(on_callback);
 
-    // Handle SIGIO
-    struct sigaction sigIOHandler;
-    sigIOHandler.sa_handler = handleSIGIO;
-    sigemptyset(&sigIOHandler.sa_mask);
-    sigIOHandler.sa_flags = 0;
-    if(sigaction(SIGIO, &sigIOHandler, NULL) < 0) {
-        spdlog::error("Error registering sigaction SIGIO");
-        return -1;
-    };
-
     mode_t mode { 0777 };
 
     if (mkfifo(PIPE_PATH, mode) != 0) {
@@ -99,7 +243,10 @@ int initFIFO(f_callback off_callback, f_callback on_callback) {
         return -1;
     };
 
-    fifo_fd = open(PIPE_PATH, O_RDONLY | O_NONBLOCK);
+    // Opened for writing too, so there always is a writer. Otherwise the
+    // FIFO would report a hangup, and be ready forever, once the first
+    // writer closes it.
+    fifo_fd = open(PIPE_PATH, O_RDWR | O_NONBLOCK);
 
     if (fifo_fd < 1) {
         spdlog::error("File descriptor for {} could not be obtained: {}.", PIPE_PATH, strerror(errno));
@@ -108,24 +255,6 @@ int initFIFO(f_callback off_callback, f_callback on_callback) {
 
     spdlog::debug("fd open at {}", fifo_fd);
 
-    // set PID of the receiving process
-    if(fcntl(fifo_fd, F_SETOWN, getpid()) != 0) {
-        spdlog::error("Could not set owner on fd: {}: {}", fifo_fd, strerror(errno));
-        return -1;
-    }
-
-    // enable asynchronous behavior
-    if(fcntl(fifo_fd, F_SETFL, fcntl(fifo_fd, F_GETFL) | O_ASYNC) != 0) {
-        spdlog::error("Could not set O_ASYNC on fd: {}: {}", fifo_fd, strerror(errno));
-        return -1;
-    }
-
-    // set the signal that is sent when the kernel tells us that there is a read/write on the fifo.
-    if(fcntl(fifo_fd, F_SETSIG, SIGIO) !=0) {
-        spdlog::error("Could not set signal SIGIO on fd: {}: {}", fifo_fd, strerror(errno));
-        return -1;
-    };
-
     return 1;
 }
 
@@ -1,14 +1,143 @@
 #ifndef FIFO_H
 #define FIFO_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
 typedef int (*f_callback)();
 
+/**
+ * Called with the input to switch to: 1 for HDMI 1, 2 for HDMI 2.
+ */
+typedef int (*f_input_callback)(int input);
+
+/**
+ * Called with the net number of volume steps (up if positive, down if
+ * negative, 0 for none) and whether to toggle mute.
+ */
+typedef int (*f_volume_callback)(int steps, bool mute);
+
+// A command line longer than this is rejected.
+const int FIFO_MAX_COMMAND_SIZE { 64 };
+// Most volume steps one batch applies, each way.
+const int FIFO_MAX_VOLUME_STEPS { 20 };
+
+/**
+ * What a batch of commands comes down to.
+ */
+struct FifoIntent {
+    // Valid commands in the batch.
+    int commands;
+    // 1 on, 0 standby, -1 not asked for. Switching input turns the system on.
+    int power;
+    // 1 for HDMI 1, 2 for HDMI 2, 0 not asked for. Cleared by a later standby.
+    int input;
+    // Net volume steps: up if positive, down if negative.
+    int volumeSteps;
+    // Whether mute was toggled an odd number of times.
+    bool mute;
+    bool query;
+};
+
+/**
+ * Counters of the FIFO reader.
+ */
+struct FifoStats {
+    // Every non-empty line, valid or not.
+    uint64_t received;
+    // Valid commands that were folded into another from the same batch.
+    uint64_t coalesced;
+    uint64_t rejected;
+};
+
+/**
+ * Splits bytes read from the FIFO into newline-delimited commands and
+ * reduces them to one FifoIntent per batch.
+ *
+ * Commands, case insensitive:
+ *
+ *     1, on                       Turn the system on.
+ *     0, off, standby             Standby.
+ *     input hdmi1|hdmi2|1|2       Switch the projector's input, turning the system on.
+ *     volume up|+ [steps]         Volume up, 1 step unless given.
+ *     volume down|- [steps]       Volume down.
+ *     volume mute, mute           Toggle mute.
+ *     query, ?                    Report the system status.
+ *
+ * Within a batch the last power command and the last input win, volume
+ * steps add up and mute toggles cancel out in pairs. A line without its
+ * newline waits for the rest, except a bare "0" or "1" as older clients
+ * write them.
+ */
+class FifoCommandParser {
+public:
+    /**
+     * Parse the complete lines in a chunk read from the FIFO.
+     *
+     * @param   char *  data
+     * @param   size_t  length
+     *
+     * @return  void
+     */
+    void feed(const char *data, size_t length);
+
+    /**
+     * End the batch: everything available has been read.
+     *
+     * @return  FifoIntent  The intent of the commands fed since the last call.
+     */
+    FifoIntent finish();
+
+    FifoStats stats() const;
+
+private:
+    void parseLine(std::string line);
+    void reject(const std::string &line);
+
+    // The line read so far.
+    std::string line_;
+    // The line is over FIFO_MAX_COMMAND_SIZE: skip to its newline.
+    bool overlong_ { false };
+    FifoIntent batch_ { 0, -1, 0, 0, false, false };
+    FifoStats stats_ { 0, 0, 0 };
+};
+
 int initFIFO(f_callback off_callback, f_callback on_callback);
 
 int cleanupFIFO();
 
+/**
+ * The FIFO's file descriptor, to wait on for commands.
+ *
+ * @return  int     -1 before initFIFO().
+ */
+int fifoFd();
+
+/**
+ * Read every command available on the FIFO and apply them as one batch:
+ * input, then power, then volume, then query callbacks, each at most once.
+ * Call when fifoFd() is readable.
+ *
+ * @return  void
+ */
+void readFIFO();
+
+/**
+ * The reader's counters.
+ *
+ * @return  FifoStats
+ */
+FifoStats getFIFOStats();
+
 void registerOffCallback(f_callback callback);
 
 void registerOnCallback(f_callback callback);
 
+void registerInputCallback(f_input_callback callback);
+
+void registerVolumeCallback(f_volume_callback callback);
+
+void registerQueryCallback(f_callback callback);
+
 #endif
@@ -0,0 +1,226 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "spdlog/spdlog.h"
+#include "spdlog/fmt/ranges.h"
+#include "cec_format.hpp"
+#include "flight_recorder.hpp"
+
+using namespace std;
+
+#define DEFAULT_PATH "/var/tmp/cec-fix.flight"
+
+/**
+ * Print usage.
+ *
+ * @return  void
+ */
+void usage(const char* name) {
+    fprintf(stderr,
+        "Usage: %s [options] [file]\n"
+        "Print the records of a cec-fix flight recorder file (default %s), oldest first.\n"
+        "  --json                One JSON object per line\n"
+        "  --last N              Only the last N records\n",
+        name, DEFAULT_PATH);
+}
+
+const char *recordTypeName(uint8_t type) {
+    switch (type) {
+        case FLIGHT_START: return "start";
+        case FLIGHT_STOP: return "stop";
+        case FLIGHT_CEC_NOTIFICATION: return "vc";
+        case FLIGHT_CEC_EVENT: return "cec";
+        case FLIGHT_PROJECTOR_SENT: return "projector-sent";
+        case FLIGHT_PROJECTOR_RECEIVED: return "projector-received";
+        case FLIGHT_DECISION: return "decision";
+        default: return "unknown";
+    }
+}
+
+const char *decisionName(uint16_t decision) {
+    switch (decision) {
+        case FLIGHT_TURN_ON: return "turn-on";
+        case FLIGHT_TURN_OFF: return "turn-off";
+        case FLIGHT_ALREADY_ON: return "already-on";
+        case FLIGHT_ALREADY_OFF: return "already-off";
+        case FLIGHT_POWER_STATUS_REPLY: return "power-status-reply";
+        case FLIGHT_POWER_STATUS_UNKNOWN: return "power-status-unknown";
+        case FLIGHT_SET_STREAM_PATH: return "set-stream-path";
+        case FLIGHT_UNHANDLED_MESSAGE: return "unhandled-message";
+        case FLIGHT_SYSTEM_ACTIVE: return "system-active";
+        case FLIGHT_SYSTEM_STANDBY: return "system-standby";
+        case FLIGHT_DEFER_ON: return "defer-on";
+        case FLIGHT_DEFER_OFF: return "defer-off";
+        default: return "unknown";
+    }
+}
+
+/**
+ * The CEC message in a FLIGHT_CEC_EVENT record.
+ */
+CECMessage recordedMessage(const FlightRecord &record) {
+    CECMessage message {};
+    if (record.length) {
+        message.initiator = record.data[0] >> 4;
+        message.follower = record.data[0] & 0x0F;
+        message.length = record.length - 1;
+        memcpy(message.payload, &record.data[1], message.length);
+    }
+    return message;
+}
+
+/**
+ * Wall clock time of a record, e.g. "2026-10-17 07:47:10.952341123".
+ *
+ * @param   bool  utc  ISO 8601 in UTC instead of local time.
+ */
+string recordTime(const FlightRecord &record, bool utc) {
+    time_t seconds = record.timeNs / 1000000000;
+    struct tm parts;
+    char text[32];
+    if (utc) {
+        gmtime_r(&seconds, &parts);
+        strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &parts);
+    } else {
+        localtime_r(&seconds, &parts);
+        strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &parts);
+    }
+    return fmt::format("{}.{:09d}{}", text, record.timeNs % 1000000000, utc ? "Z" : "");
+}
+
+/**
+ * What a record says, for the text output.
+ */
+string describe(const FlightRecord &record) {
+    switch (record.type) {
+        case FLIGHT_START:
+            return fmt::format("pid={}", record.arg);
+        case FLIGHT_CEC_NOTIFICATION: {
+            uint32_t params[5];
+            memcpy(params, record.data, sizeof(params));
+            return fmt::format("reason={:08X} params={:08X}", params[0], fmt::join(&params[1], &params[5], " "));
+        }
+        case FLIGHT_CEC_EVENT:
+            if (record.code == CEC_EVENT_TRANSMITTED) {
+                return fmt::format("tx {} {}", record.arg ? "ack" : "nack", recordedMessage(record));
+            }
+            return fmt::format("rx {}", recordedMessage(record));
+        case FLIGHT_PROJECTOR_SENT:
+        case FLIGHT_PROJECTOR_RECEIVED:
+            return fmt::format(
+                "{:02X}{}",
+                fmt::join(record.data, record.data + record.length, " "),
+                record.code > record.length ? fmt::format(" ({} bytes)", record.code) : ""
+            );
+        case FLIGHT_DECISION:
+            return fmt::format("{} {}", decisionName(record.code), record.arg);
+        default:
+            return "";
+    }
+}
+
+/**
+ * A record as a JSON object, on one line.
+ */
+string toJSON(const FlightRecord &record) {
+    string json = fmt::format(
+        "{{\"sequence\":{},\"time\":\"{}\",\"type\":\"{}\"",
+        record.sequence,
+        recordTime(record, true),
+        recordTypeName(record.type)
+    );
+
+    switch (record.type) {
+        case FLIGHT_START:
+            json += fmt::format(",\"pid\":{}", record.arg);
+            break;
+        case FLIGHT_CEC_NOTIFICATION: {
+            uint32_t params[5];
+            memcpy(params, record.data, sizeof(params));
+            json += fmt::format(",\"reason\":{},\"params\":[{}]", params[0], fmt::join(&params[1], &params[5], ","));
+            break;
+        }
+        case FLIGHT_CEC_EVENT: {
+            const CECMessage message = recordedMessage(record);
+            const char *opcode = message.length ? cecOpcodeName(message.payload[0]) : nullptr;
+            json += fmt::format(
+                ",\"direction\":\"{}\",\"initiator\":{},\"follower\":{},\"payload\":\"{:02X}\"",
+                record.code == CEC_EVENT_TRANSMITTED ? "tx" : "rx",
+                message.initiator,
+                message.follower,
+                fmt::join(message.payload, message.payload + message.length, ":")
+            );
+            if (opcode) {
+                json += fmt::format(",\"opcode\":\"{}\"", opcode);
+            }
+            if (record.code == CEC_EVENT_TRANSMITTED) {
+                json += fmt::format(",\"acknowledged\":{}", record.arg ? "true" : "false");
+            }
+            break;
+        }
+        case FLIGHT_PROJECTOR_SENT:
+        case FLIGHT_PROJECTOR_RECEIVED:
+            json += fmt::format(
+                ",\"bytes\":\"{:02X}\",\"length\":{}",
+                fmt::join(record.data, record.data + record.length, " "),
+                record.code
+            );
+            break;
+        case FLIGHT_DECISION:
+            json += fmt::format(",\"decision\":\"{}\",\"value\":{}", decisionName(record.code), record.arg);
+            break;
+    }
+    return json + "}";
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[DECODE] [%^%l%$] %v");
+
+    const struct option longOptions[] {
+        { "json", no_argument, nullptr, 'j' },
+        { "last", required_argument, nullptr, 'n' },
+        { nullptr, 0, nullptr, 0 },
+    };
+
+    bool json = false;
+    size_t last = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case 'j': json = true; break;
+            case 'n': last = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    const char *path = optind < argc ? argv[optind] : DEFAULT_PATH;
+
+    vector<FlightRecord> records;
+    if (!readFlightRecorder(path, records)) {
+        spdlog::error("{} is not a flight recorder file", path);
+        return 1;
+    }
+
+    size_t first = last && last < records.size() ? records.size() - last : 0;
+    for (size_t i = first; i < records.size(); i++) {
+        const FlightRecord &record = records[i];
+        if (json) {
+            puts(toJSON(record).c_str());
+        } else {
+            const string description = describe(record);
+            printf(
+                "%s #%lu %s%s%s\n",
+                recordTime(record, false).c_str(),
+                (unsigned long)record.sequence,
+                recordTypeName(record.type),
+                description.empty() ? "" : " ",
+                description.c_str()
+            );
+        }
+    }
+    return 0;
+}
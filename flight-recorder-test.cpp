@@ -0,0 +1,221 @@
+#include "flight_recorder.hpp"
+#include "spdlog/spdlog.h"
+#include <chrono>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+const int BENCH_RECORDS { 4000000 };
+
+/**
+ * A fresh file name in /tmp.
+ */
+string temporaryPath() {
+    char path[] = "/tmp/flight-recorder-test-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    unlink(path);
+    return path;
+}
+
+/**
+ * Check that every kind of record reads back as written.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testRoundTrip() {
+    const string path = temporaryPath();
+    FlightRecorder recorder;
+    if (!recorder.open(path.c_str(), 16)) {
+        spdlog::error("Round trip: open failed");
+        return 1;
+    }
+
+    CECEvent event { CEC_EVENT_TRANSMITTED, true, { 2, CEC_ADDRESS_TV, CEC_ADDRESS_PLAYBACK_1, { CEC_OPCODE_REPORT_POWER_STATUS, CEC_POWER_ON } } };
+    uint8_t frame[50];
+    memset(frame, 0x21, sizeof(frame));
+
+    recorder.recordCECNotification(0x01020304, 1, 2, 3, 4);
+    recorder.recordCECEvent(event);
+    recorder.recordProjector(FLIGHT_PROJECTOR_SENT, frame, sizeof(frame));
+    recorder.recordDecision(FLIGHT_TURN_ON, -6);
+    recorder.flush();
+    recorder.close();
+
+    vector<FlightRecord> records;
+    bool read = readFlightRecorder(path.c_str(), records);
+    unlink(path.c_str());
+
+    if (!read || records.size() != 6) {
+        spdlog::error("Round trip: {} records", records.size());
+        return 1;
+    }
+    if (records[0].type != FLIGHT_START || records[0].arg != getpid() || records[5].type != FLIGHT_STOP) {
+        spdlog::error("Round trip: start and stop not recorded");
+        return 1;
+    }
+    uint32_t params[5];
+    memcpy(params, records[1].data, sizeof(params));
+    if (records[1].type != FLIGHT_CEC_NOTIFICATION || params[0] != 0x01020304 || params[4] != 4) {
+        spdlog::error("Round trip: wrong notification");
+        return 1;
+    }
+    if (records[2].type != FLIGHT_CEC_EVENT || records[2].code != CEC_EVENT_TRANSMITTED || records[2].arg != 1
+            || records[2].length != 3 || records[2].data[0] != 0x04 || records[2].data[1] != CEC_OPCODE_REPORT_POWER_STATUS) {
+        spdlog::error("Round trip: wrong CEC event");
+        return 1;
+    }
+    if (records[3].type != FLIGHT_PROJECTOR_SENT || records[3].code != sizeof(frame) || records[3].length != FLIGHT_DATA_SIZE) {
+        spdlog::error("Round trip: wrong projector frame");
+        return 1;
+    }
+    if (records[4].type != FLIGHT_DECISION || records[4].code != FLIGHT_TURN_ON || records[4].arg != -6) {
+        spdlog::error("Round trip: wrong decision");
+        return 1;
+    }
+    for (size_t i = 1; i < records.size(); i++) {
+        if (records[i].sequence != records[i - 1].sequence + 1 || records[i].timeNs < records[i - 1].timeNs) {
+            spdlog::error("Round trip: records out of order");
+            return 1;
+        }
+    }
+
+    spdlog::info("Round trip: OK");
+    return 0;
+}
+
+/**
+ * Check that the ring keeps the newest records, and that reopening the file
+ * keeps them too.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testWrapAndReopen() {
+    const string path = temporaryPath();
+    FlightRecorder recorder;
+    recorder.open(path.c_str(), 8);
+    for (int i = 0; i < 20; i++) {
+        recorder.recordDecision(FLIGHT_SET_STREAM_PATH, i);
+    }
+    recorder.close();
+
+    vector<FlightRecord> records;
+    readFlightRecorder(path.c_str(), records);
+    // The start record and 20 decisions: only the last 8 are left.
+    if (records.size() != 8 || records.front().sequence != 14 || records.back().arg != 19) {
+        spdlog::error("Wrap: {} records", records.size());
+        unlink(path.c_str());
+        return 1;
+    }
+
+    // A different capacity is ignored while the file is valid.
+    recorder.open(path.c_str(), 1024);
+    recorder.close();
+    readFlightRecorder(path.c_str(), records);
+    unlink(path.c_str());
+    if (records.size() != 8 || records.back().type != FLIGHT_START || records.back().sequence != 22) {
+        spdlog::error("Reopen: records were not kept");
+        return 1;
+    }
+
+    vector<FlightRecord> none;
+    if (readFlightRecorder("/dev/null", none) || readFlightRecorder("/nonexistent", none)) {
+        spdlog::error("Reopen: read a file that is not a flight recorder");
+        return 1;
+    }
+
+    spdlog::info("Wrap and reopen: OK");
+    return 0;
+}
+
+/**
+ * Check that records survive the process being killed without any cleanup.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testCrash() {
+    const string path = temporaryPath();
+
+    pid_t child = fork();
+    if (child == 0) {
+        FlightRecorder recorder;
+        recorder.open(path.c_str(), 1024);
+        for (int i = 0; i < 100; i++) {
+            recorder.recordDecision(FLIGHT_TURN_OFF, i);
+        }
+        kill(getpid(), SIGKILL);
+    }
+    int status;
+    waitpid(child, &status, 0);
+
+    vector<FlightRecord> records;
+    readFlightRecorder(path.c_str(), records);
+    unlink(path.c_str());
+
+    if (!WIFSIGNALED(status) || records.size() != 101 || records.front().arg != child || records.back().arg != 99) {
+        spdlog::error("Crash: {} records survived", records.size());
+        return 1;
+    }
+
+    spdlog::info("Crash: OK");
+    return 0;
+}
+
+/**
+ * Cost of one record, from one thread and from several at once.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int benchmark() {
+    const string path = temporaryPath();
+    FlightRecorder recorder;
+    recorder.open(path.c_str(), 65536);
+
+    const CECEvent event { CEC_EVENT_RECEIVED, true, { 3, CEC_ADDRESS_PLAYBACK_1, CEC_ADDRESS_BROADCAST, { CEC_OPCODE_ACTIVE_SOURCE, 0x11, 0x00 } } };
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_RECORDS; i++) {
+        recorder.recordCECEvent(event);
+    }
+    auto single = chrono::steady_clock::now() - start;
+
+    const int threads = 4;
+    vector<thread> writers;
+    start = chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++) {
+        writers.emplace_back([&recorder, &event]() {
+            for (int i = 0; i < BENCH_RECORDS / threads; i++) {
+                recorder.recordCECEvent(event);
+            }
+        });
+    }
+    for (thread &writer : writers) {
+        writer.join();
+    }
+    auto shared = chrono::steady_clock::now() - start;
+
+    recorder.close();
+    unlink(path.c_str());
+
+    spdlog::info(
+        "Benchmark: {:.1f} ns/record from one thread, {:.1f} ns/record from {} threads",
+        chrono::duration<double, nano>(single).count() / BENCH_RECORDS,
+        chrono::duration<double, nano>(shared).count() / BENCH_RECORDS,
+        threads
+    );
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[FLIGHT] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    return testRoundTrip() | testWrapAndReopen() | testCrash() | benchmark();
+}
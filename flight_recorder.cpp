@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "spdlog/spdlog.h"
+#include "flight_recorder.hpp"
+
+using namespace std;
+
+const char FLIGHT_MAGIC[8] { 'C', 'E', 'C', 'F', 'L', 'I', 'T', 'E' };
+const uint32_t FLIGHT_VERSION { 1 };
+
+FlightRecorder flightRecorder;
+
+/**
+ * Whether a mapped header describes a file of the given size.
+ */
+bool isValidHeader(const FlightHeader &header, size_t fileSize) {
+    return memcmp(header.magic, FLIGHT_MAGIC, sizeof(FLIGHT_MAGIC)) == 0
+        && header.version == FLIGHT_VERSION
+        && header.recordSize == sizeof(FlightRecord)
+        && header.capacity > 0
+        && fileSize == sizeof(FlightHeader) + header.capacity * sizeof(FlightRecord);
+}
+
+FlightRecorder::~FlightRecorder() {
+    close();
+}
+
+bool FlightRecorder::open(const char *path, uint64_t capacity) {
+    close();
+    if (capacity == 0) {
+        return false;
+    }
+
+    int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        spdlog::error("Could not open flight recorder {}: {}", path, strerror(errno));
+        return false;
+    }
+
+    struct stat info;
+    fstat(fd, &info);
+    size_t size = info.st_size;
+
+    FlightHeader existing {};
+    bool keep = size >= sizeof(existing) && pread(fd, &existing, sizeof(existing), 0) == sizeof(existing) && isValidHeader(existing, size);
+    if (!keep) {
+        // New, or from another version: start over.
+        size = sizeof(FlightHeader) + capacity * sizeof(FlightRecord);
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0) {
+            spdlog::error("Could not size flight recorder {}: {}", path, strerror(errno));
+            ::close(fd);
+            return false;
+        }
+    }
+
+    void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        spdlog::error("Could not map flight recorder {}: {}", path, strerror(errno));
+        return false;
+    }
+
+    header_ = (FlightHeader *)mapped;
+    records_ = (FlightRecord *)((char *)mapped + sizeof(FlightHeader));
+    mappedSize_ = size;
+    if (!keep) {
+        memcpy(header_->magic, FLIGHT_MAGIC, sizeof(FLIGHT_MAGIC));
+        header_->version = FLIGHT_VERSION;
+        header_->recordSize = sizeof(FlightRecord);
+        header_->capacity = capacity;
+        header_->next = 0;
+    }
+
+    spdlog::info(
+        "Flight recorder {}: {} records, {} kept",
+        path,
+        header_->capacity,
+        keep ? min(header_->next, header_->capacity) : 0
+    );
+    record(FLIGHT_START, 0, getpid(), nullptr, 0);
+    return true;
+}
+
+void FlightRecorder::close() {
+    if (!header_) {
+        return;
+    }
+    munmap(header_, mappedSize_);
+    header_ = nullptr;
+    records_ = nullptr;
+    mappedSize_ = 0;
+}
+
+void FlightRecorder::flush() {
+    if (!header_) {
+        return;
+    }
+    record(FLIGHT_STOP, 0, 0, nullptr, 0);
+    msync(header_, mappedSize_, MS_SYNC);
+}
+
+void FlightRecorder::record(FlightRecordType type, uint16_t code, int32_t arg, const void *data, size_t length) {
+    if (!header_) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    const uint64_t index = __atomic_fetch_add(&header_->next, 1, __ATOMIC_RELAXED);
+    FlightRecord &record = records_[index % header_->capacity];
+
+    // Unpublish the slot while it is rewritten, so a crash halfway leaves
+    // it out rather than mixing two records.
+    __atomic_store_n(&record.sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record.timeNs = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    record.type = type;
+    record.length = min(length, FLIGHT_DATA_SIZE);
+    record.code = code;
+    record.arg = arg;
+    if (record.length) {
+        memcpy(record.data, data, record.length);
+    }
+
+    __atomic_store_n(&record.sequence, index + 1, __ATOMIC_RELEASE);
+}
+
+void FlightRecorder::recordCECNotification(uint32_t reason, uint32_t param1, uint32_t param2, uint32_t param3, uint32_t param4) {
+    const uint32_t data[] { reason, param1, param2, param3, param4 };
+    record(FLIGHT_CEC_NOTIFICATION, 0, 0, data, sizeof(data));
+}
+
+void FlightRecorder::recordCECEvent(const CECEvent &event) {
+    uint8_t data[1 + CEC_MAX_PAYLOAD_SIZE];
+    const size_t length = min((size_t)event.message.length, CEC_MAX_PAYLOAD_SIZE);
+    data[0] = (event.message.initiator & 0x0F) << 4 | (event.message.follower & 0x0F);
+    memcpy(&data[1], event.message.payload, length);
+    record(FLIGHT_CEC_EVENT, event.kind, event.acknowledged, data, 1 + length);
+}
+
+void FlightRecorder::recordProjector(FlightRecordType type, const uint8_t *bytes, size_t length) {
+    record(type, min(length, (size_t)UINT16_MAX), 0, bytes, length);
+}
+
+void FlightRecorder::recordDecision(FlightDecision decision, int32_t value) {
+    record(FLIGHT_DECISION, decision, value, nullptr, 0);
+}
+
+bool readFlightRecorder(const char *path, vector<FlightRecord> &records) {
+    records.clear();
+
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    fstat(fd, &info);
+    size_t size = info.st_size;
+
+    FlightHeader header;
+    if (size < sizeof(header) || pread(fd, &header, sizeof(header), 0) != sizeof(header) || !isValidHeader(header, size)) {
+        ::close(fd);
+        return false;
+    }
+
+    vector<FlightRecord> slots(header.capacity);
+    const size_t recordsSize = header.capacity * sizeof(FlightRecord);
+    bool complete = pread(fd, slots.data(), recordsSize, sizeof(header)) == (ssize_t)recordsSize;
+    ::close(fd);
+    if (!complete) {
+        return false;
+    }
+
+    // Only the last `capacity` claimed records can still be in the ring.
+    const uint64_t oldest = header.next > header.capacity ? header.next - header.capacity + 1 : 1;
+    for (const FlightRecord &slot : slots) {
+        if (slot.sequence >= oldest && slot.sequence <= header.next && slot.length <= FLIGHT_DATA_SIZE) {
+            records.push_back(slot);
+        }
+    }
+    sort(records.begin(), records.end(), [](const FlightRecord &a, const FlightRecord &b) {
+        return a.sequence < b.sequence;
+    });
+    return true;
+}
@@ -0,0 +1,163 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "cec.hpp"
+
+/**
+ * What a flight record holds.
+ */
+enum FlightRecordType : uint8_t {
+    // The daemon opened the recorder. arg is its pid.
+    FLIGHT_START = 1,
+    // The daemon shut down cleanly.
+    FLIGHT_STOP,
+    // A raw vc_cec notification. data is reason, param1..param4, little endian.
+    FLIGHT_CEC_NOTIFICATION,
+    // A CECEvent from the backend. code is its kind, arg whether it was
+    // acknowledged, data the header block and payload.
+    FLIGHT_CEC_EVENT,
+    // Bytes sent to and frames received from the projector. code is the
+    // full length; data holds the first FLIGHT_DATA_SIZE bytes.
+    FLIGHT_PROJECTOR_SENT,
+    FLIGHT_PROJECTOR_RECEIVED,
+    // A decision of the daemon. code is a FlightDecision, arg its value.
+    FLIGHT_DECISION,
+};
+
+/**
+ * Decisions worth knowing about after the fact.
+ */
+enum FlightDecision : uint16_t {
+    // arg is the result of sendOn() or sendOff().
+    FLIGHT_TURN_ON = 1,
+    FLIGHT_TURN_OFF,
+    FLIGHT_ALREADY_ON,
+    FLIGHT_ALREADY_OFF,
+    // arg is the CEC power status sent.
+    FLIGHT_POWER_STATUS_REPLY,
+    FLIGHT_POWER_STATUS_UNKNOWN,
+    // arg is the physical address.
+    FLIGHT_SET_STREAM_PATH,
+    // arg is the header block << 8 | opcode.
+    FLIGHT_UNHANDLED_MESSAGE,
+    // Requests from the FIFO.
+    FLIGHT_SYSTEM_ACTIVE,
+    FLIGHT_SYSTEM_STANDBY,
+    // A power command held back until the projector's transition ends. arg
+    // is its power status then.
+    FLIGHT_DEFER_ON,
+    FLIGHT_DEFER_OFF,
+};
+
+const size_t FLIGHT_DATA_SIZE { 40 };
+
+/**
+ * One record, a cache line long.
+ */
+struct alignas(64) FlightRecord {
+    // Position in the log, from 1, written last. 0 while the record is
+    // being written, or if it never was.
+    uint64_t sequence;
+    // CLOCK_REALTIME, so it can be matched against other logs.
+    int64_t timeNs;
+    uint8_t type;
+    // Bytes of data used.
+    uint8_t length;
+    uint16_t code;
+    int32_t arg;
+    uint8_t data[FLIGHT_DATA_SIZE];
+};
+
+static_assert(sizeof(FlightRecord) == 64, "A FlightRecord should fill one cache line");
+
+/**
+ * Start of the file, followed by the records.
+ */
+struct alignas(64) FlightHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t capacity;
+    // Records claimed so far, ever. Updated atomically.
+    uint64_t next;
+};
+
+/**
+ * A ring of fixed-size binary records in a memory-mapped file.
+ *
+ * Recording claims a slot with one atomic increment, copies a few bytes and
+ * publishes the slot's sequence number: no formatting, locks or system calls
+ * beyond reading the clock. It is safe from any thread, including the VCHI
+ * callback thread.
+ *
+ * The file is mapped shared, so the records are in the page cache as soon as
+ * they are written and survive the process crashing or being killed. They do
+ * not survive a power cut unless flush() ran. Opening an existing file keeps
+ * its records, so the log spans restarts.
+ *
+ * Recording does nothing until open() succeeds.
+ */
+class FlightRecorder {
+public:
+    ~FlightRecorder();
+
+    /**
+     * Map the file, creating it if needed.
+     *
+     * @param   char *    path      The file.
+     * @param   uint64_t  capacity  Records in the ring, used if the file is new or was another size.
+     *
+     * @return  bool                false if the file could not be mapped.
+     */
+    bool open(const char *path, uint64_t capacity);
+
+    /**
+     * Unmap the file. Nothing may record concurrently.
+     */
+    void close();
+
+    /**
+     * Record a clean shutdown and write the records to disk.
+     */
+    void flush();
+
+    void recordCECNotification(uint32_t reason, uint32_t param1, uint32_t param2, uint32_t param3, uint32_t param4);
+    void recordCECEvent(const CECEvent &event);
+
+    /**
+     * @param   FlightRecordType  type    FLIGHT_PROJECTOR_SENT or FLIGHT_PROJECTOR_RECEIVED.
+     * @param   uint8_t *         bytes   The bytes.
+     * @param   size_t            length  Number of bytes.
+     */
+    void recordProjector(FlightRecordType type, const uint8_t *bytes, size_t length);
+
+    void recordDecision(FlightDecision decision, int32_t value);
+
+private:
+    void record(FlightRecordType type, uint16_t code, int32_t arg, const void *data, size_t length);
+
+    FlightHeader *header_ { nullptr };
+    FlightRecord *records_ { nullptr };
+    size_t mappedSize_ { 0 };
+};
+
+/**
+ * The daemon's recorder.
+ */
+extern FlightRecorder flightRecorder;
+
+/**
+ * Read the records of a flight recorder file, oldest first. Records that
+ * were being written when the process died are left out.
+ *
+ * @param   char *                path     The file.
+ * @param   vector<FlightRecord>  records  Receives the records.
+ *
+ * @return  bool                           false if the file is not a flight recorder file.
+ */
+bool readFlightRecorder(const char *path, std::vector<FlightRecord> &records);
+
+#endif
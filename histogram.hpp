@@ -0,0 +1,93 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * Lock-free histogram of durations in microseconds.
+ *
+ * Bucket i counts durations below 2^i microseconds (and at least 2^(i-1)),
+ * so percentiles are reported as the upper bound of their bucket. Recording
+ * is a couple of relaxed atomic increments and is safe from any thread.
+ */
+class LatencyHistogram {
+public:
+    static const int BUCKETS = 32;
+
+    /**
+     * Record one duration.
+     *
+     * @param   int64_t  us  The duration in microseconds.
+     *
+     * @return  void
+     */
+    void record(int64_t us) {
+        if (us < 0) {
+            us = 0;
+        }
+        int bucket = 0;
+        while (bucket < BUCKETS - 1 && us >= ((int64_t)1 << bucket)) {
+            bucket++;
+        }
+        buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+
+        int64_t max = max_.load(std::memory_order_relaxed);
+        while (us > max && !max_.compare_exchange_weak(max, us, std::memory_order_relaxed)) { }
+    }
+
+    /**
+     * Number of recorded durations.
+     *
+     * @return  uint64_t
+     */
+    uint64_t count() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Longest recorded duration.
+     *
+     * @return  int64_t  Microseconds.
+     */
+    int64_t max() const {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Upper bound of the bucket holding the given percentile.
+     *
+     * @param   double  percentile  Between 0 and 100.
+     *
+     * @return  int64_t             Microseconds, or 0 if nothing was recorded.
+     */
+    int64_t percentile(double percentile) const {
+        uint64_t total = count();
+        if (total == 0) {
+            return 0;
+        }
+
+        uint64_t rank = (uint64_t)(total * percentile / 100.0);
+        if (rank >= total) {
+            rank = total - 1;
+        }
+
+        uint64_t seen { 0 };
+        for (int bucket = 0; bucket < BUCKETS; bucket++) {
+            seen += buckets_[bucket].load(std::memory_order_relaxed);
+            if (seen > rank) {
+                int64_t bound = (int64_t)1 << bucket;
+                return bound < max() ? bound : max();
+            }
+        }
+        return max();
+    }
+
+private:
+    std::atomic<uint64_t> buckets_[BUCKETS] {};
+    std::atomic<uint64_t> count_ { 0 };
+    std::atomic<int64_t> max_ { 0 };
+};
+
+#endif
@@ -0,0 +1,323 @@
+#include "jvc.hpp"
+#include "spdlog/spdlog.h"
+#include <chrono>
+#include <random>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+const int FUZZ_ROUNDS { 2000 };
+const int BENCH_ITERATIONS { 1000000 };
+
+const unsigned char POWER_ACK[] { 0x06, 0x89, 0x01, 0x50, 0x57, 0x0A };
+const unsigned char POWER_RESPONSE[] { 0x40, 0x89, 0x01, 0x50, 0x57, 0x31, 0x0A };
+const unsigned char INPUT_RESPONSE[] { 0x40, 0x89, 0x01, 0x49, 0x50, 0x36, 0x0A };
+const unsigned char NULL_ACK[] { 0x06, 0x89, 0x01, 0x00, 0x00, 0x0A };
+
+const vector<vector<unsigned char>> FRAMES {
+    vector<unsigned char>(begin(POWER_ACK), end(POWER_ACK)),
+    vector<unsigned char>(begin(POWER_RESPONSE), end(POWER_RESPONSE)),
+    vector<unsigned char>(begin(INPUT_RESPONSE), end(INPUT_RESPONSE)),
+    vector<unsigned char>(begin(NULL_ACK), end(NULL_ACK)),
+};
+
+
+/**
+ * Feed a stream to a framer in random-sized reads and collect the frames.
+ *
+ * @return  vector  The frames, each with its terminator put back.
+ */
+vector<vector<unsigned char>> frameStream(const vector<unsigned char> &stream, mt19937 &rng, size_t maxRead) {
+    JvcFramer framer;
+    vector<vector<unsigned char>> frames;
+    JvcFrame frame;
+    size_t offset { 0 };
+
+    while (offset < stream.size()) {
+        size_t readLen = min(uniform_int_distribution<size_t>(1, maxRead)(rng), stream.size() - offset);
+        readLen = min(readLen, framer.writeSpace());
+        memcpy(framer.writePtr(), stream.data() + offset, readLen);
+        framer.commit(readLen);
+        offset += readLen;
+
+        while (framer.next(frame)) {
+            vector<unsigned char> copy(frame.data, frame.data + frame.length);
+            copy.push_back(JVC_TERMINATOR);
+            frames.push_back(copy);
+        }
+    }
+    return frames;
+}
+
+/**
+ * Split and merge random frame sequences at random boundaries and check the
+ * framer returns exactly the frames that were sent.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testSplitMerge() {
+    mt19937 rng(1234);
+
+    for (int round = 0; round < FUZZ_ROUNDS; round++) {
+        vector<vector<unsigned char>> sent;
+        vector<unsigned char> stream;
+        int count = uniform_int_distribution<int>(1, 40)(rng);
+        for (int i = 0; i < count; i++) {
+            const vector<unsigned char> &frame = FRAMES[rng() % FRAMES.size()];
+            sent.push_back(frame);
+            stream.insert(stream.end(), frame.begin(), frame.end());
+        }
+
+        // 1 byte at a time, small splits, and everything coalesced.
+        for (size_t maxRead : { (size_t)1, (size_t)7, stream.size() }) {
+            if (frameStream(stream, rng, maxRead) != sent) {
+                spdlog::error("SplitMerge: round {} with reads up to {} bytes returned wrong frames", round, maxRead);
+                return 1;
+            }
+        }
+    }
+
+    spdlog::info("SplitMerge: OK ({} rounds)", FUZZ_ROUNDS);
+    return 0;
+}
+
+/**
+ * Check header classification and payload access.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testClassify() {
+    JvcFramer framer;
+    const unsigned char stream[] { 0x06, 0x89, 0x01, 0x50, 0x57, 0x0A, 0x40, 0x89, 0x01, 0x50, 0x57, 0x33, 0x0A, 0x7F, 0x0A };
+    memcpy(framer.writePtr(), stream, sizeof(stream));
+    framer.commit(sizeof(stream));
+
+    const unsigned char power[] { 'P', 'W' };
+    const unsigned char* payload;
+    JvcFrame ack, response, garbage;
+    if (!framer.next(ack) || ack.type != JVC_FRAME_ACK || !ack.isFor(power) || ack.payload(&payload) != 0) {
+        spdlog::error("Classify: bad ACK frame");
+        return 1;
+    }
+    if (!framer.next(response) || response.type != JVC_FRAME_RESPONSE || !response.isFor(power)
+            || response.payload(&payload) != 1 || payload[0] != 0x33) {
+        spdlog::error("Classify: bad response frame");
+        return 1;
+    }
+    if (!framer.next(garbage) || garbage.type != JVC_FRAME_UNKNOWN || framer.next(garbage)) {
+        spdlog::error("Classify: bad unknown frame");
+        return 1;
+    }
+
+    spdlog::info("Classify: OK");
+    return 0;
+}
+
+/**
+ * Check that a run of bytes without a terminator is dropped and the framer
+ * picks up again at the next frame.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testResync() {
+    JvcFramer framer;
+    JvcFrame frame;
+    memset(framer.writePtr(), 0x55, JVC_MAX_FRAME_SIZE);
+    framer.commit(JVC_MAX_FRAME_SIZE);
+    if (framer.next(frame) || framer.discarded() != 1) {
+        spdlog::error("Resync: oversized frame was not discarded");
+        return 1;
+    }
+
+    memcpy(framer.writePtr(), POWER_ACK, sizeof(POWER_ACK));
+    framer.commit(sizeof(POWER_ACK));
+    if (!framer.next(frame) || frame.type != JVC_FRAME_ACK) {
+        spdlog::error("Resync: frame after garbage was lost");
+        return 1;
+    }
+
+    spdlog::info("Resync: OK");
+    return 0;
+}
+
+/**
+ * Decode a response given as bytes, terminator excluded.
+ *
+ * @return  bool    Whether jvcDecode accepted it.
+ */
+bool decode(JvcQuery query, const vector<unsigned char> &bytes, JvcValue &value) {
+    JvcFrame frame { JVC_FRAME_RESPONSE, bytes.data(), bytes.size() };
+    return jvcDecode(query, frame, value);
+}
+
+/**
+ * Check the command bytes of every query against the JVC specification.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testQueryCommands() {
+    const vector<pair<JvcQuery, vector<unsigned char>>> expected {
+        { JVC_QUERY_POWER, { 0x3F, 0x89, 0x01, 0x50, 0x57, 0x0A } },
+        { JVC_QUERY_INPUT, { 0x3F, 0x89, 0x01, 0x49, 0x50, 0x0A } },
+        { JVC_QUERY_PICTURE_MODE, { 0x3F, 0x89, 0x01, 0x50, 0x4D, 0x50, 0x4D, 0x0A } },
+        { JVC_QUERY_LIGHT_HOURS, { 0x3F, 0x89, 0x01, 0x49, 0x46, 0x4C, 0x54, 0x0A } },
+        { JVC_QUERY_MODEL, { 0x3F, 0x89, 0x01, 0x4D, 0x44, 0x0A } },
+        { JVC_QUERY_SIGNAL, { 0x3F, 0x89, 0x01, 0x53, 0x43, 0x0A } },
+        { JVC_QUERY_SOFTWARE_VERSION, { 0x3F, 0x89, 0x01, 0x49, 0x46, 0x53, 0x56, 0x0A } },
+    };
+
+    if (expected.size() != JVC_QUERY_COUNT) {
+        spdlog::error("QueryCommands: not every query is covered");
+        return 1;
+    }
+
+    for (auto &entry : expected) {
+        size_t length;
+        const unsigned char* command = jvcQueryCommand(entry.first, &length);
+        if (vector<unsigned char>(command, command + length) != entry.second) {
+            spdlog::error("QueryCommands: wrong command for {}", jvcQueryName(entry.first));
+            return 1;
+        }
+    }
+
+    spdlog::info("QueryCommands: OK");
+    return 0;
+}
+
+/**
+ * Decode one response of each kind, and reject malformed ones.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testDecode() {
+    JvcValue value;
+
+    const vector<pair<unsigned char, int>> powerStates {
+        { 0x30, JVC_POWER_STANDBY },
+        { 0x31, JVC_POWER_ON },
+        { 0x32, JVC_POWER_COOLING },
+        { 0x33, JVC_POWER_WARMING },
+        { 0x34, JVC_POWER_EMERGENCY },
+    };
+    for (auto &state : powerStates) {
+        if (!decode(JVC_QUERY_POWER, { 0x40, 0x89, 0x01, 0x50, 0x57, state.first }, value)
+                || value.kind != JVC_VALUE_CODE || value.number != state.second) {
+            spdlog::error("Decode: power state {:X}", state.first);
+            return 1;
+        }
+    }
+
+    if (!decode(JVC_QUERY_INPUT, { 0x40, 0x89, 0x01, 0x49, 0x50, 0x37 }, value) || value.number != JVC_INPUT_HDMI2) {
+        spdlog::error("Decode: input");
+        return 1;
+    }
+
+    // User 1 picture mode
+    if (!decode(JVC_QUERY_PICTURE_MODE, { 0x40, 0x89, 0x01, 0x50, 0x4D, 0x30, 0x43 }, value) || value.number != 0x0C) {
+        spdlog::error("Decode: picture mode");
+        return 1;
+    }
+
+    // 0x04B0 = 1200 hours
+    if (!decode(JVC_QUERY_LIGHT_HOURS, { 0x40, 0x89, 0x01, 0x49, 0x46, 0x30, 0x34, 0x42, 0x30 }, value)
+            || value.kind != JVC_VALUE_NUMBER || value.number != 1200) {
+        spdlog::error("Decode: light hours");
+        return 1;
+    }
+
+    if (!decode(JVC_QUERY_MODEL, { 0x40, 0x89, 0x01, 0x4D, 0x44, 'I', 'L', 'A', 'F', 'P', 'J', ' ', '-', '-', ' ', 'B', '5', 'B', '1' }, value)
+            || value.kind != JVC_VALUE_TEXT || strcmp(value.text, "ILAFPJ -- B5B1") != 0) {
+        spdlog::error("Decode: model");
+        return 1;
+    }
+
+    if (!decode(JVC_QUERY_SIGNAL, { 0x40, 0x89, 0x01, 0x53, 0x43, 0x31 }, value) || value.number != JVC_SIGNAL_VALID) {
+        spdlog::error("Decode: signal");
+        return 1;
+    }
+
+    if (decode(JVC_QUERY_POWER, { 0x06, 0x89, 0x01, 0x50, 0x57 }, value)) {
+        spdlog::error("Decode: accepted an ACK as a response");
+        return 1;
+    }
+    if (decode(JVC_QUERY_POWER, { 0x40, 0x89, 0x02, 0x50, 0x57, 0x31 }, value)) {
+        spdlog::error("Decode: accepted a wrong unit ID");
+        return 1;
+    }
+    if (decode(JVC_QUERY_POWER, { 0x40, 0x89, 0x01, 0x49, 0x50, 0x31 }, value)) {
+        spdlog::error("Decode: accepted a response to another command");
+        return 1;
+    }
+    if (decode(JVC_QUERY_LIGHT_HOURS, { 0x40, 0x89, 0x01, 0x49, 0x46, 0x30, 0x34, 0x42 }, value)) {
+        spdlog::error("Decode: accepted a short value");
+        return 1;
+    }
+    if (decode(JVC_QUERY_PICTURE_MODE, { 0x40, 0x89, 0x01, 0x50, 0x4D, 0x30, 0x5A }, value)) {
+        spdlog::error("Decode: accepted a non-hex value");
+        return 1;
+    }
+
+    spdlog::info("Decode: OK");
+    return 0;
+}
+
+/**
+ * Compare the cost of parsing a power status reply with the framer against
+ * the previous path: zeroed 4 KB buffers and a memcmp chain over full replies.
+ *
+ * @return  void
+ */
+void benchmark() {
+    const unsigned char reply[] { 0x06, 0x89, 0x01, 0x50, 0x57, 0x0A, 0x40, 0x89, 0x01, 0x50, 0x57, 0x33, 0x0A };
+    const unsigned char standby[] { 0x06, 0x89, 0x01, 0x50, 0x57, 0x0A, 0x40, 0x89, 0x01, 0x50, 0x57, 0x30, 0x0A };
+    const unsigned char on[] { 0x06, 0x89, 0x01, 0x50, 0x57, 0x0A, 0x40, 0x89, 0x01, 0x50, 0x57, 0x31, 0x0A };
+    const unsigned char cooling[] { 0x06, 0x89, 0x01, 0x50, 0x57, 0x0A, 0x40, 0x89, 0x01, 0x50, 0x57, 0x32, 0x0A };
+    const unsigned char warming[] { 0x06, 0x89, 0x01, 0x50, 0x57, 0x0A, 0x40, 0x89, 0x01, 0x50, 0x57, 0x33, 0x0A };
+    volatile int sink { 0 };
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        unsigned char response[4096] { 0 };
+        char buffer[4096] { 0 };
+        memcpy(response, reply, sizeof(reply));
+        sink = sink + buffer[i & 0xFF];
+        if (memcmp(response, standby, sizeof(standby)) == 0) { sink = 0; }
+        else if (memcmp(response, on, sizeof(on)) == 0) { sink = 1; }
+        else if (memcmp(response, cooling, sizeof(cooling)) == 0) { sink = 2; }
+        else if (memcmp(response, warming, sizeof(warming)) == 0) { sink = 3; }
+    }
+    auto legacy = chrono::steady_clock::now() - start;
+
+    JvcFramer framer;
+    JvcFrame frame;
+    const unsigned char* payload;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        memcpy(framer.writePtr(), reply, sizeof(reply));
+        framer.commit(sizeof(reply));
+        while (framer.next(frame)) {
+            if (frame.type == JVC_FRAME_RESPONSE && frame.payload(&payload) == 1) {
+                sink = payload[0] - 0x30;
+            }
+        }
+    }
+    auto framed = chrono::steady_clock::now() - start;
+
+    spdlog::info(
+        "Benchmark: memcmp path {:.1f} ns/reply, framer {:.1f} ns/reply",
+        chrono::duration<double, nano>(legacy).count() / BENCH_ITERATIONS,
+        chrono::duration<double, nano>(framed).count() / BENCH_ITERATIONS
+    );
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[JVC] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    int ret = testClassify() | testResync() | testSplitMerge() | testQueryCommands() | testDecode();
+    if (ret == 0) {
+        benchmark();
+    }
+    return ret;
+}
@@ -0,0 +1,185 @@
+#include <string.h>
+#include "jvc.hpp"
+
+// Header byte, unit ID (2 bytes) and command (2 bytes).
+const size_t HEADER_SIZE = 5;
+
+const unsigned char UNIT_ID[] { 0x89, 0x01 };
+
+/**
+ * Everything the decoder needs to know about one reference command.
+ */
+struct QuerySpec {
+    const char* name;
+    // The full command, terminator included.
+    unsigned char command[9];
+    size_t commandLength;
+    JvcValueKind kind;
+    // Exact number of data bytes in the response, or 0 for any.
+    size_t dataLength;
+};
+
+// Indexed by JvcQuery. Command codes are from the JVC D-ILA projector
+// RS-232C / LAN remote control specification.
+const QuerySpec QUERIES[JVC_QUERY_COUNT] {
+    { "power", { 0x3F, 0x89, 0x01, 'P', 'W', 0x0A }, 6, JVC_VALUE_CODE, 1 },
+    { "input", { 0x3F, 0x89, 0x01, 'I', 'P', 0x0A }, 6, JVC_VALUE_CODE, 1 },
+    { "picture mode", { 0x3F, 0x89, 0x01, 'P', 'M', 'P', 'M', 0x0A }, 8, JVC_VALUE_CODE, 2 },
+    { "light hours", { 0x3F, 0x89, 0x01, 'I', 'F', 'L', 'T', 0x0A }, 8, JVC_VALUE_NUMBER, 4 },
+    { "model", { 0x3F, 0x89, 0x01, 'M', 'D', 0x0A }, 6, JVC_VALUE_TEXT, 0 },
+    { "signal", { 0x3F, 0x89, 0x01, 'S', 'C', 0x0A }, 6, JVC_VALUE_CODE, 1 },
+    { "software version", { 0x3F, 0x89, 0x01, 'I', 'F', 'S', 'V', 0x0A }, 8, JVC_VALUE_TEXT, 0 },
+};
+
+/**
+ * Value of an ASCII hex digit, or -1.
+ *
+ * @return  int
+ */
+int hexDigit(unsigned char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+bool JvcFrame::isFor(const unsigned char* command) const {
+    return length >= HEADER_SIZE && data[3] == command[0] && data[4] == command[1];
+}
+
+size_t JvcFrame::payload(const unsigned char** payload) const {
+    if (length <= HEADER_SIZE) {
+        *payload = nullptr;
+        return 0;
+    }
+    *payload = data + HEADER_SIZE;
+    return length - HEADER_SIZE;
+}
+
+unsigned char* JvcFramer::writePtr() {
+    // Move the unfinished frame to the front once the tail runs short.
+    if (start_ > 0 && BUFFER_SIZE - end_ < JVC_MAX_FRAME_SIZE) {
+        memmove(buffer_, buffer_ + start_, end_ - start_);
+        end_ -= start_;
+        scan_ -= start_;
+        start_ = 0;
+    }
+    return buffer_ + end_;
+}
+
+size_t JvcFramer::writeSpace() const {
+    return BUFFER_SIZE - end_;
+}
+
+void JvcFramer::commit(size_t count) {
+    end_ += count;
+}
+
+bool JvcFramer::next(JvcFrame &frame) {
+    while (true) {
+        const void* found = scan_ < end_ ? memchr(buffer_ + scan_, JVC_TERMINATOR, end_ - scan_) : nullptr;
+        if (!found) {
+            scan_ = end_;
+            if (end_ - start_ >= JVC_MAX_FRAME_SIZE) {
+                // No terminator where there must have been one. Drop the
+                // garbage and resynchronize on the next terminator.
+                discarded_++;
+                start_ = end_;
+            }
+            if (start_ == end_) {
+                start_ = end_ = scan_ = 0;
+            }
+            return false;
+        }
+
+        const unsigned char* terminator = static_cast<const unsigned char*>(found);
+        const size_t frameStart = start_;
+        const size_t frameLength = terminator - (buffer_ + frameStart);
+        start_ = scan_ = frameStart + frameLength + 1;
+
+        if (frameLength == 0) {
+            // Stray terminator
+            continue;
+        }
+
+        frame.data = buffer_ + frameStart;
+        frame.length = frameLength;
+        switch (frame.data[0]) {
+            case JVC_FRAME_ACK:
+            case JVC_FRAME_RESPONSE:
+                frame.type = static_cast<JvcFrameType>(frame.data[0]);
+                break;
+            default:
+                frame.type = JVC_FRAME_UNKNOWN;
+        }
+        return true;
+    }
+}
+
+size_t JvcFramer::buffered() const {
+    return end_ - start_;
+}
+
+void JvcFramer::reset() {
+    start_ = end_ = scan_ = 0;
+}
+
+uint64_t JvcFramer::discarded() const {
+    return discarded_;
+}
+
+const unsigned char* jvcQueryCommand(JvcQuery query, size_t* length) {
+    *length = QUERIES[query].commandLength;
+    return QUERIES[query].command;
+}
+
+const char* jvcQueryName(JvcQuery query) {
+    return query < JVC_QUERY_COUNT ? QUERIES[query].name : "unknown";
+}
+
+bool jvcDecode(JvcQuery query, const JvcFrame &frame, JvcValue &value) {
+    if (query >= JVC_QUERY_COUNT) {
+        return false;
+    }
+
+    const QuerySpec &spec = QUERIES[query];
+    if (frame.length < HEADER_SIZE
+            || frame.data[0] != JVC_FRAME_RESPONSE
+            || frame.data[1] != UNIT_ID[0]
+            || frame.data[2] != UNIT_ID[1]
+            || !frame.isFor(spec.command + 3)) {
+        return false;
+    }
+
+    const unsigned char* data;
+    size_t dataLength = frame.payload(&data);
+    if (dataLength == 0 || (spec.dataLength && dataLength != spec.dataLength)) {
+        return false;
+    }
+
+    value.query = query;
+    value.kind = spec.kind;
+    value.number = 0;
+    value.text[0] = '\0';
+
+    if (spec.kind == JVC_VALUE_TEXT) {
+        memcpy(value.text, data, dataLength);
+        value.text[dataLength] = '\0';
+        return true;
+    }
+
+    for (size_t i = 0; i < dataLength; i++) {
+        int digit = hexDigit(data[i]);
+        if (digit < 0) {
+            return false;
+        }
+        value.number = value.number << 4 | digit;
+    }
+    return true;
+}
@@ -0,0 +1,226 @@
+#ifndef JVC_H
+#define JVC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Every JVC frame ends with this byte.
+const unsigned char JVC_TERMINATOR = 0x0A;
+
+// Largest frame the framer accepts, terminator included.
+const size_t JVC_MAX_FRAME_SIZE = 64;
+
+/**
+ * Kind of a frame received from the projector, taken from its header byte.
+ */
+enum JvcFrameType {
+    JVC_FRAME_UNKNOWN = 0,
+    JVC_FRAME_ACK = 0x06,
+    JVC_FRAME_RESPONSE = 0x40,
+};
+
+/**
+ * One complete frame received from the projector.
+ *
+ * `data` points into the framer's buffer and stays valid until the next call
+ * to JvcFramer::writePtr(), JvcFramer::commit() or JvcFramer::reset().
+ */
+struct JvcFrame {
+    JvcFrameType type;
+    // The frame, starting with the header byte, without the terminator.
+    const unsigned char* data;
+    size_t length;
+
+    /**
+     * Whether the frame is about the given two-byte command, e.g. "PW".
+     *
+     * @param   unsigned char  command  The two command bytes.
+     *
+     * @return  bool
+     */
+    bool isFor(const unsigned char* command) const;
+
+    /**
+     * The bytes after the unit ID and command. Only responses carry any.
+     *
+     * @return  size_t  Number of data bytes, written to `payload`.
+     */
+    size_t payload(const unsigned char** payload) const;
+};
+
+/**
+ * Splits the byte stream of a projector session into frames.
+ *
+ * Bytes are read straight into the framer's buffer and frames are handed back
+ * as views into it, so nothing is copied or cleared per message. Any split of
+ * the stream into reads works: a read may hold part of a frame, several
+ * frames, or a frame and a half.
+ */
+class JvcFramer {
+public:
+    static const size_t BUFFER_SIZE = 256;
+
+    /**
+     * Where the next read should store its bytes.
+     *
+     * Invalidates frames returned earlier.
+     *
+     * @return  unsigned char*
+     */
+    unsigned char* writePtr();
+
+    /**
+     * How many bytes may be stored at writePtr().
+     *
+     * @return  size_t
+     */
+    size_t writeSpace() const;
+
+    /**
+     * Account for bytes stored at writePtr().
+     *
+     * @param   size_t  count  Number of bytes stored.
+     *
+     * @return  void
+     */
+    void commit(size_t count);
+
+    /**
+     * Take the next complete frame, if any.
+     *
+     * @param   JvcFrame  frame  Receives the frame.
+     *
+     * @return  bool             false if no complete frame is buffered.
+     */
+    bool next(JvcFrame &frame);
+
+    /**
+     * Number of buffered bytes that are not part of a returned frame yet.
+     *
+     * @return  size_t
+     */
+    size_t buffered() const;
+
+    /**
+     * Discard everything buffered, e.g. when the session is reopened.
+     *
+     * @return  void
+     */
+    void reset();
+
+    /**
+     * Number of oversized frames that were discarded to resynchronize.
+     *
+     * @return  uint64_t
+     */
+    uint64_t discarded() const;
+
+private:
+    unsigned char buffer_[BUFFER_SIZE];
+    // Start of the first byte not yet returned in a frame.
+    size_t start_ { 0 };
+    // End of the buffered bytes.
+    size_t end_ { 0 };
+    // Bytes in [start_, scan_) are known not to contain a terminator.
+    size_t scan_ { 0 };
+    uint64_t discarded_ { 0 };
+};
+
+/**
+ * Reference (0x3F) commands the decoder understands.
+ */
+enum JvcQuery {
+    JVC_QUERY_POWER,
+    JVC_QUERY_INPUT,
+    JVC_QUERY_PICTURE_MODE,
+    JVC_QUERY_LIGHT_HOURS,
+    JVC_QUERY_MODEL,
+    JVC_QUERY_SIGNAL,
+    JVC_QUERY_SOFTWARE_VERSION,
+    JVC_QUERY_COUNT,
+};
+
+/**
+ * Values of JVC_QUERY_POWER.
+ */
+enum JvcPower {
+    JVC_POWER_STANDBY = 0,
+    JVC_POWER_ON = 1,
+    JVC_POWER_COOLING = 2,
+    JVC_POWER_WARMING = 3,
+    JVC_POWER_EMERGENCY = 4,
+};
+
+/**
+ * Values of JVC_QUERY_INPUT.
+ */
+enum JvcInput {
+    JVC_INPUT_HDMI1 = 6,
+    JVC_INPUT_HDMI2 = 7,
+};
+
+/**
+ * Values of JVC_QUERY_SIGNAL.
+ */
+enum JvcSignal {
+    JVC_SIGNAL_NONE = 0,
+    JVC_SIGNAL_VALID = 1,
+};
+
+/**
+ * How a reference command encodes its value.
+ */
+enum JvcValueKind {
+    // A state code, sent as ASCII hex digits ("3", "0C").
+    JVC_VALUE_CODE,
+    // A counter, sent as ASCII hex digits ("04B0").
+    JVC_VALUE_NUMBER,
+    // Free text, e.g. the model name.
+    JVC_VALUE_TEXT,
+};
+
+/**
+ * The decoded value of a reference command response.
+ */
+struct JvcValue {
+    JvcQuery query;
+    JvcValueKind kind;
+    // JVC_VALUE_CODE and JVC_VALUE_NUMBER: the value. JvcPower, JvcInput
+    // and JvcSignal values for the matching queries.
+    int number;
+    // JVC_VALUE_TEXT: the value, NUL-terminated.
+    char text[JVC_MAX_FRAME_SIZE];
+};
+
+/**
+ * The complete command to send for a reference query.
+ *
+ * @param   JvcQuery  query   The query.
+ * @param   size_t    length  Receives the size of the command.
+ *
+ * @return  unsigned char*    Static storage, terminator included.
+ */
+const unsigned char* jvcQueryCommand(JvcQuery query, size_t* length);
+
+/**
+ * Decode the response frame of a reference query.
+ *
+ * Checks the header (0x40, unit ID 0x89 0x01, command echo) and the size of
+ * the data, then converts the data to the query's value kind.
+ *
+ * @param   JvcQuery  query  The query that was sent.
+ * @param   JvcFrame  frame  Its response frame.
+ * @param   JvcValue  value  Receives the value.
+ *
+ * @return  bool             false if the frame is not a valid response to the query.
+ */
+bool jvcDecode(JvcQuery query, const JvcFrame &frame, JvcValue &value);
+
+/**
+ * Name of a query, for logging.
+ *
+ * @return  char*
+ */
+const char* jvcQueryName(JvcQuery query);
+
+#endif
@@ -0,0 +1,98 @@
+#include "lan.hpp"
+#include "spdlog/spdlog.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+// A fake projector on this machine, listening on the JVC port.
+#define DEFAULT_HOST "127.0.0.1"
+
+const int DEFAULT_ITERATIONS { 200 };
+
+using namespace std;
+
+
+/**
+ * Run one operation repeatedly and log its latency distribution and throughput.
+ *
+ * @param   string    name        Name of the operation, for the report.
+ * @param   function  op          The operation. Returns a negative integer on error.
+ * @param   int       iterations  How many times to run it.
+ *
+ * @return  int                   Number of failed runs.
+ */
+int bench(const string &name, function<int()> op, int iterations) {
+    vector<double> latencies;
+    latencies.reserve(iterations);
+    int failures { 0 };
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        auto opStart = chrono::steady_clock::now();
+        if (op() < 0) {
+            failures++;
+        }
+        latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - opStart).count());
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    sort(latencies.begin(), latencies.end());
+    spdlog::warn(
+        "{:<18} n={} failed={} p50={:.0f}us p99={:.0f}us max={:.0f}us throughput={:.1f}/s",
+        name,
+        iterations,
+        failures,
+        latencies[latencies.size() / 2],
+        latencies[min(latencies.size() - 1, latencies.size() * 99 / 100)],
+        latencies.back(),
+        iterations / seconds
+    );
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[BENCH] %v");
+    // Results are logged as warnings so per-command logging can stay quiet.
+    spdlog::set_level(spdlog::level::warn);
+
+    if (argc > 3) {
+        spdlog::critical("Usage: lan-bench [HOST] [ITERATIONS]");
+        return -10;
+    }
+
+    setHost(argc > 1 ? argv[1] : DEFAULT_HOST);
+    const int iterations = argc > 2 ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+    if (iterations < 1) {
+        spdlog::critical("ITERATIONS must be positive");
+        return -10;
+    }
+
+    if (sendNull() < 0) {
+        spdlog::critical("Could not communicate with projector.");
+        return 1;
+    }
+
+    ProjectorStatus status;
+    int failures { 0 };
+    failures += bench("queryPowerStatus", queryPowerStatus, iterations);
+    failures += bench("sendOn", sendOn, iterations);
+    failures += bench("sendOff", sendOff, iterations);
+    failures += bench("status snapshot", [&status]() { return queryProjectorStatus(status); }, iterations);
+
+    closeSession();
+
+    CommandQueueStats queue = getCommandQueueStats();
+    TeardownStats teardown = getTeardownStats();
+    spdlog::warn(
+        "Queue executed={} coalesced={} timed_out={}; teardown released={} timed_out={} max={}us",
+        queue.executed,
+        queue.coalesced,
+        queue.timedOut,
+        teardown.released,
+        teardown.timedOut,
+        teardown.maxUs
+    );
+    return failures > 0 ? 1 : 0;
+}
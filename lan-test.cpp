@@ -1,6 +1,173 @@
 #include "lan.hpp"
 #include "spdlog/spdlog.h"
+#include <chrono>
+#include <thread>
 
+// A fake projector on this machine, listening on the JVC port.
+#define DEFAULT_HOST "127.0.0.1"
+
+const int BENCH_ROUNDS { 20 };
+
+using namespace std;
+
+
+/**
+ * Compare reading the status one query at a time with one pipelined batch.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int benchmarkStatus() {
+    const JvcQuery queries[] {
+        JVC_QUERY_POWER,
+        JVC_QUERY_INPUT,
+        JVC_QUERY_PICTURE_MODE,
+        JVC_QUERY_LIGHT_HOURS,
+        JVC_QUERY_SIGNAL,
+        JVC_QUERY_MODEL,
+    };
+    const int count = sizeof(queries) / sizeof(queries[0]);
+
+    // Keep per-command logging out of the measurement.
+    spdlog::set_level(spdlog::level::warn);
+
+    JvcValue value;
+    auto start = chrono::steady_clock::now();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (int i = 0; i < count; i++) {
+            if (queryReference(queries[i], value) < 0) {
+                return 1;
+            }
+        }
+    }
+    auto sequential = chrono::steady_clock::now() - start;
+
+    ProjectorStatus status;
+    start = chrono::steady_clock::now();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        if (queryProjectorStatus(status) < 0) {
+            return 1;
+        }
+    }
+    auto pipelined = chrono::steady_clock::now() - start;
+
+    spdlog::set_level(spdlog::level::debug);
+
+    spdlog::info(
+        "Status: power={} input={} picture_mode={:X} light_hours={} signal={} model='{}'",
+        status.power,
+        status.input,
+        status.pictureMode,
+        status.lightHours,
+        status.signal,
+        status.model
+    );
+    spdlog::info(
+        "{} sequential queries: {:.0f}us, one pipelined snapshot: {:.0f}us",
+        count,
+        chrono::duration<double, micro>(sequential).count() / BENCH_ROUNDS,
+        chrono::duration<double, micro>(pipelined).count() / BENCH_ROUNDS
+    );
+    return 0;
+}
+
+/**
+ * Check that a batch with more queries than the response buffer has room for
+ * is refused before anything is sent.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testBatchLimit() {
+    JvcQuery queries[JVC_QUERY_COUNT + 1];
+    JvcValue values[JVC_QUERY_COUNT + 1];
+    for (int i = 0; i <= JVC_QUERY_COUNT; i++) {
+        queries[i] = JVC_QUERY_POWER;
+    }
+
+    int ret = queryReferences(queries, JVC_QUERY_COUNT + 1, values);
+    if (ret != -2) {
+        spdlog::error("Batch limit: {} queries returned {}", JVC_QUERY_COUNT + 1, ret);
+        return 1;
+    }
+    spdlog::info("Batch limit: OK");
+    return 0;
+}
+
+/**
+ * Wait for the poller to observe a power status.
+ *
+ * @return  bool    false on timeout.
+ */
+bool waitForPower(int status, int timeoutMs) {
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+    while (getPowerSnapshot().status != status) {
+        if (chrono::steady_clock::now() > deadline) {
+            spdlog::error("Power status still {} instead of {}", getPowerSnapshot().status, status);
+            return false;
+        }
+        this_thread::sleep_for(chrono::milliseconds(50));
+    }
+    return true;
+}
+
+/**
+ * Cycle the power and check that ON during COOLING is sent once the host is
+ * in STANDBY, and that the transitions get measured.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testPowerStateMachine() {
+    // Generous for the fake projector's 3s transitions.
+    const int transitionMs = 15000;
+    startPowerPoller();
+
+    int ret = 1;
+    do {
+        setProjectorPower(false);
+        if (!waitForPower(JVC_POWER_STANDBY, transitionMs)) {
+            break;
+        }
+        if (setProjectorPower(false) != PROJECTOR_POWER_ALREADY) {
+            spdlog::error("State machine: OFF in STANDBY was not skipped");
+            break;
+        }
+        if (setProjectorPower(true) != PROJECTOR_POWER_SENT || !waitForPower(JVC_POWER_ON, transitionMs)) {
+            break;
+        }
+        if (setProjectorPower(false) != PROJECTOR_POWER_SENT) {
+            break;
+        }
+        // Changed our mind while it cools down.
+        if (setProjectorPower(true) != PROJECTOR_POWER_DEFERRED) {
+            spdlog::error("State machine: ON in COOLING was not deferred");
+            break;
+        }
+        // STANDBY only lasts until the deferred ON is accepted.
+        if (!waitForPower(JVC_POWER_ON, 2 * transitionMs)) {
+            spdlog::error("State machine: deferred ON was lost");
+            break;
+        }
+        ret = 0;
+    } while (0);
+
+    stopPowerPoller();
+
+    PowerTransitionStats stats = getPowerTransitionStats();
+    spdlog::info(
+        "State machine: warm-up={}ms ({} measured) cool-down={}ms ({} measured) already={} deferred={} sent={}",
+        stats.warmupMs,
+        stats.warmups,
+        stats.cooldownMs,
+        stats.cooldowns,
+        stats.already,
+        stats.deferred,
+        stats.deferredSent
+    );
+    if (ret == 0 && (stats.deferredSent != 1 || stats.warmups == 0 || stats.cooldowns == 0)) {
+        spdlog::error("State machine: transitions not measured or deferred ON not counted");
+        ret = 1;
+    }
+    return ret;
+}
 
 int main(int argc, char *argv[]) {
     spdlog::set_pattern("[LAN] [%^%l%$] %v");
@@ -22,7 +189,30 @@ int main(int argc, char *argv[]) {
     // } else {
     //     sendOn();
     // }
-    queryPowerStatus();
-    
-    return 0;
+    if (queryPowerStatus() < 0) {
+        return 1;
+    }
+
+    int ret = benchmarkStatus();
+    if (ret != 0) {
+        spdlog::error("Status benchmark failed");
+    }
+    if (testBatchLimit() != 0) {
+        ret = 1;
+    }
+    if (testPowerStateMachine() != 0) {
+        spdlog::error("Power state machine test failed");
+        ret = 1;
+    }
+
+    closeSession();
+
+    TeardownStats teardown = getTeardownStats();
+    spdlog::info(
+        "Session teardown: released={} timed_out={} max={}us",
+        teardown.released,
+        teardown.timedOut,
+        teardown.maxUs
+    );
+    return ret;
 }
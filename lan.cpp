@@ -4,13 +4,25 @@
 #include <string>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <poll.h>
 #include "spdlog/spdlog.h"
 #include "spdlog/fmt/bin_to_hex.h"
 #include "socket_with_timeout.h"
 #include <time.h>
-#include <thread>         // this_thread::sleep_for
-#include <chrono>         // chrono::seconds
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include <random>
+#include <mutex>
+#include <thread>
+#include <signal.h>
 #include "lan.hpp"
+#include "jvc.hpp"
+#include "histogram.hpp"
+#include "flight_recorder.hpp"
 
 using namespace std;
 
@@ -23,54 +35,249 @@ char HOST[15];
 
 const int SOCK_TIMEOUT_S = 5;
 const int SOCK_TIMEOUT_MS = SOCK_TIMEOUT_S * 1000;
-const int MAX_RESPONSE_SIZE = 4096;
+// Enough for one of each reference command, sent back to back.
+const int MAX_COMMAND_SIZE = 64;
+// The final frame of every command in a batch, each with its terminator.
+const int MAX_RESPONSE_SIZE = JVC_QUERY_COUNT * JVC_MAX_FRAME_SIZE;
 const int MAX_RETRY_COUNT = 5;
 
 const int POWER_QUERY_TTL_MS = 10000;
 
+// Background poll intervals, picked from the last observed power status.
+const int POLL_TRANSITION_MS = 1000;
+const int POLL_STEADY_MS = POWER_QUERY_TTL_MS;
+const int POLL_ERROR_MS = 5000;
+// Stop polling when nobody has read the power status for this long.
+const int POLL_IDLE_AFTER_MS = 60000;
+
+// Each measured WARMING or COOLING counts for 1/TRANSITION_LEARN_WEIGHT of
+// the learned duration.
+const int TRANSITION_LEARN_WEIGHT = 4;
+
+// Circuit breaker: open after this many consecutive failures, then probe the
+// host with an exponential backoff between these bounds.
+const int BREAKER_FAILURE_THRESHOLD = 3;
+const int BREAKER_MIN_BACKOFF_MS = 2000;
+const int BREAKER_MAX_BACKOFF_MS = 60000;
+
+// Bounds on waiting for the host to close its end of a session, and how many
+// teardowns to measure before the wait follows the observed distribution.
+const int TEARDOWN_MIN_WAIT_MS = 20;
+const int TEARDOWN_MAX_WAIT_MS = 500;
+const uint64_t TEARDOWN_LEARN_AFTER = 10;
+
+// How long a caller waits for its command to run before giving up.
+const int COMMAND_DEADLINE_MS = 15000;
+
+// Command queue priorities. Higher runs first.
+const int PRIORITY_QUERY = 0;
+const int PRIORITY_POWER = 1;
+
 const unsigned char ON_COMMAND[] { 0x21, 0x89, 0x01, 0x50, 0x57, 0x31, 0x0A };
 const unsigned char OFF_COMMAND[] { 0x21, 0x89, 0x01, 0x50, 0x57, 0x30, 0x0A };
-const unsigned char ON_OFF_ACK[] { 0x06, 0x89, 0x01, 0x50, 0x57, 0x0A };
+const unsigned char INPUT_HDMI1_COMMAND[] { 0x21, 0x89, 0x01, 0x49, 0x50, 0x36, 0x0A };
+const unsigned char INPUT_HDMI2_COMMAND[] { 0x21, 0x89, 0x01, 0x49, 0x50, 0x37, 0x0A };
 
-const unsigned char QUERY_POWER_COMMAND[] { 0x3F, 0x89, 0x01, 0x50, 0x57, 0x0A };
-const unsigned char STANDBY_ACK[] { 0x06, 0x89, 0x01, 0x50, 0x57, 0x0A, 0x40, 0x89, 0x01, 0x50, 0x57, 0x30, 0x0A };
-const unsigned char POWER_ON_ACK[] { 0x06, 0x89, 0x01, 0x50, 0x57, 0x0A, 0x40, 0x89, 0x01, 0x50, 0x57, 0x31, 0x0A };
-const unsigned char COOLING_ACK[] { 0x06, 0x89, 0x01, 0x50, 0x57, 0x0A, 0x40, 0x89, 0x01, 0x50, 0x57, 0x32, 0x0A };
-const unsigned char WARMING_ACK[] { 0x06, 0x89, 0x01, 0x50, 0x57, 0x0A, 0x40, 0x89, 0x01, 0x50, 0x57, 0x33, 0x0A };
-const unsigned char EMERGENCY_ACK[] { 0x06, 0x89, 0x01, 0x50, 0x57, 0x0A, 0x40, 0x89, 0x01, 0x50, 0x57, 0x34, 0x0A };
+const char* POWER_STATUS_NAMES[] { "STANDBY", "POWER_ON", "COOLING", "WARMING", "EMERGENCY" };
 
 const unsigned char NULL_COMMAND[] {0x21, 0x89, 0x01, 0x00, 0x00, 0x0A};
 
-bool has_active_connection = false;
+// Socket of the authenticated session with the projector, or -1 if closed.
+int session_sock { -1 };
+// Splits the bytes received on session_sock into frames.
+JvcFramer sessionFramer;
+
+/**
+ * Milliseconds on the monotonic clock.
+ *
+ * @return  int64_t
+ */
+int64_t monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000l + now.tv_nsec / 1000000l;
+}
+
+/**
+ * Microseconds on the monotonic clock.
+ *
+ * @return  int64_t
+ */
+int64_t monotonicUs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000l + now.tv_nsec / 1000l;
+}
+
+// How long the host took to release closed sessions.
+LatencyHistogram teardownHistogram;
+atomic<uint64_t> teardownTimeouts { 0 };
+
+/**
+ * How long to wait for the host to release a session.
+ *
+ * Starts at TEARDOWN_MAX_WAIT_MS and, once enough teardowns were measured,
+ * follows twice the observed p99.
+ *
+ * @return  int     Milliseconds.
+ */
+int teardownWaitMs() {
+    if (teardownHistogram.count() < TEARDOWN_LEARN_AFTER) {
+        return TEARDOWN_MAX_WAIT_MS;
+    }
+    int ms = (int)(2 * teardownHistogram.percentile(99) / 1000) + 1;
+    return clamp(ms, TEARDOWN_MIN_WAIT_MS, TEARDOWN_MAX_WAIT_MS);
+}
+
+/**
+ * Close the current session with the projector, if any.
+ *
+ * The projector only accepts a few connections, and a slot stays taken until
+ * it has closed its end. So after shutdown(), wait (bounded) for its FIN or
+ * RST before the next connection may be opened.
+ *
+ * @return  void
+ */
+void closeSession() {
+    if (session_sock < 0) {
+        return;
+    }
+
+    spdlog::debug("Closing session on socket {}", session_sock);
+
+    const int64_t start = monotonicUs();
+    const int waitMs = teardownWaitMs();
+    bool released { false };
+    char drain[JVC_MAX_FRAME_SIZE];
+
+    shutdown(session_sock, SHUT_WR);
+    while (true) {
+        int remainingMs = waitMs - (int)((monotonicUs() - start) / 1000);
+        if (remainingMs < 0) {
+            break;
+        }
+
+        struct pollfd pfd = { .fd = session_sock, .events = POLLIN | POLLRDHUP };
+        int rc = poll(&pfd, 1, remainingMs);
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rc <= 0) {
+            break;
+        }
 
+        // Late replies may still be in flight ahead of the FIN.
+        ssize_t readLen = recv(session_sock, drain, sizeof(drain), MSG_DONTWAIT);
+        if (readLen > 0 || (readLen < 0 && errno == EAGAIN)) {
+            continue;
+        }
+        released = true;
+        break;
+    }
+
+    const int64_t elapsedUs = monotonicUs() - start;
+    if (released) {
+        teardownHistogram.record(elapsedUs);
+        spdlog::debug("Host released session in {}us", elapsedUs);
+    } else {
+        teardownTimeouts++;
+        spdlog::debug("Host did not release session within {}ms", waitMs);
+    }
+
+    close(session_sock);
+    session_sock = -1;
+    sessionFramer.reset();
+}
+
+TeardownStats getTeardownStats() {
+    return TeardownStats {
+        teardownHistogram.count(),
+        teardownTimeouts.load(),
+        teardownHistogram.percentile(50),
+        teardownHistogram.percentile(99),
+        teardownHistogram.max(),
+        teardownWaitMs()
+    };
+}
 
-int sendCommand(const char* host, const unsigned char* code, int codeLen, unsigned char* response) {
-    if(has_active_connection) {
-        spdlog::warn("Active connection to host already established. Only one is allowed at a time. Aborting.");
-        return -9;
+/**
+ * Whether the current session is still usable.
+ *
+ * The projector closes idle connections on its own schedule. A pending FIN
+ * (or RST) shows up as a readable socket with nothing left to read, so this
+ * can be detected without sending anything.
+ *
+ * @return  bool
+ */
+bool isSessionAlive() {
+    if (session_sock < 0) {
+        return false;
     }
 
+    struct pollfd pfd = { .fd = session_sock, .events = POLLIN | POLLRDHUP };
+    int rc = poll(&pfd, 1, 0);
+    if (rc == 0) {
+        return true;
+    }
+    if (rc < 0 || (pfd.revents & (POLLERR | POLLHUP | POLLRDHUP))) {
+        return false;
+    }
+
+    // Readable without being asked anything: either the peer closed, or a
+    // stale reply is left over from an earlier exchange. Drop either way.
+    sessionFramer.reset();
+    ssize_t staleLen = recv(session_sock, sessionFramer.writePtr(), sessionFramer.writeSpace(), MSG_DONTWAIT);
+    if (staleLen <= 0) {
+        return false;
+    }
+    spdlog::warn("Discarded {} stale bytes from session", staleLen);
+    return true;
+}
+
+/**
+ * Read exactly `length` bytes from a socket.
+ *
+ * @return  bool    false if the socket failed or closed first.
+ */
+bool readExactly(int sock, char* buffer, size_t length) {
+    size_t total { 0 };
+    while (total < length) {
+        ssize_t readLen = read(sock, buffer + total, length - total);
+        if (readLen <= 0) {
+            return false;
+        }
+        total += readLen;
+    }
+    return true;
+}
+
+/**
+ * Open a socket to the host and complete the PJ_OK -> PJREQ -> PJACK handshake.
+ *
+ * @param   char  host  The IPv4 address of the projector.
+ *
+ * @return  int         0 if the session was established. A negative integer
+ *                      if an error was encountered.
+ */
+int openSession(const char* host) {
     int sock { 0 };
     struct sockaddr_in serv_addr;
 
-    char buffer[MAX_RESPONSE_SIZE] { 0 };
-    std::array<unsigned char, MAX_RESPONSE_SIZE> response_buffer;
+    // The handshake strings are not terminated, so read exactly their size.
+    char buffer[8] { 0 };
 
     int retCode { 0 };
 
     do {
-        has_active_connection = true;
-
         if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
             spdlog::error("Socket creation error");
             retCode = -1;
             break;
         }
 
-        const void* timeout = &SOCK_TIMEOUT_S;
-        socklen_t len = sizeof(int);
-        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, timeout, len);
-        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, timeout, len);
+        struct timeval timeout = { .tv_sec = SOCK_TIMEOUT_S, .tv_usec = 0 };
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 
         serv_addr.sin_family = AF_INET;
         serv_addr.sin_port = htons(PORT);
@@ -103,7 +310,7 @@ int sendCommand(const char* host, const unsigned char* code, int codeLen, unsign
         }
 
         // 1: Projector should send PJ_OK
-        if(read(sock, buffer, 4096) == -1) {
+        if(!readExactly(sock, buffer, strlen(OPEN))) {
             spdlog::error("Socket read error");
             retCode = -4;
             break;
@@ -119,10 +326,10 @@ int sendCommand(const char* host, const unsigned char* code, int codeLen, unsign
         memset(buffer, 0, sizeof(buffer));
 
         // 2: Reply with PJREQ
-        send(sock, REQUEST, strlen(REQUEST), 0);
+        send(sock, REQUEST, strlen(REQUEST), MSG_NOSIGNAL);
 
         // 3: Projector should send PJACK
-        if(read(sock, buffer, 4096) == -1) {
+        if(!readExactly(sock, buffer, strlen(ACK))) {
             spdlog::error("Socket read error");
             retCode = -4;
             break;
@@ -133,144 +340,1148 @@ int sendCommand(const char* host, const unsigned char* code, int codeLen, unsign
             retCode = -5;
             break;
         }
+    } while (0);
 
-        // 4: Send user command to projector
-        send(sock, code, codeLen, 0);
+    if (retCode < 0) {
+        if (sock > 0) {
+            close(sock);
+        }
+        return retCode;
+    }
 
-        // Clear buffer
-        memset(buffer, 0, sizeof(buffer));
+    spdlog::debug("Session established on socket {}", sock);
+    session_sock = sock;
+    sessionFramer.reset();
+    return 0;
+}
 
-        // Return response to caller
-        ssize_t respLen = read(sock, static_cast<void *>(&response_buffer), 4096);
-        if( respLen == -1) {
-            spdlog::error("Socket read error");
-            retCode = -4;
+/**
+ * Send commands over the open session and read back their replies.
+ *
+ * `code` holds one or more commands, each ending with 0x0A. They are sent
+ * back to back in one write and the replies are matched to them in order.
+ * Operation commands (0x21) are answered by a single ACK frame. Reference
+ * commands (0x3F) are answered by an ACK frame followed by a response frame.
+ * Frames that do not echo the expected command are skipped.
+ *
+ * @param   unsigned char   response      Receives the replies.
+ * @param   int             responseSize  Capacity of response.
+ *
+ * @return  int     The number of bytes written to response: the last frame
+ *                  of each command (its ACK or its response), each with its
+ *                  terminator. A negative integer if an error was encountered,
+ *                  -13 if the replies do not fit in response.
+ */
+int exchange(const unsigned char* code, int codeLen, unsigned char* response, int responseSize) {
+    if (send(session_sock, code, codeLen, MSG_NOSIGNAL) != codeLen) {
+        spdlog::debug("Socket send error: {}", strerror(errno));
+        return -6;
+    }
+    flightRecorder.recordProjector(FLIGHT_PROJECTOR_SENT, code, codeLen);
+
+    int respLen { 0 };
+    JvcFrame frame;
+    const unsigned char* next = code;
+    const unsigned char* end = code + codeLen;
+
+    while (next < end) {
+        const unsigned char* current = next;
+        const unsigned char* terminator = static_cast<const unsigned char*>(memchr(current, JVC_TERMINATOR, end - current));
+        next = terminator ? terminator + 1 : end;
+
+        // Header byte and unit ID come first, then the two command bytes.
+        const unsigned char* command = current + 3;
+        const int expectedFrames = current[0] == 0x3F ? 2 : 1;
+        int frames { 0 };
+
+        while (frames < expectedFrames) {
+            if (!sessionFramer.next(frame)) {
+                ssize_t readLen = read(session_sock, sessionFramer.writePtr(), sessionFramer.writeSpace());
+                if (readLen == 0) {
+                    spdlog::debug("Host closed the session");
+                    return -6;
+                }
+                if (readLen < 0) {
+                    spdlog::debug("Socket read error: {}", strerror(errno));
+                    return -4;
+                }
+                sessionFramer.commit(readLen);
+                continue;
+            }
+            flightRecorder.recordProjector(FLIGHT_PROJECTOR_RECEIVED, frame.data, frame.length);
+
+            const JvcFrameType expectedType = frames == 0 ? JVC_FRAME_ACK : JVC_FRAME_RESPONSE;
+            if (frame.type != expectedType || !frame.isFor(command)) {
+                spdlog::warn(
+                    "Skipping unexpected frame from host: {:Xpn}",
+                    spdlog::to_hex(frame.data, frame.data + frame.length)
+                );
+                continue;
+            }
+
+            frames++;
+        }
+
+        if (respLen + (int)frame.length + 1 > responseSize) {
+            spdlog::error("Replies from host exceed {} bytes", responseSize);
+            return -13;
+        }
+        memcpy(response + respLen, frame.data, frame.length);
+        respLen += frame.length;
+        response[respLen++] = JVC_TERMINATOR;
+    }
+
+    spdlog::debug(
+        "Received {} bytes from host: {:Xpn}",
+        respLen,
+        spdlog::to_hex(response, response + respLen)
+    );
+    return respLen;
+}
+
+int sendCommand(const char* host, const unsigned char* code, int codeLen, unsigned char* response, int responseSize) {
+    int retCode { 0 };
+
+    // A reused session may have been dropped by the host since it was last
+    // checked. In that case reconnect once and replay the command.
+    bool reused = isSessionAlive();
+    if (!reused) {
+        closeSession();
+    }
+
+    while (true) {
+        if (session_sock < 0) {
+            retCode = openSession(host);
+            if (retCode < 0) {
+                break;
+            }
+        }
+
+        retCode = exchange(code, codeLen, response, responseSize);
+        if (retCode >= 0) {
             break;
         }
 
-        spdlog::debug(
-            "Received {} bytes from host: {:Xpn}",
-            respLen,
-            spdlog::to_hex(std::begin(response_buffer), std::begin(response_buffer) + respLen)
-        );
-        memcpy(response, response_buffer.data(), respLen);
-        retCode = respLen;
-    } while (0);
+        // The rest of the replies are still unread, so the session is unusable.
+        closeSession();
+        if (!reused || retCode == -13) {
+            break;
+        }
+        spdlog::info("Session to host {} was dropped. Reconnecting.", host);
+        reused = false;
+    }
 
-    close(sock);
-    // Wait for host to close other end
-    this_thread::sleep_for(chrono::seconds(1));
-    has_active_connection = false;
     return retCode;
 }
 
-int sendCommandWithRetry(const char* host, const unsigned char* code, int codeLen, unsigned char* response) {
+
+// Circuit breaker for the host. While open, commands fail immediately
+// instead of waiting out connect timeouts against a host that is gone.
+enum BreakerState { BREAKER_CLOSED, BREAKER_OPEN, BREAKER_HALF_OPEN };
+atomic<int> breakerState { BREAKER_CLOSED };
+// monotonicMs() after which the next command probes the host.
+atomic<int64_t> breakerProbeAtMs { 0 };
+int consecutiveFailures { 0 };
+int breakerBackoffMs { 0 };
+minstd_rand breakerJitter { (unsigned int)time(nullptr) };
+
+/**
+ * Whether commands should fail fast right now.
+ *
+ * @return  bool
+ */
+bool isBreakerOpen() {
+    return breakerState.load(memory_order_acquire) == BREAKER_OPEN
+        && monotonicMs() < breakerProbeAtMs.load(memory_order_acquire);
+}
+
+/**
+ * Record a successful exchange with the host and close the breaker.
+ *
+ * @return  void
+ */
+void breakerSucceeded() {
+    if (breakerState.load() != BREAKER_CLOSED) {
+        spdlog::info("Host is reachable again. Closing circuit breaker.");
+    }
+    consecutiveFailures = 0;
+    breakerBackoffMs = 0;
+    breakerState.store(BREAKER_CLOSED, memory_order_release);
+}
+
+/**
+ * Record a failed exchange with the host, opening the breaker once failures
+ * pile up. Each failed probe doubles the backoff, up to BREAKER_MAX_BACKOFF_MS.
+ * The actual delay is picked at random from the upper half of the backoff, so
+ * retries do not fall into lockstep with the host's own timers.
+ *
+ * @return  void
+ */
+void breakerFailed() {
+    consecutiveFailures++;
+    if (breakerState.load() == BREAKER_CLOSED && consecutiveFailures < BREAKER_FAILURE_THRESHOLD) {
+        return;
+    }
+
+    breakerBackoffMs = breakerBackoffMs == 0
+        ? BREAKER_MIN_BACKOFF_MS
+        : min(breakerBackoffMs * 2, BREAKER_MAX_BACKOFF_MS);
+    uniform_int_distribution<int> jitter(breakerBackoffMs / 2, breakerBackoffMs);
+    int delayMs = jitter(breakerJitter);
+
+    spdlog::warn(
+        "Host unreachable after {} failures. Circuit breaker open, next probe in {}ms.",
+        consecutiveFailures,
+        delayMs
+    );
+    breakerProbeAtMs.store(monotonicMs() + delayMs, memory_order_release);
+    breakerState.store(BREAKER_OPEN, memory_order_release);
+}
+
+int sendCommandWithRetry(const char* host, const unsigned char* code, int codeLen, unsigned char* response, int responseSize) {
     int retCode { -1 };
     int retry { 0 };
     while (retCode < 0 && retry < MAX_RETRY_COUNT) {
+        if (isBreakerOpen()) {
+            spdlog::debug("Circuit breaker open. Not contacting host.");
+            return -11;
+        }
+
+        int state = BREAKER_OPEN;
+        if (breakerState.compare_exchange_strong(state, BREAKER_HALF_OPEN)) {
+            // Probe with a single attempt. Another failure reopens the breaker.
+            spdlog::info("Probing host {}", host);
+            retry = MAX_RETRY_COUNT - 1;
+        }
+
         spdlog::debug("sendCommandWithRetry attempt {} of {}", retry + 1, MAX_RETRY_COUNT);
-        retCode = sendCommand(host, code, codeLen, response);
+        retCode = sendCommand(host, code, codeLen, response, responseSize);
+        if (retCode == -13) {
+            // The host answered. Sending the batch again would overflow again.
+            breakerSucceeded();
+            break;
+        }
+        if (retCode < 0) {
+            breakerFailed();
+        } else {
+            breakerSucceeded();
+        }
         retry++;
     }
 
     return retCode;
 }
 
-struct timespec lastPowerQuery;
-int lastPowerQueryResult = -1;
+// Latest known power status, packed so readers never take a lock.
+// Bits 63-8 hold monotonicMs() of the observation, bits 7-0 hold status + 1.
+// 0 means nothing has been observed yet.
+atomic<uint64_t> powerSnapshot { 0 };
+
+/**
+ * The power state machine: the host's state as observed, and what to do
+ * once a transition ends.
+ */
+struct PowerState {
+    // @see queryPowerStatus. -1 until observed.
+    int status { -1 };
+    // monotonicMs() when the host entered `status`, and whether that is
+    // exact: when it accepted our command, rather than between two polls.
+    int64_t enteredMs { 0 };
+    bool enteredExactly { false };
+    // monotonicMs() of the latest observation.
+    int64_t seenMs { 0 };
+    // Power command to send once the transition ends: 1 ON, 0 OFF, -1 none.
+    int deferred { -1 };
+    // JvcInput to switch to once the host is POWER_ON, -1 none.
+    int deferredInput { -1 };
+    // The power command being submitted right now: 1 ON, 0 OFF, -1 none.
+    int sending { -1 };
+    // The power command setProjectorPower() sent last, until the next poll
+    // confirms it: 1 ON, 0 OFF, -1 none.
+    int sent { -1 };
+    PowerTransitionStats stats {};
+};
 
-void queryPowerStatusCacheClear() {
-    lastPowerQueryResult = -1;
+// Held while deciding on a power or input command, never while sending it.
+mutex powerStateMutex;
+PowerState powerState;
+// Whether powerState holds a deferred power or input command. Written with
+// powerStateMutex held, read without it.
+atomic<bool> powerDeferred { false };
+
+/**
+ * Refresh powerDeferred. Call with powerStateMutex held, after changing
+ * what is deferred.
+ *
+ * @return  void
+ */
+void updatePowerDeferred() {
+    powerDeferred.store(powerState.deferred >= 0 || powerState.deferredInput >= 0, memory_order_release);
 }
 
-int queryPowerStatus() {
-    spdlog::info("Sending QUERY_POWER_COMMAND to host");
-    char unsigned response[MAX_RESPONSE_SIZE] { 0 };
-    const int cmdSize = sizeof(QUERY_POWER_COMMAND);
-    int ret = sendCommandWithRetry(HOST, QUERY_POWER_COMMAND, cmdSize, response);
+/**
+ * The power status to decide on: the observed one, or the transition a
+ * power command being sent is about to start. Call with powerStateMutex held.
+ *
+ * @return  int     @see queryPowerStatus
+ */
+int decisionPowerStatus() {
+    const PowerState &state = powerState;
+    if (state.sending == 1 && state.status == JVC_POWER_STANDBY) {
+        return JVC_POWER_WARMING;
+    }
+    if (state.sending == 0 && state.status == JVC_POWER_ON) {
+        return JVC_POWER_COOLING;
+    }
+    return state.status;
+}
+
+/**
+ * Learned duration of a transition. Call with powerStateMutex held.
+ *
+ * @param   int  status  The transition, JVC_POWER_WARMING or JVC_POWER_COOLING.
+ *
+ * @return  int64_t      Milliseconds, 0 if not measured yet or not a transition.
+ */
+int64_t learnedDurationMs(int status) {
+    switch (status) {
+        case JVC_POWER_WARMING:
+            return powerState.stats.warmupMs;
+        case JVC_POWER_COOLING:
+            return powerState.stats.cooldownMs;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Fold a measured transition into the learned duration.
+ *
+ * @return  void
+ */
+void learnTransition(const char* name, int64_t &estimateMs, uint64_t &count, int64_t sampleMs) {
+    estimateMs = count == 0
+        ? sampleMs
+        : (estimateMs * (TRANSITION_LEARN_WEIGHT - 1) + sampleMs) / TRANSITION_LEARN_WEIGHT;
+    count++;
+    spdlog::info("{} took about {}ms, expecting {}ms from now on", name, sampleMs, estimateMs);
+}
+
+/**
+ * Record a power status observation and advance the state machine.
+ *
+ * A transition is measured from the moment the host accepted our command to
+ * halfway between the last poll that still saw it and the first that did not.
+ *
+ * @param   int   status    @see queryPowerStatus
+ * @param   bool  accepted  Whether this follows from the host accepting our
+ *                          command rather than from a query.
+ *
+ * @return  void
+ */
+void publishPowerStatus(int status, bool accepted = false) {
+    if (status < 0) {
+        return;
+    }
+    const int64_t now = monotonicMs();
+    powerSnapshot.store((uint64_t)now << 8 | (uint8_t)(status + 1), memory_order_release);
+
+    lock_guard<mutex> lock(powerStateMutex);
+    PowerState &state = powerState;
+    if (status != state.status) {
+        // A command only starts a transition from the state it is valid in.
+        const bool exact = accepted && (
+            (status == JVC_POWER_WARMING && state.status == JVC_POWER_STANDBY)
+            || (status == JVC_POWER_COOLING && state.status == JVC_POWER_ON)
+        );
+        const int64_t changedMs = accepted || state.status < 0 ? now : (state.seenMs + now) / 2;
+        if (state.enteredExactly && state.status == JVC_POWER_WARMING && status == JVC_POWER_ON) {
+            learnTransition("Warm-up", state.stats.warmupMs, state.stats.warmups, changedMs - state.enteredMs);
+        } else if (state.enteredExactly && state.status == JVC_POWER_COOLING && status == JVC_POWER_STANDBY) {
+            learnTransition("Cool-down", state.stats.cooldownMs, state.stats.cooldowns, changedMs - state.enteredMs);
+        }
+        state.status = status;
+        state.enteredMs = changedMs;
+        state.enteredExactly = exact;
+    }
+    state.seenMs = now;
+
+    if (accepted) {
+        return;
+    }
+    // The host acknowledges commands it then ignores. Catch an ON sent while
+    // it was cooling down, or an OFF while warming up, and retry it later.
+    if (state.deferred < 0 && ((state.sent == 1 && status == JVC_POWER_COOLING)
+            || (state.sent == 0 && status == JVC_POWER_WARMING))) {
+        spdlog::info("Host ignored {} while {}. Sending it again once it is done.",
+            state.sent ? "ON" : "OFF", POWER_STATUS_NAMES[status]);
+        state.deferred = state.sent;
+        state.stats.deferred++;
+        updatePowerDeferred();
+    }
+    state.sent = -1;
+}
+
+/**
+ * Whether a deferred power or input command waits for the poller to see its
+ * moment. Lock-free.
+ *
+ * @return  bool
+ */
+bool hasDeferredPowerCommand() {
+    return powerDeferred.load(memory_order_acquire);
+}
+
+mutex pollerMutex;
+condition_variable pollerWake;
+thread pollerThread;
+atomic<bool> pollerRunning { false };
+atomic<bool> pollerPaused { false };
+atomic<bool> pollRequested { false };
+atomic<bool> pollRescheduled { false };
+atomic<int64_t> lastDemandMs { 0 };
+
+/**
+ * Ask the poller to query the host now instead of at its next interval.
+ *
+ * @return  void
+ */
+void requestPowerPoll() {
+    pollRequested.store(true, memory_order_release);
+    pollerWake.notify_one();
+}
+
+/**
+ * Have the poller work out when its next query is due again, after the
+ * power state changed without a query.
+ *
+ * @return  void
+ */
+void reschedulePowerPoll() {
+    pollRescheduled.store(true, memory_order_release);
+    pollerWake.notify_one();
+}
+
+PowerSnapshot getPowerSnapshot() {
+    int64_t now = monotonicMs();
+    lastDemandMs.store(now, memory_order_relaxed);
+    if (pollerPaused.load(memory_order_relaxed)) {
+        requestPowerPoll();
+    }
+
+    uint64_t packed = powerSnapshot.load(memory_order_acquire);
+    if (packed == 0) {
+        return PowerSnapshot { -1, -1, false };
+    }
+    return PowerSnapshot {
+        (int)(packed & 0xFF) - 1,
+        now - (int64_t)(packed >> 8),
+        breakerState.load(memory_order_relaxed) != BREAKER_CLOSED
+    };
+}
+
+/**
+ * A command waiting in (or running from) the command queue.
+ */
+struct QueuedCommand {
+    unsigned char code[MAX_COMMAND_SIZE];
+    int codeLen;
+    int priority;
+    // Power commands: while pending, a newer power command replaces this one.
+    bool replaceable;
+    // Number of callers waiting for the result.
+    int waiters;
+    bool done;
+    int result;
+    unsigned char response[MAX_RESPONSE_SIZE];
+};
+
+mutex queueMutex;
+condition_variable queueChanged;
+deque<shared_ptr<QueuedCommand>> pendingCommands;
+shared_ptr<QueuedCommand> inflightCommand;
+// Whether some caller is currently running commands from the queue.
+bool queueBusy = false;
+uint64_t executedCount { 0 };
+uint64_t coalescedCount { 0 };
+uint64_t replacedCount { 0 };
+uint64_t timedOutCount { 0 };
+
+/**
+ * Whether a queued command sends exactly these bytes.
+ *
+ * @return  bool
+ */
+bool isSameCommand(const shared_ptr<QueuedCommand> &cmd, const unsigned char* code, int codeLen) {
+    return cmd && cmd->codeLen == codeLen && memcmp(cmd->code, code, codeLen) == 0;
+}
+
+/**
+ * Update the power status snapshot after the host accepted a power command.
+ *
+ * @return  void
+ */
+void onPowerCommandAccepted(const unsigned char* code, int codeLen) {
+    if (codeLen == sizeof(ON_COMMAND) && memcmp(code, ON_COMMAND, codeLen) == 0) {
+        // The host is at least warming up.
+        publishPowerStatus(JVC_POWER_WARMING, true);
+        reschedulePowerPoll();
+    } else if (codeLen == sizeof(OFF_COMMAND) && memcmp(code, OFF_COMMAND, codeLen) == 0) {
+        // The host is at least cooling down.
+        publishPowerStatus(JVC_POWER_COOLING, true);
+        reschedulePowerPoll();
+    }
+}
+
+/**
+ * Run queued commands, highest priority first, until `mine` is done.
+ *
+ * Only one caller runs the queue at a time. It also runs commands that other
+ * callers are waiting on, so the host only ever sees one command at a time.
+ *
+ * @param   unique_lock  lock  Holds queueMutex.
+ * @param   shared_ptr   mine  The command of the calling thread.
+ *
+ * @return  void
+ */
+void runQueue(unique_lock<mutex> &lock, const shared_ptr<QueuedCommand> &mine) {
+    queueBusy = true;
+
+    while (!mine->done && !pendingCommands.empty()) {
+        auto next = pendingCommands.begin();
+        for (auto it = pendingCommands.begin(); it != pendingCommands.end(); it++) {
+            if ((*it)->priority > (*next)->priority) {
+                next = it;
+            }
+        }
+
+        shared_ptr<QueuedCommand> cmd = *next;
+        pendingCommands.erase(next);
+        if (cmd->waiters == 0) {
+            spdlog::debug("Dropping command nobody waits for anymore");
+            continue;
+        }
+
+        inflightCommand = cmd;
+        lock.unlock();
+        int ret = sendCommandWithRetry(HOST, cmd->code, cmd->codeLen, cmd->response, sizeof(cmd->response));
+        if (ret >= 0) {
+            onPowerCommandAccepted(cmd->code, cmd->codeLen);
+        }
+        lock.lock();
+
+        inflightCommand.reset();
+        cmd->result = ret;
+        cmd->done = true;
+        executedCount++;
+        queueChanged.notify_all();
+    }
+
+    queueBusy = false;
+    // Let a waiting caller take over whatever is left.
+    queueChanged.notify_all();
+}
+
+/**
+ * Queue a command for the host and wait for its result.
+ *
+ * `code` may hold several commands back to back, which are then sent as one
+ * batch. A command identical to one that is pending or in flight is not sent again:
+ * the caller waits for that one instead. A power command replaces a pending
+ * power command, so a quick ON then OFF only sends the final OFF: the ON is
+ * completed with -14 without being sent.
+ *
+ * @param   unsigned char   code        The command(s) to send. Copied.
+ * @param   int             codeLen     Size of the command.
+ * @param   int             priority    PRIORITY_POWER or PRIORITY_QUERY.
+ * @param   bool            replaceable Whether this is a power command.
+ * @param   unsigned char   response    Receives the response, up to
+ *                                      MAX_RESPONSE_SIZE bytes. May be nullptr.
+ *
+ * @return  int     The number of bytes in the response. A negative integer
+ *                  if an error was encountered, -10 if the deadline passed,
+ *                  -11 if the circuit breaker is open, -13 if the replies
+ *                  did not fit in MAX_RESPONSE_SIZE, -14 if a newer power
+ *                  command replaced it before it was sent.
+ */
+int submitCommand(const unsigned char* code, int codeLen, int priority, bool replaceable, unsigned char* response) {
+    if (codeLen > MAX_COMMAND_SIZE) {
+        spdlog::error("Command of {} bytes is too large", codeLen);
+        return -2;
+    }
+
+    if (isBreakerOpen()) {
+        spdlog::debug("Circuit breaker open. Not queueing command.");
+        return -11;
+    }
+
+    unique_lock<mutex> lock(queueMutex);
+
+    shared_ptr<QueuedCommand> cmd;
+    if (replaceable) {
+        for (auto it = pendingCommands.begin(); it != pendingCommands.end(); it++) {
+            if (!(*it)->replaceable) {
+                continue;
+            }
+            if (isSameCommand(*it, code, codeLen)) {
+                cmd = *it;
+            } else {
+                // Its callers are told it was replaced, not sent.
+                spdlog::info("Replacing pending power command with a newer one");
+                (*it)->result = -14;
+                (*it)->done = true;
+                pendingCommands.erase(it);
+                replacedCount++;
+                queueChanged.notify_all();
+            }
+            break;
+        }
+    }
+    if (!cmd && isSameCommand(inflightCommand, code, codeLen)) {
+        cmd = inflightCommand;
+    }
+    if (!cmd) {
+        for (auto &pending : pendingCommands) {
+            if (isSameCommand(pending, code, codeLen)) {
+                cmd = pending;
+                break;
+            }
+        }
+    }
+
+    if (cmd) {
+        coalescedCount++;
+        spdlog::debug("Coalesced command with one already queued");
+    } else {
+        cmd = make_shared<QueuedCommand>();
+        memcpy(cmd->code, code, codeLen);
+        cmd->codeLen = codeLen;
+        cmd->priority = priority;
+        cmd->replaceable = replaceable;
+        cmd->waiters = 0;
+        cmd->done = false;
+        cmd->result = -1;
+        pendingCommands.push_back(cmd);
+    }
+    cmd->waiters++;
+
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(COMMAND_DEADLINE_MS);
+    while (!cmd->done) {
+        if (!queueBusy) {
+            runQueue(lock, cmd);
+            continue;
+        }
+        if (queueChanged.wait_until(lock, deadline) == cv_status::timeout && !cmd->done) {
+            cmd->waiters--;
+            timedOutCount++;
+            spdlog::warn("Timed out after {}ms waiting for the command queue", COMMAND_DEADLINE_MS);
+            return -10;
+        }
+    }
+
+    cmd->waiters--;
+    if (response && cmd->result > 0) {
+        memcpy(response, cmd->response, cmd->result);
+    }
+    return cmd->result;
+}
+
+CommandQueueStats getCommandQueueStats() {
+    lock_guard<mutex> lock(queueMutex);
+    return CommandQueueStats {
+        (int)pendingCommands.size(),
+        inflightCommand != nullptr,
+        executedCount,
+        coalescedCount,
+        replacedCount,
+        timedOutCount
+    };
+}
+
+int queryReferences(const JvcQuery* queries, int count, JvcValue* values) {
+    // The response buffer holds one response frame per query kind.
+    if (count > JVC_QUERY_COUNT) {
+        spdlog::error("Too many queries in one batch: {}", count);
+        return -2;
+    }
+
+    unsigned char command[MAX_COMMAND_SIZE];
+    int cmdSize { 0 };
+    for (int i = 0; i < count; i++) {
+        size_t length;
+        const unsigned char* code = jvcQueryCommand(queries[i], &length);
+        if (cmdSize + length > sizeof(command)) {
+            spdlog::error("Too many queries in one batch: {}", count);
+            return -2;
+        }
+        memcpy(command + cmdSize, code, length);
+        cmdSize += length;
+    }
+
+    if (count == 1) {
+        spdlog::info("Sending {} query to host", jvcQueryName(queries[0]));
+    } else {
+        spdlog::info("Sending {} queries to host", count);
+    }
+
+    unsigned char response[MAX_RESPONSE_SIZE];
+    int ret = submitCommand(command, cmdSize, PRIORITY_QUERY, false, response);
     if(ret < 0) {
         spdlog::error("Error communicating with host: {}", ret);
-    } else {
-        if(memcmp(response, STANDBY_ACK, sizeof(STANDBY_ACK)) == 0) {
-            spdlog::debug("Power status is STANDBY");
-            return 0;
+        return ret;
+    }
+
+    // One response frame per query, in order, each with its terminator.
+    const unsigned char* next = response;
+    const unsigned char* end = response + ret;
+    int decoded { 0 };
+    for (int i = 0; i < count && next < end; i++) {
+        const unsigned char* terminator = static_cast<const unsigned char*>(memchr(next, JVC_TERMINATOR, end - next));
+        size_t length = (terminator ? terminator : end) - next;
+        JvcFrame frame { JVC_FRAME_RESPONSE, next, length };
+        next += length + 1;
+
+        if (!jvcDecode(queries[i], frame, values[i])) {
+            spdlog::error(
+                "Invalid {} response: {:Xpn}",
+                jvcQueryName(queries[i]),
+                spdlog::to_hex(frame.data, frame.data + frame.length)
+            );
+            return -12;
         }
-        if(memcmp(response, POWER_ON_ACK, sizeof(POWER_ON_ACK)) == 0) {
-            spdlog::debug("Power status is POWER_ON");
-            return 1;
+        decoded++;
+    }
+    return decoded;
+}
+
+int queryReference(JvcQuery query, JvcValue &value) {
+    int ret = queryReferences(&query, 1, &value);
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * Send the power command held back by setProjectorPower(), if the last
+ * observation shows the transition it waited for has ended.
+ *
+ * The command is taken out of powerState, and marked as being sent, before
+ * it is submitted, so no lock is held while it waits in the command queue.
+ *
+ * @return  void
+ */
+void sendDeferredPowerCommand() {
+    if (!hasDeferredPowerCommand()) {
+        return;
+    }
+    int on;
+    {
+        lock_guard<mutex> lock(powerStateMutex);
+        on = powerState.deferred;
+        // Another power command is on its way. Decide after the next poll.
+        if (on < 0 || powerState.sending >= 0) {
+            return;
         }
-        if(memcmp(response, COOLING_ACK, sizeof(COOLING_ACK)) == 0) {
-            spdlog::debug("Power status is COOLING");
-            return 2;
+        const int status = powerState.status;
+        if ((on && (status == JVC_POWER_ON || status == JVC_POWER_WARMING))
+                || (!on && (status == JVC_POWER_STANDBY || status == JVC_POWER_COOLING))) {
+            // Got there some other way, e.g. the remote.
+            spdlog::info("Host is {}. Dropping deferred {}.", POWER_STATUS_NAMES[status], on ? "ON" : "OFF");
+            powerState.deferred = -1;
+            updatePowerDeferred();
+            return;
         }
-        if(memcmp(response, WARMING_ACK, sizeof(WARMING_ACK)) == 0) {
-            spdlog::debug("Power status is WARMING");
-            return 3;
+        if (status != (on ? JVC_POWER_STANDBY : JVC_POWER_ON)) {
+            return;
         }
-        if(memcmp(response, EMERGENCY_ACK, sizeof(EMERGENCY_ACK)) == 0) {
-            spdlog::debug("Power status is EMERGENCY");
-            return 4;
+        powerState.deferred = -1;
+        powerState.sending = on;
+        updatePowerDeferred();
+    }
+
+    spdlog::info("Host is {}. Sending deferred {}.", on ? "STANDBY" : "POWER_ON", on ? "ON" : "OFF");
+    const int result = on ? sendOn() : sendOff();
+    flightRecorder.recordDecision(on ? FLIGHT_TURN_ON : FLIGHT_TURN_OFF, result);
+
+    lock_guard<mutex> lock(powerStateMutex);
+    powerState.sending = -1;
+    if (result == 0) {
+        powerState.stats.deferredSent++;
+        powerState.sent = on;
+    }
+}
+
+/**
+ * Switch to the input held back by setProjectorInput(), if the last
+ * observation shows the host is POWER_ON.
+ *
+ * @return  void
+ */
+void sendDeferredInput() {
+    if (!hasDeferredPowerCommand()) {
+        return;
+    }
+    int input;
+    {
+        lock_guard<mutex> lock(powerStateMutex);
+        input = powerState.deferredInput;
+        if (input < 0 || decisionPowerStatus() != JVC_POWER_ON) {
+            return;
         }
-        spdlog::error("Unknown power status encountered.");
+        powerState.deferredInput = -1;
+        updatePowerDeferred();
     }
-    return -1;
+
+    spdlog::info("Host is POWER_ON. Sending deferred input {}.", input);
+    sendInput(input);
+}
+
+int queryProjectorStatus(ProjectorStatus &status) {
+    const JvcQuery queries[] {
+        JVC_QUERY_POWER,
+        JVC_QUERY_INPUT,
+        JVC_QUERY_PICTURE_MODE,
+        JVC_QUERY_LIGHT_HOURS,
+        JVC_QUERY_SIGNAL,
+        JVC_QUERY_MODEL,
+    };
+    JvcValue values[sizeof(queries) / sizeof(queries[0])];
+
+    int ret = queryReferences(queries, sizeof(queries) / sizeof(queries[0]), values);
+    if (ret < 0) {
+        return ret;
+    }
+
+    status.power = values[0].number;
+    status.input = values[1].number;
+    status.pictureMode = values[2].number;
+    status.lightHours = values[3].number;
+    status.signal = values[4].number;
+    strncpy(status.model, values[5].text, sizeof(status.model) - 1);
+    status.model[sizeof(status.model) - 1] = '\0';
+
+    publishPowerStatus(status.power <= JVC_POWER_EMERGENCY ? status.power : -1);
+    sendDeferredPowerCommand();
+    sendDeferredInput();
+    return 0;
+}
+
+int queryPowerStatus() {
+    JvcValue value;
+    int status { -1 };
+    if (queryReference(JVC_QUERY_POWER, value) == 0) {
+        if (value.number > JVC_POWER_EMERGENCY) {
+            spdlog::error("Unknown power status encountered: {}", value.number);
+        } else {
+            spdlog::debug("Power status is {}", POWER_STATUS_NAMES[value.number]);
+            status = value.number;
+        }
+    }
+    publishPowerStatus(status);
+    sendDeferredPowerCommand();
+    sendDeferredInput();
+    return status;
 }
 
 int queryPowerStatusCached() {
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
+    PowerSnapshot snapshot = getPowerSnapshot();
+    if (snapshot.status >= 0 && (snapshot.ageMs < POWER_QUERY_TTL_MS || isBreakerOpen())) {
+        spdlog::debug("Returning cached power status: {}{}", snapshot.status, snapshot.stale ? " (stale)" : "");
+        return snapshot.status;
+    }
 
-    if(lastPowerQueryResult == -1) {
-        lastPowerQueryResult = queryPowerStatus();
-        lastPowerQuery.tv_sec = now.tv_sec;
-        lastPowerQuery.tv_nsec = now.tv_nsec;
-        return lastPowerQueryResult;
+    return queryPowerStatus();
+}
+
+/**
+ * How long the poller should wait before its next query.
+ *
+ * Transitions are polled quickly so WARMING -> POWER_ON and COOLING -> STANDBY
+ * show up promptly, and once their duration is learned, only from shortly
+ * before they are due to end. Steady states change only when we send a
+ * command, and the host accepting one reschedules the poller.
+ *
+ * @param   int  status  The result of the last query.
+ *
+ * @return  int          Milliseconds.
+ */
+int nextPollInMs(int status) {
+    if (status < 0) {
+        return POLL_ERROR_MS;
     }
 
-    int ms_elapsed = (int)((now.tv_sec - lastPowerQuery.tv_sec) * 1000l
-                         + (now.tv_nsec - lastPowerQuery.tv_nsec) / 1000000l);
+    lock_guard<mutex> lock(powerStateMutex);
+    const PowerState &state = powerState;
+    int64_t dueMs;
+    switch (state.status) {
+        case JVC_POWER_WARMING:
+        case JVC_POWER_COOLING: {
+            dueMs = state.seenMs + POLL_TRANSITION_MS;
+            const int64_t durationMs = learnedDurationMs(state.status);
+            if (durationMs > 0) {
+                dueMs = max(dueMs, state.enteredMs + durationMs - POLL_TRANSITION_MS);
+            }
+            break;
+        }
+        default:
+            dueMs = state.seenMs + POLL_STEADY_MS;
+    }
+    return (int)max(dueMs - monotonicMs(), (int64_t)0);
+}
+
+/**
+ * Poll the host until stopPowerPoller() is called.
+ *
+ * @return  void
+ */
+void runPowerPoller() {
+    unique_lock<mutex> lock(pollerMutex);
+    auto wakeCondition = [] {
+        return pollRequested.load(memory_order_acquire) || !pollerRunning.load();
+    };
+    auto rescheduleCondition = [&wakeCondition] {
+        return wakeCondition() || pollRescheduled.load(memory_order_acquire);
+    };
+
+    while (pollerRunning) {
+        pollRequested.store(false, memory_order_release);
+        lock.unlock();
+        int status = queryPowerStatus();
+        lock.lock();
+
+        // Wait for the next poll, working out again when it is due whenever
+        // a command changes the power state in the meantime.
+        do {
+            pollRescheduled.store(false, memory_order_release);
+            // While the breaker is open, the next poll is the probe.
+            int waitMs = nextPollInMs(status);
+            if (isBreakerOpen()) {
+                waitMs = max(waitMs, (int)(breakerProbeAtMs.load() - monotonicMs()));
+            }
+            if (!pollerWake.wait_for(lock, chrono::milliseconds(waitMs), rescheduleCondition)) {
+                break;
+            }
+        } while (!wakeCondition());
+
+        // Nobody is reading the status: stop talking to the host until someone does.
+        while (pollerRunning && !pollRequested && !hasDeferredPowerCommand()
+                && monotonicMs() - lastDemandMs.load(memory_order_relaxed) > POLL_IDLE_AFTER_MS) {
+            if (!pollerPaused.exchange(true)) {
+                spdlog::debug("No power status readers. Pausing poller.");
+            }
+            pollerWake.wait_for(lock, chrono::milliseconds(POLL_STEADY_MS), wakeCondition);
+        }
+        if (pollerPaused.exchange(false)) {
+            spdlog::debug("Resuming poller.");
+        }
+    }
+}
+
+void startPowerPoller() {
+    if (pollerRunning.exchange(true)) {
+        return;
+    }
+    lastDemandMs.store(monotonicMs(), memory_order_relaxed);
+
+    // Keep process signals on the threads that wait for them.
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    pollerThread = thread(runPowerPoller);
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+void stopPowerPoller() {
+    if (!pollerRunning.exchange(false)) {
+        return;
+    }
+    {
+        lock_guard<mutex> lock(pollerMutex);
+        pollerWake.notify_one();
+    }
+    pollerThread.join();
+}
 
-    if(ms_elapsed >= POWER_QUERY_TTL_MS) {
-        lastPowerQueryResult = queryPowerStatus();
-        lastPowerQuery.tv_sec = now.tv_sec;
-        lastPowerQuery.tv_nsec = now.tv_nsec;
+/**
+ * Read the power status for isOn()/isOff().
+ *
+ * @return  int     @see queryPowerStatus
+ */
+int readPowerStatus() {
+    if (!pollerRunning) {
+        return queryPowerStatusCached();
     }
 
-    spdlog::debug("Returning cached power status: {}", lastPowerQueryResult);
-    return lastPowerQueryResult;
+    PowerSnapshot snapshot = getPowerSnapshot();
+    spdlog::debug(
+        "Power status snapshot: {} ({}ms old{})",
+        snapshot.status,
+        snapshot.ageMs,
+        snapshot.stale ? ", stale" : ""
+    );
+    return snapshot.status;
 }
 
 int sendOn() {
     spdlog::info("Sending ON_COMMAND to host");
-    unsigned char response[MAX_RESPONSE_SIZE] { 0 };
+    unsigned char response[MAX_RESPONSE_SIZE];
     const int cmdSize = sizeof(ON_COMMAND);
-    int ret = sendCommandWithRetry(HOST, ON_COMMAND, cmdSize, response);
+    int ret = submitCommand(ON_COMMAND, cmdSize, PRIORITY_POWER, true, response);
+    if (ret == -14) {
+        spdlog::info("ON_COMMAND was replaced by a newer power command");
+        return ret;
+    }
     if(ret < 0) {
         spdlog::error("Error communicating with host: {}", ret);
         return ret;;
     }
-    queryPowerStatusCacheClear();
     return 0;
 }
 
 int sendOff() {
     spdlog::info("Sending OFF_COMMAND to host");
-    unsigned char response[MAX_RESPONSE_SIZE] { 0 };
+    unsigned char response[MAX_RESPONSE_SIZE];
     const int cmdSize = sizeof(OFF_COMMAND);
-    int ret = sendCommandWithRetry(HOST, OFF_COMMAND, cmdSize, response);
+    int ret = submitCommand(OFF_COMMAND, cmdSize, PRIORITY_POWER, true, response);
+    if (ret == -14) {
+        spdlog::info("OFF_COMMAND was replaced by a newer power command");
+        return ret;
+    }
     if(ret < 0) {
         spdlog::error("Error communicating with host: {}", ret);
         return ret;
     }
-    queryPowerStatusCacheClear();
     return 0;
 }
 
+int sendInput(int input) {
+    spdlog::info("Sending input {} to host", input);
+    unsigned char response[MAX_RESPONSE_SIZE];
+    const unsigned char* code = input == JVC_INPUT_HDMI2 ? INPUT_HDMI2_COMMAND : INPUT_HDMI1_COMMAND;
+    int ret = submitCommand(code, sizeof(INPUT_HDMI1_COMMAND), PRIORITY_POWER, false, response);
+    if(ret < 0) {
+        spdlog::error("Error communicating with host: {}", ret);
+        return ret;
+    }
+    return 0;
+}
+
+/**
+ * The power status to decide on without asking the host, if it is known.
+ *
+ * It is while the poller follows the host, or if it was observed recently,
+ * or if it is a transition that has not lasted its learned duration yet.
+ *
+ * @return  int     @see queryPowerStatus
+ */
+int knownPowerStatus() {
+    const bool polled = pollerRunning && !pollerPaused;
+    lock_guard<mutex> lock(powerStateMutex);
+    const PowerState &state = powerState;
+    if (state.status < 0) {
+        return -1;
+    }
+    const int64_t now = monotonicMs();
+    if (polled || now - state.seenMs < POWER_QUERY_TTL_MS) {
+        return state.status;
+    }
+    const int64_t durationMs = learnedDurationMs(state.status);
+    if (durationMs > 0 && now < state.enteredMs + durationMs) {
+        return state.status;
+    }
+    return -1;
+}
+
+int setProjectorPower(bool on) {
+    // Marks the status as wanted, so the poller follows what happens next.
+    getPowerSnapshot();
+    if (knownPowerStatus() < 0) {
+        spdlog::debug("Power status unknown. Asking host.");
+        queryPowerStatus();
+    }
+
+    {
+        lock_guard<mutex> lock(powerStateMutex);
+        PowerState &state = powerState;
+        // This request replaces any deferred one.
+        state.deferred = -1;
+        if (!on) {
+            state.deferredInput = -1;
+        }
+        updatePowerDeferred();
+
+        // A command on its way counts as the transition it starts, so the
+        // host still gets one decision at a time.
+        const int status = decisionPowerStatus();
+        if ((on && (status == JVC_POWER_ON || status == JVC_POWER_WARMING))
+                || (!on && (status == JVC_POWER_STANDBY || status == JVC_POWER_COOLING))) {
+            state.stats.already++;
+            return PROJECTOR_POWER_ALREADY;
+        }
+        if (status == (on ? JVC_POWER_COOLING : JVC_POWER_WARMING)) {
+            const int64_t durationMs = status == state.status ? learnedDurationMs(status) : 0;
+            const int64_t remainingMs = state.enteredMs + durationMs - monotonicMs();
+            spdlog::info(
+                "Host is {}. Sending {} once it is done{}.",
+                POWER_STATUS_NAMES[status],
+                on ? "ON" : "OFF",
+                durationMs > 0 ? fmt::format(", in about {}ms", max(remainingMs, (int64_t)0)) : ""
+            );
+            state.deferred = on;
+            state.stats.deferred++;
+            updatePowerDeferred();
+            flightRecorder.recordDecision(on ? FLIGHT_DEFER_ON : FLIGHT_DEFER_OFF, status);
+            return PROJECTOR_POWER_DEFERRED;
+        }
+        state.sending = on;
+    }
+
+    const int result = on ? sendOn() : sendOff();
+    lock_guard<mutex> lock(powerStateMutex);
+    powerState.sending = -1;
+    if (result == 0) {
+        powerState.sent = on;
+    }
+    return result < 0 ? result : PROJECTOR_POWER_SENT;
+}
+
+int setProjectorInput(int input) {
+    if (input != JVC_INPUT_HDMI1 && input != JVC_INPUT_HDMI2) {
+        spdlog::error("Unknown input: {}", input);
+        return -2;
+    }
+
+    {
+        lock_guard<mutex> lock(powerStateMutex);
+        PowerState &state = powerState;
+        state.deferredInput = -1;
+        // The host ignores input commands unless it is on.
+        const int status = decisionPowerStatus();
+        if (status != JVC_POWER_ON) {
+            spdlog::info(
+                "Host is {}. Sending input {} once it is on.",
+                status < 0 ? "not known" : POWER_STATUS_NAMES[status],
+                input
+            );
+            state.deferredInput = input;
+            updatePowerDeferred();
+            return PROJECTOR_POWER_DEFERRED;
+        }
+        updatePowerDeferred();
+    }
+
+    const int result = sendInput(input);
+    return result < 0 ? result : PROJECTOR_POWER_SENT;
+}
+
+PowerTransitionStats getPowerTransitionStats() {
+    lock_guard<mutex> lock(powerStateMutex);
+    return powerState.stats;
+}
+
 int sendNull() {
     spdlog::info("Sending NULL_COMMAND to host");
-    unsigned char response[MAX_RESPONSE_SIZE] { 0 };
+    unsigned char response[MAX_RESPONSE_SIZE];
     const int cmdSize = sizeof(NULL_COMMAND);
-    int ret = sendCommandWithRetry(HOST, NULL_COMMAND, cmdSize, response);
+    int ret = submitCommand(NULL_COMMAND, cmdSize, PRIORITY_QUERY, false, response);
     if(ret < 0) {
         spdlog::error("Error communicating with host: {}", ret);
         return ret;
@@ -279,7 +1490,7 @@ int sendNull() {
 }
 
 bool isOn() {
-    int status = queryPowerStatusCached();
+    int status = readPowerStatus();
     if (status < 0) {
         throw runtime_error("Networking error: " + std::to_string(status));
     }
@@ -288,7 +1499,7 @@ bool isOn() {
 }
 
 bool isOff() {
-    int status = queryPowerStatusCached();
+    int status = readPowerStatus();
     if (status < 0) {
         throw runtime_error("Networking error: " + std::to_string(status));
     }
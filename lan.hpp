@@ -1,6 +1,100 @@
 #ifndef LAN_H
 #define LAN_H
 
+#include <stdint.h>
+#include "jvc.hpp"
+
+/**
+ * The latest observed power status of the host.
+ */
+struct PowerSnapshot {
+    // @see queryPowerStatus. -1 if nothing has been observed yet.
+    int status;
+    // Milliseconds since the status was observed. -1 if nothing has been observed yet.
+    int64_t ageMs;
+    // Whether the host is currently unreachable, so the status may be outdated.
+    bool stale;
+};
+
+/**
+ * Several reference values of the host, read in one go.
+ */
+struct ProjectorStatus {
+    // JvcPower
+    int power;
+    // JvcInput
+    int input;
+    // Picture mode code, e.g. 0x0C for User 1.
+    int pictureMode;
+    int lightHours;
+    // JvcSignal
+    int signal;
+    char model[32];
+};
+
+/**
+ * Counters of the projector command queue.
+ */
+struct CommandQueueStats {
+    // Commands waiting to be sent.
+    int depth;
+    // Whether a command is being sent right now.
+    bool inflight;
+    // Commands sent to the host.
+    uint64_t executed;
+    // Requests that were served by a command already queued or in flight.
+    uint64_t coalesced;
+    // Power commands replaced by a newer one before they were sent.
+    uint64_t replaced;
+    // Requests whose caller gave up waiting.
+    uint64_t timedOut;
+};
+
+/**
+ * How long the host takes to release a session after we close it.
+ */
+struct TeardownStats {
+    // Sessions the host released within the wait bound.
+    uint64_t released;
+    // Sessions it did not release in time.
+    uint64_t timedOut;
+    int64_t p50Us;
+    int64_t p99Us;
+    int64_t maxUs;
+    // The current wait bound, derived from the measurements.
+    int waitBoundMs;
+};
+
+/**
+ * What setProjectorPower() did.
+ */
+enum ProjectorPowerAction {
+    // The command was sent to the host.
+    PROJECTOR_POWER_SENT = 0,
+    // The host is already in, or on its way to, the requested state.
+    PROJECTOR_POWER_ALREADY = 1,
+    // The host rejects the command in its current transition, so it is sent
+    // once the transition ends.
+    PROJECTOR_POWER_DEFERRED = 2,
+};
+
+/**
+ * What the power state machine learned and did.
+ */
+struct PowerTransitionStats {
+    // Learned time spent WARMING and COOLING. 0 until measured.
+    int64_t warmupMs;
+    int64_t cooldownMs;
+    // Transitions measured.
+    uint64_t warmups;
+    uint64_t cooldowns;
+    // Requests that needed no command.
+    uint64_t already;
+    // Commands held back until a transition ended, and how many were sent then.
+    uint64_t deferred;
+    uint64_t deferredSent;
+};
+
 /**
  * Set the global projector host.
  *
@@ -11,11 +105,48 @@
 void setHost(char * host);
 void setHost(const char * host);
 
+/**
+ * Close the session with the projector.
+ *
+ * Commands keep one authenticated connection open and reuse it. A closed
+ * session is reopened transparently by the next command.
+ *
+ * @return  void
+ */
+void closeSession();
+
+/**
+ * Get measurements of how long the host takes to release closed sessions.
+ *
+ * closeSession() shuts down its side and then waits for the host to close its
+ * end, up to a bound learned from these measurements.
+ *
+ * @return  TeardownStats
+ */
+TeardownStats getTeardownStats();
+
+/**
+ * Get the counters of the projector command queue.
+ *
+ * All commands go through one queue so the host only sees one at a time.
+ * Power commands run before status queries, identical requests share one
+ * command, and a newer power command replaces a pending one. Callers wait up
+ * to a deadline for their turn instead of failing.
+ *
+ * After repeated failures a circuit breaker opens and commands fail
+ * immediately with -11. The host is then probed with an exponential backoff
+ * until it answers again.
+ *
+ * @return  CommandQueueStats
+ */
+CommandQueueStats getCommandQueueStats();
+
 /**
  * Send the NULL command for testing purposes.
  *
  * @return  int    0 if the command was sent successfully. A negative integer
- *                 if an error was encountered.
+ *                 if an error was encountered, -10 if it waited in the
+ *                 command queue for too long.
  */
 int sendNull();
 
@@ -23,7 +154,8 @@ int sendNull();
  * Send the Power On command.
  *
  * @return  int    0 if the command was sent successfully. A negative integer
- *                 if an error was encountered.
+ *                 if an error was encountered, -14 if an OFF replaced it
+ *                 before it was sent.
  */
 int sendOn();
 
@@ -31,13 +163,65 @@ int sendOn();
  * Send the Power Off/Standby command.
  *
  * @return  int    0 if the command was sent successfully. A negative integer
- *                 if an error was encountered.
+ *                 if an error was encountered, -14 if an ON replaced it
+ *                 before it was sent.
  */
 int sendOff();
 
+/**
+ * Send the input select command.
+ *
+ * @param   int  input  JVC_INPUT_HDMI1 or JVC_INPUT_HDMI2.
+ *
+ * @return  int    0 if the command was sent successfully. A negative integer
+ *                 if an error was encountered.
+ */
+int sendInput(int input);
+
+/**
+ * Bring the host to POWER_ON or STANDBY.
+ *
+ * The host only accepts ON in STANDBY and OFF in POWER_ON. A command that
+ * would be rejected mid-transition (ON while COOLING, OFF while WARMING) is
+ * held back and sent as soon as the poller sees the transition end. A later
+ * request replaces it. The host is only queried first if its state is not
+ * known: a recent observation, or a transition still within its learned
+ * duration, is enough.
+ *
+ * @param   bool  on    POWER_ON, or STANDBY.
+ *
+ * @return  int         A ProjectorPowerAction. A negative integer if an
+ *                      error was encountered. @see sendOn
+ */
+int setProjectorPower(bool on);
+
+/**
+ * Switch the host to an input.
+ *
+ * The host ignores input commands unless it is POWER_ON, so until then the
+ * input is held back and sent once the poller sees it on. A later input
+ * replaces it, and setProjectorPower(false) drops it.
+ *
+ * @param   int   input  JVC_INPUT_HDMI1 or JVC_INPUT_HDMI2.
+ *
+ * @return  int          PROJECTOR_POWER_SENT or PROJECTOR_POWER_DEFERRED. A
+ *                       negative integer if an error was encountered.
+ */
+int setProjectorInput(int input);
+
+/**
+ * Get the learned transition durations and the state machine's counters.
+ *
+ * @return  PowerTransitionStats
+ */
+PowerTransitionStats getPowerTransitionStats();
+
 /**
  * Whether the host is POWER_ON or WARMING mode.
  *
+ * While the power poller runs, this reads its latest snapshot and never
+ * touches the network.
+ *
  * @return  bool
  */
 bool isOn();
@@ -45,6 +229,9 @@ bool isOn();
 /**
  * Whether the host is in STANDBY or COOLING mode.
  *
+ * While the power poller runs, this reads its latest snapshot and never
+ * touches the network.
+ *
  * @return  bool    [return description]
  */
 bool isOff();
@@ -61,6 +248,45 @@ bool isOff();
  */
 int queryPowerStatus();
 
+/**
+ * Send a reference command and decode the response.
+ *
+ * @param   JvcQuery  query  The reference command to send.
+ * @param   JvcValue  value  Receives the decoded value.
+ *
+ * @return  int     0 if the value was decoded. A negative integer if an
+ *                  error was encountered, -12 if the response was invalid.
+ */
+int queryReference(JvcQuery query, JvcValue &value);
+
+/**
+ * Send several reference commands back to back in one session and decode the
+ * responses, matched to the queries in order.
+ *
+ * @param   JvcQuery  queries  The reference commands to send.
+ * @param   int       count    Number of queries, at most JVC_QUERY_COUNT.
+ * @param   JvcValue  values   Receives one decoded value per query.
+ *
+ * @return  int     The number of values decoded. A negative integer if an
+ *                  error was encountered, -2 if there are too many queries,
+ *                  -12 if a response was invalid, -13 if the responses were
+ *                  too large.
+ */
+int queryReferences(const JvcQuery* queries, int count, JvcValue* values);
+
+/**
+ * Read power, input, picture mode, light hours, signal and model at once.
+ *
+ * All queries share one session and one round of the command queue, so this
+ * costs about as much as a single queryPowerStatus().
+ *
+ * @param   ProjectorStatus  status  Receives the values.
+ *
+ * @return  int     0 on success. A negative integer if an error was
+ *                  encountered. @see queryReferences
+ */
+int queryProjectorStatus(ProjectorStatus &status);
+
 /**
  * Same as queryPowerStatus but caches the result for 10 seconds.
  *
@@ -72,4 +298,34 @@ int queryPowerStatus();
  */
 int queryPowerStatusCached();
 
+/**
+ * Get the latest observed power status without touching the network.
+ *
+ * While the host is unreachable this keeps returning the last known status,
+ * marked stale. Lock-free. Also marks the power status as wanted, which resumes a paused
+ * power poller.
+ *
+ * @return  PowerSnapshot
+ */
+PowerSnapshot getPowerSnapshot();
+
+/**
+ * Start polling the power status of the host in the background.
+ *
+ * The poll rate follows the power state: slow in STANDBY or POWER_ON, and
+ * paused while nobody reads the status. Once the durations of WARMING and
+ * COOLING have been learned, a transition is not polled until it is about to
+ * end, and then fast.
+ *
+ * @return  void
+ */
+void startPowerPoller();
+
+/**
+ * Stop the background power poller and wait for it to exit.
+ *
+ * @return  void
+ */
+void stopPowerPoller();
+
 #endif
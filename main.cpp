@@ -1,58 +1,240 @@
-#include <bcm_host.h>
 #include <iostream>
+#include <fstream>
 #include <stdexcept>
 #include <unistd.h>
 #include <stdlib.h>
 #include "spdlog/spdlog.h"
 #include <string.h>
 #include <signal.h>
-#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "cec.hpp"
+#include "cec_format.hpp"
+#include "cec_mock.hpp"
+#include "cec_sim.hpp"
 #include "lan.hpp"
 #include "fifo.hpp"
+#include "ring.hpp"
+#include "cec_dispatch.hpp"
+#include "cec_routes.hpp"
+#include "cec_devices.hpp"
+#include "cec_discovery.hpp"
+#include "cec_scheduler.hpp"
+#include "cec_volume.hpp"
+#include "flight_recorder.hpp"
+#include "histogram.hpp"
+#include "orchestrator.hpp"
+#include "power_reconciler.hpp"
+#include "reactor.hpp"
 
 using namespace std;
 
-bool want_run = true;
+// Runs signal, FIFO and CEC handlers on the main thread.
+Reactor reactor;
 
-// Mapping of logical to physical addresses
-unordered_map<CEC_AllDevices_T, uint8_t*> addressMap { 0 };
+// The CEC adapter.
+CECBackend *cecBackend { nullptr };
 
-const char OSD_NAME[] { "JVC NX7" };
+// CEC events waiting for the event loop.
+SpscRing<CECEvent, 64> cecEvents;
+// eventfd, written once per event pushed onto cecEvents.
+int cecEventsReady { -1 };
+// Fires when a transmit result or a held volume key is due.
+int cecTimer { -1 };
+// Runs the discovery pass at startup, which waits for replies the loop handles.
+thread cecDiscoveryThread;
+
+// What we know about the other devices on the bus, by logical address.
+CECDeviceTable cecDevices;
+
+// When each device last asked for our power status, to time the reply.
+chrono::steady_clock::time_point powerStatusRequestedAt[CEC_LOGICAL_ADDRESS_COUNT];
+// From a GiveDevicePowerStatus to the acknowledgement of our reply, in microseconds.
+LatencyHistogram powerReplyLatency;
+
+// Upper bound on the discovery pass at startup.
+const int CEC_DISCOVERY_TIMEOUT_MS { 5000 };
+
+/**
+ * Pass the final outcome of a scheduled message to discovery. See CECTransmitResultHandler.
+ */
+void handleTransmitResult(void *context, const CECMessage &message, bool acknowledged);
+
+// Everything we send goes through here, replies first.
+CECTransmitScheduler cecScheduler(CEC_ADDRESS_TV, handleTransmitResult, nullptr);
+
+// A CEC step of a power plan gives up on its frames after this long. Each
+// attempt waits up to CEC_TRANSMIT_RESULT_MS, behind whatever was queued first.
+const int CEC_STEP_TIMEOUT_MS { 2 * (1 + CEC_TRANSMIT_RETRIES) * CEC_TRANSMIT_RESULT_MS };
+
+/**
+ * A CEC step of a power plan. Done once the event loop has run it and every
+ * frame it queued has its result.
+ */
+struct CECStep {
+	bool ran;
+	// Frames still waiting for their result, and frames not acknowledged.
+	int pending;
+	int failed;
+};
+
+// Guards every CECStep and cecStepsStopped.
+mutex cecStepsMutex;
+condition_variable cecStepsChanged;
+// Set once the event loop stops, so steps stop waiting on it.
+bool cecStepsStopped = false;
+// The step the event loop is running, if any. Only touched on the event loop.
+shared_ptr<CECStep> runningCECStep;
+// Frames queued by steps, waiting for their result. Only touched on the event loop.
+vector<pair<CECMessage, shared_ptr<CECStep>>> cecStepFrames;
+
+bool sameCECMessage(const CECMessage &a, const CECMessage &b) {
+	return a.follower == b.follower && a.length == b.length && memcmp(a.payload, b.payload, a.length) == 0;
+}
+
+/**
+ * Count the result of a frame for the steps waiting on it. Runs on the event loop.
+ *
+ * @param   CECMessage  message       The frame.
+ * @param   bool        acknowledged  Whether it was acknowledged.
+ *
+ * @return  void
+ */
+void settleCECStepFrames(const CECMessage &message, bool acknowledged) {
+	lock_guard<mutex> lock(cecStepsMutex);
+	for (auto it = cecStepFrames.begin(); it != cecStepFrames.end();) {
+		if (!sameCECMessage(it->first, message)) {
+			it++;
+			continue;
+		}
+		it->second->pending--;
+		it->second->failed += !acknowledged;
+		it = cecStepFrames.erase(it);
+	}
+	cecStepsChanged.notify_all();
+}
 
 /**
- * Return string representation of a message payload.
+ * Queue a frame. Runs on the event loop.
  *
- * @param unit8_t * payload The message payload as an array of bytes.
- * @param size_t length The length of the message.
+ * A frame queued while a power plan step runs holds the step until the
+ * frame's result comes.
  *
- * @return  string
+ * @return  int     @see CECTransmitScheduler::submit
  */
-string getOpcodeString(uint8_t* payload, size_t length) {
-	string content = "";
+int submitCEC(int follower, const uint8_t *payload, size_t length, CECLane lane) {
+	const shared_ptr<CECStep> step = runningCECStep;
+	if (!step) {
+		return cecScheduler.submit(follower, payload, length, lane);
+	}
 
-	if (!length) {
-		return content;
+	CECMessage message { (uint32_t)length, CEC_ADDRESS_TV, follower, {} };
+	memcpy(message.payload, payload, length);
+	{
+		// Before it is queued: a frame the backend refuses is reported at once.
+		lock_guard<mutex> lock(cecStepsMutex);
+		cecStepFrames.push_back({ message, step });
+		step->pending++;
 	}
 
-	for (size_t i = 0; i < length; i++) {
-		content += fmt::format("{:X} ", payload[i]);
+	const int result = cecScheduler.submit(follower, payload, length, lane);
+	if (result != 0 || !cecScheduler.isPending(message)) {
+		// Refused, or suppressed as a broadcast that was just sent. Either
+		// way no result is coming, unless it came already.
+		lock_guard<mutex> lock(cecStepsMutex);
+		auto frame = find_if(cecStepFrames.begin(), cecStepFrames.end(), [&](const pair<CECMessage, shared_ptr<CECStep>> &frame) {
+			return frame.second == step && sameCECMessage(frame.first, message);
+		});
+		if (frame != cecStepFrames.end()) {
+			step->pending--;
+			step->failed += result != 0;
+			cecStepFrames.erase(frame);
+		}
 	}
+	return result;
+}
 
-	content.pop_back();  // Remove trailing space
-	return content;
+/**
+ * Let steps still waiting on the event loop go, as it is stopping. Runs on
+ * the event loop.
+ *
+ * @return  void
+ */
+void stopCECSteps() {
+	lock_guard<mutex> lock(cecStepsMutex);
+	cecStepsStopped = true;
+	cecStepsChanged.notify_all();
+}
+
+/**
+ * Queue a CEC frame for the discovery pass, behind everything else. See CECTransmitFunction.
+ *
+ * Called on cecDiscoveryThread. The frame is queued from the event loop, so
+ * its result, and what discovery writes to cecDevices, is handled there too.
+ *
+ * @return  int     0 if the frame was handed to the event loop.
+ */
+int transmitCEC(void *context, int follower, const uint8_t *payload, size_t length) {
+	vector<uint8_t> bytes(payload, payload + length);
+	return reactor.post([follower, bytes]() {
+		// Discovery gives up on the frame once its result is overdue.
+		if (cecScheduler.submit(follower, bytes.data(), bytes.size(), CEC_LANE_BACKGROUND) != 0) {
+			spdlog::error("Failed to queue discovery frame for {}", follower);
+		}
+	}) ? 0 : -1;
 }
 
+CECDiscovery cecDiscovery(cecDevices, CEC_ADDRESS_TV, transmitCEC, nullptr);
+
+/**
+ * Queue a forwarded volume key. See CECTransmitFunction.
+ *
+ * @return  int     0 if the frame was queued.
+ */
+int transmitVolumeKey(void *context, int follower, const uint8_t *payload, size_t length) {
+	return cecScheduler.submit(follower, payload, length, CEC_LANE_REQUEST);
+}
+
+// Volume keys from the Roku's remote, on their way to the receiver.
+CECVolumeForwarder cecVolume(CEC_ADDRESS_AUDIO_SYSTEM, transmitVolumeKey, nullptr);
+
+void handleTransmitResult(void *context, const CECMessage &message, bool acknowledged) {
+	settleCECStepFrames(message, acknowledged);
+	if (acknowledged && message.length == 2 && message.payload[0] == CEC_OPCODE_REPORT_POWER_STATUS
+			&& message.follower < CEC_LOGICAL_ADDRESS_COUNT) {
+		powerReplyLatency.record(chrono::duration_cast<chrono::microseconds>(
+			chrono::steady_clock::now() - powerStatusRequestedAt[message.follower]
+		).count());
+	}
+	if (!cecVolume.onTransmitResult(message.follower, message.payload, message.length, acknowledged)) {
+		cecDiscovery.onTransmitResult(message.follower, message.payload, message.length, acknowledged);
+	}
+}
+
+const char OSD_NAME[] { "JVC NX7" };
+
+// Raspberry Pi uses Broadcom chipset.
+const uint32_t VENDOR_ID_BROADCOM { 0x18C086 };
+
 /**
  * Request the physical address of a logical address.
  *
- * @param CEC_AllDevices follower Logical address of the device.
+ * @param int follower Logical address of the device.
  */
-void getPhysicalAddress(CEC_AllDevices follower) {
+void getPhysicalAddress(int follower) {
 	spdlog::info("Get physical address for {}", follower);
 	uint8_t bytes[1];
-	bytes[0] = CEC_Opcode_GivePhysicalAddress;
-	if (vc_cec_send_message(follower,
-			bytes, 1, VC_FALSE) != 0) {
+	bytes[0] = CEC_OPCODE_GIVE_PHYSICAL_ADDRESS;
+	if (submitCEC(follower,
+			bytes, 1, CEC_LANE_REQUEST) != 0) {
 		spdlog::error( "Failed to request physical address.");
 	}
 }
@@ -60,81 +242,56 @@ void getPhysicalAddress(CEC_AllDevices follower) {
 /**
  * Set the stream path to a physical address.
  *
- * @param uint8_t * physicalAddress Array of bytes representing a device's physical address.
+ * @param uint16_t physicalAddress A device's physical address.
  */
-void setStreamPath(uint8_t * physicalAddress) {
-	string path = getOpcodeString(physicalAddress, 2);
-	spdlog::info("Set stream path to: {}", path);
+void setStreamPath(uint16_t physicalAddress) {
+	spdlog::info("Set stream path to: {}", CECPhysicalAddress { physicalAddress });
+	flightRecorder.recordDecision(FLIGHT_SET_STREAM_PATH, physicalAddress);
 	uint8_t bytes[3];
-	bytes[0] = CEC_Opcode_SetStreamPath;
-	bytes[1] = physicalAddress[0];
-	bytes[2] = physicalAddress[1];
-	if (vc_cec_send_message(CEC_BROADCAST_ADDR,
-			bytes, 3, VC_FALSE) != 0) {
+	bytes[0] = CEC_OPCODE_SET_STREAM_PATH;
+	bytes[1] = physicalAddress >> 8;
+	bytes[2] = physicalAddress & 0xFF;
+	if (submitCEC(CEC_ADDRESS_BROADCAST,
+			bytes, 3, CEC_LANE_BROADCAST) != 0) {
 		spdlog::error( "Failed to set stream path.");
 	}
 }
 
 // Marker to remember if we are waiting on a physical address to set the stream path.
+// Only touched on the event loop.
 bool want_set_stream_path = false;
 
 /**
- * Set the stream path to Playback1 device.
+ * Set the stream path to Playback1 device. Runs on the event loop.
+ *
+ * Until the Roku reports its physical address, asks for it instead and sets
+ * the stream path once it comes. A power plan step then only waits for the
+ * request.
  */
 void setStreamPathToPlayback1() {
-	uint8_t * address;
-	try {
-		address = addressMap.at(CEC_AllDevices_eDVD1);
-	} catch(const out_of_range &e) {
+	if (!cecDevices.hasPhysicalAddress(CEC_ADDRESS_PLAYBACK_1)) {
 		want_set_stream_path = true;
-		getPhysicalAddress(CEC_AllDevices_eDVD1);
+		getPhysicalAddress(CEC_ADDRESS_PLAYBACK_1);
 		return;
 	}
-	if (address) {
-		setStreamPath(address);
-	}
-}
-
-/**
- * Whether a CEC message is a device reporting physical address.
- *
- * @return  bool
- */
-bool isReportPhysicalAddress(VC_CEC_MESSAGE_T &message) {
-	return (
-		message.length > 1 &&
-		message.payload[0] == CEC_Opcode_ReportPhysicalAddress
-	);
+	setStreamPath(cecDevices.at(CEC_ADDRESS_PLAYBACK_1).physicalAddress);
 }
 
 /**
  * Handler for a CEC message that reports a device's physical address.
  *
- * @param VC_CEC_MESSAGE_T message The message to parse.
+ * @param CECMessage message The message to parse.
  */
-void handleReportPhysicalAddress(VC_CEC_MESSAGE_T &message) {
-	string content = getOpcodeString(message.payload, message.length);
-	spdlog::debug("handleReportPhysicalAddress: {}:{}", message.initiator, content);
+void handleReportPhysicalAddress(CECMessage &message) {
+	spdlog::debug("handleReportPhysicalAddress: {}", message);
 
-	// If an existing address exists, free the underlying int array.
-	try {
-		uint8_t * existingAddressPtr = addressMap.at(message.initiator);
-		addressMap.erase(message.initiator);
-		delete existingAddressPtr;
-	} catch(const out_of_range &e) { }
-
-	// Set (or replace) the address of the initiator
-	uint8_t * addressPtr = new uint8_t[2];
 	// Byte 0 of the payload is the command. Bytes 1-2 are the physical address.
-	addressPtr[0] = message.payload[1];
-	addressPtr[1] = message.payload[2];
-	addressMap[message.initiator] = addressPtr;
-
-	content = getOpcodeString(addressPtr, 2);
-	spdlog::debug("Set physical address to `{}` for logical address `{}`", content, message.initiator);
+	cecDevices.setPhysicalAddress(message.initiator, message.payload[1], message.payload[2]);
+	uint16_t physicalAddress = cecDevices.at(message.initiator).physicalAddress;
+	spdlog::debug("Set physical address to `{}` for logical address `{}`", CECPhysicalAddress { physicalAddress }, message.initiator);
 
-	if (want_set_stream_path) {
-		setStreamPath(addressPtr);
+	if (want_set_stream_path && message.initiator == CEC_ADDRESS_PLAYBACK_1) {
+		setStreamPath(physicalAddress);
 		want_set_stream_path = false;
 	}
 }
@@ -142,78 +299,70 @@ void handleReportPhysicalAddress(VC_CEC_MESSAGE_T &message) {
 /**
  * Turn off the TV.
  *
- * @return  void
+ * @return  int     0 if the TV is off or was told to turn off. @see setProjectorPower
  */
-void turnOffTV() {
-	try {
-		if (isOff()) {
+int turnOffTV() {
+	spdlog::info("Turning off the TV");
+	int result = setProjectorPower(false);
+	switch (result) {
+		case PROJECTOR_POWER_ALREADY:
 			spdlog::info("TV is already off!");
-			return;
-		}
-	} catch(const runtime_error& e) {
-		spdlog::warn("Exception caught in turnOffTV: {}", e.what());
-		// Assume TV is on
+			flightRecorder.recordDecision(FLIGHT_ALREADY_OFF, 0);
+			return 0;
+		case PROJECTOR_POWER_DEFERRED:
+			return 0;
 	}
 
-	spdlog::info("Turning off the TV");
-	if(sendOff() == 0) {
+	flightRecorder.recordDecision(FLIGHT_TURN_OFF, result);
+	if(result == 0) {
 		spdlog::info("TV turned off");
 	}
+	return result;
 }
 
 /**
  * Turn on the TV.
  *
- * @return  void
+ * @return  int     0 if the TV is on or was told to turn on. @see setProjectorPower
  */
-void turnOnTV() {
-
-	try {
-		if (isOn()) {
+int turnOnTV() {
+	spdlog::info("Turning on the TV");
+	int result = setProjectorPower(true);
+	switch (result) {
+		case PROJECTOR_POWER_ALREADY:
 			spdlog::info("TV is already on!");
-			return;
-		}
-	} catch(const runtime_error& e) {
-		spdlog::warn("Exception caught in turnOnTV: {}", e.what());
-		// Assume TV is off
+			flightRecorder.recordDecision(FLIGHT_ALREADY_ON, 0);
+			return 0;
+		case PROJECTOR_POWER_DEFERRED:
+			return 0;
 	}
 
-	spdlog::info("Turning on the TV");
-	if(sendOn() == 0) {
+	flightRecorder.recordDecision(FLIGHT_TURN_ON, result);
+	if(result == 0) {
 		spdlog::info("TV turned on");
 	}
+	return result;
 }
 
 /**
- * Check whether a CEC message means that a device requested ImageViewOn.
- *
- * @param   C_CEC_MESSAGE_T  message  The parsed CEC message.
- *
- * @return  bool
- */
-bool isImageViewOn(VC_CEC_MESSAGE_T &message) {
-	return (
-		message.length == 1 && (
-			message.payload[0] == CEC_Opcode_ImageViewOn ||
-			message.payload[0] == CEC_Opcode_TextViewOn
-		)
-	);
-}
-
-/**
- * Whether a CEC message indicates that the TV should switch to standby.
- *
- * @param   C_CEC_MESSAGE_T  message  The parsed CEC message.
+ * Ask the audio system to turn on and play the Roku's audio. Runs on the event loop.
  *
- * @return  bool
+ * @return  void
  */
-bool isTVOffCmd(VC_CEC_MESSAGE_T &message) {
-	return (
-		(message.follower == CEC_AllDevices_eTV || message.follower == CEC_BROADCAST_ADDR) &&
-		message.initiator != CEC_AllDevices_eTV &&
-		message.length == 1 &&
-		message.payload[0] == CEC_Opcode_Standby
-	);
+void wakeReceiver() {
+	// The source to route, or 0.0.0.0 (us) if the Roku has not reported its address yet.
+	uint16_t physicalAddress = cecDevices.hasPhysicalAddress(CEC_ADDRESS_PLAYBACK_1)
+		? cecDevices.at(CEC_ADDRESS_PLAYBACK_1).physicalAddress
+		: 0;
+	spdlog::info("Requesting system audio mode for {}", CECPhysicalAddress { physicalAddress });
+	uint8_t bytes[3];
+	bytes[0] = CEC_OPCODE_SYSTEM_AUDIO_MODE_REQUEST;
+	bytes[1] = physicalAddress >> 8;
+	bytes[2] = physicalAddress & 0xFF;
+	if (submitCEC(CEC_ADDRESS_AUDIO_SYSTEM,
+			bytes, 3, CEC_LANE_REQUEST) != 0) {
+		spdlog::error("Failed to request system audio mode.");
+	}
 }
 
 /**
@@ -224,52 +373,46 @@ bool isTVOffCmd(VC_CEC_MESSAGE_T &message) {
 void broadcastStandby() {
 	spdlog::info("Broadcasting standby");
 
-	if (vc_cec_send_Standby(CEC_BROADCAST_ADDR, false) != 0) {
+	uint8_t bytes[1];
+	bytes[0] = CEC_OPCODE_STANDBY;
+	if (submitCEC(CEC_ADDRESS_BROADCAST,
+			bytes, 1, CEC_LANE_BROADCAST) != 0) {
 		spdlog::error( "Failed to broadcast standby command.");
 	}
 }
 
-/**
- * Whether a CEC message is a request for this device's vendor ID.
- *
- * @param   C_CEC_MESSAGE_T  message  The parsed CEC message.
- *
- * @return  bool
- */
-bool isRequestForVendorId(VC_CEC_MESSAGE_T &message) {
-	return (
-		message.follower == CEC_AllDevices_eTV &&
-		message.length == 1 &&
-		message.payload[0] == CEC_Opcode_GiveDeviceVendorID
-	);
-}
-
 /**
  * Broadcast the vendor ID of this device.
- * Raspberry Pi uses Broadcom chipset. Vendor ID is 0x18C086L.
  *
  * @return  void
  */
 void broadcastVendorId() {
-	spdlog::info("Broadcasting Vendor ID {}", CEC_VENDOR_ID_BROADCOM);
-	if(vc_cec_set_vendor_id(CEC_VENDOR_ID_BROADCOM) != 0) {
+	spdlog::info("Broadcasting Vendor ID {}", VENDOR_ID_BROADCOM);
+	uint8_t bytes[4];
+	bytes[0] = CEC_OPCODE_DEVICE_VENDOR_ID;
+	bytes[1] = (VENDOR_ID_BROADCOM >> 16) & 0xFF;
+	bytes[2] = (VENDOR_ID_BROADCOM >> 8) & 0xFF;
+	bytes[3] = VENDOR_ID_BROADCOM & 0xFF;
+	if (cecScheduler.submit(CEC_ADDRESS_BROADCAST,
+			bytes, 4, CEC_LANE_BROADCAST) != 0) {
 		spdlog::error("Failed to reply with vendor ID.");
 	}
 }
 
 /**
- * Whether a CEC message is a request for this device's power status.
+ * The CEC power status for a projector power status.
  *
- * @param   C_CEC_MESSAGE_T  message  The parsed CEC message.
+ * @param   int      status  @see queryPowerStatus
  *
- * @return  bool
+ * @return  uint8_t          CECPowerStatus. Standby if the status is not known.
  */
-bool isRequestForPowerStatus(VC_CEC_MESSAGE_T &message) {
-	return (
-		message.follower == CEC_AllDevices_eTV &&
-		message.length == 1 &&
-		message.payload[0] == CEC_Opcode_GiveDevicePowerStatus
-	);
+uint8_t cecPowerStatus(int status) {
+	switch (status) {
+		case JVC_POWER_ON: return CEC_POWER_ON;
+		case JVC_POWER_WARMING: return CEC_POWER_ON_PENDING;
+		case JVC_POWER_COOLING: return CEC_POWER_STANDBY_PENDING;
+		default: return CEC_POWER_STANDBY;
+	}
 }
 
 /**
@@ -280,31 +423,188 @@ bool isRequestForPowerStatus(VC_CEC_MESSAGE_T &message) {
  * @return  void
  */
 void replyWithPowerStatus(int requestor) {
-	bool tv_is_on;
-	try {
-		tv_is_on = isOn();
-	} catch(const runtime_error& e) {
-		spdlog::warn("Exception caught in replyWithPowerStatus: {}", e.what());
-		return;
+	// Never wait on the projector: the snapshot is kept current by the power
+	// poller and by the acknowledgements of our own power commands.
+	PowerSnapshot snapshot = getPowerSnapshot();
+	if (snapshot.status < 0) {
+		spdlog::warn("Power status of TV is not known yet. Replying standby.");
+		flightRecorder.recordDecision(FLIGHT_POWER_STATUS_UNKNOWN, snapshot.status);
 	}
 
-	spdlog::info("Replying with power status: {}", tv_is_on);
+	uint8_t status = cecPowerStatus(snapshot.status);
+	spdlog::info(
+		"Replying with power status: {} ({}ms old{})",
+		cecPowerStatusName(status),
+		snapshot.ageMs,
+		snapshot.stale ? ", stale" : ""
+	);
 	uint8_t bytes[2];
-	bytes[0] = CEC_Opcode_ReportPowerStatus;
-	bytes[1] = tv_is_on ? CEC_POWER_STATUS_ON : CEC_POWER_STATUS_STANDBY;
-	if (vc_cec_send_message(requestor,
-			bytes, 2, VC_TRUE) != 0) {
+	bytes[0] = CEC_OPCODE_REPORT_POWER_STATUS;
+	bytes[1] = status;
+	flightRecorder.recordDecision(FLIGHT_POWER_STATUS_REPLY, bytes[1]);
+	if (cecScheduler.submit(requestor,
+			bytes, 2, CEC_LANE_REPLY) != 0) {
 		spdlog::error("Failed to reply with TV power status.");
 	}
 }
 
+// The projector input to switch to with the next power on, as a JvcInput. -1: leave it.
+atomic<int> desiredInput { -1 };
+
+/**
+ * Switch the projector to the input asked for over the FIFO, if any.
+ *
+ * @return  int     0 on success.
+ */
+int switchProjectorInput() {
+	const int input = desiredInput.exchange(-1);
+	if (input < 0) {
+		return 0;
+	}
+	return setProjectorInput(input) < 0;
+}
+
+/**
+ * Run a CEC step of a power plan on the event loop, which owns the device
+ * table and the stream path marker, and wait for the frames it queued to be
+ * transmitted. The step's timing in the plan is then the time on the bus.
+ *
+ * Steps handed over in order run in that order, so a step that follows
+ * another one still runs after it.
+ *
+ * @param   function  step  Queues its frames with submitCEC().
+ *
+ * @return  int       0 once every frame was acknowledged, the number of
+ *                    frames that were not, or -1 if the step did not run or
+ *                    its frames took longer than CEC_STEP_TIMEOUT_MS.
+ */
+int onEventLoop(function<void()> step) {
+	const shared_ptr<CECStep> cecStep = make_shared<CECStep>();
+	{
+		lock_guard<mutex> lock(cecStepsMutex);
+		if (cecStepsStopped) {
+			return -1;
+		}
+	}
+	const bool posted = reactor.post([cecStep, step]() {
+		runningCECStep = cecStep;
+		step();
+		runningCECStep.reset();
+		lock_guard<mutex> lock(cecStepsMutex);
+		cecStep->ran = true;
+		cecStepsChanged.notify_all();
+	});
+	if (!posted) {
+		return -1;
+	}
+
+	unique_lock<mutex> lock(cecStepsMutex);
+	const bool done = cecStepsChanged.wait_for(lock, chrono::milliseconds(CEC_STEP_TIMEOUT_MS), [&cecStep]() {
+		return cecStepsStopped || (cecStep->ran && cecStep->pending == 0);
+	});
+	if (!done) {
+		spdlog::warn("CEC step still waiting for its frames after {}ms", CEC_STEP_TIMEOUT_MS);
+		return -1;
+	}
+	if (!cecStep->ran || cecStep->pending > 0) {
+		return -1;
+	}
+	return cecStep->failed;
+}
+
+/**
+ * Power on: the projector over the LAN, then its input, while, on the CEC
+ * bus, the receiver wakes and then the Roku is routed to it.
+ *
+ * @return  Orchestration
+ */
+Orchestration buildPowerOn() {
+	Orchestration plan;
+	int on = plan.add("projector-on", turnOnTV);
+	plan.add("projector-input", switchProjectorInput, { on });
+	int wake = plan.add("receiver-wake", []() {
+		return onEventLoop(wakeReceiver);
+	});
+	plan.add("stream-path", []() {
+		return onEventLoop(setStreamPathToPlayback1);
+	}, { wake });
+	return plan;
+}
+
+/**
+ * Standby: the projector over the LAN and everything else over CEC, at once.
+ *
+ * @return  Orchestration
+ */
+Orchestration buildStandby() {
+	Orchestration plan;
+	plan.add("projector-off", turnOffTV);
+	plan.add("broadcast-standby", []() {
+		return onEventLoop(broadcastStandby);
+	});
+	return plan;
+}
+
+const Orchestration POWER_ON = buildPowerOn();
+const Orchestration STANDBY = buildStandby();
+
+/**
+ * Run a power plan and log how long it took, and what it was waiting on.
+ *
+ * @param   char *         what      Name for the log, e.g. "Power on".
+ * @param   Orchestration  plan      The plan.
+ * @param   function       obsolete  Returns true once the steps left should be skipped.
+ *
+ * @return  int                      The number of steps that failed.
+ */
+int runPowerPlan(const char *what, const Orchestration &plan, const function<bool()> &obsolete) {
+	OrchestrationResult result = plan.run(obsolete);
+	spdlog::info(
+		"{} took {:.1f}ms, critical path {:.1f}ms: {}{}{}",
+		what,
+		result.elapsedUs / 1000.0,
+		result.criticalPathUs / 1000.0,
+		result.criticalPathNames(),
+		result.failed ? fmt::format(" ({} steps failed)", result.failed) : "",
+		result.cancelled ? fmt::format(" ({} steps skipped as obsolete)", result.cancelled) : ""
+	);
+	for (const StepTiming &step : result.steps) {
+		spdlog::debug(
+			"  {}: {:.1f}-{:.1f}ms, result {}",
+			step.name,
+			step.startUs / 1000.0,
+			step.endUs / 1000.0,
+			step.result
+		);
+	}
+	return result.failed;
+}
+
+/**
+ * Bring the system to a power state. See PowerApplyFunction.
+ */
+int applyPower(bool on, const function<bool()> &obsolete) {
+	const int failed = runPowerPlan(on ? "Power on" : "Standby", on ? POWER_ON : STANDBY, obsolete);
+	if (on && desiredInput >= 0) {
+		// Asked for after the input step. The power request that came with
+		// it gets a run of its own.
+		spdlog::debug("Input {} asked for during power on. Powering on again.", desiredInput.load());
+		return failed + 1;
+	}
+	return failed;
+}
+
+// Every power request, from CEC and the FIFO, goes through here.
+PowerReconciler powerReconciler(applyPower);
+
 /**
  * Set the entire system to standby.
  */
 int systemStandby() {
 	spdlog::debug("systemStandby called");
-	turnOffTV();
-	broadcastStandby();
+	flightRecorder.recordDecision(FLIGHT_SYSTEM_STANDBY, 0);
+	desiredInput = -1;
+	powerReconciler.request(false, "FIFO");
 	return 1;
 }
 
@@ -313,232 +613,592 @@ int systemStandby() {
  */
 int systemActive() {
 	spdlog::debug("systemActive called");
-	turnOnTV();
-	setStreamPathToPlayback1();
+	flightRecorder.recordDecision(FLIGHT_SYSTEM_ACTIVE, 0);
+	powerReconciler.request(true, "FIFO");
+	return 1;
+}
+
+/**
+ * Switch the projector's input with the power on that comes with it. See
+ * f_input_callback. An input asked for while a power on is past its input
+ * step is switched by the run that follows.
+ */
+int systemInput(int input) {
+	spdlog::debug("systemInput called");
+	desiredInput = input == 2 ? JVC_INPUT_HDMI2 : JVC_INPUT_HDMI1;
 	return 1;
 }
 
 /**
- * Parse a CEC callback into a VC_CEC_MESSAGE_T struct.
+ * Reply to a GiveOSDName request.
  *
- * @return  bool    true if parsing was successful, false otherwise.
+ * @param   int   requestor  The CEC logical address of the device asking for the name.
  */
-bool parseCECMessage(VC_CEC_MESSAGE_T &message, uint32_t reason, uint32_t param1, uint32_t param2, uint32_t param3, uint32_t param4) {
-	int retval = vc_cec_param2message(reason, param1, param2, param3, param4, &message);
-	bool success = 0 == retval;
+void setOSDName(int requestor) {
+	spdlog::info("Replying with OSD name: {}", OSD_NAME);
+	uint8_t bytes[CEC_MAX_PAYLOAD_SIZE];
+	bytes[0] = CEC_OPCODE_SET_OSD_NAME;
+	size_t length = min(strlen(OSD_NAME), (size_t)CEC_OSD_NAME_SIZE - 1);
+	memcpy(&bytes[1], OSD_NAME, length);
+	if (cecScheduler.submit(requestor,
+			bytes, 1 + length, CEC_LANE_REPLY) != 0) {
+		spdlog::error("Failed to reply with OSD name.");
+	}
+}
 
-	string content = getOpcodeString(message.payload, message.length);
+/**
+ * Handler for ImageViewOn and TextViewOn: the TV is being told to turn on.
+ *
+ * @param CECMessage message The message.
+ */
+void onImageViewOn(CECMessage &message) {
+	spdlog::info("ImageViewOn message received.");
+	powerReconciler.request(true, "CEC");
+	// This will result in the audio system sending us back a message
+}
 
-	if(success) {
-		spdlog::debug(
-			"Translated to message: initiator={initiator:X} follower={follower:X} length={length:d} content={content}",
-			fmt::arg("initiator", message.initiator),
-			fmt::arg("follower", message.follower),
-			fmt::arg("length", message.length),
-			fmt::arg("content", content)
-		);
-	} else {
-		spdlog::warn("Not a valid message!");
-	}
+/**
+ * Handler for Standby: the TV is being told to go into standby.
+ *
+ * @param CECMessage message The message.
+ */
+void onStandby(CECMessage &message) {
+	spdlog::info("Standby message received.");
+	powerReconciler.request(false, "CEC");
+}
 
-	return success;
+/**
+ * Handler for GiveDeviceVendorID. Roku likes to ask for this.
+ *
+ * @param CECMessage message The message.
+ */
+void onGiveDeviceVendorID(CECMessage &message) {
+	spdlog::info("Vendor ID request message received.");
+	broadcastVendorId();
 }
 
 /**
- * Whether a CEC message is request for the OSD name.
+ * Handler for GiveDevicePowerStatus. Roku also likes to ask for this.
  *
- * @param VC_CEC_MESSAGE_T &message The CEC message.
+ * @param CECMessage message The message.
+ */
+void onGiveDevicePowerStatus(CECMessage &message) {
+	spdlog::info("Power status request message received.");
+	powerStatusRequestedAt[message.initiator] = chrono::steady_clock::now();
+	replyWithPowerStatus(message.initiator);
+}
+
+/**
+ * Handler for ReportPhysicalAddress.
  *
- * @return  bool
+ * @param CECMessage message The message.
  */
-bool isGiveOSDName(VC_CEC_MESSAGE_T &message) {
-	return (
-		message.length == 1 &&
-		message.payload[0] == CEC_Opcode_GiveOSDName
-	);
+void onReportPhysicalAddress(CECMessage &message) {
+	spdlog::info("Report physical address message received.");
+	handleReportPhysicalAddress(message);
 }
 
 /**
- * Reply to a GiveOSDName request.
+ * Handler for UserControlPressed: forward volume keys to the audio system.
+ *
+ * @param CECMessage message The message.
  */
-void setOSDName() {
-	spdlog::info("Replying with OSD name: {}", OSD_NAME);
-	vc_cec_set_osd_name(OSD_NAME);
+void onUserControlPressed(CECMessage &message) {
+	if (!cecVolume.onPressed(message.initiator, message.payload[1])) {
+		spdlog::debug("Ignoring key {:02X} from {}", message.payload[1], message.initiator);
+	}
 }
 
 /**
- * Callback function for host side notification.
- * This is the SAME as the callback function type defined in vc_cec.h
- * Host applications register a single callback for all CEC related notifications.
- * See vc_cec.h for meanings of all parameters
+ * Handler for UserControlReleased.
  *
- * @param callback_data is the context passed in by user in <DFN>vc_cec_register_callback</DFN>
+ * @param CECMessage message The message.
+ */
+void onUserControlReleased(CECMessage &message) {
+	cecVolume.onReleased(message.initiator);
+}
+
+/**
+ * Handler for GiveOSDName.
  *
- * @param reason bits 15-0 is VC_CEC_NOTIFY_T in vc_cec.h;
- *               bits 23-16 is the valid length of message in param1 to param4 (LSB of param1 is the byte0, MSB of param4 is byte15), little endian
- *               bits 31-24 is the return code (if any)
+ * @param CECMessage message The message.
+ */
+void onGiveOSDName(CECMessage &message) {
+	spdlog::info("Give OSD name message received.");
+	setOSDName(message.initiator);
+}
+
+/**
+ * Handler for DeviceVendorID: a device announcing its vendor.
  *
- * @param param1 is the first parameter
+ * @param CECMessage message The message.
+ */
+void onDeviceVendorID(CECMessage &message) {
+	cecDevices.setVendorId(message.initiator, &message.payload[1]);
+	spdlog::debug("Vendor ID of {} is {:06X}", message.initiator, cecDevices.at(message.initiator).vendorId);
+}
+
+/**
+ * Handler for SetOSDName: a device telling us its name.
  *
- * @param param2 is the second parameter
+ * @param CECMessage message The message.
+ */
+void onSetOSDName(CECMessage &message) {
+	cecDevices.setOSDName(message.initiator, &message.payload[1], message.length - 1);
+	spdlog::debug("OSD name of {} is {}", message.initiator, cecDevices.at(message.initiator).osdName);
+}
+
+/**
+ * Handler for CECVersion.
  *
- * @param param3 is the third parameter
+ * @param CECMessage message The message.
+ */
+void onCECVersion(CECMessage &message) {
+	cecDevices.setCECVersion(message.initiator, message.payload[1]);
+	spdlog::debug("CEC version of {} is {:X}", message.initiator, message.payload[1]);
+}
+
+/**
+ * Handler for ReportPowerStatus.
  *
- * @param param4 is the fourth parameter
+ * @param CECMessage message The message.
+ */
+void onReportPowerStatus(CECMessage &message) {
+	cecDevices.setPowerStatus(message.initiator, message.payload[1]);
+	spdlog::debug("Power status of {} is {}", message.initiator, message.payload[1]);
+}
+
+constexpr CECRouteTable<CECMessage> CEC_ROUTES = buildCECRoutes({
+	onImageViewOn,
+	onStandby,
+	onGiveDeviceVendorID,
+	onGiveDevicePowerStatus,
+	onReportPhysicalAddress,
+	onGiveOSDName,
+	onUserControlPressed,
+	onUserControlReleased,
+	onDeviceVendorID,
+	onSetOSDName,
+	onCECVersion,
+	onReportPowerStatus,
+});
+
+/**
+ * Handle one CEC event in the event loop.
+ *
+ * @param   CECEvent  event  A received message or a transmit result.
  *
  * @return void
  */
-void handleCECCallback(void *callback_data, uint32_t reason, uint32_t param1, uint32_t param2, uint32_t param3, uint32_t param4) {
-	spdlog::debug(
-		"Got a callback: reason={reason:X} param1={p1:X} param2={p1:X} param3={p3:X} param4={p4:X}",
-		fmt::arg("reason", reason),
-		fmt::arg("p1", param1),
-		fmt::arg("p2", param2),
-		fmt::arg("p3", param3),
-		fmt::arg("p4", param4)
-	);
-
-	VC_CEC_MESSAGE_T message;
-	if (!parseCECMessage(message, reason, param1, param2, param3, param4)) {
+void processCECEvent(const CECEvent &event) {
+	const CECMessage &message = event.message;
+
+	// The outcome of a message we sent, not something to handle. The
+	// scheduler retries or reports it, and sends the next one.
+	if (event.kind == CEC_EVENT_TRANSMITTED) {
+		if (!cecScheduler.onTransmitted(event)) {
+			spdlog::debug("Transmit result for a message not in flight: {}", message);
+		}
 		return;
 	}
 
-	// Detect when the TV is being told to turn on. Check the power
-	// status of the receiver, because if it's not on we'll want to
-	// turn it on.
-	if (isImageViewOn(message)) {
-		spdlog::info("ImageViewOn message received.");
-		turnOnTV();
-		// This will result in the audio system sending us back a message
-		return;
+	spdlog::debug("Received message: {}", message);
+
+	CECMessage handled = message;
+	cecDevices.seen(handled.initiator);
+	if (!dispatchCECMessage(CEC_ROUTES, handled)) {
+		spdlog::debug("No handler for {}", handled);
+		flightRecorder.recordDecision(FLIGHT_UNHANDLED_MESSAGE, (handled.initiator << 4 | handled.follower) << 8 | (handled.length ? handled.payload[0] : 0));
 	}
+	cecDiscovery.onMessage(handled.initiator, handled.payload, handled.length);
+}
 
-	// Detect when the TV is being told to go into standby.
-	if (isTVOffCmd(message)) {
-		spdlog::info("Standby message received.");
-		turnOffTV();
-		broadcastStandby();
-		return;
+/**
+ * Receives events from the CEC backend. See CECEventHandler.
+ *
+ * With the vc backend this runs on the VCHI callback thread, so it only
+ * queues the event for the event loop and returns. It never logs,
+ * allocates or blocks.
+ *
+ * @return void
+ */
+void queueCECEvent(void *context, const CECEvent &event) {
+	flightRecorder.recordCECEvent(event);
+	if (cecEvents.push(event)) {
+		uint64_t one { 1 };
+		write(cecEventsReady, &one, sizeof(one));
 	}
+}
 
-	// Roku likes to ask for this.
-	if (isRequestForVendorId(message)) {
-		spdlog::info("Vendor ID request message received.");
-		broadcastVendorId();
-		return;
+/**
+ * Log the CEC event queue counters.
+ *
+ * @return  void
+ */
+void logCECQueueStats() {
+	spdlog::info(
+		"CEC queue: depth={} high_water={} capacity={} drops={}",
+		cecEvents.depth(),
+		cecEvents.highWater(),
+		cecEvents.capacity(),
+		cecEvents.drops()
+	);
+}
+
+/**
+ * Run CEC handlers for the events queued so far.
+ *
+ * Also gives up on a transmit whose result never came and repeats or
+ * releases a held volume key, then sets the CEC timer for the next of
+ * those.
+ *
+ * @return  void
+ */
+void runCECHandlers() {
+	static uint64_t reportedDrops { 0 };
+	CECEvent event;
+
+	cecScheduler.expire();
+	cecVolume.expire();
+
+	while (cecEvents.pop(event)) {
+		uint64_t drops = cecEvents.drops();
+		if (drops != reportedDrops) {
+			spdlog::warn("CEC queue full, dropped {} events so far", drops);
+			reportedDrops = drops;
+		}
+
+		processCECEvent(event);
 	}
 
-	// Roku also likes to ask for this.
-	if (isRequestForPowerStatus(message)) {
-		spdlog::info("Power status request message received.");
-		replyWithPowerStatus(message.initiator);
-		return;
+	// Steps posted to the loop submit messages without coming back here to
+	// set the timer, so never wait longer than a transmit result may take.
+	int timeoutMs = cecScheduler.timeoutMs();
+	int volumeMs = cecVolume.timeoutMs();
+	if (volumeMs >= 0 && (timeoutMs < 0 || volumeMs < timeoutMs)) {
+		timeoutMs = volumeMs;
 	}
+	reactor.setTimer(cecTimer, timeoutMs < 0 ? CEC_TRANSMIT_RESULT_MS : timeoutMs);
+}
 
-	if(isReportPhysicalAddress(message)) {
-		spdlog::info("Report physical address message received.");
-		handleReportPhysicalAddress(message);
-		return;
+/**
+ * Run CEC handlers in the event loop: when events are queued, when the
+ * adapter (for backends with a file descriptor) has events for service() to
+ * read, and on the CEC timer.
+ *
+ * @return  bool    Whether every source could be watched.
+ */
+bool watchCEC() {
+	cecTimer = reactor.addTimer("cec-timer", runCECHandlers);
+	if (cecTimer < 0) {
+		return false;
 	}
 
-	if (isGiveOSDName(message)) {
-		spdlog::info("Give OSD name message received.");
-		setOSDName();
-		return;
+	bool watched = reactor.watch("cec-events", cecEventsReady, EPOLLIN, [](uint32_t) {
+		uint64_t count;
+		read(cecEventsReady, &count, sizeof(count));
+		runCECHandlers();
+	});
+	if (watched && cecBackend->fd() >= 0) {
+		watched = reactor.watch("cec-adapter", cecBackend->fd(), EPOLLIN | EPOLLPRI, [](uint32_t events) {
+			if (events & EPOLLERR) {
+				spdlog::error("CEC adapter failed. No more CEC messages will be received.");
+				reactor.unwatch(cecBackend->fd());
+				return;
+			}
+			cecBackend->service();
+			runCECHandlers();
+		});
 	}
+
+	reactor.setTimer(cecTimer, CEC_TRANSMIT_RESULT_MS);
+	return watched;
 }
 
 /**
- * Callback function for host side notification.
- * Host applications register a single callback for all TV related notifications.
- * See <DFN>VC_HDMI_NOTIFY_T</DFN> and <DFN>VC_SDTV_NOTIFY_T</DFN> in vc_hdmi.h and vc_sdtv.h
- * respectively for list of reasons and respective param1 and param2
+ * Log every device in the table. Runs on the event loop, which owns it.
  *
- * @param callback_data is the context passed in during the call to vc_tv_register_callback
- *
- * @param reason is the notification reason
+ * @return  void
+ */
+void logCECDevices() {
+	for (int address = 0; address < CEC_LOGICAL_ADDRESS_COUNT; address++) {
+		if (cecDevices.isPresent(address)) {
+			const CECDevice &device = cecDevices.at(address);
+			spdlog::info(
+				"  {}: physical={} vendor={:06X} name='{}' power={}",
+				address,
+				CECPhysicalAddress { device.physicalAddress },
+				device.vendorId,
+				device.osdName,
+				device.powerStatus
+			);
+		}
+	}
+}
+
+/**
+ * Learn every device's addresses, vendor, name and power status, so later
+ * requests are answered from the table. Runs on cecDiscoveryThread.
  *
- * @param param1 is the first optional parameter
+ * @return  void
+ */
+void runCECDiscovery() {
+	CECDiscoveryResult discovery = cecDiscovery.run(CEC_DISCOVERY_TIMEOUT_MS);
+	spdlog::info(
+		"CEC discovery found {} devices in {}ms ({} frames, {} replies, {} unanswered)",
+		discovery.present,
+		discovery.elapsedMs,
+		discovery.transmitted,
+		discovery.replies,
+		discovery.unanswered
+	);
+	reactor.post(logCECDevices);
+}
+
+/**
+ * Log the CEC counters.
  *
- * @param param2 is the second optional parameter
+ * @return  void
+ */
+void logCECStats() {
+	logCECQueueStats();
+	spdlog::info(
+		"Power status replies: {} acknowledged, p50={}us p99={}us max={}us",
+		powerReplyLatency.count(),
+		powerReplyLatency.percentile(50),
+		powerReplyLatency.percentile(99),
+		powerReplyLatency.max()
+	);
+	cecScheduler.logStats();
+	cecVolume.logStats();
+}
+
+// Repeats, then releases, the volume key held for the FIFO.
+int fifoVolumeTimer { -1 };
+// The volume key held for the FIFO, and how many more times to press it.
+uint8_t fifoVolumeKey { CEC_USER_CONTROL_VOLUME_UP };
+int fifoVolumeSteps { 0 };
+
+/**
+ * Press the volume key held for the FIFO again while steps are left, then
+ * release it. Runs on fifoVolumeTimer.
  *
- * @return void
+ * @return  void
  */
-void handleTVCallback(void *callback_data, uint32_t reason, uint32_t p0, uint32_t p1) {
-	spdlog::debug(
-		"Got a TV callback: reason={reason:X} param0={p0:X} param1={p1:X}",
-		fmt::arg("reason", reason),
-		fmt::arg("p0", p0),
-		fmt::arg("p1", p1)
+void stepFIFOVolume() {
+	if (fifoVolumeSteps > 0) {
+		fifoVolumeSteps--;
+		cecVolume.onPressed(CEC_ADDRESS_TV, fifoVolumeKey);
+		reactor.setTimer(fifoVolumeTimer, CEC_VOLUME_REPEAT_MS);
+	} else {
+		cecVolume.onReleased(CEC_ADDRESS_TV);
+	}
+	// Sets the CEC timer for the frames this queued.
+	runCECHandlers();
+}
+
+/**
+ * Change the volume of the audio system the way its remote would, holding
+ * the key for one repeat per step. See f_volume_callback.
+ */
+int systemVolume(int steps, bool mute) {
+	spdlog::debug("systemVolume called: {} steps{}", steps, mute ? ", mute" : "");
+	if (mute) {
+		cecVolume.onPressed(CEC_ADDRESS_TV, CEC_USER_CONTROL_MUTE);
+		cecVolume.onReleased(CEC_ADDRESS_TV);
+	}
+	fifoVolumeSteps = 0;
+	if (steps != 0) {
+		fifoVolumeKey = steps > 0 ? CEC_USER_CONTROL_VOLUME_UP : CEC_USER_CONTROL_VOLUME_DOWN;
+		fifoVolumeSteps = abs(steps);
+		stepFIFOVolume();
+	} else {
+		runCECHandlers();
+	}
+	return 1;
+}
+
+// Where the FIFO's query command writes the system status.
+const char STATUS_PATH[] { "/tmp/p-cec-fix.status" };
+
+/**
+ * Log the system status and write it to STATUS_PATH, one key=value per
+ * line, for the process that asked over the FIFO. Never waits on the
+ * projector. See f_callback.
+ */
+int systemQuery() {
+	PowerSnapshot snapshot = getPowerSnapshot();
+	const char *projector = snapshot.status < 0 ? "unknown" : cecPowerStatusName(cecPowerStatus(snapshot.status));
+	string status = fmt::format(
+		"projector={}\nprojector_age_ms={}\nprojector_stale={}\n",
+		projector,
+		snapshot.ageMs,
+		(int)snapshot.stale
 	);
+	int devices = 0;
+	for (int address = 0; address < CEC_LOGICAL_ADDRESS_COUNT; address++) {
+		if (cecDevices.isPresent(address)) {
+			const CECDevice &device = cecDevices.at(address);
+			status += fmt::format(
+				"device_{0}_name={1}\ndevice_{0}_power={2}\n",
+				address,
+				device.osdName,
+				cecPowerStatusName(device.powerStatus)
+			);
+			devices++;
+		}
+	}
+	spdlog::info("Status: projector {} ({}ms old{}), {} CEC devices", projector, snapshot.ageMs, snapshot.stale ? ", stale" : "", devices);
+
+	// Readers never see a half written file.
+	const string temporary = string(STATUS_PATH) + ".tmp";
+	ofstream file(temporary, ios::trunc);
+	file << status;
+	file.close();
+	if (!file || rename(temporary.c_str(), STATUS_PATH) != 0) {
+		spdlog::error("Could not write {}: {}", STATUS_PATH, strerror(errno));
+		return -1;
+	}
+	return 1;
 }
 
 /**
- * Set up CEC handlers.
+ * Get an environment variable as a string.
  *
- * @return  bool    Whether CEC was configured successfully.
+ * @param key The name of the environment variable.
+ * @param default_value The value to return if the requested key is not found in the environment.
+ *
+ * @return  std::string The value of the requested key if present, otherwise an empty string.
  */
-bool initCEC() {
-	bcm_host_init();
-	vcos_init();
+string getEnvVar(string const & key, string const default_value) {
+	char * val = getenv(key.c_str());
+	return val == NULL ? default_value : string(val);
+}
 
-	VCHI_INSTANCE_T vchi_instance;
-	if (vchi_initialise(&vchi_instance) != 0) {
-		spdlog::critical("Could not initialize VHCI");
-		return false;
+/**
+ * Ends the daemon once a simulated scenario is over, as CTRL-c would.
+ */
+void handleScenarioFinished() {
+	kill(getpid(), SIGINT);
+}
+
+/**
+ * Create a simulated bus.
+ *
+ * @param   string  scenarioPath    Scenario to play, or empty for none.
+ *
+ * @return  CECBackend *            nullptr if the scenario cannot be read.
+ */
+CECBackend *createSimCECBackend(const string &scenarioPath) {
+	if (scenarioPath.empty()) {
+		return new SimCECBackend(theaterCECDevices());
 	}
 
-	if (vchi_connect(nullptr, 0, vchi_instance) != 0) {
-		spdlog::critical("Failed to connect to VHCI");
-		return false;
+	ifstream input(scenarioPath);
+	if (!input) {
+		spdlog::critical("Could not open CEC scenario {}", scenarioPath);
+		return nullptr;
+	}
+	CECScenario scenario;
+	int badLine = parseCECScenario(input, scenario);
+	if (badLine) {
+		spdlog::critical("Bad CEC scenario {}, line {}", scenarioPath, badLine);
+		return nullptr;
 	}
 
-	vc_vchi_cec_init(vchi_instance, nullptr, 0);
+	spdlog::info("Playing {} CEC frames from {} over {}ms", scenario.steps.size(), scenarioPath, scenario.endMs);
+	SimCECBackend *backend = new SimCECBackend(theaterCECDevices(), scenario);
+	backend->onScenarioFinished(handleScenarioFinished);
+	return backend;
+}
 
-	if (vc_cec_set_passive(VC_TRUE) != 0) {
-		spdlog::critical("Failed to enter passive mode");
-		return false;
+/**
+ * Create the CEC backend named by the CEC_BACKEND environment variable.
+ *
+ * "vc" (the default where available) uses the Broadcom firmware, "linux" the
+ * kernel CEC framework on CEC_DEVICE (default /dev/cec0), and "mock" an
+ * in-process bus with nobody else on it. "sim" is a simulated bus with the
+ * theater's Roku and receiver on it, playing the scenario in CEC_SCENARIO if
+ * set and exiting when it ends.
+ *
+ * @return  CECBackend *    nullptr if the backend is unknown.
+ */
+CECBackend *createCECBackend() {
+#ifdef HAVE_VC_CEC
+	const string name = getEnvVar("CEC_BACKEND", "vc");
+	if (name == "vc") {
+		return createVcCECBackend();
+	}
+#else
+	const string name = getEnvVar("CEC_BACKEND", "linux");
+#endif
+	if (name == "linux") {
+		return createLinuxCECBackend(getEnvVar("CEC_DEVICE", "/dev/cec0").c_str());
+	}
+	if (name == "mock") {
+		return new MockCECBackend();
+	}
+	if (name == "sim") {
+		return createSimCECBackend(getEnvVar("CEC_SCENARIO", ""));
 	}
 
-	vc_cec_register_callback(handleCECCallback, nullptr);
-	vc_tv_register_callback(handleTVCallback, nullptr);
+	spdlog::critical("Unknown CEC backend: {}", name);
+	return nullptr;
+}
 
-	if (vc_cec_register_all() != 0) {
-		spdlog::critical("Failed to register all opcodes");
+/**
+ * Set up CEC handlers.
+ *
+ * @return  bool    Whether CEC was configured successfully.
+ */
+bool initCEC() {
+	cecBackend = createCECBackend();
+	if (!cecBackend) {
 		return false;
 	}
 
-	// TODO: these probably aren't needed.
-	// vc_cec_register_command(CEC_Opcode_GivePhysicalAddress);
-	// vc_cec_register_command(CEC_Opcode_MenuRequest);
-	// vc_cec_register_command(CEC_Opcode_GetMenuLanguage);
-	// vc_cec_register_command(CEC_Opcode_GetCECVersion);
-	vc_cec_register_command(CEC_Opcode_GiveDeviceVendorID);
-	vc_cec_register_command(CEC_Opcode_GiveOSDName);
-	vc_cec_register_command(CEC_Opcode_GiveDevicePowerStatus);
+	cecEventsReady = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (cecEventsReady < 0) {
+		spdlog::critical("Could not create CEC event fd: {}", strerror(errno));
+		return false;
+	}
 
+	// Events that arrive before the loop runs wait in the queue.
+	if (!cecBackend->open(CEC_ADDRESS_TV, VENDOR_ID_BROADCOM, OSD_NAME, queueCECEvent, nullptr)) {
+		return false;
+	}
+	spdlog::info("Using the {} CEC backend", cecBackend->name());
+	cecScheduler.setBackend(cecBackend);
 
-	if (vc_cec_set_logical_address(CEC_AllDevices_eTV, CEC_DeviceType_TV, CEC_VENDOR_ID_BROADCOM) != 0) {
-		spdlog::critical("Failed to set logical address");
+	if (!watchCEC()) {
 		return false;
 	}
 
-	// Cache the physical address of Playback 1
-	getPhysicalAddress(CEC_AllDevices_eDVD1);
+	// Keep process signals on the thread that reads them.
+	sigset_t all, previous;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &previous);
+	cecDiscoveryThread = thread(runCECDiscovery);
+	pthread_sigmask(SIG_SETMASK, &previous, nullptr);
 
 	spdlog::debug("CEC init successful");
 	return true;
 }
 
 /**
- * Catch SIGINT and set running state of program to false.
+ * Stop the event loop on SIGINT or SIGTERM.
  *
- * @param   int   s  Not used
+ * @param   int   signal
  *
  * @return  void
  */
-void handleSIGINT(int s) {
-	want_run = false;
+void handleStopSignal(int signal) {
+	spdlog::info("Caught {}. Exiting.", strsignal(signal));
+	// Once the loop stops nothing answers discovery or power plan steps, so
+	// do not wait for it.
+	cecDiscovery.cancel();
+	stopCECSteps();
+	reactor.stop();
 }
 
 /**
@@ -564,21 +1224,28 @@ bool initLAN(int argc, char *argv[]) {
 		return false;
 	}
 
+	startPowerPoller();
+
 	spdlog::debug("LAN init successful");
 	return true;
 }
 
 /**
- * Get an environment variable as a string.
+ * Open the flight recorder named by FLIGHT_RECORDER (default
+ * /var/tmp/cec-fix.flight; empty to disable), holding FLIGHT_RECORDER_RECORDS
+ * records (default 65536, 4 MiB). Runs on without it if it cannot be opened.
  *
- * @param key The name of the environment variable.
- * @param default_value The value to return if the requested key is not found in the environment.
- *
- * @return  std::string The value of the requested key if present, otherwise an empty string.
+ * @return  void
  */
-string getEnvVar(string const & key, string const default_value) {
-	char * val = getenv(key.c_str());
-	return val == NULL ? default_value : string(val);
+void initFlightRecorder() {
+	const string path = getEnvVar("FLIGHT_RECORDER", "/var/tmp/cec-fix.flight");
+	if (path.empty()) {
+		return;
+	}
+	uint64_t records = strtoull(getEnvVar("FLIGHT_RECORDER_RECORDS", "65536").c_str(), nullptr, 10);
+	if (!flightRecorder.open(path.c_str(), records)) {
+		spdlog::warn("Running without a flight recorder");
+	}
 }
 
 /**
@@ -595,30 +1262,81 @@ int main(int argc, char *argv[]) {
 	const string log_level = getEnvVar("LOG_LEVEL", "debug");
 	spdlog::set_level(spdlog::level::from_str(log_level)); // Set global log level to debug
 
+	initFlightRecorder();
+
 	if (!initLAN(argc, argv)) {
 		return 1;
 	}
+	powerReconciler.start();
 
-	if (!initCEC()) {
+	// Handle CTRL-c and service stops cleanly. Blocked before the CEC
+	// backend starts threads of its own, so they inherit the mask. Power
+	// plans and discovery post their CEC work to the loop.
+	if (!reactor.open() || !reactor.watchSignals("signals", { SIGINT, SIGTERM }, handleStopSignal)
+			|| !reactor.watchPosts("posted")) {
 		return 1;
 	}
 
-	if (initFIFO(systemStandby, systemActive) < 0) {
+	if (!initCEC()) {
 		return 1;
 	}
 
-	// Handle SIGINT cleanly
-	struct sigaction sigIntHandler;
-	sigIntHandler.sa_handler = handleSIGINT;
-	sigemptyset(&sigIntHandler.sa_mask);
-	sigIntHandler.sa_flags = 0;
-	sigaction(SIGINT, &sigIntHandler, NULL);
+	if (initFIFO(systemStandby, systemActive) < 0
+			|| !reactor.watch("fifo", fifoFd(), EPOLLIN, [](uint32_t) { readFIFO(); })) {
+		return 1;
+	}
+	registerInputCallback(systemInput);
+	registerVolumeCallback(systemVolume);
+	registerQueryCallback(systemQuery);
+	fifoVolumeTimer = reactor.addTimer("fifo-volume", stepFIFOVolume);
 
 	spdlog::info("Running! Press CTRL-c to exit.");
 
-	while (want_run) {
-		pause();
-	}
+	reactor.run();
+
+	powerReconciler.stop();
+	powerReconciler.logStats();
+	FifoStats fifo = getFIFOStats();
+	spdlog::info("FIFO commands: received={} coalesced={} rejected={}", fifo.received, fifo.coalesced, fifo.rejected);
+	cecDiscoveryThread.join();
+	logCECStats();
+	reactor.logStats();
+	cecBackend->close();
+	stopPowerPoller();
+	closeSession();
+	flightRecorder.flush();
+
+	CommandQueueStats stats = getCommandQueueStats();
+	spdlog::info(
+		"Projector queue: executed={} coalesced={} replaced={} timed_out={}",
+		stats.executed,
+		stats.coalesced,
+		stats.replaced,
+		stats.timedOut
+	);
+
+	PowerTransitionStats transitions = getPowerTransitionStats();
+	spdlog::info(
+		"Projector power: warm-up={}ms ({} measured) cool-down={}ms ({} measured) already={} deferred={} deferred_sent={}",
+		transitions.warmupMs,
+		transitions.warmups,
+		transitions.cooldownMs,
+		transitions.cooldowns,
+		transitions.already,
+		transitions.deferred,
+		transitions.deferredSent
+	);
+
+	TeardownStats teardown = getTeardownStats();
+	spdlog::info(
+		"Projector session teardown: released={} timed_out={} p50={}us p99={}us max={}us bound={}ms",
+		teardown.released,
+		teardown.timedOut,
+		teardown.p50Us,
+		teardown.p99Us,
+		teardown.maxUs,
+		teardown.waitBoundMs
+	);
 
 	return cleanupFIFO();;
 }
@@ -0,0 +1,145 @@
+#include "orchestrator.hpp"
+#include "spdlog/spdlog.h"
+#include <atomic>
+#include <chrono>
+#include <signal.h>
+#include <thread>
+
+using namespace std;
+
+/**
+ * A step that takes `ms` milliseconds and returns `result`.
+ */
+function<int()> sleepFor(int ms, int result = 0) {
+    return [ms, result]() {
+        this_thread::sleep_for(chrono::milliseconds(ms));
+        return result;
+    };
+}
+
+/**
+ * Check that independent steps overlap, dependent steps wait, and the
+ * critical path is the chain that ended last.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testPowerOn() {
+    // The power-on plan, with the projector slower than the CEC steps.
+    Orchestration plan;
+    int projector = plan.add("projector-on", sleepFor(300));
+    int wake = plan.add("receiver-wake", sleepFor(50));
+    int route = plan.add("stream-path", sleepFor(50), { wake });
+
+    OrchestrationResult result = plan.run();
+    const StepTiming &wakeTiming = result.steps[wake];
+    const StepTiming &routeTiming = result.steps[route];
+
+    if (routeTiming.startUs < wakeTiming.endUs) {
+        spdlog::error("Power on: stream path started before the receiver woke");
+        return 1;
+    }
+    if (routeTiming.endUs > result.steps[projector].endUs) {
+        spdlog::error("Power on: CEC steps waited on the projector");
+        return 1;
+    }
+    if (result.elapsedUs < 300000 || result.elapsedUs > 380000) {
+        spdlog::error("Power on: took {}us, expected about 300000us", result.elapsedUs);
+        return 1;
+    }
+    if (result.criticalPath.size() != 1 || result.criticalPath[0] != projector
+            || result.criticalPathUs < 300000 || result.criticalPathUs > result.elapsedUs) {
+        spdlog::error("Power on: critical path {} ({}us)", result.criticalPathNames(), result.criticalPathUs);
+        return 1;
+    }
+
+    spdlog::info("Power on: OK, {}us, critical path {}", result.elapsedUs, result.criticalPathNames());
+    return 0;
+}
+
+/**
+ * Check that a chain that ends last is reported step by step, and that
+ * failed steps are counted without stopping the steps after them.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testChain() {
+    Orchestration plan;
+    int a = plan.add("a", sleepFor(100, -1));
+    int b = plan.add("b", sleepFor(20));
+    int c = plan.add("c", sleepFor(100), { a, b });
+    plan.add("d", sleepFor(10), { b });
+
+    OrchestrationResult result = plan.run();
+    if (result.failed != 1 || result.steps[c].result != 0) {
+        spdlog::error("Chain: {} failed", result.failed);
+        return 1;
+    }
+    if (result.criticalPathNames() != "a > c" || result.criticalPathUs < 200000 || result.elapsedUs > 280000) {
+        spdlog::error("Chain: critical path {} ({}us of {}us)", result.criticalPathNames(), result.criticalPathUs, result.elapsedUs);
+        return 1;
+    }
+
+    spdlog::info("Chain: OK");
+    return 0;
+}
+
+/**
+ * Check that cancelling a run skips the steps that have not started.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testCancel() {
+    atomic<bool> obsolete { false };
+    Orchestration plan;
+    int slow = plan.add("projector-on", sleepFor(100));
+    int wake = plan.add("receiver-wake", [&obsolete]() {
+        obsolete = true;
+        return 0;
+    });
+    int route = plan.add("stream-path", sleepFor(10), { wake });
+
+    OrchestrationResult result = plan.run([&obsolete]() { return obsolete.load(); });
+    if (result.cancelled != 1 || result.failed != 0 || result.steps[route].result != STEP_CANCELLED
+            || result.steps[slow].result != 0 || result.steps[wake].result != 0) {
+        spdlog::error("Cancel: {} cancelled, {} failed", result.cancelled, result.failed);
+        return 1;
+    }
+
+    spdlog::info("Cancel: OK");
+    return 0;
+}
+
+/**
+ * Check that steps run with every signal blocked.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testSignals() {
+    Orchestration plan;
+    plan.add("check", []() {
+        sigset_t mask;
+        pthread_sigmask(SIG_SETMASK, nullptr, &mask);
+        return sigismember(&mask, SIGINT) && sigismember(&mask, SIGIO) ? 0 : 1;
+    });
+
+    if (plan.run().failed) {
+        spdlog::error("Signals: a step could receive signals");
+        return 1;
+    }
+    sigset_t mask;
+    pthread_sigmask(SIG_SETMASK, nullptr, &mask);
+    if (sigismember(&mask, SIGINT)) {
+        spdlog::error("Signals: the caller's mask was not restored");
+        return 1;
+    }
+
+    spdlog::info("Signals: OK");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[ORCHESTRATOR] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    return testPowerOn() | testChain() | testCancel() | testSignals();
+}
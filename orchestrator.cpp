@@ -0,0 +1,112 @@
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <signal.h>
+#include <thread>
+#include "orchestrator.hpp"
+
+using namespace std;
+
+string OrchestrationResult::criticalPathNames() const {
+    string names;
+    for (int step : criticalPath) {
+        if (!names.empty()) {
+            names += " > ";
+        }
+        names += steps[step].name;
+    }
+    return names;
+}
+
+int Orchestration::add(const char *name, function<int()> run, initializer_list<int> after) {
+    steps_.push_back({ name, move(run), after });
+    return steps_.size() - 1;
+}
+
+OrchestrationResult Orchestration::run(function<bool()> cancelled) const {
+    typedef chrono::steady_clock Clock;
+    const Clock::time_point start = Clock::now();
+    const int count = steps_.size();
+
+    OrchestrationResult result {};
+    result.steps.resize(count);
+
+    // Steps each step must wait for, and steps waiting on each step.
+    vector<int> waiting(count);
+    vector<vector<int>> dependents(count);
+    for (int i = 0; i < count; i++) {
+        result.steps[i].name = steps_[i].name;
+        waiting[i] = steps_[i].after.size();
+        for (int before : steps_[i].after) {
+            dependents[before].push_back(i);
+        }
+    }
+
+    mutex lock;
+    condition_variable finished;
+    int done = 0;
+    vector<thread> threads;
+
+    // Starts a step. Called with `lock` held.
+    function<void(int)> launch = [&](int step) {
+        sigset_t all, previous;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &previous);
+        threads.emplace_back([&, step]() {
+            const int64_t startUs = chrono::duration_cast<chrono::microseconds>(Clock::now() - start).count();
+            const int stepResult = cancelled && cancelled() ? STEP_CANCELLED : steps_[step].run();
+            const int64_t endUs = chrono::duration_cast<chrono::microseconds>(Clock::now() - start).count();
+
+            lock_guard<mutex> guard(lock);
+            result.steps[step].result = stepResult;
+            result.steps[step].startUs = startUs;
+            result.steps[step].endUs = endUs;
+            for (int next : dependents[step]) {
+                if (--waiting[next] == 0) {
+                    launch(next);
+                }
+            }
+            done++;
+            finished.notify_all();
+        });
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    };
+
+    {
+        unique_lock<mutex> guard(lock);
+        for (int i = 0; i < count; i++) {
+            if (waiting[i] == 0) {
+                launch(i);
+            }
+        }
+        finished.wait(guard, [&]() { return done == count; });
+    }
+    for (thread &step : threads) {
+        step.join();
+    }
+
+    // Walk back from the step that ended last through the step each one
+    // waited on longest.
+    int last = -1;
+    for (int i = 0; i < count; i++) {
+        const StepTiming &timing = result.steps[i];
+        result.cancelled += timing.result == STEP_CANCELLED;
+        result.failed += timing.result != 0 && timing.result != STEP_CANCELLED;
+        result.elapsedUs = max(result.elapsedUs, timing.endUs);
+        if (last < 0 || timing.endUs > result.steps[last].endUs) {
+            last = i;
+        }
+    }
+    while (last >= 0) {
+        result.criticalPath.insert(result.criticalPath.begin(), last);
+        result.criticalPathUs += result.steps[last].endUs - result.steps[last].startUs;
+        int waitedOn = -1;
+        for (int before : steps_[last].after) {
+            if (waitedOn < 0 || result.steps[before].endUs > result.steps[waitedOn].endUs) {
+                waitedOn = before;
+            }
+        }
+        last = waitedOn;
+    }
+    return result;
+}
@@ -0,0 +1,97 @@
+#ifndef ORCHESTRATOR_H
+#define ORCHESTRATOR_H
+
+#include <functional>
+#include <initializer_list>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Result of a step that was skipped because its run was cancelled.
+const int STEP_CANCELLED { -125 };
+
+/**
+ * What happened to one step of a run.
+ */
+struct StepTiming {
+    const char *name;
+    // The step's return value. 0 is success.
+    int result;
+    // Microseconds since the run started.
+    int64_t startUs;
+    int64_t endUs;
+};
+
+/**
+ * Outcome of a run.
+ */
+struct OrchestrationResult {
+    // One per step, in the order they were added.
+    std::vector<StepTiming> steps;
+    // Steps that returned non-zero, cancelled ones not included.
+    int failed;
+    // Steps skipped because the run was cancelled before they started.
+    int cancelled;
+    // From the start of the run to the end of its last step.
+    int64_t elapsedUs;
+    // Time spent in the steps of the critical path: the chain of steps, each
+    // waiting on the one before it, that ends last.
+    int64_t criticalPathUs;
+    // Indexes into `steps`, first step first.
+    std::vector<int> criticalPath;
+
+    /**
+     * The critical path as step names, e.g. "receiver-wake > stream-path".
+     *
+     * @return  string
+     */
+    std::string criticalPathNames() const;
+};
+
+/**
+ * A set of steps and the order they must run in, run with as much
+ * concurrency as that order allows.
+ *
+ * A step starts once every step it comes after has finished, on a thread of
+ * its own, so slow network steps do not hold up quick CEC ones. Ordering is
+ * all a dependency means: a step runs even if one it comes after failed.
+ * Once a run is cancelled, steps that have not started are skipped, while
+ * the ones already running finish.
+ *
+ * Step threads block every signal, so signals keep being delivered to the
+ * threads that expect them.
+ */
+class Orchestration {
+public:
+    /**
+     * Add a step.
+     *
+     * @param   char *                      name   Used in logs. Must outlive the orchestration.
+     * @param   std::function<int()>        run    The work. Returns 0 on success.
+     * @param   std::initializer_list<int>  after  Steps, returned by earlier add() calls, to run after.
+     *
+     * @return  int                                The step, for later `after` lists.
+     */
+    int add(const char *name, std::function<int()> run, std::initializer_list<int> after = {});
+
+    /**
+     * Run every step and wait for all of them to finish.
+     *
+     * @param   std::function<bool()>  cancelled  Asked before each step starts. Returns
+     *                                            true to skip it, with STEP_CANCELLED. May be empty.
+     *
+     * @return  OrchestrationResult
+     */
+    OrchestrationResult run(std::function<bool()> cancelled = nullptr) const;
+
+private:
+    struct Step {
+        const char *name;
+        std::function<int()> run;
+        std::vector<int> after;
+    };
+
+    std::vector<Step> steps_;
+};
+
+#endif
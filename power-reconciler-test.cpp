@@ -0,0 +1,225 @@
+#include "power_reconciler.hpp"
+#include "spdlog/spdlog.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Stands in for the power plans: records each run and takes `ms` to finish,
+ * checking whether it became obsolete half way.
+ */
+struct FakeSystem {
+    int ms;
+    mutex lock;
+    vector<bool> runs;
+    atomic<int> obsoleteSeen { 0 };
+
+    FakeSystem(int ms) : ms(ms) {}
+
+    PowerApplyFunction apply() {
+        return [this](bool on, const function<bool()> &obsolete) {
+            {
+                lock_guard<mutex> guard(lock);
+                runs.push_back(on);
+            }
+            this_thread::sleep_for(chrono::milliseconds(ms / 2));
+            if (obsolete()) {
+                obsoleteSeen++;
+                return 0;
+            }
+            this_thread::sleep_for(chrono::milliseconds(ms / 2));
+            return 0;
+        };
+    }
+
+    vector<bool> snapshot() {
+        lock_guard<mutex> guard(lock);
+        return runs;
+    }
+};
+
+/**
+ * Check that a burst of requests for both states costs one run, for the
+ * state asked for last.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testBurst() {
+    FakeSystem system(20);
+    PowerReconciler reconciler(system.apply(), 50);
+    reconciler.start();
+
+    // ImageViewOn, TextViewOn, then "0" and "1" from the FIFO.
+    reconciler.request(true, "CEC");
+    reconciler.request(true, "CEC");
+    reconciler.request(false, "FIFO");
+    reconciler.request(true, "FIFO");
+
+    if (!reconciler.waitIdle(1000)) {
+        spdlog::error("Burst: not idle");
+        return 1;
+    }
+    vector<bool> runs = system.snapshot();
+    PowerReconcilerStats stats = reconciler.stats();
+    if (runs.size() != 1 || !runs[0]) {
+        spdlog::error("Burst: {} runs", runs.size());
+        return 1;
+    }
+    if (stats.requests != 4 || stats.superseded != 3 || stats.applied != 1 || stats.obsoleted != 0) {
+        spdlog::error("Burst: requests={} superseded={} applied={}", stats.requests, stats.superseded, stats.applied);
+        return 1;
+    }
+
+    spdlog::info("Burst: OK");
+    return 0;
+}
+
+/**
+ * Check that a request for the other state during a run makes the run
+ * obsolete, and is applied right after it.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testObsolete() {
+    FakeSystem system(200);
+    PowerReconciler reconciler(system.apply(), 10);
+    reconciler.start();
+
+    reconciler.request(true, "CEC");
+    this_thread::sleep_for(chrono::milliseconds(50));
+    // The power on run is in progress.
+    reconciler.request(false, "CEC");
+
+    if (!reconciler.waitIdle(2000)) {
+        spdlog::error("Obsolete: not idle");
+        return 1;
+    }
+    vector<bool> runs = system.snapshot();
+    PowerReconcilerStats stats = reconciler.stats();
+    if (runs.size() != 2 || !runs[0] || runs[1]) {
+        spdlog::error("Obsolete: {} runs", runs.size());
+        return 1;
+    }
+    if (system.obsoleteSeen != 1 || stats.obsoleted != 1 || stats.superseded != 0) {
+        spdlog::error("Obsolete: seen={} obsoleted={}", system.obsoleteSeen.load(), stats.obsoleted);
+        return 1;
+    }
+
+    spdlog::info("Obsolete: OK");
+    return 0;
+}
+
+/**
+ * Check that requests repeating the state being applied are served by
+ * the run in progress, without making it obsolete.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testRepeat() {
+    FakeSystem system(100);
+    PowerReconciler reconciler(system.apply(), 10);
+    reconciler.start();
+
+    reconciler.request(false, "CEC");
+    this_thread::sleep_for(chrono::milliseconds(30));
+    // Standby retransmitted while the first one is being applied.
+    for (int i = 0; i < 5; i++) {
+        reconciler.request(false, "CEC");
+    }
+
+    if (!reconciler.waitIdle(2000)) {
+        spdlog::error("Repeat: not idle");
+        return 1;
+    }
+    vector<bool> runs = system.snapshot();
+    PowerReconcilerStats stats = reconciler.stats();
+    if (runs.size() != 1 || system.obsoleteSeen != 0 || stats.obsoleted != 0 || stats.superseded != 4) {
+        spdlog::error("Repeat: {} runs, obsoleted={} superseded={}", runs.size(), stats.obsoleted, stats.superseded);
+        return 1;
+    }
+
+    spdlog::info("Repeat: OK");
+    return 0;
+}
+
+/**
+ * Check that a steady stream of requests is still applied once the first
+ * has waited POWER_DEBOUNCE_MAX_MS.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testStream() {
+    FakeSystem system(0);
+    PowerReconciler reconciler(system.apply(), 100);
+    reconciler.start();
+
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int64_t firstRunMs = -1;
+    while (chrono::steady_clock::now() - start < chrono::milliseconds(POWER_DEBOUNCE_MAX_MS + 300)) {
+        reconciler.request(true, "FIFO");
+        this_thread::sleep_for(chrono::milliseconds(20));
+        if (firstRunMs < 0 && !system.snapshot().empty()) {
+            firstRunMs = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    if (firstRunMs < POWER_DEBOUNCE_MAX_MS || firstRunMs > POWER_DEBOUNCE_MAX_MS + 100) {
+        spdlog::error("Stream: first run after {}ms", firstRunMs);
+        return 1;
+    }
+
+    spdlog::info("Stream: OK, first run after {}ms", firstRunMs);
+    return 0;
+}
+
+/**
+ * Check that a repeat that arrives after the run in progress did its part,
+ * like an input asked for after the input step, gets a run of its own when
+ * the run reports work left undone.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testUnfinished() {
+    atomic<int> input { -1 };
+    atomic<int> switched { -1 };
+    atomic<int> runs { 0 };
+    PowerReconciler reconciler([&](bool on, const function<bool()> &obsolete) {
+        runs++;
+        this_thread::sleep_for(chrono::milliseconds(50));
+        const int wanted = input.exchange(-1);
+        if (wanted >= 0) {
+            switched = wanted;
+        }
+        this_thread::sleep_for(chrono::milliseconds(50));
+        return input >= 0 ? 1 : 0;
+    }, 10);
+    reconciler.start();
+
+    reconciler.request(true, "FIFO");
+    this_thread::sleep_for(chrono::milliseconds(80));
+    // After the first run took the input it wanted, which was none.
+    input = 2;
+    reconciler.request(true, "FIFO");
+
+    if (!reconciler.waitIdle(2000)) {
+        spdlog::error("Unfinished: not idle");
+        return 1;
+    }
+    if (runs != 2 || switched != 2) {
+        spdlog::error("Unfinished: {} runs, switched to {}", runs.load(), switched.load());
+        return 1;
+    }
+
+    spdlog::info("Unfinished: OK");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[POWER RECONCILER] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    return testBurst() | testObsolete() | testRepeat() | testStream() | testUnfinished();
+}
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <signal.h>
+#include "spdlog/spdlog.h"
+#include "power_reconciler.hpp"
+
+using namespace std;
+
+PowerReconciler::PowerReconciler(PowerApplyFunction apply, int debounceMs)
+    : apply_(move(apply)), debounceMs_(debounceMs) {}
+
+void PowerReconciler::start() {
+    lock_guard<mutex> lock(mutex_);
+    if (running_) {
+        return;
+    }
+    running_ = true;
+
+    // Keep process signals on the threads that wait for them.
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    thread_ = thread(&PowerReconciler::run, this);
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+void PowerReconciler::stop() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+        changed_.notify_all();
+    }
+    thread_.join();
+}
+
+void PowerReconciler::request(bool on, const char *source) {
+    lock_guard<mutex> lock(mutex_);
+    const Clock::time_point now = Clock::now();
+    stats_.requests++;
+    if (generation_ > appliedGeneration_) {
+        stats_.superseded++;
+    } else {
+        firstPending_ = now;
+    }
+    lastPending_ = now;
+    generation_++;
+    desired_ = on;
+    spdlog::debug("{} wants power {}", source, on ? "on" : "standby");
+    changed_.notify_all();
+}
+
+void PowerReconciler::run() {
+    unique_lock<mutex> lock(mutex_);
+    while (running_) {
+        if (generation_ == appliedGeneration_) {
+            changed_.wait(lock);
+            continue;
+        }
+
+        // Let the burst settle.
+        const Clock::time_point due = min(
+            lastPending_ + chrono::milliseconds(debounceMs_),
+            firstPending_ + chrono::milliseconds(POWER_DEBOUNCE_MAX_MS)
+        );
+        if (Clock::now() < due) {
+            changed_.wait_until(lock, due);
+            continue;
+        }
+
+        const uint64_t generation = generation_;
+        const bool on = desired_;
+        appliedGeneration_ = generation;
+        applying_ = true;
+        stats_.applied++;
+        lock.unlock();
+
+        // Obsolete once a later request wants the other state.
+        bool overtaken = false;
+        const int result = apply_(on, [this, on, &overtaken]() {
+            lock_guard<mutex> lock(mutex_);
+            overtaken = overtaken || desired_ != on;
+            return overtaken;
+        });
+
+        lock.lock();
+        applying_ = false;
+        if (overtaken || desired_ != on) {
+            stats_.obsoleted++;
+        } else if (result == 0) {
+            // Repeats that arrived during a complete run were served by it.
+            appliedGeneration_ = generation_;
+        }
+        changed_.notify_all();
+    }
+}
+
+bool PowerReconciler::waitIdle(int timeoutMs) {
+    unique_lock<mutex> lock(mutex_);
+    return changed_.wait_for(lock, chrono::milliseconds(timeoutMs), [this]() {
+        return generation_ == appliedGeneration_ && !applying_;
+    });
+}
+
+PowerReconcilerStats PowerReconciler::stats() {
+    lock_guard<mutex> lock(mutex_);
+    return stats_;
+}
+
+void PowerReconciler::logStats() {
+    PowerReconcilerStats stats = this->stats();
+    spdlog::info(
+        "Power requests: received={} superseded={} applied={} obsoleted={}",
+        stats.requests,
+        stats.superseded,
+        stats.applied,
+        stats.obsoleted
+    );
+}
@@ -0,0 +1,135 @@
+#ifndef POWER_RECONCILER_H
+#define POWER_RECONCILER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+
+// Power requests are applied once none has arrived for this long...
+const int POWER_DEBOUNCE_MS { 150 };
+// ...or once the first of a burst has waited this long.
+const int POWER_DEBOUNCE_MAX_MS { 600 };
+
+/**
+ * Brings the system to a power state.
+ *
+ * @param   bool                   on        Power on, or standby.
+ * @param   std::function<bool()>  obsolete  Returns true once a newer request wants
+ *                                           the other state. Work not started by then
+ *                                           should be skipped.
+ *
+ * @return  int                              0 once the system is in the state with
+ *                                           nothing left to do. Otherwise requests
+ *                                           that arrived during the run get a run
+ *                                           of their own.
+ */
+typedef std::function<int(bool on, const std::function<bool()> &obsolete)> PowerApplyFunction;
+
+struct PowerReconcilerStats {
+    // Requests from every source.
+    uint64_t requests;
+    // Requests replaced by a later one before they were applied.
+    uint64_t superseded;
+    // Times the apply function ran.
+    uint64_t applied;
+    // Runs overtaken by a request for the other state while in progress.
+    uint64_t obsoleted;
+};
+
+/**
+ * Keeps the latest desired power state and drives the system toward it.
+ *
+ * CEC messages and FIFO commands only record what they want and return. A
+ * thread of its own waits for requests to settle (POWER_DEBOUNCE_MS) and
+ * then applies the latest one, so ImageViewOn/TextViewOn bursts, repeated
+ * Standby messages or "1" and "0" written back to back cost one run. The
+ * apply function checks the actual state (the projector is only sent a
+ * command if it is not there already), so requests can be repeated freely.
+ * Repeats that arrive while that state is being applied are served by the
+ * run, unless it fails or leaves something undone.
+ *
+ * A request for the other state while a run is in progress makes the run
+ * obsolete, and the new state is applied as soon as the run returns.
+ */
+class PowerReconciler {
+public:
+    /**
+     * @param   PowerApplyFunction  apply       Brings the system to a state. Runs on the reconciler thread.
+     * @param   int                 debounceMs  @see POWER_DEBOUNCE_MS
+     */
+    PowerReconciler(PowerApplyFunction apply, int debounceMs = POWER_DEBOUNCE_MS);
+
+    ~PowerReconciler() {
+        stop();
+    }
+
+    /**
+     * Start applying requests, including any made before.
+     *
+     * @return  void
+     */
+    void start();
+
+    /**
+     * Stop after the run in progress, if any. Requests not applied yet are dropped.
+     *
+     * @return  void
+     */
+    void stop();
+
+    /**
+     * Ask for a power state. Never blocks on the system.
+     *
+     * @param   bool    on      Power on, or standby.
+     * @param   char *  source  Who asks, for the log, e.g. "CEC".
+     *
+     * @return  void
+     */
+    void request(bool on, const char *source);
+
+    /**
+     * Wait until every request so far has been applied.
+     *
+     * @param   int   timeoutMs  Upper bound on the wait.
+     *
+     * @return  bool             false on timeout.
+     */
+    bool waitIdle(int timeoutMs);
+
+    PowerReconcilerStats stats();
+
+    /**
+     * Log the counters.
+     *
+     * @return  void
+     */
+    void logStats();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    void run();
+
+    const PowerApplyFunction apply_;
+    const int debounceMs_;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::thread thread_;
+    bool running_ { false };
+    // The latest request, counted from 1, and the state it wants.
+    uint64_t generation_ { 0 };
+    bool desired_ { false };
+    // The request being applied or last applied.
+    uint64_t appliedGeneration_ { 0 };
+    bool applying_ { false };
+    // When the first and latest requests not yet applied arrived.
+    Clock::time_point firstPending_;
+    Clock::time_point lastPending_;
+    PowerReconcilerStats stats_ {};
+};
+
+#endif
@@ -0,0 +1,255 @@
+#include "orchestrator.hpp"
+#include "reactor.hpp"
+#include "spdlog/spdlog.h"
+#include <chrono>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+/**
+ * Milliseconds since `start`.
+ */
+int64_t elapsedMs(Clock::time_point start) {
+    return chrono::duration_cast<chrono::milliseconds>(Clock::now() - start).count();
+}
+
+/**
+ * Check that timers fire in order, once per setTimer(), and that re-arming
+ * replaces the previous expiry.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testTimers() {
+    Reactor reactor;
+    if (!reactor.open()) {
+        return 1;
+    }
+
+    const Clock::time_point start = Clock::now();
+    vector<pair<int, int64_t>> fired;
+    int slow = reactor.addTimer("slow", [&]() {
+        fired.push_back({ 0, elapsedMs(start) });
+        reactor.stop();
+    });
+    int fast = -1;
+    fast = reactor.addTimer("fast", [&]() {
+        fired.push_back({ 1, elapsedMs(start) });
+        if (fired.size() < 3) {
+            reactor.setTimer(fast, 0);
+        }
+    });
+    reactor.setTimer(slow, 500);
+    // Replaced before it expires.
+    reactor.setTimer(slow, 100);
+    reactor.setTimer(fast, 20);
+    reactor.run();
+
+    if (fired.size() != 4 || fired[0].first != 1 || fired[2].first != 1 || fired[3].first != 0) {
+        spdlog::error("Timers: fired {} times", fired.size());
+        return 1;
+    }
+    if (fired[0].second < 20 || fired[3].second < 100 || fired[3].second > 200) {
+        spdlog::error("Timers: fast after {}ms, slow after {}ms", fired[0].second, fired[3].second);
+        return 1;
+    }
+    ReactorStats stats = reactor.stats();
+    if (stats.sources.size() != 2 || stats.sources[0].wakeups != 1 || stats.sources[1].wakeups != 3 || stats.wakeups != 4) {
+        spdlog::error("Timers: {} wakeups", stats.wakeups);
+        return 1;
+    }
+
+    spdlog::info("Timers: OK");
+    return 0;
+}
+
+/**
+ * Check that a readable descriptor runs its handler until unwatched, and
+ * that each wakeup is counted against it.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testDescriptors() {
+    Reactor reactor;
+    if (!reactor.open()) {
+        return 1;
+    }
+
+    int fd = eventfd(0, EFD_NONBLOCK);
+    int reads = 0;
+    reactor.watch("eventfd", fd, EPOLLIN, [&](uint32_t events) {
+        uint64_t value;
+        if ((events & EPOLLIN) && read(fd, &value, sizeof(value)) == sizeof(value)) {
+            reads++;
+        }
+        if (reads == 3) {
+            reactor.unwatch(fd);
+        }
+    });
+    int writes = 0;
+    int timer = -1;
+    timer = reactor.addTimer("writer", [&]() {
+        if (writes++ < 4) {
+            uint64_t one { 1 };
+            write(fd, &one, sizeof(one));
+            reactor.setTimer(timer, 5);
+        } else {
+            reactor.stop();
+        }
+    });
+    reactor.setTimer(timer, 0);
+    reactor.run();
+    close(fd);
+
+    ReactorStats stats = reactor.stats();
+    if (reads != 3 || stats.sources[0].wakeups != 3 || stats.sources[1].wakeups != 5) {
+        spdlog::error("Descriptors: {} reads, {} wakeups", reads, stats.sources[0].wakeups);
+        return 1;
+    }
+
+    reactor.logStats();
+    spdlog::info("Descriptors: OK");
+    return 0;
+}
+
+/**
+ * Check that signals are read in the loop rather than handled in signal
+ * context, and do not end the process.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testSignals() {
+    Reactor reactor;
+    if (!reactor.open()) {
+        return 1;
+    }
+
+    vector<int> caught;
+    if (!reactor.watchSignals("signals", { SIGUSR1, SIGUSR2 }, [&](int signal) {
+        caught.push_back(signal);
+        if (signal == SIGUSR2) {
+            reactor.stop();
+        }
+    })) {
+        return 1;
+    }
+    int timer = reactor.addTimer("raise", []() {
+        kill(getpid(), SIGUSR1);
+        kill(getpid(), SIGUSR2);
+    });
+    reactor.setTimer(timer, 10);
+    reactor.run();
+
+    if (caught.size() != 2 || caught[0] != SIGUSR1 || caught[1] != SIGUSR2) {
+        spdlog::error("Signals: caught {}", caught.size());
+        return 1;
+    }
+
+    spdlog::info("Signals: OK");
+    return 0;
+}
+
+/**
+ * Check that power plan steps posted from their own threads run on the loop,
+ * in order, while reply handlers fire there, and that no request waiting for
+ * a reply is lost.
+ *
+ * Mirrors the stream path: a step sets it at once if the Roku's address is
+ * known, or asks for it and leaves it to the reply handler.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testPost() {
+    Reactor reactor;
+    if (!reactor.open() || !reactor.watchPosts("posted")) {
+        return 1;
+    }
+
+    // Only touched on the loop, like the device table.
+    const thread::id loop = this_thread::get_id();
+    bool elsewhere = false;
+    bool known = false;
+    int waiting = 0;
+    int served = 0;
+    vector<int> order;
+
+    const int RUNS = 50;
+    Orchestration plan;
+    int wake = plan.add("receiver-wake", [&]() {
+        return reactor.post([&]() {
+            elsewhere |= this_thread::get_id() != loop;
+            order.push_back(0);
+        }) ? 0 : 1;
+    });
+    plan.add("stream-path", [&]() {
+        return reactor.post([&]() {
+            elsewhere |= this_thread::get_id() != loop;
+            order.push_back(1);
+            if (known) {
+                served++;
+            } else {
+                waiting++;
+            }
+        }) ? 0 : 1;
+    }, { wake });
+
+    // The Roku's address comes and goes, as the table is refreshed.
+    int replies = 0;
+    int reply = -1;
+    reply = reactor.addTimer("replies", [&]() {
+        elsewhere |= this_thread::get_id() != loop;
+        known = replies++ % 2 == 1;
+        if (known) {
+            served += waiting;
+            waiting = 0;
+        }
+        reactor.setTimer(reply, 1);
+    });
+    reactor.setTimer(reply, 0);
+
+    int failed = 0;
+    thread runner([&]() {
+        for (int i = 0; i < RUNS; i++) {
+            failed += plan.run().failed;
+            this_thread::sleep_for(chrono::microseconds(300));
+        }
+        reactor.post([&]() {
+            // Wait for one more reply, then stop.
+            reactor.setTimer(reactor.addTimer("stop", [&]() { reactor.stop(); }), 10);
+        });
+    });
+    reactor.run();
+    runner.join();
+
+    bool ordered = order.size() == 2 * RUNS;
+    for (size_t i = 0; ordered && i < order.size(); i++) {
+        ordered = order[i] == (int)(i % 2);
+    }
+    if (failed || elsewhere || !ordered || served != RUNS || waiting != 0) {
+        spdlog::error(
+            "Post: failed={} elsewhere={} ordered={} served={} waiting={}",
+            failed,
+            elsewhere,
+            ordered,
+            served,
+            waiting
+        );
+        return 1;
+    }
+
+    spdlog::info("Post: OK, {} replies", replies);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[REACTOR] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    return testTimers() | testDescriptors() | testSignals() | testPost();
+}
@@ -0,0 +1,212 @@
+#include <chrono>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "spdlog/spdlog.h"
+#include "reactor.hpp"
+
+using namespace std;
+
+// Events handled per epoll_wait.
+const int REACTOR_MAX_EVENTS { 16 };
+
+Reactor::~Reactor() {
+    for (Source &source : sources_) {
+        if (source.owned) {
+            close(source.fd);
+        }
+    }
+    if (epollFd_ >= 0) {
+        close(epollFd_);
+    }
+}
+
+bool Reactor::open() {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0) {
+        spdlog::critical("Could not create epoll set: {}", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+int Reactor::add(const char *name, int fd, bool owned, uint32_t events, ReactorHandler handler) {
+    struct epoll_event event {};
+    event.events = events;
+    event.data.u32 = sources_.size();
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+        spdlog::error("Could not watch {}: {}", name, strerror(errno));
+        return -1;
+    }
+    sources_.push_back({ fd, owned, true, move(handler), { name, 0, 0, 0 } });
+    return sources_.size() - 1;
+}
+
+bool Reactor::watch(const char *name, int fd, uint32_t events, ReactorHandler handler) {
+    return add(name, fd, false, events, move(handler)) >= 0;
+}
+
+void Reactor::unwatch(int fd) {
+    for (Source &source : sources_) {
+        if (source.watched && source.fd == fd) {
+            epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+            source.watched = false;
+        }
+    }
+}
+
+bool Reactor::watchSignals(const char *name, initializer_list<int> signals, function<void(int)> handler) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int signal : signals) {
+        sigaddset(&mask, signal);
+    }
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+        spdlog::error("Could not create signalfd: {}", strerror(errno));
+        return false;
+    }
+    int source = add(name, fd, true, EPOLLIN, [fd, handler](uint32_t) {
+        struct signalfd_siginfo info;
+        while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+            handler(info.ssi_signo);
+        }
+    });
+    if (source < 0) {
+        close(fd);
+        return false;
+    }
+    return true;
+}
+
+bool Reactor::watchPosts(const char *name) {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        spdlog::error("Could not create eventfd: {}", strerror(errno));
+        return false;
+    }
+    int source = add(name, fd, true, EPOLLIN, [this, fd](uint32_t) {
+        uint64_t count;
+        read(fd, &count, sizeof(count));
+        vector<function<void()>> tasks;
+        {
+            lock_guard<mutex> lock(postMutex_);
+            tasks.swap(posted_);
+        }
+        for (function<void()> &task : tasks) {
+            task();
+        }
+    });
+    if (source < 0) {
+        close(fd);
+        return false;
+    }
+    postFd_ = fd;
+    return true;
+}
+
+bool Reactor::post(function<void()> task) {
+    if (postFd_ < 0) {
+        return false;
+    }
+    {
+        lock_guard<mutex> lock(postMutex_);
+        posted_.push_back(move(task));
+    }
+    const uint64_t one { 1 };
+    return write(postFd_, &one, sizeof(one)) == sizeof(one);
+}
+
+int Reactor::addTimer(const char *name, function<void()> handler) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        spdlog::error("Could not create timerfd: {}", strerror(errno));
+        return -1;
+    }
+    int source = add(name, fd, true, EPOLLIN, [fd, handler](uint32_t) {
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+            handler();
+        }
+    });
+    if (source < 0) {
+        close(fd);
+    }
+    return source;
+}
+
+void Reactor::setTimer(int timer, int ms) {
+    struct itimerspec spec {};
+    if (ms >= 0) {
+        // An all-zero expiry disarms, so due now means one nanosecond from now.
+        spec.it_value.tv_sec = ms / 1000;
+        spec.it_value.tv_nsec = ms % 1000 * 1000000l + (ms == 0);
+    }
+    timerfd_settime(sources_[timer].fd, 0, &spec, nullptr);
+}
+
+void Reactor::run() {
+    typedef chrono::steady_clock Clock;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    running_ = true;
+    while (running_) {
+        int count = epoll_wait(epollFd_, events, REACTOR_MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            spdlog::critical("epoll_wait failed: {}", strerror(errno));
+            break;
+        }
+        wakeups_++;
+
+        for (int i = 0; i < count && running_; i++) {
+            Source &source = sources_[events[i].data.u32];
+            // Unwatched by a handler that ran before it in this round.
+            if (!source.watched) {
+                continue;
+            }
+
+            const Clock::time_point start = Clock::now();
+            source.handler(events[i].events);
+            const int64_t us = chrono::duration_cast<chrono::microseconds>(Clock::now() - start).count();
+            source.stats.wakeups++;
+            source.stats.busyUs += us;
+            source.stats.maxUs = max(source.stats.maxUs, us);
+        }
+    }
+}
+
+void Reactor::stop() {
+    running_ = false;
+}
+
+ReactorStats Reactor::stats() const {
+    ReactorStats stats { wakeups_, {} };
+    for (const Source &source : sources_) {
+        stats.sources.push_back(source.stats);
+    }
+    return stats;
+}
+
+void Reactor::logStats() const {
+    ReactorStats stats = this->stats();
+    spdlog::info("Event loop: {} wakeups", stats.wakeups);
+    for (const ReactorSourceStats &source : stats.sources) {
+        spdlog::info(
+            "  {}: {} wakeups, {:.1f}ms busy, max {}us",
+            source.name,
+            source.wakeups,
+            source.busyUs / 1000.0,
+            source.maxUs
+        );
+    }
+}
@@ -0,0 +1,184 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Runs when a watched file descriptor is ready.
+ *
+ * @param   uint32_t  events  The epoll events that are ready, e.g. EPOLLIN.
+ */
+typedef std::function<void(uint32_t events)> ReactorHandler;
+
+/**
+ * How often one source woke the loop, and what its handler cost.
+ */
+struct ReactorSourceStats {
+    const char *name;
+    uint64_t wakeups;
+    // Time spent in the handler.
+    int64_t busyUs;
+    int64_t maxUs;
+};
+
+/**
+ * Counters of the whole loop.
+ */
+struct ReactorStats {
+    // Returns from epoll_wait with something to do.
+    uint64_t wakeups;
+    // One per watched file descriptor, signal set and timer, in the order
+    // they were added.
+    std::vector<ReactorSourceStats> sources;
+};
+
+/**
+ * A single-threaded event loop on epoll.
+ *
+ * File descriptors, signals (through a signalfd) and timers (timerfds) are
+ * all sources of one epoll set, and their handlers run one after another on
+ * the thread that called run(). Signals are blocked and read like any other
+ * input, so no work happens in signal context.
+ *
+ * Sources are added and removed from the loop's thread only, either before
+ * run() or from a handler. Other threads hand work to the loop with post().
+ */
+class Reactor {
+public:
+    ~Reactor();
+
+    /**
+     * Create the epoll set.
+     *
+     * @return  bool    false if it could not be created.
+     */
+    bool open();
+
+    /**
+     * Run a handler whenever a file descriptor is ready. Level triggered.
+     *
+     * @param   char *          name     For the stats. Must outlive the reactor.
+     * @param   int             fd       Not closed by the reactor.
+     * @param   uint32_t        events   E.g. EPOLLIN.
+     * @param   ReactorHandler  handler
+     *
+     * @return  bool                     false if it could not be watched.
+     */
+    bool watch(const char *name, int fd, uint32_t events, ReactorHandler handler);
+
+    /**
+     * Stop watching a file descriptor. Its stats are kept.
+     *
+     * @param   int   fd
+     *
+     * @return  void
+     */
+    void unwatch(int fd);
+
+    /**
+     * Block signals on the calling thread and handle them in the loop.
+     *
+     * Threads started later inherit the mask. Threads started before must
+     * block these signals themselves, or they may take them first.
+     *
+     * @param   char *                    name     For the stats.
+     * @param   std::initializer_list     signals  E.g. { SIGINT, SIGTERM }.
+     * @param   std::function<void(int)>  handler  Called with each signal number.
+     *
+     * @return  bool                               false on failure.
+     */
+    bool watchSignals(const char *name, std::initializer_list<int> signals, std::function<void(int)> handler);
+
+    /**
+     * Run functions handed over with post() in the loop.
+     *
+     * @param   char *  name  For the stats.
+     *
+     * @return  bool          false on failure.
+     */
+    bool watchPosts(const char *name);
+
+    /**
+     * Run a function on the loop's thread, after the ones posted before it.
+     * Safe to call from any thread, once watchPosts() has returned. Functions
+     * still waiting when the loop stops are never run.
+     *
+     * @param   std::function<void()>  task
+     *
+     * @return  bool    false if the loop does not take posts.
+     */
+    bool post(std::function<void()> task);
+
+    /**
+     * Add a one-shot timer, disarmed until setTimer().
+     *
+     * @param   char *                 name     For the stats.
+     * @param   std::function<void()>  handler  Runs when the timer expires.
+     *
+     * @return  int                             The timer, or -1 on failure.
+     */
+    int addTimer(const char *name, std::function<void()> handler);
+
+    /**
+     * Arm a timer, replacing its previous expiry.
+     *
+     * @param   int   timer  From addTimer().
+     * @param   int   ms     From now. Negative to disarm.
+     *
+     * @return  void
+     */
+    void setTimer(int timer, int ms);
+
+    /**
+     * Run handlers until stop() is called.
+     *
+     * @return  void
+     */
+    void run();
+
+    /**
+     * Make run() return once the handler running now is done. Call from a handler.
+     *
+     * @return  void
+     */
+    void stop();
+
+    ReactorStats stats() const;
+
+    /**
+     * Log the counters.
+     *
+     * @return  void
+     */
+    void logStats() const;
+
+private:
+    struct Source {
+        int fd;
+        // Signal and timer file descriptors are the reactor's own.
+        bool owned;
+        bool watched;
+        ReactorHandler handler;
+        ReactorSourceStats stats;
+    };
+
+    int add(const char *name, int fd, bool owned, uint32_t events, ReactorHandler handler);
+
+    int epollFd_ { -1 };
+    // eventfd written once per post(), -1 until watchPosts().
+    int postFd_ { -1 };
+    std::mutex postMutex_;
+    std::vector<std::function<void()>> posted_;
+    bool running_ { false };
+    uint64_t wakeups_ { 0 };
+    // Indexed by the epoll data. A deque, so handlers may add sources while
+    // one of them runs.
+    std::deque<Source> sources_;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include "ring.hpp"
+#include "spdlog/spdlog.h"
+#include <thread>
+
+const uint32_t ITEM_COUNT { 1000000 };
+
+
+/**
+ * Fill the ring past capacity and check that overflow is dropped and counted.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testOverflow() {
+    SpscRing<uint32_t, 8> ring;
+    for (uint32_t i = 0; i < 10; i++) {
+        ring.push(i);
+    }
+
+    if (ring.depth() != 8 || ring.drops() != 2 || ring.highWater() != 8) {
+        spdlog::error("Overflow: depth={} drops={} high_water={}", ring.depth(), ring.drops(), ring.highWater());
+        return 1;
+    }
+
+    uint32_t item;
+    for (uint32_t i = 0; i < 8; i++) {
+        if (!ring.pop(item) || item != i) {
+            spdlog::error("Overflow: expected {} but popped {}", i, item);
+            return 1;
+        }
+    }
+
+    if (ring.pop(item)) {
+        spdlog::error("Overflow: ring should be empty");
+        return 1;
+    }
+
+    spdlog::info("Overflow: OK");
+    return 0;
+}
+
+/**
+ * Push from one thread and pop from another and check nothing is reordered.
+ *
+ * @return  int     0 on success, 1 on failure.
+ */
+int testConcurrent() {
+    SpscRing<uint32_t, 64> ring;
+
+    std::thread producer([&ring]() {
+        for (uint32_t i = 0; i < ITEM_COUNT; i++) {
+            while (!ring.push(i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    uint32_t expected { 0 };
+    uint32_t item;
+    int ret { 0 };
+    while (expected < ITEM_COUNT) {
+        if (!ring.pop(item)) {
+            continue;
+        }
+        if (item != expected) {
+            spdlog::error("Concurrent: expected {} but popped {}", expected, item);
+            ret = 1;
+            break;
+        }
+        expected++;
+    }
+
+    producer.join();
+    if (ret == 0) {
+        spdlog::info("Concurrent: OK ({} items, {} retried pushes)", ITEM_COUNT, ring.drops());
+    }
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[RING] [%^%l%$] %v");
+    spdlog::set_level(spdlog::level::debug); // Set global log level to debug
+
+    return testOverflow() | testConcurrent();
+}
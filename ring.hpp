@@ -0,0 +1,106 @@
+#ifndef RING_H
+#define RING_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Bounded, lock-free ring buffer for exactly one producer and one consumer.
+ *
+ * push() never blocks: when the ring is full the item is dropped and counted.
+ * This makes it safe to call from a callback thread that must return quickly.
+ *
+ * @tparam  T  Type of the items. Must be trivially copyable.
+ * @tparam  N  Capacity of the ring. Must be a power of two.
+ */
+template <typename T, size_t N>
+class SpscRing {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    /**
+     * Add an item to the ring. Producer side only.
+     *
+     * @param   T  item  The item to add.
+     *
+     * @return  bool     false if the ring was full and the item was dropped.
+     */
+    bool push(const T &item) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        const size_t tail = tail_.load(std::memory_order_acquire);
+        if (head - tail >= N) {
+            drops_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        items_[head & (N - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+
+        const size_t depth = head + 1 - tail;
+        if (depth > highWater_.load(std::memory_order_relaxed)) {
+            highWater_.store(depth, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    /**
+     * Remove the oldest item from the ring. Consumer side only.
+     *
+     * @param   T  item  Receives the removed item.
+     *
+     * @return  bool     false if the ring was empty.
+     */
+    bool pop(T &item) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        item = items_[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Number of items currently queued.
+     *
+     * @return  size_t
+     */
+    size_t depth() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Largest depth observed since the ring was created.
+     *
+     * @return  size_t
+     */
+    size_t highWater() const {
+        return highWater_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Number of items dropped because the ring was full.
+     *
+     * @return  uint64_t
+     */
+    uint64_t drops() const {
+        return drops_.load(std::memory_order_relaxed);
+    }
+
+    static constexpr size_t capacity() {
+        return N;
+    }
+
+private:
+    // Producer and consumer indices live on separate cache lines so the two
+    // threads do not invalidate each other on every operation.
+    alignas(64) std::atomic<size_t> head_ { 0 };
+    alignas(64) std::atomic<size_t> tail_ { 0 };
+    alignas(64) std::atomic<size_t> highWater_ { 0 };
+    std::atomic<uint64_t> drops_ { 0 };
+    T items_[N];
+};
+
+#endif